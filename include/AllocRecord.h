@@ -26,22 +26,31 @@ SOFTWARE.
 #ifndef ALLOCRECORD_H_
 #define ALLOCRECORD_H_
 
+#include <stddef.h>
+#include <stdint.h>
+
 //
-// Little class to hold the record of a memory allocation
+// Little class to hold the record of a memory allocation.  These are stored
+// inline in the AllocTable slots so it has to stay a plain copyable value.
 //
 class AllocRecord {
 public:
 
-    AllocRecord(void* addr, int size): m_addr(addr), m_size(size) { }
+    AllocRecord(): m_addr(NULL), m_size(0), m_owner(NULL), m_count(0) { }
+    AllocRecord(void* addr, size_t size, void* owner = NULL, uint32_t count = 1): m_addr(addr), m_size(size), m_owner(owner), m_count(count) { }
     ~AllocRecord() { }
     
     inline void* GetAddress()       { return m_addr; }
-    inline unsigned long GetID()     { return (unsigned long)m_addr; }
-    inline int GetSize()            { return m_size; }
+    inline uintptr_t GetID()        { return (uintptr_t)m_addr; }
+    inline size_t GetSize()         { return m_size; }
+    inline void* GetOwner()         { return m_owner; }     // PerformanceRec that made the allocation
+    inline uint32_t GetCount()      { return m_count; }     // Allocations it stands for when sampled, m_size is their bytes
     
 private:
     void* m_addr;
-    int m_size;
+    size_t m_size;
+    void* m_owner;
+    uint32_t m_count;
 };
  
 #endif /*ALLOCRECORD_H_*/
@@ -0,0 +1,76 @@
+/*****************************************************************************
+MIT License
+
+Copyright (c) 2016 Douglas Adler
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*****************************************************************************/
+
+
+#ifndef ALLOCTABLE_H_
+#define ALLOCTABLE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "AllocRecord.h"
+
+#define ALLOC_TABLE_SHARD_BITS		6
+#define ALLOC_TABLE_SHARDS			(1 << ALLOC_TABLE_SHARD_BITS)
+
+//
+// Address table for the PERFORMANCE_MEMORY tracking.  The address space is
+// split over a fixed number of shards, each an open addressing hash table
+// with its own lock, so threads allocating at the same time rarely touch the
+// same lock.  Records are kept in the slots themselves and the slot arrays
+// are mapped directly, so tracking an allocation never calls malloc.
+//
+class AllocTable
+{
+public:
+	AllocTable();
+	virtual ~AllocTable();
+
+	// Returns true if a record for the same address was replaced, the old
+	// record is copied to rOld
+	bool		Insert(const AllocRecord& rec, AllocRecord& rOld);
+	// Returns false if the address isn't in the table
+	bool		Remove(void* addr, AllocRecord& rRec);
+	bool		Clear();
+	uint64_t	GetCount();
+
+private:
+	typedef struct {
+		volatile int	nLock;
+		uint32_t		nMask;
+		uint32_t		nUsed;		// live records
+		uint32_t		nFilled;	// live records and tombstones
+		AllocRecord*	pSlots;
+		char			pad[64 - sizeof(int) - 3 * sizeof(uint32_t) - sizeof(AllocRecord*)];
+	} Shard;
+
+	static uint64_t	Hash(uintptr_t key);
+	static void		Lock(Shard* pShard);
+	static void		Unlock(Shard* pShard);
+	static bool		Grow(Shard* pShard);
+
+	Shard		mShards[ALLOC_TABLE_SHARDS];
+};
+
+#endif /*ALLOCTABLE_H_*/
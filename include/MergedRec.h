@@ -0,0 +1,73 @@
+/*****************************************************************************
+MIT License
+
+Copyright (c) 2016 Douglas Adler
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*****************************************************************************/
+
+#ifndef MERGEDREC_H_
+#define MERGEDREC_H_
+
+#include <vector>
+
+#include "PerfMetrics.h"
+#include "PerfRecordReport.h"
+#include "PerformanceRec.h"
+#include "Node.h"
+
+//
+// Node of a calling context tree merged from several thread trees.
+// Children are matched by PerfID, so identical call paths from different
+// threads land on the same node.  The inclusive time each thread spent on
+// the path is kept so the spread across threads can be reported.
+//
+class MergedRec : public Node
+{
+public:
+	MergedRec(PerfID nID, PerfID nCatID);
+	virtual ~MergedRec();
+
+	PerfID 		GetID();
+	PerfID 		GetCatID();
+	MergedRec*	GetChild(PerfID nID, PerfID nCatID);
+
+	bool 		Merge(PerformanceRec* pRec);
+	bool 		Merge(MergedRec* pRec);
+	bool		AddThreadTotal(uint64_t nTotal);
+	bool 		GetReport(PerfRecordReport* report);
+	uint64_t 	GetTotalTime();
+	uint32_t	GetThreadCount();
+	uint64_t	GetThreadPercentile(uint32_t nPercent);
+
+private:
+	PerfID				mID;
+	PerfID				mCatID;
+	uint32_t			mTotalCalls;
+	uint64_t			mTotalTime;
+	uint64_t			mTotalSelf;
+	uint32_t			mMinTime;
+	uint32_t			mMaxTime;
+	uint64_t			mStartTime;
+	uint64_t			mEndTime;
+	vector<uint64_t>	mThreadTotals;
+	bool				mbSorted;
+};
+
+#endif /*MERGEDREC_H_*/
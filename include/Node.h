@@ -27,34 +27,42 @@ SOFTWARE.
 
 #include <list>
 
+#include "PerfArena.h"
+
 using namespace std;
 
 typedef enum NodeType_e
 {
 	PerfRecord,
+	MergedRecord,
 	UnknownType
 } NodeType;
 
+class Node;
+typedef list<Node*, PerfArenaAllocator<Node*> > NodeList;
+
 class Node
 {
 public:
-	Node();
+	Node(PerfArena* pArena = NULL);
+	// Copies the type only, the copy has no parent or children
+	Node(const Node& node);
 	virtual ~Node();
 	
 	bool SetParent(Node* pMode);
 	Node* GetParent();
 	bool AddSibling(Node* pMode);
 	Node* GetNextSibling(Node* pCurrentSibling);
-	list<Node*>::iterator GetSiblingIterator();
-	list<Node*>* GetSiblingList() { return &mSiblingList; }
-	bool IsSiblingEnd(list<Node*>::iterator iter);
+	NodeList::iterator GetSiblingIterator();
+	NodeList* GetSiblingList() { return &mSiblingList; }
+	bool IsSiblingEnd(NodeList::iterator iter);
 
 	bool SetNodeType(NodeType type);
 	NodeType GetNodeType();
 	
 private:
 	NodeType		mType;
-	list<Node*>		mSiblingList;
+	NodeList		mSiblingList;
 	Node*			mParent;
 };
 
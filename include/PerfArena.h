@@ -0,0 +1,103 @@
+/*****************************************************************************
+MIT License
+
+Copyright (c) 2016 Douglas Adler
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*****************************************************************************/
+
+#ifndef PERFARENA_H_
+#define PERFARENA_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+//
+// Fixed size bump allocator.  The block is mapped and touched when the arena
+// is set up, so allocating from it later never calls malloc or takes a page
+// fault.  Memory is only given back when the whole arena is freed.
+//
+class PerfArena
+{
+public:
+	PerfArena();
+	virtual ~PerfArena();
+
+	bool		Init(size_t nSize);
+	bool		Free();
+	void*		Alloc(size_t nSize);
+	bool		Owns(const void* p) const;
+	size_t		GetSize() const;
+	size_t		GetUsed() const;
+	size_t		GetAvailable() const;
+
+	// Objects that may come from an arena or the heap, tagged so they can be
+	// released without knowing which.
+	static void*	Allocate(size_t nSize, PerfArena* pArena);
+	static void		Release(void* p);
+	static size_t	AllocationSize(size_t nSize);
+
+private:
+	char*		mpBase;
+	size_t		mSize;
+	size_t		mUsed;
+};
+
+//
+// STL allocator drawing from an arena, or the heap when it has none.
+//
+template <class T>
+class PerfArenaAllocator
+{
+public:
+	typedef T value_type;
+
+	PerfArenaAllocator(PerfArena* pArena = NULL) : mpArena(pArena) { }
+	template <class U>
+	PerfArenaAllocator(const PerfArenaAllocator<U>& other) : mpArena(other.GetArena()) { }
+
+	T* allocate(size_t n)
+	{
+		void* p = (mpArena != NULL) ? mpArena->Alloc(n * sizeof(T)) : NULL;
+		return (T*)((p != NULL) ? p : ::operator new(n * sizeof(T)));
+	}
+	void deallocate(T* p, size_t n)
+	{
+		if(mpArena == NULL || mpArena->Owns(p) == false) {
+			::operator delete(p);
+		}
+	}
+	PerfArena* GetArena() const { return mpArena; }
+
+private:
+	PerfArena*	mpArena;
+};
+
+template <class T, class U>
+inline bool operator==(const PerfArenaAllocator<T>& a, const PerfArenaAllocator<U>& b)
+{
+	return a.GetArena() == b.GetArena();
+}
+template <class T, class U>
+inline bool operator!=(const PerfArenaAllocator<T>& a, const PerfArenaAllocator<U>& b)
+{
+	return a.GetArena() != b.GetArena();
+}
+
+#endif /*PERFARENA_H_*/
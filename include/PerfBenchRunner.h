@@ -0,0 +1,72 @@
+/*****************************************************************************
+MIT License
+
+Copyright (c) 2016 Douglas Adler
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*****************************************************************************/
+
+
+#ifndef PERFBENCHRUNNER_H_
+#define PERFBENCHRUNNER_H_
+
+#include <stdint.h>
+
+#include <vector>
+
+#include "PerfMetrics.h"
+
+// A sample times a batch of at least this long, so the two clock reads
+// around it are lost in the noise
+#define PERF_BENCH_MIN_SAMPLE_TIME	100000		// ns
+#define PERF_BENCH_MIN_SAMPLES		10
+#define PERF_BENCH_MAX_SAMPLES		100000
+
+//
+// Runs one PERF_BENCH.  The warm-up doubles the batch size until a batch
+// takes PERF_BENCH_MIN_SAMPLE_TIME, then keeps running batches untimed for
+// the rest of the warm-up.  Batches are then timed until the target time
+// has passed.  Each timed batch is a call of the ID, with the iterations
+// as its work units.
+//
+class PerfBenchRunner
+{
+public:
+	PerfBenchRunner(const char * szName, const char * szCategory, PerfBenchFunction pfnBench, void* pContext);
+	virtual ~PerfBenchRunner();
+
+	// Times in ns
+	bool	Run(uint64_t nWarmupTime, uint64_t nTargetTime);
+	void	GetResult(PerfBenchResult* pResult);
+
+private:
+	static uint64_t	GetTime();
+	static double	GetQuantile(std::vector<double>& sorted, double nQuantile);
+	uint64_t		RunBatch(uint64_t nIterations);
+	void			Calibrate(uint64_t nWarmupTime);
+
+	const char *		mszName;
+	const char *		mszCategory;
+	PerfBenchFunction	mpfnBench;
+	void*				mpContext;
+	uint64_t			mnIterations;			// Per batch
+	std::vector<double>	mSamples;				// ns per iteration
+};
+
+#endif /*PERFBENCHRUNNER_H_*/
@@ -0,0 +1,123 @@
+/*****************************************************************************
+MIT License
+
+Copyright (c) 2016 Douglas Adler
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*****************************************************************************/
+#ifndef PERFBINARYREPORT_H_
+#define PERFBINARYREPORT_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/types.h>
+
+#include <string>
+
+//
+// Layout of PerfReport.bin, which PERF_REPORT writes instead of the text
+// reports with PerfOptionBinaryReport.  perfmetrics-report turns it into
+// the text reports offline.
+//
+//   PerfBinaryHeader
+//   body				nBodySize bytes, nChecksum is their FNV-1a 64 hash
+//
+// Every number in the body is a LEB128 varint, "s" marks a zigzag encoded
+// signed one.  A string is its length and then its bytes.
+//
+//   columns		PERF_BINARY_ bits, the optional fields below that are there
+//   nStrings		{ string }						every name and category once
+//   nCategories	{ catID, name }					name is a string index
+//   nIDs			{ id, catID, name, category, [budget, breaches] }
+//													an ID whose catID isn't a category is internal
+//   nThreads		{ threadID, nNodes, node... }	each thread's tree in preorder
+//
+//   node			s depth, s ID, calls, total, self, min, max - min,
+//					aborted, recursive calls, max recursion,
+//					[work units],
+//					[I/O ops, bytes, time, PERF_IO_LATENCY_BUCKETS counts],
+//					[has rusage, if it has: the 6 PerfRusage counts],
+//					[allocs, alloc bytes, frees, live bytes],
+//					[lock acquires, contended, wait time, hold time]
+//
+// depth and ID are relative to the node before, starting from 0.  depth
+// is the root's 0, ID is an index into the IDs, nIDs when it's unknown.
+// Times are in usec.  Bump PERF_BINARY_VERSION when anything changes.
+//
+// Not kept, so perfmetrics-report can't show them: the perf_event counter
+// columns and attributes, the CPU time columns, the allocation size classes,
+// the per node counters and gauges, and the per ID part of the contention
+// report.
+//
+#define PERF_BINARY_MAGIC			0x314E494246524550ULL	// "PERFBIN1"
+#define PERF_BINARY_VERSION			2
+
+// The columns bits
+#define PERF_BINARY_WORK			0x01	// PERF_ADD_WORK was used
+#define PERF_BINARY_IO				0x02	// An I/O op was timed
+#define PERF_BINARY_RUSAGE			0x04	// A category has PERF_CATEGORY_RUSAGE
+#define PERF_BINARY_ALLOCS			0x08	// Built with PERFORMANCE_MEMORY
+#define PERF_BINARY_BUDGETS			0x10	// A budget was set
+#define PERF_BINARY_LOCKS			0x20	// A lock was timed
+
+typedef struct PerfBinaryHeader_s
+{
+	uint64_t	nMagic;
+	uint32_t	nVersion;
+	uint32_t	nHeaderSize;			// sizeof(PerfBinaryHeader), the body starts here
+	uint64_t	nBodySize;
+	uint64_t	nChecksum;
+	uint64_t	nStartTime;				// PERF_START, usec since the epoch
+	uint64_t	nEndTime;				// PERF_STOP, 0 in a dump of a running process
+	int32_t		nPid;
+	uint32_t	nReserved;
+} PerfBinaryHeader;
+
+class PerfBinaryReport
+{
+public:
+	PerfBinaryReport();
+	virtual ~PerfBinaryReport();
+
+	// Writer, the body is built in memory and written with one fwrite
+	void		PutVarint(uint64_t nValue);
+	void		PutSigned(int64_t nValue);
+	void		PutString(const char* szValue);
+	bool		Write(FILE* fp, uint64_t nStartTime, uint64_t nEndTime);
+
+	// Reader, false once the body runs out
+	bool		Open(const char* szFile);
+	PerfBinaryHeader*	GetHeader();
+	bool		GetVarint(uint64_t* pnValue);
+	bool		GetSigned(int64_t* pnValue);
+	bool		GetString(std::string* pValue);
+	bool		Close();
+
+private:
+	static uint64_t	GetChecksum(const uint8_t* pData, size_t nSize);
+
+	std::string			mBody;
+	PerfBinaryHeader*	mpHeader;
+	const uint8_t*		mpData;
+	size_t				mnDataSize;
+	size_t				mnOffset;
+	size_t				mnMapSize;
+};
+
+#endif /*PERFBINARYREPORT_H_*/
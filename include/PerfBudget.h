@@ -0,0 +1,72 @@
+/*****************************************************************************
+MIT License
+
+Copyright (c) 2016 Douglas Adler
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*****************************************************************************/
+
+
+#ifndef PERFBUDGET_H_
+#define PERFBUDGET_H_
+
+#include <stdint.h>
+
+#include "PerfMetrics.h"
+
+#define PERF_BUDGET_QUEUE_SIZE		1024		// Must be a power of two
+
+// An ID's latency budget, nodes of the ID point at it
+typedef struct PerfBudget_s
+{
+	volatile uint64_t		nBudget;				// usec, 0 uses the category's
+	volatile uint64_t*		pnCategoryBudget;
+	volatile uint64_t		nBreaches;
+} PerfBudget;
+
+//
+// Bounded queue of budget breaches from any thread to the one thread that
+// runs the callback.  Pushing never blocks or allocates, a full queue drops
+// the event and counts it.
+//
+class PerfBudgetQueue
+{
+public:
+	PerfBudgetQueue();
+	virtual ~PerfBudgetQueue();
+
+	bool		Push(const PerfBudgetEvent& event);
+	// Only called from the draining thread
+	bool		Pop(PerfBudgetEvent& event);
+	uint64_t	GetDropped();
+	bool		Clear();
+
+private:
+	typedef struct {
+		volatile uint64_t	nSequence;
+		PerfBudgetEvent		event;
+	} Slot;
+
+	Slot				mSlots[PERF_BUDGET_QUEUE_SIZE];
+	volatile uint64_t	mnEnqueue;
+	uint64_t			mnDequeue;
+	volatile uint64_t	mnDropped;
+};
+
+#endif /*PERFBUDGET_H_*/
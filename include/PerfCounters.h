@@ -0,0 +1,72 @@
+/*****************************************************************************
+MIT License
+
+Copyright (c) 2016 Douglas Adler
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*****************************************************************************/
+
+
+#ifndef PERFCOUNTERS_H_
+#define PERFCOUNTERS_H_
+
+#include <stdint.h>
+
+#define PERF_MAX_COUNTERS			4
+
+typedef enum PerfCounterMode_e
+{
+	PerfCountersNone,
+	PerfCountersHardware,		// cycles, instructions, cache misses, branch misses
+	PerfCountersSoftware		// task clock (ns), page faults, context switches
+} PerfCounterMode;
+
+//
+// Group of perf_event counters for the calling thread.  Open it on the thread
+// being measured.  Where the kernel allows it the counters are read with rdpmc
+// through the mmapped event page, otherwise with a single read() of the group.
+//
+class PerfCounters
+{
+public:
+	PerfCounters();
+	virtual ~PerfCounters();
+
+	// Try the hardware counters and fall back to software ones, or open the
+	// mode given so every thread reports the same counters
+	bool			Open(PerfCounterMode eMode);
+	bool			Close();
+	bool			Read(uint64_t* pValues);
+	PerfCounterMode	GetMode();
+	uint32_t		GetCount();
+
+	static const char*	GetName(PerfCounterMode eMode, uint32_t idx);
+
+private:
+	bool			OpenGroup(PerfCounterMode eMode);
+	bool			ReadFast(uint64_t* pValues);
+
+	PerfCounterMode	meMode;
+	uint32_t		mnCount;
+	int				mFD[PERF_MAX_COUNTERS];
+	void*			mpPage[PERF_MAX_COUNTERS];
+	bool			mbRdpmc;
+};
+
+#endif /*PERFCOUNTERS_H_*/
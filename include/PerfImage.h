@@ -0,0 +1,140 @@
+/*****************************************************************************
+MIT License
+
+Copyright (c) 2016 Douglas Adler
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*****************************************************************************/
+#ifndef PERFIMAGE_H_
+#define PERFIMAGE_H_
+
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/types.h>
+
+#include "PerfMetrics.h"
+
+//
+// Layout of the profile image file, see PERF_SET_IMAGE_FILE.  The file is
+// mapped shared while the process runs, so what was written is still in
+// it if the process dies.  perfmetrics-report reads it back.
+//
+//   PerfImageHeader
+//   PerfImageID		IDs[nMaxIDs]		at nIDOffset
+//   PerfImageNode		nodes[nMaxNodes]	at nNodeOffset
+//
+// Records refer to each other by index, never by address, so a reader can
+// map the file anywhere.  A node's parent is nodes[nParent - 1], 0 for a
+// thread's root.  Slots are handed out in order and nIDs and nNodes count
+// the slots taken.  A record is only complete once PERF_IMAGE_VALID is set
+// in its nFlags.  Only add to the end of a record and bump
+// PERF_IMAGE_VERSION when anything else changes.  Times are in usec.
+//
+#define PERF_IMAGE_MAGIC			0x31474D4946524550ULL	// "PERFIMG1"
+#define PERF_IMAGE_VERSION			1
+#define PERF_IMAGE_MAX_IDS			4096
+#define PERF_IMAGE_DEFAULT_NODES	65536
+#define PERF_IMAGE_NAME_SIZE		64
+#define PERF_IMAGE_VALID			0x1
+#define PERF_IMAGE_INTERNAL			0x2		// ThreadStart and [other], not in the category report
+
+typedef struct PerfImageHeader_s
+{
+	uint64_t			nMagic;
+	uint32_t			nVersion;
+	uint32_t			nHeaderSize;			// sizeof(PerfImageHeader)
+	uint32_t			nIDSize;				// sizeof(PerfImageID)
+	uint32_t			nNodeSize;				// sizeof(PerfImageNode)
+	uint32_t			nMaxIDs;
+	uint32_t			nMaxNodes;
+	uint64_t			nIDOffset;				// From the start of the file
+	uint64_t			nNodeOffset;
+	int32_t				nPid;
+	uint32_t			nReserved;
+	uint64_t			nStartTime;				// PERF_START, usec since the epoch
+	volatile uint64_t	nEndTime;				// PERF_STOP, 0 if the process never got there
+	volatile uint32_t	nIDs;
+	volatile uint32_t	nNodes;
+	volatile uint64_t	nDroppedNodes;			// Nodes that didn't fit, and their children
+} PerfImageHeader;
+
+typedef struct PerfImageID_s
+{
+	volatile uint32_t	nFlags;
+	uint32_t			nID;
+	uint32_t			nCategoryID;
+	uint32_t			nReserved;
+	char				szName[PERF_IMAGE_NAME_SIZE];
+	char				szCategory[PERF_IMAGE_NAME_SIZE];
+} PerfImageID;
+
+// Updated by the node's thread at every exit, see PerformanceRec::UpdateImage
+typedef struct PerfImageNode_s
+{
+	volatile uint32_t	nFlags;
+	uint32_t			nParent;
+	uint32_t			nID;
+	uint32_t			nCategoryID;
+	uint64_t			nThreadID;
+	uint64_t			nCalls;
+	uint64_t			nTotalTime;
+	uint64_t			nRecursiveTime;			// Folded calls, added to the self time
+	uint64_t			nFoldedOutTime;			// Folded into an ancestor, taken from the self time
+	uint32_t			nMinTime;
+	uint32_t			nMaxTime;
+	uint32_t			nAbortedCalls;
+	uint32_t			nRecursiveCalls;
+	uint32_t			nMaxRecursion;
+	uint32_t			nReserved;
+} PerfImageNode;
+
+class PerfImage
+{
+public:
+	PerfImage();
+	virtual ~PerfImage();
+
+	static size_t	GetSize(uint32_t nMaxNodes);
+
+	// Writer
+	bool			Create(const char* szFile, uint32_t nMaxNodes, uint64_t nStartTime);
+	bool			AddID(PerfID id, PerfID catID, const char* szName, const char* szCategory, bool bInternal);
+	// NULL when the image is full, or the parent didn't fit
+	PerfImageNode*	AddNode(PerfImageNode* pParent, PerfID id, PerfID catID, pthread_t threadID);
+	// Counts a node left out because its parent is not in the image
+	void			DropNode();
+	bool			SetEnded(uint64_t nEndTime);
+
+	// Reader
+	bool			Open(const char* szFile);
+	PerfImageHeader*	GetHeader();
+	// NULL for a slot that isn't complete
+	PerfImageID*	GetID(uint32_t nIndex);
+	PerfImageNode*	GetNode(uint32_t nIndex);
+
+	bool			Close();
+
+private:
+	PerfImageHeader*	mpHeader;
+	PerfImageID*		mpIDs;
+	PerfImageNode*		mpNodes;
+	size_t				mnSize;
+};
+
+#endif /*PERFIMAGE_H_*/
@@ -0,0 +1,146 @@
+/*****************************************************************************
+MIT License
+
+Copyright (c) 2016 Douglas Adler
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*****************************************************************************/
+
+
+#ifndef PERFLIVESTATS_H_
+#define PERFLIVESTATS_H_
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "PerfMetrics.h"
+
+//
+// Layout of the live stats segment, see PerfOptionLiveStats.  Readers
+// in other processes map it read only, so only add to the end of a
+// record and bump PERF_LIVE_VERSION when anything else changes.
+//
+//   PerfLiveHeader
+//   PerfLiveRecord		IDs[nMaxIDs]
+//   PerfLiveRecord		categories[nMaxCategories]
+//
+// One thread writes every record.  It makes nSequence odd, updates the
+// record, then makes it even again.  A reader copies the record and keeps
+// the copy only if nSequence was the same even number before and after.
+// Times are in usec.
+//
+#define PERF_LIVE_MAGIC				0x4556494C46524550ULL	// "PERFLIVE"
+#define PERF_LIVE_VERSION			1
+#define PERF_LIVE_MAX_IDS			1024		// Also the largest PerfID that's published
+#define PERF_LIVE_MAX_CATEGORIES	256
+#define PERF_LIVE_NAME_SIZE			64
+#define PERF_LIVE_NAME_FORMAT		"/perfmetrics.%d"		// shm_open name, the pid
+// Call time buckets, bucket n holds calls up to 4^n usec and the last one everything longer
+#define PERF_LIVE_LATENCY_BUCKETS	12
+
+typedef struct PerfLiveHeader_s
+{
+	uint64_t			nMagic;
+	uint32_t			nVersion;
+	uint32_t			nHeaderSize;			// sizeof(PerfLiveHeader)
+	uint32_t			nRecordSize;			// sizeof(PerfLiveRecord)
+	uint32_t			nMaxIDs;
+	uint32_t			nMaxCategories;
+	uint32_t			nInterval;				// ms between updates
+	int32_t				nPid;
+	uint32_t			nReserved;
+	uint64_t			nStartTime;				// PERF_START, usec since the epoch
+	volatile uint32_t	nIDs;					// Records in use, only grow
+	volatile uint32_t	nCategories;
+	volatile uint64_t	nUpdateTime;			// Last update, usec since the epoch
+	volatile uint64_t	nUpdates;
+	volatile uint32_t	bStopped;				// PERF_STOP was called, no more updates
+	volatile uint32_t	nDroppedIDs;			// IDs past nMaxIDs, or PerfIDs too large to count
+} PerfLiveHeader;
+
+typedef struct PerfLiveRecord_s
+{
+	volatile uint64_t	nSequence;				// Odd while the record is being written
+	uint64_t			nID;
+	char				szName[PERF_LIVE_NAME_SIZE];
+	char				szCategory[PERF_LIVE_NAME_SIZE];	// Same as szName for a category
+	uint64_t			nCalls;
+	uint64_t			nTotalTime;				// Inclusive
+	uint64_t			nSelfTime;
+	uint64_t			nMaxTime;
+	uint64_t			nAbortedCalls;
+} PerfLiveRecord;
+
+// What each thread adds to, indexed by PerfID, see ThreadRecord::GetLiveCounts.
+// Not part of the segment.
+typedef struct PerfLiveCounts_s
+{
+	uint64_t			nCalls;
+	uint64_t			nTotalTime;
+	uint64_t			nSelfTime;
+	uint64_t			nMaxTime;
+	uint64_t			nAbortedCalls;
+	uint64_t			nLatency[PERF_LIVE_LATENCY_BUCKETS];
+} PerfLiveCounts;
+
+//
+// The segment.  The library creates it and is its only writer, readers
+// such as perfmetrics-top attach to it.
+//
+class PerfLiveStats
+{
+public:
+	PerfLiveStats();
+	virtual ~PerfLiveStats();
+
+	static size_t	GetSize();
+	static bool		GetName(pid_t nPid, char* szName, size_t nSize);
+	static uint32_t	GetLatencyBucket(uint64_t nTime);
+	// usec, the upper bound of every bucket but the last
+	static uint64_t	GetBucketLimit(uint32_t nBucket);
+
+	// Writer
+	bool		Create(uint32_t nInterval, uint64_t nStartTime);
+	bool		SetID(uint32_t nSlot, PerfID id, const char* szName, const char* szCategory, const PerfLiveCounts& counts);
+	bool		SetCategory(uint32_t nSlot, PerfID id, const char* szName, const PerfLiveCounts& counts);
+	bool		SetUpdated(uint64_t nUpdateTime, bool bStopped);
+	bool		SetDroppedIDs(uint32_t nDroppedIDs);
+	// Removes the name, readers still attached keep their mapping
+	bool		Destroy();
+
+	// Reader
+	bool		Attach(const char* szName);
+	bool		Detach();
+	PerfLiveHeader*	GetHeader();
+	// False if the writer kept changing the record
+	bool		ReadID(uint32_t nSlot, PerfLiveRecord* pRecord);
+	bool		ReadCategory(uint32_t nSlot, PerfLiveRecord* pRecord);
+
+private:
+	static bool	WriteRecord(PerfLiveRecord* pRecord, PerfID id, const char* szName, const char* szCategory, const PerfLiveCounts& counts);
+	static bool	ReadRecord(PerfLiveRecord* pShared, PerfLiveRecord* pRecord);
+
+	PerfLiveHeader*	mpHeader;
+	PerfLiveRecord*	mpIDs;
+	PerfLiveRecord*	mpCategories;
+	char			mszName[PERF_LIVE_NAME_SIZE];
+	bool			mbOwner;
+};
+
+#endif /*PERFLIVESTATS_H_*/
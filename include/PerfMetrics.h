@@ -34,6 +34,12 @@ SOFTWARE.
 **---------------------------------------------------------------------
 */
 #include "performance_id.h"
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
 
 
 /*
@@ -83,6 +89,30 @@ SOFTWARE.
     #define PERF_ENTRY(n, c)                (PerfMetrics::PerfEntry(n, c))
     #define PERF_EXIT(n, c)                 (PerfMetrics::PerfExit(n, c))
     #define PERF_FUNC(n, c)                 PerfFunction FuncMetric(n, c)
+    #define PERF_FUNC_WORK(n, c, u)         PerfFunction FuncMetric(n, c, u)
+    #define PERF_ADD_WORK(u)                (PerfMetrics::PerfAddWork(u))
+    #define PERF_COUNTER_ADD(n, d)          (PerfMetrics::PerfCounterAdd(n, d))
+    #define PERF_GAUGE_SET(n, v)            (PerfMetrics::PerfGaugeSet(n, v))
+    #define PERF_SET_BUDGET(n, c, t)        (PerfMetrics::PerfSetBudget(n, c, t))
+    #define PERF_SET_CATEGORY_BUDGET(c, t)  (PerfMetrics::PerfSetCategoryBudget(c, t))
+    #define PERF_SET_BUDGET_CALLBACK(f, p, a) (PerfMetrics::PerfSetBudgetCallback(f, p, a))
+    #define PERF_SET_METRICS_ENDPOINT(a)    (PerfMetrics::PerfSetMetricsEndpoint(a))
+    #define PERF_SET_IMAGE_FILE(f, n)       (PerfMetrics::PerfSetImageFile(f, n))
+    #define PERF_SET_OPTION(o, v)           (PerfMetrics::PerfSetOption(o, v))
+    #define PERF_CATEGORY_RUSAGE(c)         (PerfMetrics::PerfCategoryRusage(c))
+    #define PERF_MUTEX_LOCK(m, n)           (PerfMetrics::PerfMutexLock(m, n))
+    #define PERF_MUTEX_UNLOCK(m, n)         (PerfMetrics::PerfMutexUnlock(m, n))
+    #define PERF_IO(n, c, b)                PerfIOFunction IOMetric(n, c, b)
+    #define PERF_IO_BYTES(b)                (IOMetric.SetBytes(b))
+    #define PERF_READ(f, p, s)              (PerfMetrics::PerfRead(f, p, s))
+    #define PERF_WRITE(f, p, s)             (PerfMetrics::PerfWrite(f, p, s))
+    #define PERF_PREAD(f, p, s, o)          (PerfMetrics::PerfPread(f, p, s, o))
+    #define PERF_PWRITE(f, p, s, o)         (PerfMetrics::PerfPwrite(f, p, s, o))
+    #define PERF_FSYNC(f)                   (PerfMetrics::PerfFsync(f))
+    #define PERF_SEND(f, p, s, x)           (PerfMetrics::PerfSend(f, p, s, x))
+    #define PERF_RECV(f, p, s, x)           (PerfMetrics::PerfRecv(f, p, s, x))
+    #define PERF_BENCH(n, c, f, p, r)       (PerfMetrics::PerfBench(n, c, f, p, r))
+    #define PERF_BENCH_CALL(n, c, f, r)     (PerfMetrics::PerfBench(n, c, f, r))
 #else 
 // C entry points
     #define PERF_START()                    PerfStart()
@@ -97,6 +127,26 @@ SOFTWARE.
     #define PERF_ENTRY(n, c)                PerfEntry(n, c)
     #define PERF_EXIT(n, c)                 PerfExit(n, c)
     #define PERF_FUNC(n, c)                 PerfFunction(n, c)
+    #define PERF_ADD_WORK(u)                PerfAddWork(u)
+    #define PERF_COUNTER_ADD(n, d)          PerfCounterAdd(n, d)
+    #define PERF_GAUGE_SET(n, v)            PerfGaugeSet(n, v)
+    #define PERF_SET_BUDGET(n, c, t)        PerfSetBudget(n, c, t)
+    #define PERF_SET_CATEGORY_BUDGET(c, t)  PerfSetCategoryBudget(c, t)
+    #define PERF_SET_BUDGET_CALLBACK(f, p, a) PerfSetBudgetCallback(f, p, a)
+    #define PERF_SET_METRICS_ENDPOINT(a)    PerfSetMetricsEndpoint(a)
+    #define PERF_SET_IMAGE_FILE(f, n)       PerfSetImageFile(f, n)
+    #define PERF_SET_OPTION(o, v)           PerfSetOption(o, v)
+    #define PERF_CATEGORY_RUSAGE(c)         PerfCategoryRusage(c)
+    #define PERF_MUTEX_LOCK(m, n)           PerfMutexLock(m, n)
+    #define PERF_MUTEX_UNLOCK(m, n)         PerfMutexUnlock(m, n)
+    #define PERF_READ(f, p, s)              PerfRead(f, p, s)
+    #define PERF_WRITE(f, p, s)             PerfWrite(f, p, s)
+    #define PERF_PREAD(f, p, s, o)          PerfPread(f, p, s, o)
+    #define PERF_PWRITE(f, p, s, o)         PerfPwrite(f, p, s, o)
+    #define PERF_FSYNC(f)                   PerfFsync(f)
+    #define PERF_SEND(f, p, s, x)           PerfSend(f, p, s, x)
+    #define PERF_RECV(f, p, s, x)           PerfRecv(f, p, s, x)
+    #define PERF_BENCH(n, c, f, p, r)       PerfBench(n, c, f, p, r)
 #endif // __cplusplus
 #else
 #define PERF_START()
@@ -111,9 +161,37 @@ SOFTWARE.
 #define PERF_ENTRY(n, c)
 #define PERF_EXIT(n, c)
 #define PERF_FUNC(n, c)
+#define PERF_FUNC_WORK(n, c, u)
+#define PERF_ADD_WORK(u)
+#define PERF_COUNTER_ADD(n, d)
+#define PERF_GAUGE_SET(n, v)
+#define PERF_SET_BUDGET(n, c, t)
+#define PERF_SET_CATEGORY_BUDGET(c, t)
+#define PERF_SET_BUDGET_CALLBACK(f, p, a)
+#define PERF_SET_METRICS_ENDPOINT(a)
+#define PERF_SET_IMAGE_FILE(f, n)
+#define PERF_SET_OPTION(o, v)
+#define PERF_CATEGORY_RUSAGE(c)
+#define PERF_MUTEX_LOCK(m, n)           pthread_mutex_lock(m)
+#define PERF_MUTEX_UNLOCK(m, n)         pthread_mutex_unlock(m)
+#define PERF_IO(n, c, b)
+#define PERF_IO_BYTES(b)
+#define PERF_READ(f, p, s)              read(f, p, s)
+#define PERF_WRITE(f, p, s)             write(f, p, s)
+#define PERF_PREAD(f, p, s, o)          pread(f, p, s, o)
+#define PERF_PWRITE(f, p, s, o)         pwrite(f, p, s, o)
+#define PERF_FSYNC(f)                   fsync(f)
+#define PERF_SEND(f, p, s, x)           send(f, p, s, x)
+#define PERF_RECV(f, p, s, x)           recv(f, p, s, x)
+// Nothing is measured, the result is zeroed and the call fails, see PerfBenchDisabled
+#define PERF_BENCH(n, c, f, p, r)       ((void)(f), (void)(p), PerfBenchDisabled(r))
+#define PERF_BENCH_CALL(n, c, f, r)     ((void)(f), PerfBenchDisabled(r))
 #endif
+// Scoped lock of a pthread_mutex_t or anything with lock/try_lock/unlock, see PerfLockGuard
+#define PERF_LOCK_GUARD(m, n)           PerfLockGuard PerfLockGuardVar(m, n)
 
 #define INVALID_PERF_ID 		0xffffffffUL
+#define PERF_BUDGET_MAX_DEPTH	32
 
 /*
 **---------------------------------------------------------------------
@@ -122,6 +200,81 @@ SOFTWARE.
 */
 typedef unsigned long 	PerfID;
 
+//
+// Runtime options, set with PERF_SET_OPTION before PERF_START
+//
+typedef enum PerfOption_e
+{
+	PerfOptionFoldRecursion,		// Non zero folds recursive calls into the ancestor node
+	PerfOptionMaxThreadNodes,		// Max tree nodes per thread, 0 is unlimited
+	PerfOptionMaxDepth,				// Max tree depth, 0 is unlimited
+	PerfOptionMaxMemory,			// Max bytes used for tree nodes, 0 is unlimited
+	PerfOptionThreadArena,			// Bytes preallocated per thread for its tree, 0 uses the heap
+	PerfOptionRegistryArena,		// Bytes preallocated at PERF_START for IDs and names, 0 uses the heap
+	PerfOptionAllocSampleRate,		// Allocation hooks track one allocation per this many bytes, 0 tracks all
+	PerfOptionPerfCounters,			// Non zero opens perf_event counters on each thread
+	PerfOptionSlowCalls,			// Keep this many of the slowest calls of each ID, 0 keeps none
+	PerfOptionWatchdog,				// Report scopes open longer than this many ms, 0 is off
+	PerfOptionLiveStats,			// Publish per ID totals to shared memory every this many ms, 0 is off
+	PerfOptionReportSignal,			// Dump the reports to a new directory on this signal, e.g. SIGUSR1, 0 is off
+	PerfOptionBinaryReport,			// Non zero writes PerfReport.bin instead of the text reports, see perfmetrics-report
+	PerfOptionBenchWarmup,			// ms each PERF_BENCH runs untimed first, 100 by default
+	PerfOptionBenchTime,			// ms of timed samples each PERF_BENCH takes, 1000 by default
+	PerfOptionLast
+} PerfOption;
+
+//
+// A call that took longer than its budget, see PERF_SET_BUDGET
+//
+typedef struct PerfBudgetEvent_s
+{
+	PerfID			id;
+	const char *	szName;
+	const char *	szCategory;
+	uint64_t		nDuration;						// usec
+	uint64_t		nBudget;						// usec
+	uint64_t		nStartTime;						// usec since the epoch
+	pthread_t		threadID;
+	uint32_t		nDepth;							// Frames in the path, root first
+	PerfID			path[PERF_BUDGET_MAX_DEPTH];
+	const char *	szPath[PERF_BUDGET_MAX_DEPTH];
+} PerfBudgetEvent;
+
+typedef void (*PerfBudgetCallback)(const PerfBudgetEvent* pEvent, void* pContext);
+
+//
+// What PERF_BENCH measured.  Each sample times a batch of iterations, and
+// the times below are the batch time divided by the iterations, in ns.
+//
+typedef struct PerfBenchResult_s
+{
+	uint32_t		nSamples;
+	uint64_t		nIterations;					// Per sample
+	double			nMedian;
+	double			nMAD;							// Median absolute deviation from the median
+	double			nCILow;							// 95% confidence interval of the median
+	double			nCIHigh;
+	double			nMean;
+	double			nStdDev;
+	double			nMin;
+	double			nMax;
+	uint32_t		nLowOutliers;					// Below Q1 - 1.5 IQR
+	uint32_t		nHighOutliers;					// Above Q3 + 1.5 IQR
+} PerfBenchResult;
+
+#ifndef FEATURE_PERFORMANCE_PROFILING
+// PERF_BENCH with profiling off, a function so a NULL result is fine
+static inline int PerfBenchDisabled(PerfBenchResult* pResult)
+{
+	if(pResult != NULL) {
+		memset(pResult, 0, sizeof(PerfBenchResult));
+	}
+	return 0;
+}
+#endif
+
+typedef void (*PerfBenchFunction)(void* pContext);
+
 
 /*
 **---------------------------------------------------------------------
@@ -138,6 +291,7 @@ class PerfFunction
 public:
 	PerfFunction(PerfID id);
 	PerfFunction(const char * szName,  const char * szCategory);
+	PerfFunction(const char * szName,  const char * szCategory, uint64_t nUnits);
 	virtual ~PerfFunction();
 private:
 	PerfID 			m_id;
@@ -145,6 +299,23 @@ private:
 	const char * 	m_szCategory;
 };
 
+//
+// A scope that moves nBytes of I/O, see PERF_IO.  Use PERF_IO_BYTES when
+// the count is only known once the I/O is done.
+//
+class PerfIOFunction
+{
+public:
+	PerfIOFunction(const char * szName,  const char * szCategory, int64_t nBytes);
+	virtual ~PerfIOFunction();
+	void SetBytes(int64_t nBytes)	{ m_nBytes = nBytes; }
+private:
+	const char *	m_szName;
+	const char * 	m_szCategory;
+	int64_t			m_nBytes;
+	uint64_t		m_nStart;
+};
+
 class PerfMetrics
 {
 public:
@@ -161,8 +332,45 @@ public:
 	static bool PerfExit       ( const char * szName,  const char * szCategory );
     static bool PerfAlloc      ( void* addr, int size );
     static bool PerfFree       ( void* addr );
+    static bool PerfSetOption  ( PerfOption eOption, unsigned long nValue );
+    static bool PerfCategoryRusage ( const char * szCategory );
+    static bool PerfAddWork    ( uint64_t nUnits );
+    static bool PerfCounterAdd ( const char * szName, int64_t nDelta );
+    static bool PerfGaugeSet   ( const char * szName, int64_t nValue );
+    static bool PerfSetBudget  ( const char * szName, const char * szCategory, uint64_t nBudget );
+    static bool PerfSetCategoryBudget ( const char * szCategory, uint64_t nBudget );
+    static bool PerfSetBudgetCallback ( PerfBudgetCallback pfnCallback, void* pContext, bool bAsync );
+    static bool PerfSetMetricsEndpoint ( const char * szAddress );
+    static bool PerfSetImageFile ( const char * szFile, unsigned long nMaxNodes );
+    static int  PerfMutexLock  ( pthread_mutex_t* pMutex, const char * szName );
+    static int  PerfMutexUnlock( pthread_mutex_t* pMutex, const char * szName );
+    // Used by PerfLockGuard for other lock types
+    static uint64_t PerfLockWaitStart ( void );
+    static bool PerfLockAcquired ( void* pLock, const char * szName, uint64_t nWaitStart, bool bContended );
+    static bool PerfLockReleased ( void* pLock );
+    // I/O, each call is its own node in the IO category
+    static ssize_t PerfRead    ( int fd, void* pBuf, size_t nCount );
+    static ssize_t PerfWrite   ( int fd, const void* pBuf, size_t nCount );
+    static ssize_t PerfPread   ( int fd, void* pBuf, size_t nCount, off_t nOffset );
+    static ssize_t PerfPwrite  ( int fd, const void* pBuf, size_t nCount, off_t nOffset );
+    static int     PerfFsync   ( int fd );
+    static ssize_t PerfSend    ( int fd, const void* pBuf, size_t nCount, int nFlags );
+    static ssize_t PerfRecv    ( int fd, void* pBuf, size_t nCount, int nFlags );
+    // Used by PerfIOFunction, charges the I/O to the current node
+    static uint64_t PerfIOStart ( void );
+    static bool PerfIOEnd      ( uint64_t nStart, int64_t nBytes );
+    // Repeats pfnBench and records each sample as a call of szName, pResult may be NULL
+    static bool PerfBench      ( const char * szName, const char * szCategory, PerfBenchFunction pfnBench, void* pContext, PerfBenchResult* pResult );
+    // Any callable, e.g. a lambda
+    template <class F>
+    static bool PerfBench      ( const char * szName, const char * szCategory, F fn, PerfBenchResult* pResult )
+    {
+        return PerfBench(szName, szCategory, CallBench<F>, (void*)&fn, pResult);
+    }
 private:
     static PerfID GetUniqueID  ( );
+    template <class F>
+    static void CallBench      ( void* pContext )	{ (*(F*)pContext)(); }
 	
 };
 #else	// __cplusplus
@@ -176,10 +384,75 @@ extern int   PerfReport     ( void );
 extern int   PerfEntry      ( const char * szName,  const char * szCategory );
 extern int   PerfExit       ( const char * szName,  const char * szCategory );
 extern int   PerfFunction   ( const char * szName,  const char * szCategory);
+extern int   PerfSetOption  ( PerfOption eOption, unsigned long nValue );
+extern int   PerfCategoryRusage ( const char * szCategory );
+extern int   PerfAddWork    ( uint64_t nUnits );
+extern int   PerfCounterAdd ( const char * szName, int64_t nDelta );
+extern int   PerfGaugeSet   ( const char * szName, int64_t nValue );
+extern int   PerfSetBudget  ( const char * szName, const char * szCategory, uint64_t nBudget );
+extern int   PerfSetCategoryBudget ( const char * szCategory, uint64_t nBudget );
+extern int   PerfSetBudgetCallback ( PerfBudgetCallback pfnCallback, void* pContext, int bAsync );
+extern int   PerfSetMetricsEndpoint ( const char * szAddress );
+extern int   PerfSetImageFile ( const char * szFile, unsigned long nMaxNodes );
+extern int   PerfMutexLock  ( pthread_mutex_t* pMutex, const char * szName );
+extern int   PerfMutexUnlock( pthread_mutex_t* pMutex, const char * szName );
+extern ssize_t PerfRead     ( int fd, void* pBuf, size_t nCount );
+extern ssize_t PerfWrite    ( int fd, const void* pBuf, size_t nCount );
+extern ssize_t PerfPread    ( int fd, void* pBuf, size_t nCount, off_t nOffset );
+extern ssize_t PerfPwrite   ( int fd, const void* pBuf, size_t nCount, off_t nOffset );
+extern int     PerfFsync    ( int fd );
+extern ssize_t PerfSend     ( int fd, const void* pBuf, size_t nCount, int nFlags );
+extern ssize_t PerfRecv     ( int fd, void* pBuf, size_t nCount, int nFlags );
+extern int   PerfBench      ( const char * szName, const char * szCategory, PerfBenchFunction pfnBench, void* pContext, PerfBenchResult* pResult );
 //
 END_EXTERN_C
 #endif // __cplusplus
 
 #endif 	// FEATURE_PERFORMANCE_PROFILING
 
+#ifdef  __cplusplus
+//
+// Holds a lock for the scope and records how long it waited for it and how
+// long it was held.  Works with pthread_mutex_t and with std::mutex or any
+// other type that has try_lock, lock and unlock.
+//
+class PerfLockGuard
+{
+public:
+	template <class M>
+	PerfLockGuard(M& mutex, const char * szName) : mpLock(&mutex), mpfnUnlock(UnlockMutex<M>)
+	{
+#ifdef FEATURE_PERFORMANCE_PROFILING
+		uint64_t	nWaitStart	= 0;
+		bool		bContended	= !mutex.try_lock();
+		if(bContended) {
+			nWaitStart = PerfMetrics::PerfLockWaitStart();
+			mutex.lock();
+		}
+		PerfMetrics::PerfLockAcquired(mpLock, szName, nWaitStart, bContended);
+#else
+		mutex.lock();
+#endif
+	}
+	PerfLockGuard(pthread_mutex_t& mutex, const char * szName) : mpLock(&mutex), mpfnUnlock(UnlockPthread)
+	{
+		PERF_MUTEX_LOCK(&mutex, szName);
+	}
+	~PerfLockGuard()
+	{
+#ifdef FEATURE_PERFORMANCE_PROFILING
+		PerfMetrics::PerfLockReleased(mpLock);
+#endif
+		mpfnUnlock(mpLock);
+	}
+private:
+	template <class M>
+	static void UnlockMutex(void* pLock)		{ ((M*)pLock)->unlock(); }
+	static void UnlockPthread(void* pLock)		{ pthread_mutex_unlock((pthread_mutex_t*)pLock); }
+
+	void*	mpLock;
+	void	(*mpfnUnlock)(void* pLock);
+};
+#endif // __cplusplus
+
 #endif /* PERFMETRICS_H */
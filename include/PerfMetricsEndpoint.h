@@ -0,0 +1,65 @@
+/*****************************************************************************
+MIT License
+
+Copyright (c) 2016 Douglas Adler
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*****************************************************************************/
+#ifndef PERFMETRICSENDPOINT_H_
+#define PERFMETRICSENDPOINT_H_
+
+#include <pthread.h>
+#include <string>
+
+//
+// A scrape listener, see PERF_SET_METRICS_ENDPOINT.  One thread accepts
+// connections on a Unix domain socket or a 127.0.0.1 TCP port and answers
+// every GET of / or /metrics with the body the format function builds, in
+// the Prometheus text format.  One client is served at a time.
+//
+typedef bool (*PerfMetricsFormat)(std::string& body, void* pContext);
+
+class PerfMetricsEndpoint
+{
+public:
+	PerfMetricsEndpoint();
+	virtual ~PerfMetricsEndpoint();
+
+	// "/path" is a Unix socket, "port" or "127.0.0.1:port" is TCP
+	bool		Start(const char* szAddress, PerfMetricsFormat pfnFormat, void* pContext);
+	bool		Stop();
+	bool		IsRunning();
+	const char*	GetAddress();
+
+private:
+	bool		Listen(const char* szAddress);
+	void		Serve(int nClient);
+	static void*	ServeThread(void* pArg);
+
+	PerfMetricsFormat	mpfnFormat;
+	void*				mpContext;
+	int					mnListen;
+	int					mnWakePipe[2];
+	bool				mbUnix;
+	bool				mbRunning;
+	pthread_t			mThread;
+	std::string			mAddress;
+};
+
+#endif /*PERFMETRICSENDPOINT_H_*/
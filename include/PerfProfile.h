@@ -0,0 +1,128 @@
+/*****************************************************************************
+MIT License
+
+Copyright (c) 2016 Douglas Adler
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*****************************************************************************/
+#ifndef PERFPROFILE_H_
+#define PERFPROFILE_H_
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include "PerfMetrics.h"
+#include "PerfRecordReport.h"
+
+class PerfBinaryReport;
+
+//
+// A finished profile read back from a file, for the offline tools.  Load
+// takes a PERF_SET_IMAGE_FILE image or a PerfOptionBinaryReport
+// PerfReport.bin and tells them apart by their magic.
+//
+typedef struct PerfProfileID_s
+{
+	PerfID				id;
+	PerfID				catID;
+	bool				bInternal;			// ThreadStart and [other], in no category
+	std::string			name;
+	std::string			category;
+	uint64_t			nBudget;			// PERF_BINARY_BUDGETS, usec
+	uint64_t			nBreaches;
+} PerfProfileID;
+
+typedef struct PerfProfileCategory_s
+{
+	PerfID				catID;
+	std::string			name;
+} PerfProfileCategory;
+
+// Times are in usec, a node's parent always comes before it.  The fields
+// after nMaxRecursion are only filled in for the columns GetColumns has.
+typedef struct PerfProfileNode_s
+{
+	uint32_t			nParent;			// Index + 1 into the nodes, 0 for a thread's root
+	PerfID				id;
+	PerfID				catID;
+	uint64_t			nThreadID;
+	uint64_t			nCalls;
+	uint64_t			nTotalTime;
+	uint64_t			nSelfTime;
+	uint32_t			nMinTime;
+	uint32_t			nMaxTime;
+	uint32_t			nAbortedCalls;
+	uint32_t			nRecursiveCalls;
+	uint32_t			nMaxRecursion;
+	uint64_t			nWorkUnits;
+	uint64_t			nIOOps;
+	uint64_t			nIOBytes;
+	uint64_t			nIOTime;
+	uint64_t			nIOLatency[PERF_IO_LATENCY_BUCKETS];
+	bool				bRusage;
+	PerfRusage			rusage;
+	uint64_t			nAllocCount;
+	uint64_t			nAllocBytes;
+	uint64_t			nFreeCount;
+	uint64_t			nLiveBytes;
+	uint64_t			nLockAcquires;
+	uint64_t			nLockContended;
+	uint64_t			nLockWaitTime;
+	uint64_t			nLockHoldTime;
+	std::vector<uint32_t>	children;
+} PerfProfileNode;
+
+class PerfProfile
+{
+public:
+	PerfProfile();
+	virtual ~PerfProfile();
+
+	bool			Load(const char* szFile);
+
+	// In the order the category report lists them
+	std::vector<PerfProfileCategory>&	GetCategories();
+	std::vector<PerfProfileID>&		GetIDs();
+	std::vector<PerfProfileNode>&		GetNodes();
+	// Nodes the file couldn't hold, or that weren't complete
+	uint64_t		GetDroppedNodes();
+	// PERF_BINARY_ bits of the optional columns, an image has none
+	uint32_t		GetColumns();
+	PerfProfileID*	FindID(PerfID id);
+	// "ID n" for an ID the file doesn't name
+	std::string		GetName(PerfID id);
+
+private:
+	static uint64_t	GetMagic(const char* szFile);
+	bool			LoadImage(const char* szFile);
+	bool			LoadBinary(const char* szFile);
+	bool			LoadBinaryColumns(PerfBinaryReport& binary, PerfProfileNode* pNode);
+	bool			LoadBinaryNode(PerfBinaryReport& binary, uint64_t nThreadID, std::vector<uint32_t>& path, int64_t* pnDepth, int64_t* pnID);
+	void			LinkNodes();
+
+	std::vector<PerfProfileCategory>	mCategories;
+	std::vector<PerfProfileID>		mIDs;
+	std::vector<PerfProfileNode>		mNodes;
+	uint64_t						mnDroppedNodes;
+	uint32_t						mnColumns;
+};
+
+#endif /*PERFPROFILE_H_*/
@@ -32,6 +32,8 @@ SOFTWARE.
 */
 #include <stdint.h>
 
+#include "PerfCounters.h"
+
 /*
 **-------------------------------------------------------------------------
 **  Macro Definitions
@@ -43,6 +45,14 @@ SOFTWARE.
 ** Constants and Primary Macro Definitions
 **---------------------------------------------------------------------
 */
+// Allocation size classes, class n holds sizes up to 16 << n and the last one everything bigger
+#define PERF_ALLOC_SIZE_CLASSES		16
+#define PERF_ALLOC_MIN_CLASS_SIZE	16
+// I/O latency buckets, bucket n holds latencies up to 1 << n usec and the last one everything longer
+#define PERF_IO_LATENCY_BUCKETS		16
+// Named counters and gauges, PERF_COUNTER_ADD and PERF_GAUGE_SET
+#define PERF_MAX_METRICS			64
+#define PERF_MAX_NODE_METRICS		8		// Per node, more than this are only counted per thread
 
 
 /*
@@ -51,6 +61,28 @@ SOFTWARE.
 **---------------------------------------------------------------------
 */
 
+// getrusage(RUSAGE_THREAD) counters, kept for categories set with PERF_CATEGORY_RUSAGE
+typedef struct PerfRusage_s
+{
+	uint64_t		nVolCtxSwitches;
+	uint64_t		nInvolCtxSwitches;
+	uint64_t		nMinorFaults;
+	uint64_t		nMajorFaults;
+	uint64_t		nBlockIn;
+	uint64_t		nBlockOut;
+} PerfRusage;
+
+// A counter's total or a gauge's last value, with the gauge's range
+typedef struct PerfMetricValue_s
+{
+	uint32_t		nMetric;			// Index of the name in the metric table
+	uint32_t		nUpdates;			// 0 for an unused slot
+	int64_t			nValue;
+	int64_t			nMin;
+	int64_t			nMax;
+	uint64_t		nSequence;			// Order of the last gauge set, across threads
+} PerfMetricValue;
+
 typedef struct PerfRecordReport_s
 {
 	uint32_t		nTotalCalls;
@@ -66,6 +98,29 @@ typedef struct PerfRecordReport_s
 	double			nTotalCPUTimeSelf;
 	double			nMinCPUTime;
 	double			nMaxCPUTime;
+	uint32_t		nRecursiveCalls;
+	uint32_t		nMaxRecursion;
+	uint32_t		nAbortedCalls;		// Calls that never saw their own exit
+	uint64_t		nAllocCount;
+	uint64_t		nAllocBytes;
+	uint64_t		nFreeCount;
+	uint64_t		nLiveBytes;
+	uint64_t		nAllocSizes[PERF_ALLOC_SIZE_CLASSES];
+	bool			bRusage;
+	PerfRusage		rusage;
+	uint32_t		nCounters;			// perf_event counters, see PerfOptionPerfCounters
+	uint64_t		nCounterValues[PERF_MAX_COUNTERS];
+	uint32_t		nLockAcquires;		// PERF_MUTEX_LOCK and PerfLockGuard
+	uint32_t		nLockContended;
+	uint64_t		nLockWaitTime;
+	uint64_t		nLockHoldTime;
+	uint64_t		nIOOps;				// PERF_IO and the PERF_READ style wrappers
+	uint64_t		nIOBytes;
+	uint64_t		nIOTime;
+	uint64_t		nIOLatency[PERF_IO_LATENCY_BUCKETS];
+	uint64_t		nWorkUnits;			// PERF_FUNC_WORK and PERF_ADD_WORK
+	uint32_t		nMetrics;			// PERF_COUNTER_ADD and PERF_GAUGE_SET
+	PerfMetricValue	metrics[PERF_MAX_NODE_METRICS];
 } PerfRecordReport;
 
 
@@ -0,0 +1,79 @@
+/*****************************************************************************
+MIT License
+
+Copyright (c) 2016 Douglas Adler
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*****************************************************************************/
+
+
+#ifndef PERFSHADOWSTACK_H_
+#define PERFSHADOWSTACK_H_
+
+#include <pthread.h>
+#include <stdint.h>
+
+#include "PerfMetrics.h"
+
+// Frames deeper than this are counted but not published
+#define PERF_SHADOW_STACK_DEPTH		256
+
+//
+// A thread's open scopes, written only by the thread and readable from any
+// other.  A sequence count around each change lets a reader tell if it
+// copied the frames while they were changing and try again, so the owner
+// never waits on a reader.
+//
+class PerfShadowStack
+{
+public:
+	typedef struct {
+		PerfID		id;
+		uint64_t	nEntryTime;
+	} Frame;
+
+	PerfShadowStack(pthread_t threadID, const char* szThreadName);
+	virtual ~PerfShadowStack();
+
+	// Owner thread only
+	bool		Push(PerfID id, uint64_t nEntryTime);
+	bool		Pop();
+	uint32_t	GetDepth();
+
+	// Any thread.  Copies up to nMax frames, root first, and returns how many.
+	// pnDepth gets the full depth.  False if the owner kept changing it.
+	bool		Read(Frame* pFrames, uint32_t nMax, uint32_t* pnFrames, uint32_t* pnDepth);
+
+	pthread_t	GetThreadID();
+	const char*	GetThreadName();
+	// The last frame the watchdog reported, only used by the watchdog
+	bool		IsReported(uint32_t nDepth, uint64_t nEntryTime);
+	bool		SetReported(uint32_t nDepth, uint64_t nEntryTime);
+
+private:
+	volatile uint64_t	mnSequence;				// Odd while the owner is changing the frames
+	volatile uint32_t	mnDepth;
+	Frame				mFrames[PERF_SHADOW_STACK_DEPTH];
+	pthread_t			mThreadID;
+	char				mszThreadName[16];
+	uint32_t			mnReportedDepth;
+	uint64_t			mnReportedEntryTime;
+};
+
+#endif /*PERFSHADOWSTACK_H_*/
@@ -0,0 +1,78 @@
+/*****************************************************************************
+MIT License
+
+Copyright (c) 2016 Douglas Adler
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*****************************************************************************/
+
+
+#ifndef PERFSLOWCALLS_H_
+#define PERFSLOWCALLS_H_
+
+#include <pthread.h>
+#include <stdint.h>
+
+#include <vector>
+
+#include "PerfMetrics.h"
+
+// Deeper paths keep the frames nearest the call
+#define PERF_SLOW_CALL_MAX_DEPTH	32
+
+//
+// The N slowest calls of one ID.  A min-heap on the duration, so a call only
+// has to beat the fastest call kept to get in, and that check is a single
+// load.  The path is only walked once a call gets in.
+//
+class PerfSlowCalls
+{
+public:
+	typedef struct {
+		uint64_t	nDuration;
+		uint64_t	nStartTime;
+		pthread_t	threadID;
+		uint32_t	nDepth;						// Frames in path, root first
+		bool		bTruncated;					// Frames above path[0] were dropped
+		PerfID		path[PERF_SLOW_CALL_MAX_DEPTH];
+	} SlowCall;
+
+	PerfSlowCalls(uint32_t nSize);
+	virtual ~PerfSlowCalls();
+
+	// Calls this long or shorter won't get in
+	uint64_t	GetThreshold();
+	bool		Add(const SlowCall& call);
+	// Slowest first
+	void		GetCalls(std::vector<SlowCall>& calls);
+
+private:
+	static void	Lock(volatile int* pLock);
+	static void	Unlock(volatile int* pLock);
+	void		SiftDown(uint32_t nPos);
+	void		SiftUp(uint32_t nPos);
+
+	volatile int		mnLock;
+	volatile uint64_t	mnThreshold;
+	uint32_t			mnSize;
+	uint32_t			mnCount;
+	SlowCall*			mpCalls;
+};
+
+#endif /*PERFSLOWCALLS_H_*/
@@ -32,12 +32,20 @@ SOFTWARE.
 #include "performance_id.h"
 #include "PerfRecordReport.h"
 #include "Node.h"
+#include "PerfCounters.h"
+#include "PerfSlowCalls.h"
+#include "PerfBudget.h"
+#include "PerfImage.h"
 
 class PerformanceRec : public Node
 {
 public:
-	PerformanceRec();
+	PerformanceRec(PerfArena* pArena = NULL);
 	virtual ~PerformanceRec();
+
+	static void*	operator new(size_t nSize, PerfArena* pArena);
+	static void		operator delete(void* p, PerfArena* pArena);
+	static void		operator delete(void* p);
 	
 	bool 		SetID(PerfID nID);
 	bool 		SetCatID(PerfID nID);
@@ -45,16 +53,57 @@ public:
 	PerfID 		GetCatID();
 	bool 		SetThreadID(pthread_t nThreadID);
 	pthread_t 	GetThreadID();
+	bool		SetDepth(uint32_t nDepth);
+	uint32_t	GetDepth();
 	
-	bool 		AddEntry();
-	bool 		AddExit();
+	bool 		AddEntry(uint64_t nEntryTime);
+	bool 		AddExit(uint64_t nEntryTime);
+	bool		AddAbortedCall();
+	bool		AddRecursiveEntry();
+	bool		AddRecursiveExit(uint64_t nTime);
+	bool		AddFoldedTime(uint64_t nTime);
+	uint32_t	GetRecursionDepth();
+	bool		EnableRusage(PerfArena* pArena);
+	bool		EnableCounters(PerfCounters* pCounters, PerfArena* pArena);
+	// Arena bytes of the optional blocks, so a new node can be charged for them
+	static size_t	GetRusageMemory();
+	static size_t	GetCountersMemory();
+	static size_t	GetIOMemory();
+	bool		HasIO();
+	static size_t	GetMetricsMemory();
+	bool		HasMetrics();
+	bool		AddLockWait(uint64_t nWaitTime, bool bContended);
+	bool		AddLockHold(uint64_t nHoldTime);
+	bool		AddIO(uint64_t nBytes, uint64_t nLatency, PerfArena* pArena);
+	static uint32_t	GetLatencyBucket(uint64_t nLatency);
+	bool		AddWork(uint64_t nUnits);
+	bool		SetSlowCalls(PerfSlowCalls* pSlowCalls);
+	PerfSlowCalls*	GetSlowCalls();
+	bool		SetBudget(PerfBudget* pBudget);
+	PerfBudget*	GetBudget();
+	bool		SetImageNode(PerfImageNode* pImage);
+	PerfImageNode*	GetImageNode();
+	uint64_t	GetLastEntryTime();
+	uint64_t	GetLastCallTime();
+	bool		AddMetric(uint32_t nMetric, int64_t nValue, bool bGauge, uint64_t nSequence, PerfArena* pArena);
+	static void	UpdateMetric(PerfMetricValue* pMetric, int64_t nValue, bool bGauge, uint64_t nSequence);
+#ifdef PERFORMANCE_MEMORY
+	// nCount allocations of nSize, nBytes in all, more than one when sampled
+	bool		AddAlloc(uint64_t nSize, uint64_t nBytes, uint32_t nCount);
+	bool		AddFree(uint64_t nBytes, uint32_t nCount);
+	static uint32_t	GetSizeClass(uint64_t nSize);
+#endif
 	bool 		GetReport(PerfRecordReport* report);
+	PerformanceRec*	Clone();
 	uint64_t 	GetTotalTime();
 	clock_t 	GetTotalCPUTime();
 	uint32_t 	GetTotalSamples();
 	
 private:
 	bool 		GetCurrentTimeStamp(uint64_t* pnTimeStamp);
+	static void*	CopyData(const void* pData, size_t nSize);
+	bool		UpdateImage();
+	bool		GetThreadRusage(PerfRusage* pUsage);
 	uint64_t 	GetChildTotalTime();
 	clock_t		GetChildTotalTimeCPU();
 	
@@ -62,8 +111,9 @@ private:
 	PerfID		mID;
 	PerfID		mCatID;
 	pthread_t	mThreadID;
+	uint32_t	mDepth;
 	
-	uint64_t	mCurrentEntryTime;
+	uint64_t	mLastEntryTime;			// Of the call that last exited
 	uint64_t	mLastExitTime;
 	uint64_t	mStartTime;
 	uint64_t	mTotalTime;
@@ -76,6 +126,64 @@ private:
 	clock_t		mMinCPUTime;
 	clock_t		mMaxCPUTime;
 	uint32_t	mTotalCalls;
+	uint32_t	mAbortedCalls;			// Closed when an outer call exited, see PerfExit
+
+	// Recursion folding
+	uint32_t	mRecursionDepth;
+	uint32_t	mMaxRecursion;
+	uint32_t	mRecursiveCalls;
+	uint64_t	mRecursiveTime;		// Time in calls folded into this node
+	uint64_t	mFoldedOutTime;		// Time in calls folded out of this node into an ancestor
+
+	// Only allocated for nodes in a PERF_CATEGORY_RUSAGE category
+	typedef struct {
+		PerfRusage	entry;
+		PerfRusage	total;
+	} RusageData;
+	RusageData*	mpRusage;
+
+	// Only allocated when the thread has perf_event counters open
+	typedef struct {
+		PerfCounters*	pCounters;
+		uint64_t		entry[PERF_MAX_COUNTERS];
+		uint64_t		total[PERF_MAX_COUNTERS];
+	} CounterData;
+	CounterData*	mpCounters;
+
+	// Locks taken while this node was current
+	uint32_t	mLockAcquires;
+	uint32_t	mLockContended;
+	uint64_t	mLockWaitTime;
+	uint64_t	mLockHoldTime;
+
+	// Only allocated for nodes that did I/O
+	typedef struct {
+		uint64_t	nOps;
+		uint64_t	nBytes;
+		uint64_t	nTime;
+		uint64_t	nLatency[PERF_IO_LATENCY_BUCKETS];
+	} IOData;
+	IOData*		mpIO;
+
+	// Items, bytes or whatever the caller counts as work, see PERF_ADD_WORK
+	uint64_t	mWorkUnits;
+
+	// Only allocated for nodes that set counters or gauges, PERF_MAX_NODE_METRICS of them
+	PerfMetricValue*	mpMetrics;
+
+	// The ID's slowest calls, shared by every node of the ID
+	PerfSlowCalls*	mpSlowCalls;
+	PerfBudget*		mpBudget;
+	PerfImageNode*	mpImage;		// This node in the image file, see PERF_SET_IMAGE_FILE
+
+#ifdef PERFORMANCE_MEMORY
+	// Allocations made while this node was current, frees may come from any thread
+	uint64_t	mAllocCount;
+	uint64_t	mAllocBytes;
+	uint64_t	mFreeCount;
+	uint64_t	mFreeBytes;
+	uint64_t	mAllocSizes[PERF_ALLOC_SIZE_CLASSES];
+#endif
 	
 };
 
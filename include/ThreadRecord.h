@@ -2,27 +2,93 @@
 #define THREADRECORD_H_
 
 #include <pthread.h>
+#include <stdint.h>
+
+#include <vector>
 
 #include "PerfMetrics.h"
 #include "Node.h" 
+#include "PerfArena.h"
+#include "PerfCounters.h"
+#include "PerfRecordReport.h"
+#include "PerfShadowStack.h"
+#include "PerfLiveStats.h"
+
+class PerformanceRec;
 
 class ThreadRecord
 {
 public:
+	// One per open call, the calls' entry times live here rather than in the nodes
+	typedef struct EntryFrame_s
+	{
+		PerformanceRec*	pRecord;		// Node charged with the call
+		Node*			pReturn;		// Current node when the call was made
+		uint64_t		nEntryTime;
+		uint64_t		nChildTime;		// Closed calls made from this one
+		PerfID			id;				// ID entered, pRecord is [other] when the call was dropped
+		bool			bFolded;		// Folded into pRecord, which was already open
+	} EntryFrame;
+
 	ThreadRecord();
 	virtual ~ThreadRecord();
 	
+	bool		CreateArena(size_t nSize);
+	PerfArena*	GetArena();
+	// Arena room held back for [other] nodes the tree may still need
+	bool		ReserveArena(size_t nSize);
+	bool		ReleaseArena(size_t nSize);
+	size_t		GetArenaAvailable();
+	bool		OpenCounters(PerfCounterMode eMode);
+	PerfCounters*	GetCounters();
 	bool		SetRootNode(Node* pRoot);
 	Node* 		GetRootNode();
 	bool		SetCurrentNode(Node* pCurrent);
 	Node* 		GetCurrentNode();
 	pthread_t	GetThreadID();
+	const char*	GetThreadName();
+	bool		PushFrame(const EntryFrame& frame);
+	bool		PopFrame();
+	// 0 is the outermost call
+	EntryFrame*	GetFrame(size_t nFrame);
+	size_t		GetFrameDepth();
+	bool		AddNode();
+	uint32_t	GetNodeCount();
+	bool		AddDroppedCall();
+	uint64_t	GetDroppedCalls();
+	PerfMetricValue*	GetMetrics(bool bCreate);
+	static size_t		GetMetricsMemory();
+	PerfShadowStack*	GetShadowStack();
+	// Other threads walk every thread through here, see PerfMetrics.cpp
+	ThreadRecord*	GetNextThread();
+	// Indexed by PerfID, see PerfOptionLiveStats.  Created off the thread's
+	// hot path, by any thread.
+	bool			CreateLiveCounts();
+	PerfLiveCounts*	GetLiveCounts();
+	bool		SetNextThread(ThreadRecord* pNext);
+	// Held while the tree changes when reports can be dumped, see PerfOptionReportSignal
+	bool		LockTree();
+	bool		UnlockTree();
+	// Copy of the tree from the heap, for a report.  The tree must be locked.
+	ThreadRecord*	CopyTree();
 	
 	
 private:
+	PerfArena*	mpArena;
+	size_t		mArenaReserved;
+	PerfCounters*	mpCounters;
 	Node*		mTree;
 	Node*		mCurrentNode;
 	pthread_t	mThreadID;
+	char		mszThreadName[16];		// pthread names are limited to 16 bytes
+	vector<EntryFrame>	mFrames;
+	uint32_t	mNodeCount;
+	uint64_t	mDroppedCalls;
+	PerfMetricValue*	mpMetrics;		// This thread's counters and gauges, by metric index
+	PerfShadowStack*	mpShadowStack;	// Open scopes, for readers on other threads
+	ThreadRecord*	mpNextThread;
+	PerfLiveCounts*	mpLiveCounts;	// Written by this thread, read by the live stats thread
+	pthread_mutex_t	mTreeMutex;
 };
 
 #endif /*THREADRECORD_H_*/
@@ -0,0 +1,202 @@
+/*****************************************************************************
+MIT License
+
+Copyright (c) 2016 Douglas Adler
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*****************************************************************************/
+
+#include <string.h>
+#include <sched.h>
+#include <sys/mman.h>
+
+#include "AllocTable.h"
+
+#define ALLOC_TABLE_MIN_SLOTS		1024
+#define ALLOC_SLOT_EMPTY			((uintptr_t)0)
+#define ALLOC_SLOT_TOMBSTONE		((uintptr_t)1)
+// Grow (or just rehash away tombstones) past 3/4 full
+#define ALLOC_TABLE_FULL(s)			((s)->nFilled + 1 > (((s)->nMask + 1) / 4) * 3)
+
+AllocTable::AllocTable()
+{
+	memset(mShards, 0, sizeof(mShards));
+}
+
+AllocTable::~AllocTable()
+{
+	Clear();
+}
+
+// Fibonacci hash of the address, the low bits are always zero for aligned blocks
+uint64_t AllocTable::Hash(uintptr_t key)
+{
+	return ((uint64_t)key >> 4) * 0x9E3779B97F4A7C15ull;
+}
+void AllocTable::Lock(Shard* pShard)
+{
+	while(__sync_lock_test_and_set(&pShard->nLock, 1)) {
+		while(__atomic_load_n(&pShard->nLock, __ATOMIC_RELAXED)) {
+			sched_yield();
+		}
+	}
+}
+void AllocTable::Unlock(Shard* pShard)
+{
+	__sync_lock_release(&pShard->nLock);
+}
+
+// Rehash the live records into a table sized for them, called with the shard lock held
+bool AllocTable::Grow(Shard* pShard)
+{
+	uint32_t nSlots = ALLOC_TABLE_MIN_SLOTS;
+
+	while(nSlots / 2 <= pShard->nUsed) {
+		nSlots *= 2;
+	}
+	void* p = mmap(NULL, nSlots * sizeof(AllocRecord), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if(p == MAP_FAILED) {
+		return false;
+	}
+	AllocRecord*	pSlots	= (AllocRecord*)p;
+	uint32_t		nMask	= nSlots - 1;
+
+	for(uint32_t i = 0; pShard->pSlots != NULL && i <= pShard->nMask; i++) {
+		uintptr_t key = pShard->pSlots[i].GetID();
+		if(key == ALLOC_SLOT_EMPTY || key == ALLOC_SLOT_TOMBSTONE) {
+			continue;
+		}
+		uint32_t idx = (uint32_t)Hash(key) & nMask;
+		while(pSlots[idx].GetID() != ALLOC_SLOT_EMPTY) {
+			idx = (idx + 1) & nMask;
+		}
+		pSlots[idx] = pShard->pSlots[i];
+	}
+	if(pShard->pSlots != NULL) {
+		munmap(pShard->pSlots, (pShard->nMask + 1) * sizeof(AllocRecord));
+	}
+	pShard->pSlots	= pSlots;
+	pShard->nMask	= nMask;
+	pShard->nFilled	= pShard->nUsed;
+	return true;
+}
+
+bool AllocTable::Insert(const AllocRecord& rec, AllocRecord& rOld)
+{
+	uintptr_t	key		= ((AllocRecord&)rec).GetID();
+	uint64_t	nHash	= Hash(key);
+	Shard*		pShard	= &mShards[nHash >> (64 - ALLOC_TABLE_SHARD_BITS)];
+	bool		bFound	= false;
+
+	if(key == ALLOC_SLOT_EMPTY || key == ALLOC_SLOT_TOMBSTONE) {
+		return false;
+	}
+	Lock(pShard);
+	if(pShard->pSlots == NULL || ALLOC_TABLE_FULL(pShard)) {
+		if(!Grow(pShard)) {
+			Unlock(pShard);
+			return false;
+		}
+	}
+	uint32_t idx	= (uint32_t)nHash & pShard->nMask;
+	int64_t	 nFree	= -1;
+	for(;;) {
+		uintptr_t slotKey = pShard->pSlots[idx].GetID();
+		if(slotKey == key) {
+			rOld = pShard->pSlots[idx];
+			pShard->pSlots[idx] = rec;
+			bFound = true;
+			break;
+		}
+		if(slotKey == ALLOC_SLOT_TOMBSTONE && nFree < 0) {
+			nFree = idx;
+		}
+		else if(slotKey == ALLOC_SLOT_EMPTY) {
+			if(nFree < 0) {
+				nFree = idx;
+				pShard->nFilled++;
+			}
+			pShard->pSlots[nFree] = rec;
+			pShard->nUsed++;
+			break;
+		}
+		idx = (idx + 1) & pShard->nMask;
+	}
+	Unlock(pShard);
+	return bFound;
+}
+
+bool AllocTable::Remove(void* addr, AllocRecord& rRec)
+{
+	uintptr_t	key		= (uintptr_t)addr;
+	uint64_t	nHash	= Hash(key);
+	Shard*		pShard	= &mShards[nHash >> (64 - ALLOC_TABLE_SHARD_BITS)];
+	bool		bFound	= false;
+
+	if(key == ALLOC_SLOT_EMPTY || key == ALLOC_SLOT_TOMBSTONE) {
+		return false;
+	}
+	Lock(pShard);
+	if(pShard->pSlots != NULL) {
+		uint32_t idx = (uint32_t)nHash & pShard->nMask;
+		for(;;) {
+			uintptr_t slotKey = pShard->pSlots[idx].GetID();
+			if(slotKey == key) {
+				rRec = pShard->pSlots[idx];
+				pShard->pSlots[idx] = AllocRecord((void*)ALLOC_SLOT_TOMBSTONE, 0);
+				pShard->nUsed--;
+				bFound = true;
+				break;
+			}
+			if(slotKey == ALLOC_SLOT_EMPTY) {
+				break;
+			}
+			idx = (idx + 1) & pShard->nMask;
+		}
+	}
+	Unlock(pShard);
+	return bFound;
+}
+
+bool AllocTable::Clear()
+{
+	for(int i = 0; i < ALLOC_TABLE_SHARDS; i++) {
+		Shard* pShard = &mShards[i];
+		Lock(pShard);
+		if(pShard->pSlots != NULL) {
+			munmap(pShard->pSlots, (pShard->nMask + 1) * sizeof(AllocRecord));
+		}
+		pShard->pSlots	= NULL;
+		pShard->nMask	= 0;
+		pShard->nUsed	= 0;
+		pShard->nFilled	= 0;
+		Unlock(pShard);
+	}
+	return true;
+}
+
+uint64_t AllocTable::GetCount()
+{
+	uint64_t nCount = 0;
+
+	for(int i = 0; i < ALLOC_TABLE_SHARDS; i++) {
+		nCount += mShards[i].nUsed;
+	}
+	return nCount;
+}
@@ -0,0 +1,171 @@
+/*****************************************************************************
+MIT License
+
+Copyright (c) 2016 Douglas Adler
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*****************************************************************************/
+
+#include <string.h>
+
+#include <algorithm>
+
+#include "MergedRec.h"
+
+#define MAX_UINT32       0xFFFFFFFFul
+
+MergedRec::MergedRec(PerfID nID, PerfID nCatID)
+{
+	mID				= nID;
+	mCatID			= nCatID;
+	mTotalCalls		= 0;
+	mTotalTime		= 0;
+	mTotalSelf		= 0;
+	mMinTime		= MAX_UINT32;
+	mMaxTime		= 0;
+	mStartTime		= 0;
+	mEndTime		= 0;
+	mbSorted		= true;
+	SetNodeType(MergedRecord);
+}
+
+MergedRec::~MergedRec()
+{
+}
+
+PerfID MergedRec::GetID()
+{
+	return mID;
+}
+PerfID MergedRec::GetCatID()
+{
+	return mCatID;
+}
+MergedRec* MergedRec::GetChild(PerfID nID, PerfID nCatID)
+{
+	NodeList::iterator 	iter	= GetSiblingIterator();
+	MergedRec*				pChild	= NULL;
+
+	while(IsSiblingEnd(iter) == false) {
+		pChild = (MergedRec*)*iter;
+		if(pChild->GetID() == nID) {
+			return pChild;
+		}
+		iter++;
+	}
+	pChild = new MergedRec(nID, nCatID);
+	pChild->SetParent(this);
+	AddSibling(pChild);
+	return pChild;
+}
+
+bool MergedRec::Merge(PerformanceRec* pRec)
+{
+	PerfRecordReport report;
+
+	if(pRec->GetReport(&report) == false) {
+		return false;
+	}
+	mTotalCalls		+= report.nTotalCalls;
+	mTotalTime		+= report.nTotalTime;
+	mTotalSelf		+= report.nTotalSelf;
+	if(report.nMinTime < mMinTime) {
+		mMinTime = report.nMinTime;
+	}
+	if(report.nMaxTime > mMaxTime) {
+		mMaxTime = report.nMaxTime;
+	}
+	if(mStartTime == 0 || report.nStartTime < mStartTime) {
+		mStartTime = report.nStartTime;
+	}
+	if(report.nEndTime > mEndTime) {
+		mEndTime = report.nEndTime;
+	}
+	mThreadTotals.push_back(report.nTotalTime);
+	mbSorted = false;
+	return true;
+}
+bool MergedRec::Merge(MergedRec* pRec)
+{
+	mTotalCalls		+= pRec->mTotalCalls;
+	mTotalTime		+= pRec->mTotalTime;
+	mTotalSelf		+= pRec->mTotalSelf;
+	if(pRec->mMinTime < mMinTime) {
+		mMinTime = pRec->mMinTime;
+	}
+	if(pRec->mMaxTime > mMaxTime) {
+		mMaxTime = pRec->mMaxTime;
+	}
+	if(mStartTime == 0 || pRec->mStartTime < mStartTime) {
+		mStartTime = pRec->mStartTime;
+	}
+	if(pRec->mEndTime > mEndTime) {
+		mEndTime = pRec->mEndTime;
+	}
+	mThreadTotals.insert(mThreadTotals.end(), pRec->mThreadTotals.begin(), pRec->mThreadTotals.end());
+	mbSorted = false;
+	return true;
+}
+// Used for the roots, which carry the per thread totals but no calls
+bool MergedRec::AddThreadTotal(uint64_t nTotal)
+{
+	mTotalTime += nTotal;
+	mThreadTotals.push_back(nTotal);
+	mbSorted = false;
+	return true;
+}
+bool MergedRec::GetReport(PerfRecordReport* report)
+{
+	memset(report, 0, sizeof(PerfRecordReport));
+	if(mTotalCalls == 0) {
+		return false;
+	}
+	report->nStartTime 		= mStartTime;
+	report->nEndTime		= mEndTime;
+	report->nTotalCalls		= mTotalCalls;
+	report->nTotalTime		= mTotalTime;
+	report->nTotalSelf		= mTotalSelf;
+	report->nMinTime		= mMinTime;
+	report->nMaxTime		= mMaxTime;
+	return true;
+}
+uint64_t MergedRec::GetTotalTime()
+{
+	return mTotalTime;
+}
+uint32_t MergedRec::GetThreadCount()
+{
+	return mThreadTotals.size();
+}
+// Nearest rank percentile of the per thread inclusive time on this path
+uint64_t MergedRec::GetThreadPercentile(uint32_t nPercent)
+{
+	if(mThreadTotals.empty()) {
+		return 0;
+	}
+	if(mbSorted == false) {
+		std::sort(mThreadTotals.begin(), mThreadTotals.end());
+		mbSorted = true;
+	}
+	size_t nRank = (mThreadTotals.size() * nPercent + 99) / 100;
+	if(nRank == 0) {
+		nRank = 1;
+	}
+	return mThreadTotals[nRank - 1];
+}
@@ -27,7 +27,8 @@ SOFTWARE.
 #include "Node.h"
 
 
-Node::Node()
+Node::Node(PerfArena* pArena)
+: mSiblingList(PerfArenaAllocator<Node*>(pArena))
 {
 	mType	= UnknownType;
 	mParent = NULL;
@@ -35,6 +36,14 @@ Node::Node()
 	return;
 }
 
+Node::Node(const Node& node)
+: mSiblingList(PerfArenaAllocator<Node*>(NULL))
+{
+	mType	= node.mType;
+	mParent = NULL;
+	return;
+}
+
 Node::~Node()
 {
 	Node* pNode = NULL;
@@ -67,7 +76,7 @@ bool Node::AddSibling(Node* pNode)
 }
 Node* Node::GetNextSibling(Node* pCurrentSibling)
 {
-	list<Node*>::iterator iter = mSiblingList.begin();
+	NodeList::iterator iter = mSiblingList.begin();
 	
 	if(pCurrentSibling == NULL) {
 		return mSiblingList.front();
@@ -91,12 +100,12 @@ Node* Node::GetNextSibling(Node* pCurrentSibling)
 		return *(iter);
 	}
 }
-list<Node*>::iterator Node::GetSiblingIterator()
+NodeList::iterator Node::GetSiblingIterator()
 {
 	return mSiblingList.begin();
 }
 
-bool Node::IsSiblingEnd(list<Node*>::iterator iter)
+bool Node::IsSiblingEnd(NodeList::iterator iter)
 {
 	if(iter == mSiblingList.end()) {
 		return true;
@@ -0,0 +1,216 @@
+/*****************************************************************************
+MIT License
+
+Copyright (c) 2016 Douglas Adler
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*****************************************************************************/
+
+//
+// Automatic allocation tracking.  Routes malloc, calloc, realloc, free and the
+// global operator new/delete into PerfAlloc/PerfFree so allocation sites don't
+// need PERF_ALLOC/PERF_FREE.  This file is only built into the alloc variants
+// of the library, which are compiled with PERFORMANCE_MEMORY.
+//
+// libperfmetrics_alloc.a (PERF_ALLOC_WRAP) provides __wrap_malloc etc. for
+// linking with
+//     -Wl,--wrap=malloc,--wrap=free,--wrap=calloc,--wrap=realloc
+// libperfmetrics_alloc.so defines malloc etc. itself and calls the glibc
+// __libc_ versions, so it works when linked or preloaded ahead of libc.
+//
+
+#include <stdlib.h>
+#include <limits.h>
+
+#include <new>
+
+#include "PerfMetrics.h"
+
+#ifdef FEATURE_PERFORMANCE_PROFILING
+
+#ifdef PERF_ALLOC_WRAP
+extern "C" void*	__real_malloc(size_t nSize);
+extern "C" void*	__real_calloc(size_t nCount, size_t nSize);
+extern "C" void*	__real_realloc(void* p, size_t nSize);
+extern "C" void		__real_free(void* p);
+
+#define REAL_MALLOC(n)			__real_malloc(n)
+#define REAL_CALLOC(c, n)		__real_calloc(c, n)
+#define REAL_REALLOC(p, n)		__real_realloc(p, n)
+#define REAL_FREE(p)			__real_free(p)
+#define HOOK_MALLOC				__wrap_malloc
+#define HOOK_CALLOC				__wrap_calloc
+#define HOOK_REALLOC			__wrap_realloc
+#define HOOK_FREE				__wrap_free
+#else
+extern "C" void*	__libc_malloc(size_t nSize);
+extern "C" void*	__libc_calloc(size_t nCount, size_t nSize);
+extern "C" void*	__libc_realloc(void* p, size_t nSize);
+extern "C" void		__libc_free(void* p);
+
+#define REAL_MALLOC(n)			__libc_malloc(n)
+#define REAL_CALLOC(c, n)		__libc_calloc(c, n)
+#define REAL_REALLOC(p, n)		__libc_realloc(p, n)
+#define REAL_FREE(p)			__libc_free(p)
+#define HOOK_MALLOC				malloc
+#define HOOK_CALLOC				calloc
+#define HOOK_REALLOC			realloc
+#define HOOK_FREE				free
+#endif
+
+// PerfMetrics.cpp, set with PerfOptionAllocSampleRate
+extern unsigned long gnAllocSampleRate;
+extern bool PerfAllocSampled(void* addr, size_t size, uint64_t nBytes, uint32_t nCount);
+
+// Set while the tracker runs so anything it allocates isn't tracked again.
+// initial-exec so touching it never allocates, even from a preloaded library.
+static __thread int		tlsInHook			__attribute__((tls_model("initial-exec")))	= 0;
+static __thread long	tlsBytesToSample	__attribute__((tls_model("initial-exec")))	= 0;
+
+// With a sample rate of N, track the allocation that takes each thread past
+// every N bytes allocated.  Big allocations are always tracked.
+static inline bool SampleAlloc(size_t nSize, unsigned long nRate)
+{
+	if(nRate == 0) {
+		return true;
+	}
+	tlsBytesToSample -= (long)nSize;
+	if(tlsBytesToSample > 0) {
+		return false;
+	}
+	tlsBytesToSample += nRate;
+	if(tlsBytesToSample <= 0) {
+		tlsBytesToSample = nRate;
+	}
+	return true;
+}
+// An allocation smaller than the rate is tracked about nSize / N of the time,
+// so it's counted as N / nSize allocations and N bytes.  The totals are then
+// estimates of all the allocations rather than a sum of the sampled ones.
+static inline void TrackAlloc(void* p, size_t nSize)
+{
+	unsigned long	nRate	= gnAllocSampleRate;
+	uint64_t		nBytes	= nSize;
+	uint32_t		nCount	= 1;
+
+	if(p == NULL || tlsInHook != 0 || nSize > INT_MAX || SampleAlloc(nSize, nRate) == false) {
+		return;
+	}
+	if(nRate > nSize) {
+		nBytes = nRate;
+		nCount = (nSize > 0) ? (uint32_t)(nRate / nSize) : 1;
+	}
+	tlsInHook = 1;
+	PerfAllocSampled(p, nSize, nBytes, nCount);
+	tlsInHook = 0;
+}
+static inline void TrackFree(void* p)
+{
+	if(p == NULL || tlsInHook != 0) {
+		return;
+	}
+	tlsInHook = 1;
+	PerfMetrics::PerfFree(p);
+	tlsInHook = 0;
+}
+
+extern "C" void* HOOK_MALLOC(size_t nSize)
+{
+	void* p = REAL_MALLOC(nSize);
+	TrackAlloc(p, nSize);
+	return p;
+}
+extern "C" void* HOOK_CALLOC(size_t nCount, size_t nSize)
+{
+	void* p = REAL_CALLOC(nCount, nSize);
+	TrackAlloc(p, nCount * nSize);
+	return p;
+}
+extern "C" void* HOOK_REALLOC(void* pOld, size_t nSize)
+{
+	void* p = REAL_REALLOC(pOld, nSize);
+	if(p != NULL || nSize == 0) {
+		// The old block is gone either way
+		TrackFree(pOld);
+	}
+	TrackAlloc(p, nSize);
+	return p;
+}
+extern "C" void HOOK_FREE(void* p)
+{
+	TrackFree(p);
+	REAL_FREE(p);
+}
+
+//
+// operator new/delete go through the hooked malloc/free.  The wrapped build
+// needs these as well because --wrap doesn't reach the malloc calls made
+// inside libstdc++.
+//
+static inline void* NewAlloc(size_t nSize)
+{
+	void* p = HOOK_MALLOC(nSize == 0 ? 1 : nSize);
+	if(p == NULL) {
+		throw std::bad_alloc();
+	}
+	return p;
+}
+
+void* operator new(size_t nSize)
+{
+	return NewAlloc(nSize);
+}
+void* operator new[](size_t nSize)
+{
+	return NewAlloc(nSize);
+}
+void* operator new(size_t nSize, const std::nothrow_t&) noexcept
+{
+	return HOOK_MALLOC(nSize == 0 ? 1 : nSize);
+}
+void* operator new[](size_t nSize, const std::nothrow_t&) noexcept
+{
+	return HOOK_MALLOC(nSize == 0 ? 1 : nSize);
+}
+void operator delete(void* p) noexcept
+{
+	HOOK_FREE(p);
+}
+void operator delete[](void* p) noexcept
+{
+	HOOK_FREE(p);
+}
+void operator delete(void* p, const std::nothrow_t&) noexcept
+{
+	HOOK_FREE(p);
+}
+void operator delete[](void* p, const std::nothrow_t&) noexcept
+{
+	HOOK_FREE(p);
+}
+void operator delete(void* p, size_t) noexcept
+{
+	HOOK_FREE(p);
+}
+void operator delete[](void* p, size_t) noexcept
+{
+	HOOK_FREE(p);
+}
+
+#endif // FEATURE_PERFORMANCE_PROFILING
@@ -0,0 +1,130 @@
+/*****************************************************************************
+MIT License
+
+Copyright (c) 2016 Douglas Adler
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*****************************************************************************/
+
+#include <string.h>
+#include <sys/mman.h>
+
+#include <new>
+
+#include "PerfArena.h"
+
+#define ARENA_ALIGN			16
+#define ARENA_TAG_SIZE		ARENA_ALIGN
+#define ARENA_TAG_HEAP		0x48454150ul		// "HEAP"
+#define ARENA_TAG_ARENA		0x4152454Eul		// "AREN"
+
+#define ALIGN_UP(n)			(((n) + (ARENA_ALIGN - 1)) & ~((size_t)ARENA_ALIGN - 1))
+
+PerfArena::PerfArena()
+{
+	mpBase	= NULL;
+	mSize	= 0;
+	mUsed	= 0;
+}
+
+PerfArena::~PerfArena()
+{
+	Free();
+}
+
+bool PerfArena::Init(size_t nSize)
+{
+	Free();
+	nSize = ALIGN_UP(nSize);
+	void* p = mmap(NULL, nSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+	if(p == MAP_FAILED) {
+		return false;
+	}
+	// MAP_POPULATE is only a hint, touch the pages so the hot path never faults
+	memset(p, 0, nSize);
+	mpBase	= (char*)p;
+	mSize	= nSize;
+	mUsed	= 0;
+	return true;
+}
+bool PerfArena::Free()
+{
+	if(mpBase != NULL) {
+		munmap(mpBase, mSize);
+	}
+	mpBase	= NULL;
+	mSize	= 0;
+	mUsed	= 0;
+	return true;
+}
+void* PerfArena::Alloc(size_t nSize)
+{
+	nSize = ALIGN_UP(nSize);
+	if(mpBase == NULL || nSize > mSize - mUsed) {
+		return NULL;
+	}
+	void* p = mpBase + mUsed;
+	mUsed += nSize;
+	return p;
+}
+bool PerfArena::Owns(const void* p) const
+{
+	return (const char*)p >= mpBase && (const char*)p < mpBase + mSize;
+}
+size_t PerfArena::GetSize() const
+{
+	return mSize;
+}
+size_t PerfArena::GetUsed() const
+{
+	return mUsed;
+}
+size_t PerfArena::GetAvailable() const
+{
+	return mSize - mUsed;
+}
+
+void* PerfArena::Allocate(size_t nSize, PerfArena* pArena)
+{
+	char* p = (pArena != NULL) ? (char*)pArena->Alloc(nSize + ARENA_TAG_SIZE) : NULL;
+
+	if(p != NULL) {
+		*(uint32_t*)p = ARENA_TAG_ARENA;
+	}
+	else {
+		p = (char*)::operator new(nSize + ARENA_TAG_SIZE);
+		*(uint32_t*)p = ARENA_TAG_HEAP;
+	}
+	return p + ARENA_TAG_SIZE;
+}
+void PerfArena::Release(void* p)
+{
+	if(p == NULL) {
+		return;
+	}
+	char* pBase = (char*)p - ARENA_TAG_SIZE;
+	if(*(uint32_t*)pBase == ARENA_TAG_HEAP) {
+		::operator delete(pBase);
+	}
+}
+// Arena bytes used by an Allocate() of nSize
+size_t PerfArena::AllocationSize(size_t nSize)
+{
+	return ALIGN_UP(nSize + ARENA_TAG_SIZE);
+}
@@ -0,0 +1,171 @@
+/*****************************************************************************
+MIT License
+
+Copyright (c) 2016 Douglas Adler
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*****************************************************************************/
+
+#include <string.h>
+#include <time.h>
+#include <math.h>
+
+#include <algorithm>
+
+#include "PerfBenchRunner.h"
+
+using namespace std;
+
+PerfBenchRunner::PerfBenchRunner(const char * szName, const char * szCategory, PerfBenchFunction pfnBench, void* pContext)
+{
+	mszName		= szName;
+	mszCategory	= szCategory;
+	mpfnBench	= pfnBench;
+	mpContext	= pContext;
+	mnIterations	= 1;
+}
+
+PerfBenchRunner::~PerfBenchRunner()
+{
+}
+
+uint64_t PerfBenchRunner::GetTime()
+{
+	struct timespec	now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+uint64_t PerfBenchRunner::RunBatch(uint64_t nIterations)
+{
+	uint64_t	nStart	= GetTime();
+
+	for(uint64_t idx = 0; idx < nIterations; idx++) {
+		mpfnBench(mpContext);
+	}
+	return GetTime() - nStart;
+}
+
+void PerfBenchRunner::Calibrate(uint64_t nWarmupTime)
+{
+	uint64_t	nStart	= GetTime();
+
+	mnIterations = 1;
+	while(RunBatch(mnIterations) < PERF_BENCH_MIN_SAMPLE_TIME && mnIterations < (1ULL << 40)) {
+		mnIterations *= 2;
+	}
+	while(GetTime() - nStart < nWarmupTime) {
+		RunBatch(mnIterations);
+	}
+	return;
+}
+
+bool PerfBenchRunner::Run(uint64_t nWarmupTime, uint64_t nTargetTime)
+{
+	if(mpfnBench == NULL) {
+		return false;
+	}
+	Calibrate(nWarmupTime);
+
+	uint64_t	nStart	= GetTime();
+
+	mSamples.clear();
+	while(mSamples.size() < PERF_BENCH_MAX_SAMPLES) {
+		if(PerfMetrics::PerfEntry(mszName, mszCategory) == false) {
+			return false;
+		}
+		uint64_t nTime = RunBatch(mnIterations);
+		PerfMetrics::PerfAddWork(mnIterations);
+		PerfMetrics::PerfExit(mszName, mszCategory);
+		mSamples.push_back((double)nTime / mnIterations);
+		if(mSamples.size() >= PERF_BENCH_MIN_SAMPLES && GetTime() - nStart >= nTargetTime) {
+			break;
+		}
+	}
+	return true;
+}
+
+// Linear between the closest ranks
+double PerfBenchRunner::GetQuantile(vector<double>& sorted, double nQuantile)
+{
+	double	nPos	= nQuantile * (sorted.size() - 1);
+	size_t	nLow	= (size_t)nPos;
+
+	if(nLow + 1 >= sorted.size()) {
+		return sorted.back();
+	}
+	return sorted[nLow] + (sorted[nLow + 1] - sorted[nLow]) * (nPos - nLow);
+}
+
+void PerfBenchRunner::GetResult(PerfBenchResult* pResult)
+{
+	memset(pResult, 0, sizeof(PerfBenchResult));
+	if(mSamples.empty()) {
+		return;
+	}
+	vector<double>	sorted(mSamples);
+	vector<double>	deviations;
+	uint32_t		nSamples	= sorted.size();
+	double			nSum		= 0.0;
+	double			nSquares	= 0.0;
+
+	sort(sorted.begin(), sorted.end());
+	pResult->nSamples		= nSamples;
+	pResult->nIterations	= mnIterations;
+	pResult->nMedian		= GetQuantile(sorted, 0.5);
+	pResult->nMin			= sorted.front();
+	pResult->nMax			= sorted.back();
+	for(uint32_t idx = 0; idx < nSamples; idx++) {
+		nSum += sorted[idx];
+		deviations.push_back(fabs(sorted[idx] - pResult->nMedian));
+	}
+	pResult->nMean = nSum / nSamples;
+	for(uint32_t idx = 0; idx < nSamples; idx++) {
+		nSquares += (sorted[idx] - pResult->nMean) * (sorted[idx] - pResult->nMean);
+	}
+	pResult->nStdDev = nSamples > 1 ? sqrt(nSquares / (nSamples - 1)) : 0.0;
+	sort(deviations.begin(), deviations.end());
+	pResult->nMAD = GetQuantile(deviations, 0.5);
+
+	// Distribution free, the ranks n/2 -+ 1.96 sqrt(n)/2 around the median
+	double	nSpread	= 1.96 * sqrt((double)nSamples) / 2.0;
+	long	nLow	= lround(nSamples / 2.0 - nSpread);
+	long	nHigh	= lround(1.0 + nSamples / 2.0 + nSpread);
+
+	nLow	= max(nLow, 1L);
+	nHigh	= min(nHigh, (long)nSamples);
+	pResult->nCILow		= sorted[nLow - 1];
+	pResult->nCIHigh	= sorted[nHigh - 1];
+
+	// Tukey's fences
+	double	nQ1		= GetQuantile(sorted, 0.25);
+	double	nQ3		= GetQuantile(sorted, 0.75);
+	double	nFence	= 1.5 * (nQ3 - nQ1);
+
+	for(uint32_t idx = 0; idx < nSamples; idx++) {
+		if(sorted[idx] < nQ1 - nFence) {
+			pResult->nLowOutliers++;
+		}
+		else if(sorted[idx] > nQ3 + nFence) {
+			pResult->nHighOutliers++;
+		}
+	}
+	return;
+}
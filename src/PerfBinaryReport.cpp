@@ -0,0 +1,188 @@
+/*****************************************************************************
+MIT License
+
+Copyright (c) 2016 Douglas Adler
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*****************************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "PerfBinaryReport.h"
+
+PerfBinaryReport::PerfBinaryReport()
+{
+	mpHeader	= NULL;
+	mpData		= NULL;
+	mnDataSize	= 0;
+	mnOffset	= 0;
+	mnMapSize	= 0;
+}
+
+PerfBinaryReport::~PerfBinaryReport()
+{
+	Close();
+}
+
+uint64_t PerfBinaryReport::GetChecksum(const uint8_t* pData, size_t nSize)
+{
+	uint64_t nHash = 0xcbf29ce484222325ULL;
+
+	for(size_t idx = 0; idx < nSize; idx++) {
+		nHash ^= pData[idx];
+		nHash *= 0x100000001b3ULL;
+	}
+	return nHash;
+}
+void PerfBinaryReport::PutVarint(uint64_t nValue)
+{
+	while(nValue >= 0x80) {
+		mBody.push_back((char)((nValue & 0x7f) | 0x80));
+		nValue >>= 7;
+	}
+	mBody.push_back((char)nValue);
+}
+void PerfBinaryReport::PutSigned(int64_t nValue)
+{
+	PutVarint(((uint64_t)nValue << 1) ^ (uint64_t)(nValue >> 63));
+}
+void PerfBinaryReport::PutString(const char* szValue)
+{
+	size_t nLength = strlen(szValue);
+
+	PutVarint(nLength);
+	mBody.append(szValue, nLength);
+}
+// The header goes in front of the body, so the file is a single write
+bool PerfBinaryReport::Write(FILE* fp, uint64_t nStartTime, uint64_t nEndTime)
+{
+	PerfBinaryHeader	header;
+	std::string			file;
+
+	memset(&header, 0, sizeof(header));
+	header.nMagic		= PERF_BINARY_MAGIC;
+	header.nVersion		= PERF_BINARY_VERSION;
+	header.nHeaderSize	= sizeof(PerfBinaryHeader);
+	header.nBodySize	= mBody.size();
+	header.nChecksum	= GetChecksum((const uint8_t*)mBody.data(), mBody.size());
+	header.nStartTime	= nStartTime;
+	header.nEndTime		= nEndTime;
+	header.nPid			= getpid();
+	file.reserve(sizeof(header) + mBody.size());
+	file.append((const char*)&header, sizeof(header));
+	file.append(mBody);
+	mBody.clear();
+	return fwrite(file.data(), 1, file.size(), fp) == file.size();
+}
+bool PerfBinaryReport::Open(const char* szFile)
+{
+	struct stat	info;
+
+	if(mpHeader != NULL) {
+		return false;
+	}
+	int fd = open(szFile, O_RDONLY | O_CLOEXEC);
+	if(fd < 0) {
+		return false;
+	}
+	if(fstat(fd, &info) != 0 || (size_t)info.st_size < sizeof(PerfBinaryHeader)) {
+		close(fd);
+		return false;
+	}
+	void* p = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if(p == MAP_FAILED) {
+		return false;
+	}
+	mpHeader	= (PerfBinaryHeader*)p;
+	mnMapSize	= info.st_size;
+	if(mpHeader->nMagic != PERF_BINARY_MAGIC || mpHeader->nVersion != PERF_BINARY_VERSION ||
+	   mpHeader->nHeaderSize < sizeof(PerfBinaryHeader) || mpHeader->nHeaderSize > mnMapSize ||
+	   mpHeader->nBodySize != mnMapSize - mpHeader->nHeaderSize) {
+		Close();
+		return false;
+	}
+	mpData		= (const uint8_t*)p + mpHeader->nHeaderSize;
+	mnDataSize	= mpHeader->nBodySize;
+	mnOffset	= 0;
+	if(GetChecksum(mpData, mnDataSize) != mpHeader->nChecksum) {
+		Close();
+		return false;
+	}
+	return true;
+}
+PerfBinaryHeader* PerfBinaryReport::GetHeader()
+{
+	return mpHeader;
+}
+bool PerfBinaryReport::GetVarint(uint64_t* pnValue)
+{
+	uint64_t	nValue	= 0;
+	uint32_t	nShift	= 0;
+
+	while(mnOffset < mnDataSize && nShift < 64) {
+		uint8_t nByte = mpData[mnOffset++];
+		nValue |= (uint64_t)(nByte & 0x7f) << nShift;
+		if((nByte & 0x80) == 0) {
+			*pnValue = nValue;
+			return true;
+		}
+		nShift += 7;
+	}
+	return false;
+}
+bool PerfBinaryReport::GetSigned(int64_t* pnValue)
+{
+	uint64_t nValue = 0;
+
+	if(GetVarint(&nValue) == false) {
+		return false;
+	}
+	*pnValue = (int64_t)(nValue >> 1) ^ -(int64_t)(nValue & 1);
+	return true;
+}
+bool PerfBinaryReport::GetString(std::string* pValue)
+{
+	uint64_t nLength = 0;
+
+	if(GetVarint(&nLength) == false || nLength > mnDataSize - mnOffset) {
+		return false;
+	}
+	pValue->assign((const char*)mpData + mnOffset, nLength);
+	mnOffset += nLength;
+	return true;
+}
+bool PerfBinaryReport::Close()
+{
+	if(mpHeader == NULL) {
+		return false;
+	}
+	munmap(mpHeader, mnMapSize);
+	mpHeader	= NULL;
+	mpData		= NULL;
+	mnDataSize	= 0;
+	mnOffset	= 0;
+	mnMapSize	= 0;
+	return true;
+}
@@ -0,0 +1,147 @@
+/*****************************************************************************
+MIT License
+
+Copyright (c) 2016 Douglas Adler
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*****************************************************************************/
+
+//
+// make check.  Numbers and strings written with PerfBinaryReport must read
+// back the same, the varint edges and zigzag signed values included.  Then a
+// changed body byte must fail the checksum in Open, and reading past the
+// end of the body must return false.
+//
+
+#include <stdio.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include <string>
+
+#include "PerfBinaryReport.h"
+
+static const uint64_t gnVarints[]	= { 0, 1, 127, 128, 16383, 16384, 0xFFFFFFFFULL, 0x100000000ULL, UINT64_MAX };
+static const int64_t  gnSigned[]	= { 0, -1, 1, -64, 64, -65, INT32_MIN, INT32_MAX, INT64_MIN, INT64_MAX };
+static const char*    gszStrings[]	= { "", "a", "PERF_FUNC", "Name;with <xml> & 'quotes'" };
+
+#define TEST_COUNT(a)		(sizeof(a) / sizeof(a[0]))
+
+static bool WriteFile(const char* szFile)
+{
+	PerfBinaryReport	binary;
+
+	for(size_t idx = 0; idx < TEST_COUNT(gnVarints); idx++) {
+		binary.PutVarint(gnVarints[idx]);
+	}
+	for(size_t idx = 0; idx < TEST_COUNT(gnSigned); idx++) {
+		binary.PutSigned(gnSigned[idx]);
+	}
+	for(size_t idx = 0; idx < TEST_COUNT(gszStrings); idx++) {
+		binary.PutString(gszStrings[idx]);
+	}
+	FILE* fp = fopen(szFile, "w");
+	if(fp == NULL) {
+		return false;
+	}
+	bool bWritten = binary.Write(fp, 1, 2);
+	return fclose(fp) == 0 && bWritten;
+}
+
+static bool ReadFile(const char* szFile)
+{
+	PerfBinaryReport	binary;
+	uint64_t			nValue	= 0;
+	int64_t				nSigned	= 0;
+	std::string			value;
+
+	if(binary.Open(szFile) == false) {
+		printf("Open failed on a good file\n");
+		return false;
+	}
+	if(binary.GetHeader()->nStartTime != 1 || binary.GetHeader()->nEndTime != 2) {
+		printf("Header times don't match\n");
+		return false;
+	}
+	for(size_t idx = 0; idx < TEST_COUNT(gnVarints); idx++) {
+		if(binary.GetVarint(&nValue) == false || nValue != gnVarints[idx]) {
+			printf("Varint %lu read back as %lu\n", (unsigned long)gnVarints[idx], (unsigned long)nValue);
+			return false;
+		}
+	}
+	for(size_t idx = 0; idx < TEST_COUNT(gnSigned); idx++) {
+		if(binary.GetSigned(&nSigned) == false || nSigned != gnSigned[idx]) {
+			printf("Signed %ld read back as %ld\n", (long)gnSigned[idx], (long)nSigned);
+			return false;
+		}
+	}
+	for(size_t idx = 0; idx < TEST_COUNT(gszStrings); idx++) {
+		if(binary.GetString(&value) == false || value != gszStrings[idx]) {
+			printf("String '%s' read back as '%s'\n", gszStrings[idx], value.c_str());
+			return false;
+		}
+	}
+	if(binary.GetVarint(&nValue) == true || binary.GetString(&value) == true) {
+		printf("Read past the end of the body\n");
+		return false;
+	}
+	binary.Close();
+	return true;
+}
+
+// Flip one byte in the body, Open must see the checksum doesn't match
+static bool CorruptFile(const char* szFile)
+{
+	PerfBinaryReport	binary;
+	uint8_t				nByte	= 0;
+
+	FILE* fp = fopen(szFile, "r+");
+	if(fp == NULL) {
+		return false;
+	}
+	if(fseek(fp, sizeof(PerfBinaryHeader) + 5, SEEK_SET) != 0 || fread(&nByte, 1, 1, fp) != 1) {
+		fclose(fp);
+		return false;
+	}
+	nByte ^= 0x01;
+	fseek(fp, sizeof(PerfBinaryHeader) + 5, SEEK_SET);
+	fwrite(&nByte, 1, 1, fp);
+	fclose(fp);
+	if(binary.Open(szFile) == true) {
+		printf("Open took a file with a changed body\n");
+		binary.Close();
+		return false;
+	}
+	return true;
+}
+
+int main(int argc, char** argv)
+{
+	char	szFile[128];
+
+	snprintf(szFile, sizeof(szFile), "/tmp/perfmetrics-binary-test.%d.bin", (int)getpid());
+	if(WriteFile(szFile) == false) {
+		printf("Can't write %s\n", szFile);
+		return 1;
+	}
+	bool bPassed = ReadFile(szFile) && CorruptFile(szFile);
+	unlink(szFile);
+	printf("Binary report round trip: %s\n", bPassed ? "passed" : "failed");
+	return bPassed ? 0 : 1;
+}
@@ -0,0 +1,91 @@
+/*****************************************************************************
+MIT License
+
+Copyright (c) 2016 Douglas Adler
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*****************************************************************************/
+
+#include "PerfBudget.h"
+
+PerfBudgetQueue::PerfBudgetQueue()
+{
+	Clear();
+}
+
+PerfBudgetQueue::~PerfBudgetQueue()
+{
+}
+
+// Each slot's sequence says whose turn it is, a producer claims a slot by
+// moving mnEnqueue on and publishes it by moving the sequence on
+bool PerfBudgetQueue::Push(const PerfBudgetEvent& event)
+{
+	uint64_t	nPos	= __atomic_load_n(&mnEnqueue, __ATOMIC_RELAXED);
+	Slot*		pSlot	= NULL;
+
+	while(true) {
+		pSlot = &mSlots[nPos & (PERF_BUDGET_QUEUE_SIZE - 1)];
+		int64_t nDiff = (int64_t)__atomic_load_n(&pSlot->nSequence, __ATOMIC_ACQUIRE) - (int64_t)nPos;
+		if(nDiff == 0) {
+			if(__sync_bool_compare_and_swap(&mnEnqueue, nPos, nPos + 1)) {
+				break;
+			}
+			nPos = __atomic_load_n(&mnEnqueue, __ATOMIC_RELAXED);
+		}
+		else if(nDiff < 0) {
+			// Full
+			__sync_fetch_and_add(&mnDropped, 1);
+			return false;
+		}
+		else {
+			nPos = __atomic_load_n(&mnEnqueue, __ATOMIC_RELAXED);
+		}
+	}
+	pSlot->event = event;
+	__atomic_store_n(&pSlot->nSequence, nPos + 1, __ATOMIC_RELEASE);
+	return true;
+}
+bool PerfBudgetQueue::Pop(PerfBudgetEvent& event)
+{
+	Slot* pSlot = &mSlots[mnDequeue & (PERF_BUDGET_QUEUE_SIZE - 1)];
+
+	if(__atomic_load_n(&pSlot->nSequence, __ATOMIC_ACQUIRE) != mnDequeue + 1) {
+		return false;
+	}
+	event = pSlot->event;
+	__atomic_store_n(&pSlot->nSequence, mnDequeue + PERF_BUDGET_QUEUE_SIZE, __ATOMIC_RELEASE);
+	mnDequeue++;
+	return true;
+}
+uint64_t PerfBudgetQueue::GetDropped()
+{
+	return __atomic_load_n(&mnDropped, __ATOMIC_RELAXED);
+}
+// Only when nothing is pushing or popping
+bool PerfBudgetQueue::Clear()
+{
+	for(uint64_t idx = 0; idx < PERF_BUDGET_QUEUE_SIZE; idx++) {
+		mSlots[idx].nSequence = idx;
+	}
+	mnEnqueue	= 0;
+	mnDequeue	= 0;
+	mnDropped	= 0;
+	return true;
+}
@@ -0,0 +1,232 @@
+/*****************************************************************************
+MIT License
+
+Copyright (c) 2016 Douglas Adler
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*****************************************************************************/
+
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/ioctl.h>
+#include <linux/perf_event.h>
+
+#include "PerfCounters.h"
+
+typedef struct {
+	uint32_t	nType;
+	uint64_t	nConfig;
+	const char*	szName;
+} PerfCounterEvent;
+
+static const PerfCounterEvent gHardwareEvents[PERF_MAX_COUNTERS] = {
+	{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES,			"Cycles" },
+	{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS,		"Instructions" },
+	{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES,		"CacheMisses" },
+	{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES,		"BranchMisses" }
+};
+static const PerfCounterEvent gSoftwareEvents[] = {
+	{ PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK,			"TaskClockNs" },
+	{ PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS,		"PageFaults" },
+	{ PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES,	"ContextSwitches" }
+};
+
+static int OpenEvent(const PerfCounterEvent* pEvent, int nGroupFD)
+{
+	struct perf_event_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.size			= sizeof(attr);
+	attr.type			= pEvent->nType;
+	attr.config			= pEvent->nConfig;
+	attr.exclude_kernel	= 1;
+	attr.exclude_hv		= 1;
+	attr.read_format	= PERF_FORMAT_GROUP;
+	attr.disabled		= (nGroupFD == -1) ? 1 : 0;
+	// This thread only, on any CPU
+	if(pEvent->nType == PERF_TYPE_SOFTWARE) {
+		// Context switches happen in the kernel, count them there if we're allowed
+		attr.exclude_kernel = 0;
+		int nFD = (int)syscall(__NR_perf_event_open, &attr, 0, -1, nGroupFD, 0);
+		if(nFD >= 0) {
+			return nFD;
+		}
+		attr.exclude_kernel = 1;
+	}
+	return (int)syscall(__NR_perf_event_open, &attr, 0, -1, nGroupFD, 0);
+}
+
+PerfCounters::PerfCounters()
+{
+	meMode	= PerfCountersNone;
+	mnCount	= 0;
+	mbRdpmc	= false;
+	for(int idx = 0; idx < PERF_MAX_COUNTERS; idx++) {
+		mFD[idx]	= -1;
+		mpPage[idx]	= NULL;
+	}
+}
+
+PerfCounters::~PerfCounters()
+{
+	Close();
+}
+
+bool PerfCounters::OpenGroup(PerfCounterMode eMode)
+{
+	const PerfCounterEvent*	pEvents	= (eMode == PerfCountersHardware) ? gHardwareEvents : gSoftwareEvents;
+	uint32_t				nEvents	= (eMode == PerfCountersHardware) ? PERF_MAX_COUNTERS : sizeof(gSoftwareEvents) / sizeof(gSoftwareEvents[0]);
+
+	for(uint32_t idx = 0; idx < nEvents; idx++) {
+		mFD[idx] = OpenEvent(&pEvents[idx], idx == 0 ? -1 : mFD[0]);
+		if(mFD[idx] < 0) {
+			Close();
+			return false;
+		}
+		mnCount++;
+	}
+	meMode = eMode;
+
+	// rdpmc needs every counter's event page to allow it
+#if defined(__x86_64__) || defined(__i386__)
+	mbRdpmc = (eMode == PerfCountersHardware);
+	for(uint32_t idx = 0; idx < mnCount; idx++) {
+		void* p = mmap(NULL, sysconf(_SC_PAGESIZE), PROT_READ, MAP_SHARED, mFD[idx], 0);
+		if(p == MAP_FAILED) {
+			mbRdpmc = false;
+			continue;
+		}
+		mpPage[idx] = p;
+		if(((struct perf_event_mmap_page*)p)->cap_user_rdpmc == 0) {
+			mbRdpmc = false;
+		}
+	}
+#endif
+	ioctl(mFD[0], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+	ioctl(mFD[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+	return true;
+}
+
+bool PerfCounters::Open(PerfCounterMode eMode)
+{
+	Close();
+	if(eMode == PerfCountersNone) {
+		// Hardware counters usually aren't there in a VM
+		return OpenGroup(PerfCountersHardware) || OpenGroup(PerfCountersSoftware);
+	}
+	return OpenGroup(eMode);
+}
+
+bool PerfCounters::Close()
+{
+	for(int idx = 0; idx < PERF_MAX_COUNTERS; idx++) {
+		if(mpPage[idx] != NULL) {
+			munmap(mpPage[idx], sysconf(_SC_PAGESIZE));
+		}
+		if(mFD[idx] >= 0) {
+			close(mFD[idx]);
+		}
+		mFD[idx]	= -1;
+		mpPage[idx]	= NULL;
+	}
+	meMode	= PerfCountersNone;
+	mnCount	= 0;
+	mbRdpmc	= false;
+	return true;
+}
+
+//
+// Read the counters in user space, see the perf_event_mmap_page comments in
+// linux/perf_event.h.  Falls back to read() if the kernel has the counter
+// scheduled out.
+//
+bool PerfCounters::ReadFast(uint64_t* pValues)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	for(uint32_t idx = 0; idx < mnCount; idx++) {
+		volatile struct perf_event_mmap_page* pc = (volatile struct perf_event_mmap_page*)mpPage[idx];
+		uint32_t	seq;
+		uint32_t	index;
+		uint64_t	count;
+
+		do {
+			seq = pc->lock;
+			__asm__ __volatile__("" ::: "memory");
+			index = pc->index;
+			count = pc->offset;
+			if(pc->cap_user_rdpmc == 0 || index == 0) {
+				return false;
+			}
+			uint32_t	lo;
+			uint32_t	hi;
+			uint16_t	width = pc->pmc_width;
+			__asm__ __volatile__("rdpmc" : "=a"(lo), "=d"(hi) : "c"(index - 1));
+			int64_t pmc = (int64_t)(((uint64_t)hi << 32) | lo);
+			pmc <<= 64 - width;
+			pmc >>= 64 - width;
+			count += pmc;
+			__asm__ __volatile__("" ::: "memory");
+		} while(pc->lock != seq);
+		pValues[idx] = count;
+	}
+	return true;
+#else
+	return false;
+#endif
+}
+
+bool PerfCounters::Read(uint64_t* pValues)
+{
+	uint64_t	buffer[1 + PERF_MAX_COUNTERS];
+
+	if(mnCount == 0) {
+		return false;
+	}
+	if(mbRdpmc == true && ReadFast(pValues) == true) {
+		return true;
+	}
+	// PERF_FORMAT_GROUP gives the number of counters then each value
+	if(read(mFD[0], buffer, sizeof(uint64_t) * (1 + mnCount)) != (ssize_t)(sizeof(uint64_t) * (1 + mnCount))) {
+		memset(pValues, 0, sizeof(uint64_t) * mnCount);
+		return false;
+	}
+	memcpy(pValues, &buffer[1], sizeof(uint64_t) * mnCount);
+	return true;
+}
+
+PerfCounterMode PerfCounters::GetMode()
+{
+	return meMode;
+}
+uint32_t PerfCounters::GetCount()
+{
+	return mnCount;
+}
+const char* PerfCounters::GetName(PerfCounterMode eMode, uint32_t idx)
+{
+	if(eMode == PerfCountersHardware && idx < PERF_MAX_COUNTERS) {
+		return gHardwareEvents[idx].szName;
+	}
+	if(eMode == PerfCountersSoftware && idx < sizeof(gSoftwareEvents) / sizeof(gSoftwareEvents[0])) {
+		return gSoftwareEvents[idx].szName;
+	}
+	return "";
+}
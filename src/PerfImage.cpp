@@ -0,0 +1,223 @@
+/*****************************************************************************
+MIT License
+
+Copyright (c) 2016 Douglas Adler
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "PerfImage.h"
+
+PerfImage::PerfImage()
+{
+	mpHeader	= NULL;
+	mpIDs		= NULL;
+	mpNodes		= NULL;
+	mnSize		= 0;
+}
+
+PerfImage::~PerfImage()
+{
+	Close();
+}
+
+size_t PerfImage::GetSize(uint32_t nMaxNodes)
+{
+	return sizeof(PerfImageHeader) + sizeof(PerfImageID) * PERF_IMAGE_MAX_IDS + sizeof(PerfImageNode) * (size_t)nMaxNodes;
+}
+// The file is sparse, only the pages records land on take up space
+bool PerfImage::Create(const char* szFile, uint32_t nMaxNodes, uint64_t nStartTime)
+{
+	if(mpHeader != NULL || nMaxNodes == 0) {
+		return false;
+	}
+	int fd = open(szFile, O_CREAT | O_RDWR | O_TRUNC | O_CLOEXEC, 0644);
+	if(fd < 0) {
+		return false;
+	}
+	size_t nSize = GetSize(nMaxNodes);
+	if(ftruncate(fd, nSize) != 0) {
+		close(fd);
+		return false;
+	}
+	void* p = mmap(NULL, nSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if(p == MAP_FAILED) {
+		return false;
+	}
+	mpHeader	= (PerfImageHeader*)p;
+	mpIDs		= (PerfImageID*)(mpHeader + 1);
+	mpNodes		= (PerfImageNode*)(mpIDs + PERF_IMAGE_MAX_IDS);
+	mnSize		= nSize;
+
+	// ftruncate zeroed it, the magic goes in last so a reader never sees half a header
+	mpHeader->nVersion		= PERF_IMAGE_VERSION;
+	mpHeader->nHeaderSize	= sizeof(PerfImageHeader);
+	mpHeader->nIDSize		= sizeof(PerfImageID);
+	mpHeader->nNodeSize		= sizeof(PerfImageNode);
+	mpHeader->nMaxIDs		= PERF_IMAGE_MAX_IDS;
+	mpHeader->nMaxNodes		= nMaxNodes;
+	mpHeader->nIDOffset		= (char*)mpIDs - (char*)mpHeader;
+	mpHeader->nNodeOffset	= (char*)mpNodes - (char*)mpHeader;
+	mpHeader->nPid			= getpid();
+	mpHeader->nStartTime	= nStartTime;
+	__atomic_store_n(&mpHeader->nMagic, PERF_IMAGE_MAGIC, __ATOMIC_RELEASE);
+	return true;
+}
+static bool TakeSlot(volatile uint32_t* pnCount, uint32_t nMax, uint32_t* pnSlot)
+{
+	uint32_t nSlot = __atomic_load_n(pnCount, __ATOMIC_RELAXED);
+
+	do {
+		if(nSlot >= nMax) {
+			return false;
+		}
+	} while(!__atomic_compare_exchange_n(pnCount, &nSlot, nSlot + 1, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+	*pnSlot = nSlot;
+	return true;
+}
+bool PerfImage::AddID(PerfID id, PerfID catID, const char* szName, const char* szCategory, bool bInternal)
+{
+	uint32_t nSlot = 0;
+
+	if(mpHeader == NULL || TakeSlot(&mpHeader->nIDs, PERF_IMAGE_MAX_IDS, &nSlot) == false) {
+		return false;
+	}
+	PerfImageID* pID = &mpIDs[nSlot];
+	pID->nID			= id;
+	pID->nCategoryID	= catID;
+	strncpy(pID->szName, szName, PERF_IMAGE_NAME_SIZE - 1);
+	strncpy(pID->szCategory, szCategory, PERF_IMAGE_NAME_SIZE - 1);
+	__atomic_store_n(&pID->nFlags, PERF_IMAGE_VALID | (bInternal ? PERF_IMAGE_INTERNAL : 0), __ATOMIC_RELEASE);
+	return true;
+}
+PerfImageNode* PerfImage::AddNode(PerfImageNode* pParent, PerfID id, PerfID catID, pthread_t threadID)
+{
+	uint32_t nSlot = 0;
+
+	if(mpHeader == NULL) {
+		return NULL;
+	}
+	if(TakeSlot(&mpHeader->nNodes, mpHeader->nMaxNodes, &nSlot) == false) {
+		__sync_fetch_and_add(&mpHeader->nDroppedNodes, 1);
+		return NULL;
+	}
+	PerfImageNode* pNode = &mpNodes[nSlot];
+	pNode->nParent		= (pParent != NULL) ? (uint32_t)(pParent - mpNodes) + 1 : 0;
+	pNode->nID			= id;
+	pNode->nCategoryID	= catID;
+	pNode->nThreadID	= (uint64_t)threadID;
+	__atomic_store_n(&pNode->nFlags, PERF_IMAGE_VALID, __ATOMIC_RELEASE);
+	return pNode;
+}
+void PerfImage::DropNode()
+{
+	if(mpHeader != NULL) {
+		__sync_fetch_and_add(&mpHeader->nDroppedNodes, 1);
+	}
+}
+bool PerfImage::SetEnded(uint64_t nEndTime)
+{
+	if(mpHeader == NULL) {
+		return false;
+	}
+	__atomic_store_n(&mpHeader->nEndTime, nEndTime, __ATOMIC_RELEASE);
+	msync(mpHeader, mnSize, MS_ASYNC);
+	return true;
+}
+bool PerfImage::Open(const char* szFile)
+{
+	struct stat	info;
+
+	if(mpHeader != NULL) {
+		return false;
+	}
+	int fd = open(szFile, O_RDONLY | O_CLOEXEC);
+	if(fd < 0) {
+		return false;
+	}
+	if(fstat(fd, &info) != 0 || (size_t)info.st_size < sizeof(PerfImageHeader)) {
+		close(fd);
+		return false;
+	}
+	void* p = mmap(NULL, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if(p == MAP_FAILED) {
+		return false;
+	}
+	mpHeader	= (PerfImageHeader*)p;
+	mnSize		= info.st_size;
+	if(mpHeader->nMagic != PERF_IMAGE_MAGIC || mpHeader->nVersion != PERF_IMAGE_VERSION ||
+	   mpHeader->nIDSize < sizeof(PerfImageID) || mpHeader->nNodeSize < sizeof(PerfImageNode) ||
+	   mpHeader->nIDOffset + (uint64_t)mpHeader->nIDSize * mpHeader->nMaxIDs > mnSize ||
+	   mpHeader->nNodeOffset + (uint64_t)mpHeader->nNodeSize * mpHeader->nMaxNodes > mnSize) {
+		Close();
+		return false;
+	}
+	mpIDs	= (PerfImageID*)((char*)mpHeader + mpHeader->nIDOffset);
+	mpNodes	= (PerfImageNode*)((char*)mpHeader + mpHeader->nNodeOffset);
+	return true;
+}
+PerfImageHeader* PerfImage::GetHeader()
+{
+	return mpHeader;
+}
+PerfImageID* PerfImage::GetID(uint32_t nIndex)
+{
+	if(mpHeader == NULL || nIndex >= mpHeader->nMaxIDs) {
+		return NULL;
+	}
+	PerfImageID* pID = (PerfImageID*)((char*)mpIDs + (size_t)mpHeader->nIDSize * nIndex);
+	if((__atomic_load_n(&pID->nFlags, __ATOMIC_ACQUIRE) & PERF_IMAGE_VALID) == 0) {
+		return NULL;
+	}
+	return pID;
+}
+PerfImageNode* PerfImage::GetNode(uint32_t nIndex)
+{
+	if(mpHeader == NULL || nIndex >= mpHeader->nMaxNodes) {
+		return NULL;
+	}
+	PerfImageNode* pNode = (PerfImageNode*)((char*)mpNodes + (size_t)mpHeader->nNodeSize * nIndex);
+	if((__atomic_load_n(&pNode->nFlags, __ATOMIC_ACQUIRE) & PERF_IMAGE_VALID) == 0) {
+		return NULL;
+	}
+	return pNode;
+}
+// The writer's file stays, that's the point of it
+bool PerfImage::Close()
+{
+	if(mpHeader == NULL) {
+		return false;
+	}
+	munmap(mpHeader, mnSize);
+	mpHeader	= NULL;
+	mpIDs		= NULL;
+	mpNodes		= NULL;
+	mnSize		= 0;
+	return true;
+}
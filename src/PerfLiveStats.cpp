@@ -0,0 +1,281 @@
+/*****************************************************************************
+MIT License
+
+Copyright (c) 2016 Douglas Adler
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "PerfLiveStats.h"
+
+// A reader gives up on a record after this many changes under it
+#define LIVE_READ_RETRIES		16
+
+PerfLiveStats::PerfLiveStats()
+{
+	mpHeader		= NULL;
+	mpIDs			= NULL;
+	mpCategories	= NULL;
+	mszName[0]		= '\0';
+	mbOwner			= false;
+}
+
+PerfLiveStats::~PerfLiveStats()
+{
+	if(mbOwner == true) {
+		Destroy();
+	}
+	else {
+		Detach();
+	}
+}
+
+size_t PerfLiveStats::GetSize()
+{
+	return sizeof(PerfLiveHeader) + sizeof(PerfLiveRecord) * (PERF_LIVE_MAX_IDS + PERF_LIVE_MAX_CATEGORIES);
+}
+bool PerfLiveStats::GetName(pid_t nPid, char* szName, size_t nSize)
+{
+	snprintf(szName, nSize, PERF_LIVE_NAME_FORMAT, (int)nPid);
+	return true;
+}
+uint32_t PerfLiveStats::GetLatencyBucket(uint64_t nTime)
+{
+	uint32_t nBucket = 0;
+
+	while(nBucket < PERF_LIVE_LATENCY_BUCKETS - 1 && nTime > GetBucketLimit(nBucket)) {
+		nBucket++;
+	}
+	return nBucket;
+}
+uint64_t PerfLiveStats::GetBucketLimit(uint32_t nBucket)
+{
+	return (uint64_t)1 << (2 * nBucket);
+}
+// The segment for this process, only readable by the same user.  The names
+// of the IDs can say a lot about what the process is doing.
+bool PerfLiveStats::Create(uint32_t nInterval, uint64_t nStartTime)
+{
+	if(mpHeader != NULL) {
+		return false;
+	}
+	GetName(getpid(), mszName, sizeof(mszName));
+	// A segment left with this name could be anyone's, with any mode, so it is
+	// removed and ours has to be a new one
+	shm_unlink(mszName);
+	int fd = shm_open(mszName, O_CREAT | O_EXCL | O_RDWR, 0600);
+	if(fd < 0) {
+		return false;
+	}
+	if(ftruncate(fd, GetSize()) != 0) {
+		close(fd);
+		shm_unlink(mszName);
+		return false;
+	}
+	void* p = mmap(NULL, GetSize(), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if(p == MAP_FAILED) {
+		shm_unlink(mszName);
+		return false;
+	}
+	mpHeader		= (PerfLiveHeader*)p;
+	mpIDs			= (PerfLiveRecord*)(mpHeader + 1);
+	mpCategories	= mpIDs + PERF_LIVE_MAX_IDS;
+	mbOwner			= true;
+
+	// ftruncate zeroed it, the magic goes in last so a reader never sees half a header
+	mpHeader->nVersion			= PERF_LIVE_VERSION;
+	mpHeader->nHeaderSize		= sizeof(PerfLiveHeader);
+	mpHeader->nRecordSize		= sizeof(PerfLiveRecord);
+	mpHeader->nMaxIDs			= PERF_LIVE_MAX_IDS;
+	mpHeader->nMaxCategories	= PERF_LIVE_MAX_CATEGORIES;
+	mpHeader->nInterval			= nInterval;
+	mpHeader->nPid				= getpid();
+	mpHeader->nStartTime		= nStartTime;
+	__atomic_store_n(&mpHeader->nMagic, PERF_LIVE_MAGIC, __ATOMIC_RELEASE);
+	return true;
+}
+bool PerfLiveStats::WriteRecord(PerfLiveRecord* pRecord, PerfID id, const char* szName, const char* szCategory, const PerfLiveCounts& counts)
+{
+	uint64_t nSequence = pRecord->nSequence;
+
+	__atomic_store_n(&pRecord->nSequence, nSequence + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	if(pRecord->nID != id) {
+		pRecord->nID = id;
+		strncpy(pRecord->szName, szName, PERF_LIVE_NAME_SIZE - 1);
+		strncpy(pRecord->szCategory, szCategory, PERF_LIVE_NAME_SIZE - 1);
+	}
+	pRecord->nCalls			= counts.nCalls;
+	pRecord->nTotalTime		= counts.nTotalTime;
+	pRecord->nSelfTime		= counts.nSelfTime;
+	pRecord->nMaxTime		= counts.nMaxTime;
+	pRecord->nAbortedCalls	= counts.nAbortedCalls;
+	__atomic_store_n(&pRecord->nSequence, nSequence + 2, __ATOMIC_RELEASE);
+	return true;
+}
+bool PerfLiveStats::SetID(uint32_t nSlot, PerfID id, const char* szName, const char* szCategory, const PerfLiveCounts& counts)
+{
+	if(mpHeader == NULL || nSlot >= PERF_LIVE_MAX_IDS) {
+		return false;
+	}
+	WriteRecord(&mpIDs[nSlot], id, szName, szCategory, counts);
+	if(nSlot >= mpHeader->nIDs) {
+		__atomic_store_n(&mpHeader->nIDs, nSlot + 1, __ATOMIC_RELEASE);
+	}
+	return true;
+}
+bool PerfLiveStats::SetCategory(uint32_t nSlot, PerfID id, const char* szName, const PerfLiveCounts& counts)
+{
+	if(mpHeader == NULL || nSlot >= PERF_LIVE_MAX_CATEGORIES) {
+		return false;
+	}
+	WriteRecord(&mpCategories[nSlot], id, szName, szName, counts);
+	if(nSlot >= mpHeader->nCategories) {
+		__atomic_store_n(&mpHeader->nCategories, nSlot + 1, __ATOMIC_RELEASE);
+	}
+	return true;
+}
+bool PerfLiveStats::SetUpdated(uint64_t nUpdateTime, bool bStopped)
+{
+	if(mpHeader == NULL) {
+		return false;
+	}
+	__atomic_store_n(&mpHeader->nUpdateTime, nUpdateTime, __ATOMIC_RELAXED);
+	__atomic_store_n(&mpHeader->bStopped, bStopped ? 1 : 0, __ATOMIC_RELAXED);
+	__atomic_store_n(&mpHeader->nUpdates, mpHeader->nUpdates + 1, __ATOMIC_RELEASE);
+	return true;
+}
+bool PerfLiveStats::SetDroppedIDs(uint32_t nDroppedIDs)
+{
+	if(mpHeader == NULL) {
+		return false;
+	}
+	__atomic_store_n(&mpHeader->nDroppedIDs, nDroppedIDs, __ATOMIC_RELAXED);
+	return true;
+}
+bool PerfLiveStats::Destroy()
+{
+	if(mpHeader == NULL) {
+		return false;
+	}
+	munmap(mpHeader, GetSize());
+	if(mbOwner == true) {
+		shm_unlink(mszName);
+	}
+	mpHeader		= NULL;
+	mpIDs			= NULL;
+	mpCategories	= NULL;
+	mbOwner			= false;
+	return true;
+}
+// Accepts a segment name or a pid
+bool PerfLiveStats::Attach(const char* szName)
+{
+	struct stat	info;
+
+	if(mpHeader != NULL) {
+		return false;
+	}
+	if(szName[0] != '/') {
+		GetName((pid_t)atoi(szName), mszName, sizeof(mszName));
+	}
+	else {
+		strncpy(mszName, szName, sizeof(mszName) - 1);
+		mszName[sizeof(mszName) - 1] = '\0';
+	}
+	int fd = shm_open(mszName, O_RDONLY, 0);
+	if(fd < 0) {
+		return false;
+	}
+	// Don't trust the size until the header says what wrote it
+	if(fstat(fd, &info) != 0 || (size_t)info.st_size < sizeof(PerfLiveHeader)) {
+		close(fd);
+		return false;
+	}
+	void* p = mmap(NULL, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if(p == MAP_FAILED) {
+		return false;
+	}
+	PerfLiveHeader* pHeader = (PerfLiveHeader*)p;
+	if(__atomic_load_n(&pHeader->nMagic, __ATOMIC_ACQUIRE) != PERF_LIVE_MAGIC ||
+		pHeader->nVersion != PERF_LIVE_VERSION ||
+		pHeader->nHeaderSize != sizeof(PerfLiveHeader) ||
+		pHeader->nRecordSize != sizeof(PerfLiveRecord) ||
+		pHeader->nMaxIDs != PERF_LIVE_MAX_IDS ||
+		pHeader->nMaxCategories != PERF_LIVE_MAX_CATEGORIES ||
+		(size_t)info.st_size < GetSize()) {
+		munmap(p, info.st_size);
+		return false;
+	}
+	mpHeader		= pHeader;
+	mpIDs			= (PerfLiveRecord*)(mpHeader + 1);
+	mpCategories	= mpIDs + PERF_LIVE_MAX_IDS;
+	mbOwner			= false;
+	return true;
+}
+bool PerfLiveStats::Detach()
+{
+	return Destroy();
+}
+PerfLiveHeader* PerfLiveStats::GetHeader()
+{
+	return mpHeader;
+}
+bool PerfLiveStats::ReadRecord(PerfLiveRecord* pShared, PerfLiveRecord* pRecord)
+{
+	for(uint32_t nTry = 0; nTry < LIVE_READ_RETRIES; nTry++) {
+		uint64_t nSequence = __atomic_load_n(&pShared->nSequence, __ATOMIC_ACQUIRE);
+		if((nSequence & 1) != 0) {
+			continue;
+		}
+		memcpy(pRecord, (const void*)pShared, sizeof(PerfLiveRecord));
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if(__atomic_load_n(&pShared->nSequence, __ATOMIC_RELAXED) == nSequence) {
+			pRecord->nSequence = nSequence;
+			pRecord->szName[PERF_LIVE_NAME_SIZE - 1]		= '\0';
+			pRecord->szCategory[PERF_LIVE_NAME_SIZE - 1]	= '\0';
+			return true;
+		}
+	}
+	return false;
+}
+bool PerfLiveStats::ReadID(uint32_t nSlot, PerfLiveRecord* pRecord)
+{
+	if(mpHeader == NULL || nSlot >= PERF_LIVE_MAX_IDS) {
+		return false;
+	}
+	return ReadRecord(&mpIDs[nSlot], pRecord);
+}
+bool PerfLiveStats::ReadCategory(uint32_t nSlot, PerfLiveRecord* pRecord)
+{
+	if(mpHeader == NULL || nSlot >= PERF_LIVE_MAX_CATEGORIES) {
+		return false;
+	}
+	return ReadRecord(&mpCategories[nSlot], pRecord);
+}
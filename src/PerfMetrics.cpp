@@ -34,24 +34,43 @@ SOFTWARE.
 #ifdef FEATURE_PERFORMANCE_PROFILING
 
 #include <string.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <unistd.h>
 #include <pthread.h>
+#include <errno.h>
+#include <semaphore.h>
+#include <signal.h>
 #include <time.h>
 #include <sys/time.h>
+#include <sys/stat.h>
+#include <limits.h>
 #include <stdio.h>
 
 #include <list>
-#ifdef PERFORMANCE_MEMORY    
-#include <map>
-#endif
 #include <iostream>
 #include <iomanip>
 #include <string>
+#include <vector>
+#include <map>
 
 #include "PerfMetrics.h"
 
 #include "Node.h"
 #include "ThreadRecord.h"
+#include "MergedRec.h"
+#include "PerfArena.h"
+#include "PerfCounters.h"
+#include "PerfSlowCalls.h"
+#include "PerfBudget.h"
+#include "PerfShadowStack.h"
+#include "PerfLiveStats.h"
+#include "PerfMetricsEndpoint.h"
+#include "PerfImage.h"
+#include "PerfBinaryReport.h"
+#include "PerfBenchRunner.h"
 #include "AllocRecord.h"
+#include "AllocTable.h"
 #include "PerformanceRec.h"
 #include "PerfRecordReport.h"
 
@@ -73,6 +92,8 @@ SOFTWARE.
 #define TREE_REPORT_XML
 #define WRITE_REPORT_TO_FILE
 #define WRITE_REPORT_TO_SCREEN
+#define FOLDED_REPORT
+#define MERGED_TREE_REPORT
 //#define DISPLAY_CPU_TOTALS
 
 /*
@@ -82,12 +103,25 @@ SOFTWARE.
 */
 static const char * szIDReportFile 			= "./IDReport.txt";
 static const char * szCatReportFile 		= "./CategoryReport.txt";
+static const char * szContentionReportFile	= "./ContentionReport.txt";
+static const char * szMetricsReportFile		= "./MetricsReport.txt";
+static const char * szOutlierReportFile		= "./OutlierReport.txt";
+static const char * szBinaryReportFile		= "./PerfReport.bin";
+static const char * szBenchReportFile		= "./BenchReport.txt";
 #ifdef TREE_REPORT_XML
 static const char * szTreeReportFile 		= "./TreeReport.xml";
 #else
 static const char * szTreeReportFile 		= "./TreeReport.txt";
 #endif
+#ifdef FOLDED_REPORT
+static const char * szFoldedReportFile		= "./FoldedReport.txt";
+static const char * szFoldedMergedFile		= "./FoldedReportMerged.txt";
+#endif
+#ifdef MERGED_TREE_REPORT
+static const char * szMergedTreeReportFile	= "./MergedTreeReport.xml";
+#endif
 static const char * ELEMENT_DELIMITER		= ";";
+static const char * szIOCategory			= "IO";
 
 /*
 **---------------------------------------------------------------------
@@ -101,6 +135,14 @@ typedef enum ReportType_e
 	TreeReportType
 } ReportType;
 
+typedef struct PerfIOTotals_s
+{
+	uint64_t		nOps;
+	uint64_t		nBytes;
+	uint64_t		nTime;
+	uint64_t		nLatency[PERF_IO_LATENCY_BUCKETS];
+} PerfIOTotals;
+
 typedef struct CategoryReport_s
 {
 	const char * 	szName;
@@ -116,6 +158,10 @@ typedef struct CategoryReport_s
 	double			nMinCPUTime;
 	double			nMaxCPUTime;
 	double			nAvgCPUTime;
+	PerfRusage		rusage;
+	uint64_t		nCounterValues[PERF_MAX_COUNTERS];
+	PerfIOTotals	io;
+	uint64_t		nWorkUnits;
 } CategoryReport;
 
 typedef struct IDReport_s
@@ -133,34 +179,168 @@ typedef struct IDReport_s
 	double			nMinCPUTime;
 	double			nMaxCPUTime;
 	double			nAvgCPUTime;
+	uint64_t		nAllocCount;
+	uint64_t		nAllocBytes;
+	uint64_t		nFreeCount;
+	uint64_t		nLiveBytes;
+	PerfRusage		rusage;
+	uint64_t		nCounterValues[PERF_MAX_COUNTERS];
+	uint64_t		nLockAcquires;
+	uint64_t		nLockContended;
+	uint64_t		nLockWaitTime;
+	uint64_t		nLockHoldTime;
+	PerfIOTotals	io;
+	uint64_t		nWorkUnits;
+	uint64_t		nBudget;
+	uint64_t		nBreaches;
+	uint64_t		nAbortedCalls;
 } IDReport;
 
+// Per lock totals, updated from any thread
+typedef struct PerfLockData_s {
+	const char*			szKey;				// Caller's name pointer, checked before the name
+	char				szName[64];
+	volatile uint64_t	nAcquires;
+	volatile uint64_t	nContended;
+	volatile uint64_t	nWaitTime;
+	volatile uint64_t	nMaxWait;
+	volatile uint64_t	nHoldTime;
+	volatile uint64_t	nMaxHold;
+} PerfLockData;
+
+// Name of a PERF_COUNTER_ADD or PERF_GAUGE_SET metric, the index is its ID
+typedef struct PerfMetricDef_s {
+	const char*			szKey;				// Caller's name pointer, checked before the name
+	char				szName[64];
+	bool				bGauge;
+} PerfMetricDef;
+
+// A finished PERF_BENCH, in the order they ran
+typedef struct PerfBenchRecord_s {
+	std::string			name;
+	std::string			category;
+	PerfBenchResult		result;
+} PerfBenchRecord;
+
+// A lock held by this thread, for the hold time
+typedef struct PerfHeldLock_s {
+	void*				pLock;
+	PerfLockData*		pLockData;
+	PerformanceRec*		pNode;
+	uint64_t			nAcquireTime;
+	uint64_t			nRunStart;			// gStartTime when taken, pNode is stale after a cleanup
+} PerfHeldLock;
+
 typedef struct PerfCategoryData_s {
     const char*     szName;
     uint32_t        nID;
+    bool            bRusage;		// Nodes capture getrusage deltas, see PERF_CATEGORY_RUSAGE
+    volatile uint64_t nBudget;		// usec, see PERF_SET_CATEGORY_BUDGET
+    struct PerfCategoryData_s* pNext;	// gPerfCatList
 } PerfCategoryData;
 
-list<PerfCategoryData*>		gPerfCatList;
+//
+// The IDs and categories in the order they were added.  Entries are only
+// appended, under gRegistryMutex, and the count is published after the link,
+// so any thread can walk the list without the lock.  An iterator stops at the
+// count it started with, and a copy of the list is a snapshot of the entries
+// it had then.
+//
+template <class T>
+class PerfRegistryList
+{
+public:
+	class iterator
+	{
+	public:
+		iterator(T* p, uint32_t nLeft) : mp(p), mnLeft(nLeft) { }
+		T* operator*() const { return mp; }
+		iterator& operator++()
+		{
+			mnLeft--;
+			mp = (mnLeft > 0) ? __atomic_load_n(&mp->pNext, __ATOMIC_ACQUIRE) : NULL;
+			return *this;
+		}
+		iterator operator++(int) { iterator old = *this; ++(*this); return old; }
+		bool operator==(const iterator& other) const { return mp == other.mp; }
+		bool operator!=(const iterator& other) const { return mp != other.mp; }
+	private:
+		T*			mp;
+		uint32_t	mnLeft;
+	};
+
+	PerfRegistryList() : mpHead(NULL), mpTail(NULL), mnCount(0) { }
+	PerfRegistryList(const PerfRegistryList& other) : mpHead(NULL), mpTail(NULL), mnCount(0) { *this = other; }
+	PerfRegistryList& operator=(const PerfRegistryList& other)
+	{
+		mnCount	= __atomic_load_n(&other.mnCount, __ATOMIC_ACQUIRE);
+		mpHead	= (mnCount > 0) ? other.mpHead : NULL;
+		mpTail	= NULL;		// A snapshot isn't appended to
+		return *this;
+	}
+	iterator begin() const
+	{
+		uint32_t nCount = size();
+		return iterator((nCount > 0) ? mpHead : NULL, nCount);
+	}
+	iterator end() const { return iterator(NULL, 0); }
+	uint32_t size() const { return __atomic_load_n(&mnCount, __ATOMIC_ACQUIRE); }
+	bool empty() const { return size() == 0; }
+	// Caller holds gRegistryMutex
+	void push_back(T* p)
+	{
+		p->pNext = NULL;
+		if(mpTail == NULL) {
+			mpHead = p;
+		}
+		else {
+			__atomic_store_n(&mpTail->pNext, p, __ATOMIC_RELEASE);
+		}
+		mpTail = p;
+		__atomic_store_n(&mnCount, mnCount + 1, __ATOMIC_RELEASE);
+	}
+	// Only once nothing can walk the list, the entries are the caller's to free
+	void clear()
+	{
+		mpHead	= NULL;
+		mpTail	= NULL;
+		mnCount	= 0;
+	}
+private:
+	T*					mpHead;
+	T*					mpTail;
+	volatile uint32_t	mnCount;
+};
+
+// IDs, categories and their names come from here once PerfOptionRegistryArena is set
+static PerfArena			gRegistryArena;
+
+typedef PerfRegistryList<PerfCategoryData> PerfCatList;
+PerfCatList		gPerfCatList;
 
 
 PerfID	gPERF_ID_THREAD_START		= INVALID_PERF_ID;
 PerfID	gPERF_CATID_THREAD_START	= INVALID_PERF_ID;
+PerfID	gPERF_ID_OVERFLOW			= INVALID_PERF_ID;
+PerfID	gPERF_CATID_OVERFLOW		= INVALID_PERF_ID;
 
 typedef struct PerfIDData_s {
     const char*     szName;
     PerfID			id;
     PerfID			categoryID;
     const char *    szCategory;
+    PerfSlowCalls*	pSlowCalls;		// PerfOptionSlowCalls
+    PerfBudget		budget;			// PERF_SET_BUDGET
+    struct PerfIDData_s* pNext;		// gPerfIDList
 } PerfIDData;
 
-list<PerfIDData*>		gPerfIDList;
+typedef PerfRegistryList<PerfIDData> PerfIDList;
+PerfIDList		gPerfIDList;
 
+// Held to add an ID or category.  A name is looked up again under it before
+// it's added, so two threads can't add the same one.
+static pthread_mutex_t	gRegistryMutex	= PTHREAD_MUTEX_INITIALIZER;
 
-#ifdef PERFORMANCE_MEMORY    
-struct AllocPair : pair<unsigned int, AllocRecord*> {
-    AllocPair(AllocRecord* pRec) : pair<unsigned int, AllocRecord*>(pRec->GetID(), pRec) { }
-};
-#endif
 /*
 **---------------------------------------------------------------------
 ** Internal Prototypes
@@ -176,20 +356,156 @@ struct AllocPair : pair<unsigned int, AllocRecord*> {
 **---------------------------------------------------------------------
 */
 static	list<ThreadRecord*>	mThreadList;
+static pthread_mutex_t		gThreadListMutex	= PTHREAD_MUTEX_INITIALIZER;
+// Each thread's own record, set when it registers.  It's only valid for the
+// generation it was set in, PerfStart and PerfCleanup drop every record.
+// initial-exec so the allocation hooks can read it without allocating.
+static volatile uint32_t	gnThreadGeneration	= 1;
+static __thread ThreadRecord*	tlsThread			__attribute__((tls_model("initial-exec")))	= NULL;
+static __thread uint32_t		tlsThreadGeneration	__attribute__((tls_model("initial-exec")))	= 0;
+// Set when there was no room for this thread's tree, for the same generation
+static __thread uint32_t		tlsRefusedGeneration	__attribute__((tls_model("initial-exec")))	= 0;
 static 	uint64_t			gStartTime	= 0;
 static 	uint64_t			gEndTime	= 0;
 
 
 #ifdef PERFORMANCE_MEMORY    
-static  map<unsigned int, AllocRecord*> mAllocMap;
+static  AllocTable                      mAllocTable;
 static  uint64_t                        mAllocCurrent;
 static  uint64_t                        mAllocMax;
+// Allocations are only tracked between PERF_START and PERF_CLEANUP, the
+// allocation hooks see every malloc including those made during exit.
+static  volatile bool                   mbTrackAllocs   = false;
+static  bool                            mbAtExitSet     = false;
 #endif
 
 static PerfID 				nID			= 0;
 static pthread_mutex_t		lock;
 static bool					bLockInit	= false;
 
+// Runtime options
+static bool					gbFoldRecursion	= false;
+static unsigned long		gnMaxThreadNodes	= 0;
+static unsigned long		gnMaxDepth			= 0;
+static unsigned long		gnMaxMemory			= 0;
+static unsigned long		gnThreadArena		= 0;
+static unsigned long		gnRegistryArena		= 0;
+static bool					gbRusage			= false;	// Some category captures getrusage
+static bool					gbIO				= false;	// Some node did I/O
+static bool					gbWork				= false;	// Some node counted work units
+static bool					gbPerfCounters		= false;
+static unsigned long		gnSlowCalls			= 0;
+static unsigned long		gnWatchdog			= 0;	// ms
+static unsigned long		gnLiveStats			= 0;	// ms
+static int					gnReportSignal		= 0;
+static bool					gbBinaryReport		= false;	// PerfReport.bin instead of the text reports
+static PerfCounterMode		geCounterMode		= PerfCountersNone;		// Set by the first thread to open them
+// Read by the allocation hooks in PerfAllocHook.cpp
+unsigned long				gnAllocSampleRate	= 0;
+
+// A node and its entry in the parent's child list
+#define PERF_RECORD_MEMORY		(PerfArena::AllocationSize(sizeof(PerformanceRec)) + 4 * sizeof(void*))
+// Each node is charged for itself and the [other] child it may need when a
+// limit is hit, so the overflow nodes always fit inside PerfOptionMaxMemory.
+// In a thread arena the [other] half stays reserved until it's needed.
+#define PERF_NODE_MEMORY		(2 * PERF_RECORD_MEMORY)
+static volatile uint64_t	gnProfilerMemory	= 0;
+static volatile uint64_t	gnDroppedCalls		= 0;	// Calls charged to an [other] node, and every call made in one
+static volatile uint64_t	gnAbortedCalls		= 0;	// Some call was closed by an outer exit
+static volatile uint64_t	gnDroppedIO			= 0;	// I/O ops with no room for a block, even in [other]
+static volatile uint64_t	gnDroppedMetrics	= 0;	// Metric updates with no room for the thread's block
+static volatile uint64_t	gnDroppedThreads	= 0;	// Threads with no room for a tree, not profiled
+
+// Lock contention, see PERF_MUTEX_LOCK.  Lookups don't take a lock, new
+// locks are filled in under gLockDataMutex and then published by the count.
+#define PERF_MAX_LOCKS			256
+#define PERF_MAX_HELD_LOCKS		32
+static PerfLockData			gLockData[PERF_MAX_LOCKS];
+static volatile uint32_t	gnLockCount			= 0;
+static pthread_mutex_t		gLockDataMutex		= PTHREAD_MUTEX_INITIALIZER;
+static __thread PerfHeldLock	tlsHeldLocks[PERF_MAX_HELD_LOCKS];
+static __thread uint32_t		tlsHeldLockCount	= 0;
+
+// Counters and gauges, same scheme as the locks.  Values are kept per thread
+// and per node and summed at report time.
+static PerfMetricDef		gMetricDefs[PERF_MAX_METRICS];
+static volatile uint32_t	gnMetricCount		= 0;
+static pthread_mutex_t		gMetricDefMutex		= PTHREAD_MUTEX_INITIALIZER;
+static volatile uint64_t	gnGaugeSequence		= 0;
+
+// Latency budgets.  Breaches are counted per ID and passed to the callback,
+// either on the thread that breached or through a queue to gBudgetThread.
+static bool					gbBudgets			= false;	// Some ID or category has a budget
+static PerfBudgetCallback	gpfnBudgetCallback	= NULL;
+static void*				gpBudgetContext		= NULL;
+static bool					gbBudgetAsync		= false;
+static PerfBudgetQueue*		gpBudgetQueue		= NULL;
+static pthread_t			gBudgetThread;
+static bool					gbBudgetThreadRun	= false;
+static sem_t				gBudgetSem;
+static __thread bool		tlsInBudgetCallback	= false;
+
+// Each thread is linked in here when it's first seen and stays until
+// PERF_CLEANUP, so other threads can walk the list without a lock.
+static ThreadRecord* volatile	gpThreads		= NULL;
+
+// Stuck scope watchdog
+static pthread_t			gWatchdogThread;
+static bool					gbWatchdogRun		= false;
+static pthread_mutex_t		gWatchdogMutex		= PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t		gWatchdogCond		= PTHREAD_COND_INITIALIZER;
+static volatile uint64_t	gnStuckScopes		= 0;
+
+// Live stats segment.  Threads count their calls by PerfID, one thread sums
+// them and is the segment's only writer.
+static PerfLiveStats*		gpLiveStats			= NULL;
+static pthread_t			gLiveStatsThread;
+static bool					gbLiveStatsRun		= false;
+static pthread_mutex_t		gLiveStatsMutex		= PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t		gLiveStatsCond		= PTHREAD_COND_INITIALIZER;
+static bool					gbLiveCounts		= false;	// The segment or the endpoint wants the counts
+
+// Report dumps.  The signal handler only sets the flag and posts the
+// semaphore, gReportThread copies the trees and writes the reports.
+// PERF_REPORT and a dump don't run at the same time.
+static pthread_t			gReportThread;
+static bool					gbReportThreadRun	= false;
+static sem_t				gReportSem;
+static volatile sig_atomic_t	gbReportRequested	= 0;
+static struct sigaction		gOldReportAction;
+static bool					gbTreeLocks			= false;	// Threads lock their tree while it changes
+static pthread_mutex_t		gReportMutex		= PTHREAD_MUTEX_INITIALIZER;
+static list<ThreadRecord*>*	gpReportThreads		= &mThreadList;	// The trees the reports are written from
+static PerfIDList*			gpReportIDs			= &gPerfIDList;	// and the IDs and categories they name
+static PerfCatList*			gpReportCategories	= &gPerfCatList;
+static std::string			gReportDir;			// Prefix of the report files
+
+// Scrape endpoint, served from the same counts as the live stats segment
+#define PERF_ENDPOINT_ADDRESS_SIZE	108
+static char					gszMetricsEndpoint[PERF_ENDPOINT_ADDRESS_SIZE]	= "";
+static PerfMetricsEndpoint*	gpMetricsEndpoint	= NULL;
+
+// Profile image, every node and ID mirrored into a file-backed map so the
+// numbers survive a crash, see PerfImage
+static char					gszImageFile[PATH_MAX]	= "";
+static uint32_t				gnImageNodes		= 0;
+static PerfImage*			gpImage				= NULL;
+
+// Benchmarks, see PERF_BENCH
+static unsigned long			gnBenchWarmup		= 100;	// ms
+static unsigned long			gnBenchTime			= 1000;	// ms
+static vector<PerfBenchRecord>	gBenchResults;
+static pthread_mutex_t			gBenchMutex			= PTHREAD_MUTEX_INITIALIZER;
+
+// One ID or category summed over every thread
+typedef struct PerfLiveRow_s
+{
+	PerfID				id;
+	const char*			szName;
+	const char*			szCategory;
+	PerfLiveCounts		counts;
+} PerfLiveRow;
+
 /*
 **---------------------------------------------------------------------
 ** Internal Functions
@@ -222,9 +538,42 @@ static bool GetCurrentTimeStamp(uint64_t* pnTimeStamp)
 	
 	return true;
 }
+// Registry entries and names, from the registry arena while it has room
+template <class T>
+static T* NewRegistryData()
+{
+	void* p = gRegistryArena.Alloc(sizeof(T));
+	return (p != NULL) ? new(p) T() : new T();
+}
+template <class T>
+static void DeleteRegistryData(T* p)
+{
+	if(gRegistryArena.Owns(p)) {
+		p->~T();
+	}
+	else {
+		delete p;
+	}
+}
+static char* RegistryStrDup(const char* sz)
+{
+	size_t	nLen	= strlen(sz) + 1;
+	char*	p		= (char*)gRegistryArena.Alloc(nLen);
+	if(p == NULL) {
+		return strdup(sz);
+	}
+	memcpy(p, sz, nLen);
+	return p;
+}
+static void RegistryStrFree(const char* sz)
+{
+	if(sz != NULL && gRegistryArena.Owns(sz) == false) {
+		free((void*)sz);
+	}
+}
 //static uint32_t FindCategoryByID(PerfID id)
 //{
-//	list<PerfIDData*>::iterator 	iter = gPerfIDList.begin();
+//	PerfIDList::iterator 	iter = gPerfIDList.begin();
 //
 //	while(iter != gPerfIDList.end()) {
 //		PerfIDData* pPerfData = *iter;
@@ -238,9 +587,9 @@ static bool GetCurrentTimeStamp(uint64_t* pnTimeStamp)
 static uint32_t FindIndexByCategoryID(uint32_t catID)
 {
 	uint32_t							idx 	= 0;
-	list<PerfCategoryData*>::iterator 	iter 	= gPerfCatList.begin();
+	PerfCatList::iterator 	iter 	= gpReportCategories->begin();
 
-	while(iter != gPerfCatList.end()) {
+	while(iter != gpReportCategories->end()) {
 		PerfCategoryData* pPerfData = *iter;
 		if(pPerfData->nID == catID) {
 			return idx;
@@ -254,9 +603,9 @@ static uint32_t FindIndexByCategoryID(uint32_t catID)
 static uint32_t FindIndexByPerfID(PerfID id)
 {
 	uint32_t						idx 	= 0;
-	list<PerfIDData*>::iterator 	iter 	= gPerfIDList.begin();
+	PerfIDList::iterator 	iter 	= gpReportIDs->begin();
 
-	while(iter != gPerfIDList.end()) {
+	while(iter != gpReportIDs->end()) {
 		PerfIDData* pPerfData = *iter;
 		if(pPerfData->id == id) {
 			return idx;
@@ -268,7 +617,7 @@ static uint32_t FindIndexByPerfID(PerfID id)
 }
 static PerfIDData* FindPerfDataByPerfID(PerfID id)
 {
-	list<PerfIDData*>::iterator 	iter = gPerfIDList.begin();
+	PerfIDList::iterator 	iter = gPerfIDList.begin();
 
 	while(iter != gPerfIDList.end()) {
 		PerfIDData* pPerfData = *iter;
@@ -282,9 +631,9 @@ static PerfIDData* FindPerfDataByPerfID(PerfID id)
 static PerfIDData* FindPerfDataByIdx(uint32_t idx)
 {
 	uint32_t						nCount	= 0;
-	list<PerfIDData*>::iterator 	iter 	= gPerfIDList.begin();
+	PerfIDList::iterator 	iter 	= gpReportIDs->begin();
 
-	while(nCount != gPerfIDList.size()) {
+	while(nCount != gpReportIDs->size()) {
 		PerfIDData* pPerfData = *iter;
 		if(nCount == idx) {
 			return pPerfData;
@@ -294,6 +643,418 @@ static PerfIDData* FindPerfDataByIdx(uint32_t idx)
 	}
 	return NULL;
 }
+static void SumRusage(PerfRusage* pTotal, PerfRusage* pUsage)
+{
+	pTotal->nVolCtxSwitches		+= pUsage->nVolCtxSwitches;
+	pTotal->nInvolCtxSwitches	+= pUsage->nInvolCtxSwitches;
+	pTotal->nMinorFaults		+= pUsage->nMinorFaults;
+	pTotal->nMajorFaults		+= pUsage->nMajorFaults;
+	pTotal->nBlockIn			+= pUsage->nBlockIn;
+	pTotal->nBlockOut			+= pUsage->nBlockOut;
+}
+// getrusage columns for the category and ID reports, only added when a category captures them
+static void WriteRusageHeader(FILE* fp)
+{
+	const char* szColumns[] = { "Vol CS", "Invol CS", "Minor Faults", "Major Faults", "Block In", "Block Out" };
+
+	for(size_t idx = 0; idx < sizeof(szColumns) / sizeof(szColumns[0]); idx++) {
+		fprintf(fp, "%s", ELEMENT_DELIMITER);
+		fprintf(fp, "%s", szColumns[idx]);
+	}
+}
+static void WriteRusageColumns(FILE* fp, PerfRusage* pUsage)
+{
+	fprintf(fp, "%s%lu", ELEMENT_DELIMITER, (unsigned long)pUsage->nVolCtxSwitches);
+	fprintf(fp, "%s%lu", ELEMENT_DELIMITER, (unsigned long)pUsage->nInvolCtxSwitches);
+	fprintf(fp, "%s%lu", ELEMENT_DELIMITER, (unsigned long)pUsage->nMinorFaults);
+	fprintf(fp, "%s%lu", ELEMENT_DELIMITER, (unsigned long)pUsage->nMajorFaults);
+	fprintf(fp, "%s%lu", ELEMENT_DELIMITER, (unsigned long)pUsage->nBlockIn);
+	fprintf(fp, "%s%lu", ELEMENT_DELIMITER, (unsigned long)pUsage->nBlockOut);
+}
+static void PrintRusageColumns(PerfRusage* pUsage)
+{
+	uint64_t nValues[] = { pUsage->nVolCtxSwitches, pUsage->nInvolCtxSwitches, pUsage->nMinorFaults,
+						   pUsage->nMajorFaults, pUsage->nBlockIn, pUsage->nBlockOut };
+
+	for(size_t idx = 0; idx < sizeof(nValues) / sizeof(nValues[0]); idx++) {
+		cout << "\t\t" << nValues[idx];
+	}
+}
+static void SumIO(PerfIOTotals* pTotal, PerfRecordReport* pReport)
+{
+	pTotal->nOps	+= pReport->nIOOps;
+	pTotal->nBytes	+= pReport->nIOBytes;
+	pTotal->nTime	+= pReport->nIOTime;
+	for(uint32_t idx = 0; idx < PERF_IO_LATENCY_BUCKETS; idx++) {
+		pTotal->nLatency[idx] += pReport->nIOLatency[idx];
+	}
+}
+// Bytes per usec is MB/s
+static double GetIOThroughput(uint64_t nBytes, uint64_t nTime)
+{
+	return nTime > 0 ? (double)nBytes / nTime : 0.0;
+}
+// Latency histogram as limit:count pairs in usec
+static std::string FormatIOLatency(const uint64_t* pLatency)
+{
+	std::string	latency;
+	char		buffer[64];
+
+	for(uint32_t nBucket = 0; nBucket < PERF_IO_LATENCY_BUCKETS; nBucket++) {
+		if(pLatency[nBucket] == 0) {
+			continue;
+		}
+		if(nBucket < PERF_IO_LATENCY_BUCKETS - 1) {
+			snprintf(buffer, sizeof(buffer), "%s%lu:%lu", latency.empty() ? "" : " ",
+						1UL << nBucket, (unsigned long)pLatency[nBucket]);
+		}
+		else {
+			snprintf(buffer, sizeof(buffer), "%s%lu+:%lu", latency.empty() ? "" : " ",
+						1UL << (nBucket - 1), (unsigned long)pLatency[nBucket]);
+		}
+		latency.append(buffer);
+	}
+	return latency;
+}
+static void WriteIOHeader(FILE* fp)
+{
+	const char* szColumns[] = { "IO Ops", "IO Bytes", "IO Time", "MB/s", "IO Latency (us)" };
+
+	for(size_t idx = 0; idx < sizeof(szColumns) / sizeof(szColumns[0]); idx++) {
+		fprintf(fp, "%s", ELEMENT_DELIMITER);
+		fprintf(fp, "%s", szColumns[idx]);
+	}
+}
+static void WriteIOColumns(FILE* fp, PerfIOTotals* pIO)
+{
+	fprintf(fp, "%s%lu", ELEMENT_DELIMITER, (unsigned long)pIO->nOps);
+	fprintf(fp, "%s%lu", ELEMENT_DELIMITER, (unsigned long)pIO->nBytes);
+	fprintf(fp, "%s%lf", ELEMENT_DELIMITER, pIO->nTime / 1000.0);
+	fprintf(fp, "%s%lf", ELEMENT_DELIMITER, GetIOThroughput(pIO->nBytes, pIO->nTime));
+	fprintf(fp, "%s%s", ELEMENT_DELIMITER, FormatIOLatency(pIO->nLatency).c_str());
+}
+static void PrintIOColumns(PerfIOTotals* pIO)
+{
+	cout << "\t\t" << pIO->nOps;
+	cout << "\t\t" << pIO->nBytes;
+	cout << "\t\t" << pIO->nTime / 1000.0;
+	cout << "\t\t" << GetIOThroughput(pIO->nBytes, pIO->nTime);
+	cout << "\t\t" << FormatIOLatency(pIO->nLatency);
+}
+// Work rates from the clock total in usec
+static double GetNsPerUnit(uint64_t nTime, uint64_t nUnits)
+{
+	return nUnits > 0 ? (nTime * 1000.0) / nUnits : 0.0;
+}
+static double GetUnitsPerSec(uint64_t nTime, uint64_t nUnits)
+{
+	return nTime > 0 ? (nUnits * 1000000.0) / nTime : 0.0;
+}
+static void WriteWorkHeader(FILE* fp)
+{
+	fprintf(fp, "%sWork Units%sns/Unit%sUnits/s", ELEMENT_DELIMITER, ELEMENT_DELIMITER, ELEMENT_DELIMITER);
+}
+static void WriteWorkColumns(FILE* fp, uint64_t nTime, uint64_t nUnits)
+{
+	fprintf(fp, "%s%lu", ELEMENT_DELIMITER, (unsigned long)nUnits);
+	fprintf(fp, "%s%lf", ELEMENT_DELIMITER, GetNsPerUnit(nTime, nUnits));
+	fprintf(fp, "%s%lf", ELEMENT_DELIMITER, GetUnitsPerSec(nTime, nUnits));
+}
+static void PrintWorkColumns(uint64_t nTime, uint64_t nUnits)
+{
+	cout << "\t\t" << nUnits;
+	cout << "\t\t" << GetNsPerUnit(nTime, nUnits);
+	cout << "\t\t" << GetUnitsPerSec(nTime, nUnits);
+}
+// The budget in force for an ID, its own or its category's
+static uint64_t GetBudget(PerfBudget* pBudget)
+{
+	uint64_t nBudget = __atomic_load_n(&pBudget->nBudget, __ATOMIC_RELAXED);
+
+	if(nBudget == 0 && pBudget->pnCategoryBudget != NULL) {
+		nBudget = __atomic_load_n(pBudget->pnCategoryBudget, __ATOMIC_RELAXED);
+	}
+	return nBudget;
+}
+static void WriteBudgetHeader(FILE* fp)
+{
+	fprintf(fp, "%sBudget%sBreaches", ELEMENT_DELIMITER, ELEMENT_DELIMITER);
+}
+static void WriteBudgetColumns(FILE* fp, uint64_t nBudget, uint64_t nBreaches)
+{
+	fprintf(fp, "%s%lu", ELEMENT_DELIMITER, (unsigned long)nBudget);
+	fprintf(fp, "%s%lu", ELEMENT_DELIMITER, (unsigned long)nBreaches);
+}
+static void SumCounters(uint64_t* pTotal, PerfRecordReport* pReport)
+{
+	for(uint32_t idx = 0; idx < pReport->nCounters; idx++) {
+		pTotal[idx] += pReport->nCounterValues[idx];
+	}
+}
+static uint32_t GetCounterCount()
+{
+	uint32_t nCount = 0;
+
+	while(nCount < PERF_MAX_COUNTERS && PerfCounters::GetName(geCounterMode, nCount)[0] != '\0') {
+		nCount++;
+	}
+	return nCount;
+}
+// perf_event columns, each counter's total and per call, and IPC from the hardware counters
+static void WriteCounterHeader(FILE* fp)
+{
+	for(uint32_t idx = 0; idx < GetCounterCount(); idx++) {
+		fprintf(fp, "%s%s", ELEMENT_DELIMITER, PerfCounters::GetName(geCounterMode, idx));
+		fprintf(fp, "%s%s/Call", ELEMENT_DELIMITER, PerfCounters::GetName(geCounterMode, idx));
+	}
+	if(geCounterMode == PerfCountersHardware) {
+		fprintf(fp, "%sIPC", ELEMENT_DELIMITER);
+	}
+}
+static void WriteCounterColumns(FILE* fp, uint64_t* pValues, uint32_t nSamples)
+{
+	for(uint32_t idx = 0; idx < GetCounterCount(); idx++) {
+		fprintf(fp, "%s%lu", ELEMENT_DELIMITER, (unsigned long)pValues[idx]);
+		fprintf(fp, "%s%0.1f", ELEMENT_DELIMITER, nSamples > 0 ? (double)pValues[idx] / nSamples : 0.0);
+	}
+	if(geCounterMode == PerfCountersHardware) {
+		fprintf(fp, "%s%0.2f", ELEMENT_DELIMITER, pValues[0] > 0 ? (double)pValues[1] / pValues[0] : 0.0);
+	}
+}
+static void PrintCounterHeader()
+{
+	for(uint32_t idx = 0; idx < GetCounterCount(); idx++) {
+		cout << "\t\t" << PerfCounters::GetName(geCounterMode, idx) << "\t\t/Call";
+	}
+	if(geCounterMode == PerfCountersHardware) {
+		cout << "\t\tIPC";
+	}
+}
+static void PrintCounterColumns(uint64_t* pValues, uint32_t nSamples)
+{
+	for(uint32_t idx = 0; idx < GetCounterCount(); idx++) {
+		cout << "\t\t" << pValues[idx];
+		cout << "\t\t" << (nSamples > 0 ? (double)pValues[idx] / nSamples : 0.0);
+	}
+	if(geCounterMode == PerfCountersHardware) {
+		cout << "\t\t" << (pValues[0] > 0 ? (double)pValues[1] / pValues[0] : 0.0);
+	}
+}
+// Counter values for a tree node as name='value' attributes, or name=value for the text tree
+static std::string FormatCounters(PerfRecordReport* pReport, bool bXML)
+{
+	std::string	counters;
+	char		buffer[96];
+
+	for(uint32_t idx = 0; idx < pReport->nCounters; idx++) {
+		snprintf(buffer, sizeof(buffer), bXML ? " %s='%lu'" : " %s=%lu", PerfCounters::GetName(geCounterMode, idx),
+					(unsigned long)pReport->nCounterValues[idx]);
+		counters.append(buffer);
+	}
+	if(pReport->nCounters > 0 && geCounterMode == PerfCountersHardware) {
+		snprintf(buffer, sizeof(buffer), bXML ? " IPC='%0.2f'" : " IPC=%0.2f",
+					pReport->nCounterValues[0] > 0 ? (double)pReport->nCounterValues[1] / pReport->nCounterValues[0] : 0.0);
+		counters.append(buffer);
+	}
+	return counters;
+}
+#ifdef PERFORMANCE_MEMORY
+static void StopAllocTracking(void)
+{
+	mbTrackAllocs = false;
+}
+#endif
+// The calling thread's record, NULL until its first PERF_ENTRY
+static ThreadRecord* FindThreadRecord()
+{
+	if(tlsThreadGeneration != gnThreadGeneration) {
+		return NULL;
+	}
+	return tlsThread;
+}
+// Holds a thread's tree while the thread changes it, only when a report
+// dump may be copying the tree
+class PerfTreeGuard
+{
+public:
+	PerfTreeGuard(ThreadRecord* pThread)
+	{
+		mpThread = (gbTreeLocks == true) ? pThread : NULL;
+		if(mpThread != NULL) {
+			mpThread->LockTree();
+		}
+	}
+	~PerfTreeGuard()
+	{
+		if(mpThread != NULL) {
+			mpThread->UnlockTree();
+		}
+	}
+private:
+	ThreadRecord*	mpThread;
+};
+static void AtomicMax(volatile uint64_t* pnMax, uint64_t nValue)
+{
+	uint64_t nMax = __atomic_load_n(pnMax, __ATOMIC_RELAXED);
+
+	while(nValue > nMax && !__sync_bool_compare_and_swap(pnMax, nMax, nValue)) {
+		nMax = __atomic_load_n(pnMax, __ATOMIC_RELAXED);
+	}
+}
+// Locks are matched by name, callers normally pass the same literal so the pointer matches first
+static PerfLockData* FindLockData(const char* szName, uint32_t nCount)
+{
+	for(uint32_t idx = 0; idx < nCount; idx++) {
+		if(gLockData[idx].szKey == szName || strcmp(gLockData[idx].szName, szName) == 0) {
+			return &gLockData[idx];
+		}
+	}
+	return NULL;
+}
+static PerfLockData* GetLockData(const char* szName)
+{
+	PerfLockData*	pLockData	= NULL;
+	uint32_t		nCount		= __atomic_load_n(&gnLockCount, __ATOMIC_ACQUIRE);
+
+	if(szName == NULL) {
+		szName = "[unnamed]";
+	}
+	pLockData = FindLockData(szName, nCount);
+	if(pLockData == NULL) {
+		pthread_mutex_lock(&gLockDataMutex);
+		nCount		= __atomic_load_n(&gnLockCount, __ATOMIC_ACQUIRE);
+		pLockData	= FindLockData(szName, nCount);
+		if(pLockData == NULL && nCount < PERF_MAX_LOCKS) {
+			pLockData = &gLockData[nCount];
+			memset(pLockData, 0, sizeof(PerfLockData));
+			pLockData->szKey = szName;
+			strncpy(pLockData->szName, szName, sizeof(pLockData->szName) - 1);
+			__atomic_store_n(&gnLockCount, nCount + 1, __ATOMIC_RELEASE);
+		}
+		pthread_mutex_unlock(&gLockDataMutex);
+	}
+	return pLockData;
+}
+//
+// Take memory from PerfOptionMaxMemory, all of it or none.  Every thread
+// charges the same total, so the check and the add are one compare and swap.
+//
+static bool ReserveProfilerMemory(uint64_t nMemory)
+{
+	if(gnMaxMemory == 0) {
+		__sync_fetch_and_add(&gnProfilerMemory, nMemory);
+		return true;
+	}
+	while(true) {
+		uint64_t nUsed = gnProfilerMemory;
+		if(nUsed + nMemory > gnMaxMemory) {
+			return false;
+		}
+		if(__sync_bool_compare_and_swap(&gnProfilerMemory, nUsed, nUsed + nMemory)) {
+			return true;
+		}
+	}
+}
+//
+// Charge a block added to an existing node or thread, the same limits as a new node
+//
+static bool ChargeNodeMemory(ThreadRecord* pThread, uint64_t nMemory)
+{
+	if(pThread->GetArenaAvailable() < nMemory) {
+		return false;
+	}
+	return ReserveProfilerMemory(nMemory);
+}
+static uint32_t FindMetricIndex(const char* szName, uint32_t nCount)
+{
+	for(uint32_t idx = 0; idx < nCount; idx++) {
+		if(gMetricDefs[idx].szKey == szName || strcmp(gMetricDefs[idx].szName, szName) == 0) {
+			return idx;
+		}
+	}
+	return MAX_UINT32;
+}
+// The first use of a name decides whether it's a counter or a gauge
+static uint32_t GetMetricIndex(const char* szName, bool bGauge)
+{
+	uint32_t	nCount	= __atomic_load_n(&gnMetricCount, __ATOMIC_ACQUIRE);
+	uint32_t	nMetric	= FindMetricIndex(szName, nCount);
+
+	if(nMetric == MAX_UINT32) {
+		pthread_mutex_lock(&gMetricDefMutex);
+		nCount	= __atomic_load_n(&gnMetricCount, __ATOMIC_ACQUIRE);
+		nMetric	= FindMetricIndex(szName, nCount);
+		if(nMetric == MAX_UINT32 && nCount < PERF_MAX_METRICS) {
+			PerfMetricDef* pDef = &gMetricDefs[nCount];
+			memset(pDef, 0, sizeof(PerfMetricDef));
+			pDef->szKey		= szName;
+			pDef->bGauge	= bGauge;
+			strncpy(pDef->szName, szName, sizeof(pDef->szName) - 1);
+			nMetric = nCount;
+			__atomic_store_n(&gnMetricCount, nCount + 1, __ATOMIC_RELEASE);
+		}
+		pthread_mutex_unlock(&gMetricDefMutex);
+	}
+	return nMetric;
+}
+static bool AddMetric(const char* szName, int64_t nValue, bool bGauge)
+{
+	uint64_t	nSequence	= 0;
+	uint32_t	nMetric		= 0;
+
+	if(gStartTime == 0 || gEndTime != 0 || szName == NULL) {
+		return false;
+	}
+	nMetric = GetMetricIndex(szName, bGauge);
+	if(nMetric == MAX_UINT32) {
+		return false;
+	}
+	ThreadRecord* pThread = FindThreadRecord();
+	if(pThread == NULL) {
+		return false;
+	}
+	bGauge = gMetricDefs[nMetric].bGauge;
+	if(bGauge == true) {
+		nSequence = __sync_add_and_fetch(&gnGaugeSequence, 1);
+	}
+	// Both blocks are charged like tree nodes.  Without room for the thread's
+	// block the update is dropped, without room for the node's it's only kept
+	// per thread.
+	if(pThread->GetMetrics(false) == NULL && ChargeNodeMemory(pThread, ThreadRecord::GetMetricsMemory()) == false) {
+		__sync_fetch_and_add(&gnDroppedMetrics, 1);
+		return false;
+	}
+	PerformanceRec::UpdateMetric(&pThread->GetMetrics(true)[nMetric], nValue, bGauge, nSequence);
+	if(pThread->GetCurrentNode() != NULL && pThread->GetCurrentNode()->GetNodeType() == PerfRecord) {
+		PerfTreeGuard	guard(pThread);
+		PerformanceRec*	pRecord	= (PerformanceRec*)pThread->GetCurrentNode();
+
+		if(pRecord->HasMetrics() == true || ChargeNodeMemory(pThread, PerformanceRec::GetMetricsMemory()) == true) {
+			pRecord->AddMetric(nMetric, nValue, bGauge, nSequence, pThread->GetArena());
+		}
+	}
+	return true;
+}
+// Counters as name=total, gauges as name=last[min..max]
+static std::string FormatMetrics(PerfRecordReport* pReport)
+{
+	std::string	metrics;
+	char		buffer[128];
+
+	for(uint32_t idx = 0; idx < pReport->nMetrics; idx++) {
+		PerfMetricValue* pMetric = &pReport->metrics[idx];
+		if(gMetricDefs[pMetric->nMetric].bGauge == false) {
+			snprintf(buffer, sizeof(buffer), "%s%s=%ld", metrics.empty() ? "" : " ",
+						gMetricDefs[pMetric->nMetric].szName, (long)pMetric->nValue);
+		}
+		else {
+			snprintf(buffer, sizeof(buffer), "%s%s=%ld[%ld..%ld]", metrics.empty() ? "" : " ",
+						gMetricDefs[pMetric->nMetric].szName, (long)pMetric->nValue, (long)pMetric->nMin, (long)pMetric->nMax);
+		}
+		metrics.append(buffer);
+	}
+	return metrics;
+}
 static void SumCatReportData(CategoryReport* pCatReport, PerfRecordReport* pReport)
 {
 	pCatReport->nSamples 	+= pReport->nTotalCalls;
@@ -321,6 +1082,10 @@ static void SumCatReportData(CategoryReport* pCatReport, PerfRecordReport* pRepo
 	if(pCatReport->nSamples > 0) {
 		pCatReport->nAvgCPUTime 	= pCatReport->nTotalCPUTime / pCatReport->nSamples;
 	}
+	SumRusage(&pCatReport->rusage, &pReport->rusage);
+	SumCounters(pCatReport->nCounterValues, pReport);
+	SumIO(&pCatReport->io, pReport);
+	pCatReport->nWorkUnits	+= pReport->nWorkUnits;
 	return;
 }
 static void SumIDReportData(IDReport* pIDReport, PerfRecordReport* pReport)
@@ -350,6 +1115,21 @@ static void SumIDReportData(IDReport* pIDReport, PerfRecordReport* pReport)
 	if(pIDReport->nSamples > 0) {
 		pIDReport->nAvgCPUTime 	= pIDReport->nTotalCPUTime / pIDReport->nSamples;
 	}
+	// Memory
+	pIDReport->nAllocCount		+= pReport->nAllocCount;
+	pIDReport->nAllocBytes		+= pReport->nAllocBytes;
+	pIDReport->nFreeCount		+= pReport->nFreeCount;
+	pIDReport->nLiveBytes		+= pReport->nLiveBytes;
+	SumRusage(&pIDReport->rusage, &pReport->rusage);
+	SumCounters(pIDReport->nCounterValues, pReport);
+	SumIO(&pIDReport->io, pReport);
+	pIDReport->nWorkUnits	+= pReport->nWorkUnits;
+	pIDReport->nAbortedCalls	+= pReport->nAbortedCalls;
+	// Locks
+	pIDReport->nLockAcquires	+= pReport->nLockAcquires;
+	pIDReport->nLockContended	+= pReport->nLockContended;
+	pIDReport->nLockWaitTime	+= pReport->nLockWaitTime;
+	pIDReport->nLockHoldTime	+= pReport->nLockHoldTime;
 	return;
 }
 static bool GetNodeCategoryData(Node* pNode, CategoryReport* catReport, uint16_t nCategories)
@@ -407,6 +1187,30 @@ static bool GetNodeIDData(Node* pNode, IDReport* idReport, uint16_t nIDs)
 	}	
 	return retVal;	
 }
+#ifdef PERFORMANCE_MEMORY
+// Non empty size classes as "limit:count", the last class is "limit+:count"
+static std::string FormatAllocSizes(PerfRecordReport* pReport)
+{
+	std::string	sizes;
+	char		buffer[64];
+
+	for(uint32_t nClass = 0; nClass < PERF_ALLOC_SIZE_CLASSES; nClass++) {
+		if(pReport->nAllocSizes[nClass] == 0) {
+			continue;
+		}
+		if(nClass < PERF_ALLOC_SIZE_CLASSES - 1) {
+			snprintf(buffer, sizeof(buffer), "%s%lu:%lu", sizes.empty() ? "" : " ",
+						(unsigned long)PERF_ALLOC_MIN_CLASS_SIZE << nClass, (unsigned long)pReport->nAllocSizes[nClass]);
+		}
+		else {
+			snprintf(buffer, sizeof(buffer), "%s%lu+:%lu", sizes.empty() ? "" : " ",
+						(unsigned long)PERF_ALLOC_MIN_CLASS_SIZE << (nClass - 1), (unsigned long)pReport->nAllocSizes[nClass]);
+		}
+		sizes.append(buffer);
+	}
+	return sizes;
+}
+#endif
 static bool WriteNodeDataToScreen(Node* pNode, uint16_t nSize)
 {
 	Node* pParent = pNode->GetParent();;
@@ -440,6 +1244,43 @@ static bool WriteNodeDataToScreen(Node* pNode, uint16_t nSize)
 			cout << PerfRecord.nMaxTime / 1000.0 << " ";
 			cout << PerfRecord.nMinTime / 1000.0 << " ";
 			cout << (PerfRecord.nTotalTime/PerfRecord.nTotalCalls) / 1000.0;
+			if(PerfRecord.nRecursiveCalls > 0) {
+				cout << " (Recursive:C,D) " << PerfRecord.nRecursiveCalls << " " << PerfRecord.nMaxRecursion;
+			}
+			if(PerfRecord.nAbortedCalls > 0) {
+				cout << " (Aborted) " << PerfRecord.nAbortedCalls;
+			}
+#ifdef PERFORMANCE_MEMORY
+			if(PerfRecord.nAllocCount > 0) {
+				cout << " (Memory:A,B,F,L) " << PerfRecord.nAllocCount << " " << PerfRecord.nAllocBytes << " ";
+				cout << PerfRecord.nFreeCount << " " << PerfRecord.nLiveBytes;
+				cout << " (Sizes) " << FormatAllocSizes(&PerfRecord);
+			}
+#endif
+			if(PerfRecord.bRusage == true) {
+				cout << " (Rusage:VCS,ICS,MnF,MjF,BI,BO) " << PerfRecord.rusage.nVolCtxSwitches << " " << PerfRecord.rusage.nInvolCtxSwitches << " ";
+				cout << PerfRecord.rusage.nMinorFaults << " " << PerfRecord.rusage.nMajorFaults << " ";
+				cout << PerfRecord.rusage.nBlockIn << " " << PerfRecord.rusage.nBlockOut;
+			}
+			if(PerfRecord.nCounters > 0) {
+				cout << " (Counters)" << FormatCounters(&PerfRecord, false);
+			}
+			if(PerfRecord.nLockAcquires > 0) {
+				cout << " (Locks:A,C,W,H) " << PerfRecord.nLockAcquires << " " << PerfRecord.nLockContended << " ";
+				cout << PerfRecord.nLockWaitTime / 1000.0 << " " << PerfRecord.nLockHoldTime / 1000.0;
+			}
+			if(PerfRecord.nIOOps > 0) {
+				cout << " (IO:O,B,MB/s) " << PerfRecord.nIOOps << " " << PerfRecord.nIOBytes << " ";
+				cout << GetIOThroughput(PerfRecord.nIOBytes, PerfRecord.nIOTime);
+				cout << " (Latency) " << FormatIOLatency(PerfRecord.nIOLatency);
+			}
+			if(PerfRecord.nWorkUnits > 0) {
+				cout << " (Work:U,ns/U,U/s) " << PerfRecord.nWorkUnits << " " << GetNsPerUnit(PerfRecord.nTotalTime, PerfRecord.nWorkUnits);
+				cout << " " << GetUnitsPerSec(PerfRecord.nTotalTime, PerfRecord.nWorkUnits);
+			}
+			if(PerfRecord.nMetrics > 0) {
+				cout << " (Metrics) " << FormatMetrics(&PerfRecord);
+			}
 #ifdef DISPLAY_CPU_TOTALS
 			cout << " (CPU:T,S,Mx,Mn,A) ";
 			cout << dec << PerfRecord.nTotalCPUTime * 1000.0 << " ";
@@ -458,6 +1299,22 @@ static bool WriteNodeDataToScreen(Node* pNode, uint16_t nSize)
 
 	return true;
 }
+static void EscapeToXML(std::string& data)
+{
+    std::string buffer;
+    buffer.reserve(data.size() + 50);
+    for(size_t pos = 0; pos != data.size(); ++pos) {
+        switch(data[pos]) {
+            case '&':  buffer.append("&amp;");       break;
+            case '\"': buffer.append("&quot;");      break;
+            case '\'': buffer.append("&apos;");      break;
+            case '<':  buffer.append("&lt;");        break;
+            case '>':  buffer.append("&gt;");        break;
+            default:   buffer.append(1, data[pos]);  break;
+        }
+    }
+    data.swap(buffer);
+}
 #ifndef TREE_REPORT_XML
 static bool WriteNodeDataToFile(Node* pNode, uint16_t nSize, FILE* fp)
 {
@@ -488,11 +1345,45 @@ static bool WriteNodeDataToFile(Node* pNode, uint16_t nSize, FILE* fp)
 			fprintf(fp, "%0.3f ", PerfRecord.nMaxTime / 1000.0);
 			fprintf(fp, "%0.3f ", PerfRecord.nMinTime / 1000.0);
 			fprintf(fp, "%0.3f ", (PerfRecord.nTotalTime/PerfRecord.nTotalCalls) / 1000.0);
-#ifdef DISPLAY_CPU_TOTALS
-			cout << " (CPU:T,S,Mx,Mn,A) ";
-			fprintf(fp, "%0.3f ", PerfRecord.nTotalCPUTime * 1000.0);
-			fprintf(fp, "%0.3f ", PerfRecord.nTotalCPUTimeSelf * 1000.0);
-			fprintf(fp, "%0.3f ", PerfRecord.nMaxCPUTime * 1000.0);
+			if(PerfRecord.nAbortedCalls > 0) {
+				fprintf(fp, " (Aborted) %u ", PerfRecord.nAbortedCalls);
+			}
+#ifdef PERFORMANCE_MEMORY
+			if(PerfRecord.nAllocCount > 0) {
+				fprintf(fp, " (Memory:A,B,F,L) %lu %lu %lu %lu", (unsigned long)PerfRecord.nAllocCount, (unsigned long)PerfRecord.nAllocBytes,
+								(unsigned long)PerfRecord.nFreeCount, (unsigned long)PerfRecord.nLiveBytes);
+				fprintf(fp, " (Sizes) %s ", FormatAllocSizes(&PerfRecord).c_str());
+			}
+#endif
+			if(PerfRecord.bRusage == true) {
+				fprintf(fp, " (Rusage:VCS,ICS,MnF,MjF,BI,BO) %lu %lu %lu %lu %lu %lu ",
+								(unsigned long)PerfRecord.rusage.nVolCtxSwitches, (unsigned long)PerfRecord.rusage.nInvolCtxSwitches,
+								(unsigned long)PerfRecord.rusage.nMinorFaults, (unsigned long)PerfRecord.rusage.nMajorFaults,
+								(unsigned long)PerfRecord.rusage.nBlockIn, (unsigned long)PerfRecord.rusage.nBlockOut);
+			}
+			if(PerfRecord.nCounters > 0) {
+				fprintf(fp, " (Counters)%s ", FormatCounters(&PerfRecord, false).c_str());
+			}
+			if(PerfRecord.nLockAcquires > 0) {
+				fprintf(fp, " (Locks:A,C,W,H) %u %u %0.3f %0.3f ", PerfRecord.nLockAcquires, PerfRecord.nLockContended,
+								PerfRecord.nLockWaitTime / 1000.0, PerfRecord.nLockHoldTime / 1000.0);
+			}
+			if(PerfRecord.nIOOps > 0) {
+				fprintf(fp, " (IO:O,B,MB/s) %lu %lu %0.3f (Latency) %s ", (unsigned long)PerfRecord.nIOOps, (unsigned long)PerfRecord.nIOBytes,
+								GetIOThroughput(PerfRecord.nIOBytes, PerfRecord.nIOTime), FormatIOLatency(PerfRecord.nIOLatency).c_str());
+			}
+			if(PerfRecord.nWorkUnits > 0) {
+				fprintf(fp, " (Work:U,ns/U,U/s) %lu %0.3f %0.3f ", (unsigned long)PerfRecord.nWorkUnits,
+								GetNsPerUnit(PerfRecord.nTotalTime, PerfRecord.nWorkUnits), GetUnitsPerSec(PerfRecord.nTotalTime, PerfRecord.nWorkUnits));
+			}
+			if(PerfRecord.nMetrics > 0) {
+				fprintf(fp, " (Metrics) %s ", FormatMetrics(&PerfRecord).c_str());
+			}
+#ifdef DISPLAY_CPU_TOTALS
+			cout << " (CPU:T,S,Mx,Mn,A) ";
+			fprintf(fp, "%0.3f ", PerfRecord.nTotalCPUTime * 1000.0);
+			fprintf(fp, "%0.3f ", PerfRecord.nTotalCPUTimeSelf * 1000.0);
+			fprintf(fp, "%0.3f ", PerfRecord.nMaxCPUTime * 1000.0);
 			fprintf(fp, "%0.3f ", PerfRecord.nMinCPUTime * 1000.0);
 			fprintf(fp, "%0.3f ", (PerfRecord.nTotalCPUTime/PerfRecord.nTotalCalls) * 1000.0);
 #endif
@@ -503,22 +1394,6 @@ static bool WriteNodeDataToFile(Node* pNode, uint16_t nSize, FILE* fp)
 }
 #else //TREE_REPORT_XML
 
-static void EscapeToXML(std::string& data)
-{
-    std::string buffer;
-    buffer.reserve(data.size() + 50);
-    for(size_t pos = 0; pos != data.size(); ++pos) {
-        switch(data[pos]) {
-            case '&':  buffer.append("&amp;");       break;
-            case '\"': buffer.append("&quot;");      break;
-            case '\'': buffer.append("&apos;");      break;
-            case '<':  buffer.append("&lt;");        break;
-            case '>':  buffer.append("&gt;");        break;
-            default:   buffer.append(1, data[pos]);  break;
-        }
-    }
-    data.swap(buffer);
-}
 static bool WriteNodeDataToFileAsXML(Node* pNode, uint16_t nSize, FILE* fp)
 {
 	// Tracking vars
@@ -557,6 +1432,48 @@ static bool WriteNodeDataToFileAsXML(Node* pNode, uint16_t nSize, FILE* fp)
 							PerfRecord.nMaxTime / 1000.0,
 							PerfRecord.nMinTime / 1000.0,
 							(PerfRecord.nTotalTime/PerfRecord.nTotalCalls) / 1000.0);
+			if(PerfRecord.nRecursiveCalls > 0) {
+				fprintf(fp, " Recursive='%u' MaxRecursion='%u'", PerfRecord.nRecursiveCalls, PerfRecord.nMaxRecursion);
+			}
+			if(PerfRecord.nAbortedCalls > 0) {
+				fprintf(fp, " Aborted='%u'", PerfRecord.nAbortedCalls);
+			}
+#ifdef PERFORMANCE_MEMORY
+			if(PerfRecord.nAllocCount > 0) {
+				fprintf(fp, " Allocs='%lu' AllocBytes='%lu' Frees='%lu' LiveBytes='%lu' AllocSizes='%s'",
+							(unsigned long)PerfRecord.nAllocCount, (unsigned long)PerfRecord.nAllocBytes,
+							(unsigned long)PerfRecord.nFreeCount, (unsigned long)PerfRecord.nLiveBytes,
+							FormatAllocSizes(&PerfRecord).c_str());
+			}
+#endif
+			if(PerfRecord.bRusage == true) {
+				fprintf(fp, " VolCS='%lu' InvolCS='%lu' MinorFaults='%lu' MajorFaults='%lu' BlockIn='%lu' BlockOut='%lu'",
+							(unsigned long)PerfRecord.rusage.nVolCtxSwitches, (unsigned long)PerfRecord.rusage.nInvolCtxSwitches,
+							(unsigned long)PerfRecord.rusage.nMinorFaults, (unsigned long)PerfRecord.rusage.nMajorFaults,
+							(unsigned long)PerfRecord.rusage.nBlockIn, (unsigned long)PerfRecord.rusage.nBlockOut);
+			}
+			if(PerfRecord.nCounters > 0) {
+				fprintf(fp, "%s", FormatCounters(&PerfRecord, true).c_str());
+			}
+			if(PerfRecord.nLockAcquires > 0) {
+				fprintf(fp, " LockAcquires='%u' LockContended='%u' LockWait='%0.3f' LockHold='%0.3f'",
+							PerfRecord.nLockAcquires, PerfRecord.nLockContended,
+							PerfRecord.nLockWaitTime / 1000.0, PerfRecord.nLockHoldTime / 1000.0);
+			}
+			if(PerfRecord.nIOOps > 0) {
+				fprintf(fp, " IOOps='%lu' IOBytes='%lu' IOTime='%0.3f' IOMBps='%0.3f' IOLatency='%s'",
+							(unsigned long)PerfRecord.nIOOps, (unsigned long)PerfRecord.nIOBytes, PerfRecord.nIOTime / 1000.0,
+							GetIOThroughput(PerfRecord.nIOBytes, PerfRecord.nIOTime), FormatIOLatency(PerfRecord.nIOLatency).c_str());
+			}
+			if(PerfRecord.nWorkUnits > 0) {
+				fprintf(fp, " Work='%lu' NsPerUnit='%0.3f' UnitsPerSec='%0.3f'", (unsigned long)PerfRecord.nWorkUnits,
+							GetNsPerUnit(PerfRecord.nTotalTime, PerfRecord.nWorkUnits), GetUnitsPerSec(PerfRecord.nTotalTime, PerfRecord.nWorkUnits));
+			}
+			if(PerfRecord.nMetrics > 0) {
+				std::string metrics = FormatMetrics(&PerfRecord);
+				EscapeToXML(metrics);
+				fprintf(fp, " Metrics='%s'", metrics.c_str());
+			}
 
 #ifdef DISPLAY_CPU_TOTALS
 			fprintf(fp, " Total_CPU='%0.3f' Self_CPU='%0.3f' Max_CPU='%0.3f' Min_CPU='%0.3f' Avg_CPU='%0.3f'",
@@ -641,11 +1558,11 @@ static bool GetChildData(Node* pNode, void* report, uint16_t nSize, ReportType e
 	}
 
 #ifdef ORDER_CHILD_DATA
-	list<Node*>* pSiblingList = pNode->GetSiblingList();
+	NodeList* pSiblingList = pNode->GetSiblingList();
 	pSiblingList->sort(OrderChildByTotal);
 #endif
 	// Recurse
-	list<Node*>::iterator iter	= pNode->GetSiblingIterator();
+	NodeList::iterator iter	= pNode->GetSiblingIterator();
 	while(pNode->IsSiblingEnd(iter) == false) {
 		Node* pChild = *iter;
 //		cout << "GetChildData for " << pNode << " found child " << pChild << endl;
@@ -664,10 +1581,10 @@ static bool GetChildData(Node* pNode, void* report, uint16_t nSize, ReportType e
 static bool GenerateReport(void* report, uint16_t nSize, ReportType eType)
 {
 	ThreadRecord* 					pThread		= NULL;
-	list<ThreadRecord*>::iterator 	iter 		= mThreadList.begin();
+	list<ThreadRecord*>::iterator 	iter 		= gpReportThreads->begin();
 
 	// Walk the threads
-	while(iter != mThreadList.end()) {
+	while(iter != gpReportThreads->end()) {
 		pThread	= *iter;
 		// Walk the nodes
 		Node * pParent = pThread->GetRootNode();
@@ -681,238 +1598,2126 @@ static bool GenerateReport(void* report, uint16_t nSize, ReportType eType)
 	}	
 	return true;
 }
-static PerformanceRec* NewPerfRecord(PerfID id, PerfID catID, NodeType eType, Node* pParent, pthread_t threadID)
+static PerformanceRec* NewPerfRecord(PerfID id, PerfID catID, NodeType eType, Node* pParent, pthread_t threadID, PerfArena* pArena)
 {
 	if(id == INVALID_PERF_ID) {
 		cout << "\t NewPerfRecord invalid ID" << endl;
 	}
-	PerformanceRec* pNewRecord	= new PerformanceRec();
+	PerformanceRec* pNewRecord	= new(pArena) PerformanceRec(pArena);
 
 	pNewRecord->SetID(id);
 	pNewRecord->SetCatID(catID);
 	pNewRecord->SetNodeType(eType);
 	pNewRecord->SetParent(pParent);
 	pNewRecord->SetThreadID(threadID);	
+	if(pParent != NULL) {
+		pNewRecord->SetDepth(((PerformanceRec*)pParent)->GetDepth() + 1);
+	}
+	// Per ID state the node needs at every exit
+	PerfIDData* pPerfData = FindPerfDataByPerfID(id);
+	if(pPerfData != NULL) {
+		pNewRecord->SetSlowCalls(pPerfData->pSlowCalls);
+		pNewRecord->SetBudget(&pPerfData->budget);
+	}
+	if(gpImage != NULL) {
+		// A node whose parent isn't in the image can't be placed in it either
+		PerfImageNode* pParentImage = (pParent != NULL) ? ((PerformanceRec*)pParent)->GetImageNode() : NULL;
+		if(pParent != NULL && pParentImage == NULL) {
+			gpImage->DropNode();
+		}
+		else {
+			pNewRecord->SetImageNode(gpImage->AddNode(pParentImage, id, catID, threadID));
+		}
+	}
 	
 //	cout << "Created new PerfRecord " << pNewRecord << " ID = " << id;
 //	cout << " Name = " << gPerfIDData[FindIndexByPerfID(id)].szName;
 //	cout << " Parent = " << pParent << endl;
 	return pNewRecord;
 }
-
-static void SortIDByTotalCalls(IDReport* pReport, int nElements)
+// Only called for a call slower than the fastest one kept for its ID
+// The IDs from the thread's root down to pNode, root first.  Deeper paths
+// keep the nMax frames nearest pNode.
+static uint32_t GetNodePath(Node* pNode, PerfID* pPath, uint32_t nMax, bool* pbTruncated)
 {
-	int i, j;
-	IDReport temp;
-	int numLength = nElements;
+	PerfID		path[nMax];
+	uint32_t	nDepth	= 0;
 
-	for(i = 0; i< (numLength -1); i++)  {
-		for(j = (i+1); j < numLength; j++) {
-			if (pReport[i].nSamples < pReport[j].nSamples) {
-				temp 		= pReport[i];          // swap
-				pReport[i] 	= pReport[j];
-				pReport[j] 	= temp;
+	*pbTruncated = false;
+	while(pNode != NULL && pNode->GetNodeType() == PerfRecord) {
+		PerfID id = ((PerformanceRec*)pNode)->GetID();
+		if(id != gPERF_ID_THREAD_START) {
+			if(nDepth == nMax) {
+				*pbTruncated = true;
+				break;
 			}
+			path[nDepth++] = id;
 		}
+		pNode = pNode->GetParent();
 	}
+	for(uint32_t idx = 0; idx < nDepth; idx++) {
+		pPath[idx] = path[nDepth - idx - 1];
+	}
+	return nDepth;
+}
+static void AddSlowCall(PerformanceRec* pRecord)
+{
+	PerfSlowCalls::SlowCall	call;
 
-	return;
+	call.nDuration		= pRecord->GetLastCallTime();
+	call.nStartTime		= pRecord->GetLastEntryTime();
+	call.threadID		= pRecord->GetThreadID();
+	call.nDepth			= GetNodePath(pRecord, call.path, PERF_SLOW_CALL_MAX_DEPTH, &call.bTruncated);
+	pRecord->GetSlowCalls()->Add(call);
 }
+// Names are filled in just before the callback, so the thread that breached only copies IDs
+static void ResolveBudgetEvent(PerfBudgetEvent* pEvent)
+{
+	PerfIDData* pPerfData = FindPerfDataByPerfID(pEvent->id);
 
-void WriteCategoryReportToFile(CategoryReport* pReport, int nElements)
+	pEvent->szName		= (pPerfData != NULL) ? pPerfData->szName : "?";
+	pEvent->szCategory	= (pPerfData != NULL) ? pPerfData->szCategory : "?";
+	for(uint32_t idx = 0; idx < pEvent->nDepth; idx++) {
+		pPerfData = FindPerfDataByPerfID(pEvent->path[idx]);
+		pEvent->szPath[idx] = (pPerfData != NULL) ? pPerfData->szName : "?";
+	}
+}
+static void CheckBudget(PerformanceRec* pRecord)
 {
-	FILE * fp = fopen(szCatReportFile, "w");
-	if(fp != NULL) {
-		int idx = 0;
+	PerfBudget*		pBudget	= pRecord->GetBudget();
+	uint64_t		nBudget	= GetBudget(pBudget);
+	PerfBudgetEvent	event;
+	bool			bTruncated;
 
-		fprintf(fp, "Name");
-		fprintf(fp, "%s", ELEMENT_DELIMITER);
-		fprintf(fp, "Samples");
-		fprintf(fp, "%s", ELEMENT_DELIMITER);
-		fprintf(fp, "Total");
-		fprintf(fp, "%s", ELEMENT_DELIMITER);
-		fprintf(fp, "Self");
-		fprintf(fp, "%s", ELEMENT_DELIMITER);
-		fprintf(fp, "Min");
-		fprintf(fp, "%s", ELEMENT_DELIMITER);
-		fprintf(fp, "Max");
-		fprintf(fp, "%s", ELEMENT_DELIMITER);
-		fprintf(fp, "Avg");
-		#ifdef DISPLAY_CPU_TOTALS
-		fprintf(fp, "%s", ELEMENT_DELIMITER);
-		fprintf(fp, "CPU Total");
-		fprintf(fp, "%s", ELEMENT_DELIMITER);
-		fprintf(fp, "Self");
-		fprintf(fp, "%s", ELEMENT_DELIMITER);
-		fprintf(fp, "Min");
-		fprintf(fp, "%s", ELEMENT_DELIMITER);
-		fprintf(fp, "Max");
-		fprintf(fp, "%s", ELEMENT_DELIMITER);
-		fprintf(fp, "Avg");
-		fprintf(fp, "%s", ELEMENT_DELIMITER);
-		#endif
-		fprintf(fp, "\n");
-		for(idx = 0; idx < nElements; idx++) {
-			if(pReport[idx].nSamples > 0) {
-				fprintf(fp, "%s", pReport[idx].szName);
-				fprintf(fp, "%s", ELEMENT_DELIMITER);
-				fprintf(fp, "%u", pReport[idx].nSamples);
-				fprintf(fp, "%s", ELEMENT_DELIMITER);
-				fprintf(fp, "%lf", pReport[idx].nTotalTime / 1000.0);
-				fprintf(fp, "%s", ELEMENT_DELIMITER);
-				fprintf(fp, "%lf", pReport[idx].nSelfTime / 1000.0);
-				fprintf(fp, "%s", ELEMENT_DELIMITER);
-				fprintf(fp, "%lf", pReport[idx].nMinTime / 1000.0);
-				fprintf(fp, "%s", ELEMENT_DELIMITER);
-				fprintf(fp, "%lf", pReport[idx].nMaxTime / 1000.0);
-				fprintf(fp, "%s", ELEMENT_DELIMITER);
-				fprintf(fp, "%lf", pReport[idx].nAvgTime / 1000.0);
-#ifdef DISPLAY_CPU_TOTALS
-				fprintf(fp, "%s", ELEMENT_DELIMITER);
-				fprintf(fp, "%lf", pReport[idx].nTotalCPUTime * 1000.0);
-				fprintf(fp, "%s", ELEMENT_DELIMITER);
-				fprintf(fp, "%lf", pReport[idx].nSelfCPUTime * 1000.0);
-				fprintf(fp, "%s", ELEMENT_DELIMITER);
-				fprintf(fp, "%lf", pReport[idx].nMinCPUTime * 1000.0);
-				fprintf(fp, "%s", ELEMENT_DELIMITER);
-				fprintf(fp, "%lf", pReport[idx].nMaxCPUTime * 1000.0);
-				fprintf(fp, "%s", ELEMENT_DELIMITER);
-				fprintf(fp, "%lf", pReport[idx].nAvgCPUTime * 1000.0);
-#endif
-				fprintf(fp, "\n");
-			}
+	if(nBudget == 0 || pRecord->GetLastCallTime() <= nBudget) {
+		return;
+	}
+	__sync_fetch_and_add(&pBudget->nBreaches, 1);
+	// A callback that breaches its own budget isn't reported again
+	if(gpfnBudgetCallback == NULL || tlsInBudgetCallback == true) {
+		return;
+	}
+	event.id			= pRecord->GetID();
+	event.szName		= NULL;
+	event.szCategory	= NULL;
+	event.nDuration		= pRecord->GetLastCallTime();
+	event.nBudget		= nBudget;
+	event.nStartTime	= pRecord->GetLastEntryTime();
+	event.threadID		= pRecord->GetThreadID();
+	event.nDepth		= GetNodePath(pRecord, event.path, PERF_BUDGET_MAX_DEPTH, &bTruncated);
+	if(gbBudgetAsync == true) {
+		if(gpBudgetQueue != NULL && gpBudgetQueue->Push(event) == true) {
+			sem_post(&gBudgetSem);
 		}
-		fclose(fp);
 	}
-	return;
+	else {
+		tlsInBudgetCallback = true;
+		ResolveBudgetEvent(&event);
+		gpfnBudgetCallback(&event, gpBudgetContext);
+		tlsInBudgetCallback = false;
+	}
 }
-void WriteIDReportToFile(IDReport* pReport, int nElements)
+static void* BudgetThread(void* pArg)
 {
-	FILE * fp = fopen(szIDReportFile, "w");
-//	printf("AVE -- WriteIDReportToFile nElements = %d fp = %p\n", nElements, fp);
-	if(fp != NULL) {
-		int idx = 0;
+	PerfBudgetEvent	event;
+	bool			bRun	= true;
 
-		fprintf(fp, "Name");
-		fprintf(fp, "%s", ELEMENT_DELIMITER);
-		fprintf(fp, "Samples");
-		fprintf(fp, "%s", ELEMENT_DELIMITER);
-		fprintf(fp, "Total");
-		fprintf(fp, "%s", ELEMENT_DELIMITER);
-		fprintf(fp, "Self");
-		fprintf(fp, "%s", ELEMENT_DELIMITER);
-		fprintf(fp, "Min");
-		fprintf(fp, "%s", ELEMENT_DELIMITER);
-		fprintf(fp, "Max");
-		fprintf(fp, "%s", ELEMENT_DELIMITER);
-		fprintf(fp, "Avg");
-		fprintf(fp, "%s", ELEMENT_DELIMITER);
-		fprintf(fp, "Category");
-#ifdef DISPLAY_CPU_TOTALS
-		fprintf(fp, "%s", ELEMENT_DELIMITER);
-		fprintf(fp, "CPU Total");
-		fprintf(fp, "%s", ELEMENT_DELIMITER);
-		fprintf(fp, "Self");
-		fprintf(fp, "%s", ELEMENT_DELIMITER);
-		fprintf(fp, "Min");
-		fprintf(fp, "%s", ELEMENT_DELIMITER);
-		fprintf(fp, "Max");
-		fprintf(fp, "%s", ELEMENT_DELIMITER);
-		fprintf(fp, "Avg");
-		fprintf(fp, "%s", ELEMENT_DELIMITER);
-#endif
-		fprintf(fp, "\n");
-		for(idx = 0; idx < nElements; idx++) {
-//			printf("AVE -- WriteIDReportToFile name = %s samples = %d\n", pReport[idx].szName, pReport[idx].nSamples);
-			if(pReport[idx].nSamples > 0) {
-				fprintf(fp, "%s", pReport[idx].szName);
-				fprintf(fp, "%s", ELEMENT_DELIMITER);
-				fprintf(fp, "%u", pReport[idx].nSamples);
-				fprintf(fp, "%s", ELEMENT_DELIMITER);
-				fprintf(fp, "%lf", pReport[idx].nTotalTime / 1000.0);
-				fprintf(fp, "%s", ELEMENT_DELIMITER);
-				fprintf(fp, "%lf", pReport[idx].nSelfTime / 1000.0);
-				fprintf(fp, "%s", ELEMENT_DELIMITER);
-				fprintf(fp, "%lf", pReport[idx].nMinTime / 1000.0);
-				fprintf(fp, "%s", ELEMENT_DELIMITER);
-				fprintf(fp, "%lf", pReport[idx].nMaxTime / 1000.0);
-				fprintf(fp, "%s", ELEMENT_DELIMITER);
-				fprintf(fp, "%lf", pReport[idx].nAvgTime / 1000.0);
-				fprintf(fp, "%s", ELEMENT_DELIMITER);
-				fprintf(fp, "%s", pReport[idx].szCategory);
-#ifdef DISPLAY_CPU_TOTALS
-				fprintf(fp, "%s", ELEMENT_DELIMITER);
-				fprintf(fp, "%lf", pReport[idx].nTotalCPUTime * 1000.0);
-				fprintf(fp, "%s", ELEMENT_DELIMITER);
-				fprintf(fp, "%lf", pReport[idx].nSelfCPUTime * 1000.0);
-				fprintf(fp, "%s", ELEMENT_DELIMITER);
-				fprintf(fp, "%lf", pReport[idx].nMinCPUTime * 1000.0);
-				fprintf(fp, "%s", ELEMENT_DELIMITER);
-				fprintf(fp, "%lf", pReport[idx].nMaxCPUTime * 1000.0);
-				fprintf(fp, "%s", ELEMENT_DELIMITER);
-				fprintf(fp, "%lf", pReport[idx].nAvgCPUTime * 1000.0);
-#endif
-				fprintf(fp, "\n");
-			}
+	tlsInBudgetCallback = true;
+	while(bRun == true) {
+		sem_wait(&gBudgetSem);
+		bRun = __atomic_load_n(&gbBudgetThreadRun, __ATOMIC_ACQUIRE);
+		while(gpBudgetQueue->Pop(event) == true) {
+			ResolveBudgetEvent(&event);
+			gpfnBudgetCallback(&event, gpBudgetContext);
 		}
-		fclose(fp);
 	}
-	return;
+	return NULL;
 }
-void WriteTreeReportToFile()
+static void StartBudgetThread()
 {
-	ThreadRecord* 					pThread		= NULL;
-	list<ThreadRecord*>::iterator 	iter 		= mThreadList.begin();
+	if(gbBudgetThreadRun == true || gbBudgetAsync == false || gpfnBudgetCallback == NULL) {
+		return;
+	}
+	if(gpBudgetQueue == NULL) {
+		gpBudgetQueue = new PerfBudgetQueue();
+	}
+	gpBudgetQueue->Clear();
+	sem_init(&gBudgetSem, 0, 0);
+	gbBudgetThreadRun = true;
+	if(pthread_create(&gBudgetThread, NULL, BudgetThread, NULL) != 0) {
+		gbBudgetThreadRun = false;
+		sem_destroy(&gBudgetSem);
+	}
+}
+// Delivers whatever is still queued before returning
+static void StopBudgetThread()
+{
+	if(gbBudgetThreadRun == false) {
+		return;
+	}
+	__atomic_store_n(&gbBudgetThreadRun, false, __ATOMIC_RELEASE);
+	sem_post(&gBudgetSem);
+	pthread_join(gBudgetThread, NULL);
+	sem_destroy(&gBudgetSem);
+}
+static void AddThread(ThreadRecord* pThread)
+{
+	ThreadRecord* pHead = NULL;
 
-	FILE * fp = fopen(szTreeReportFile, "w");
-	if(fp != NULL) {
-		// Document Header
-#ifdef TREE_REPORT_XML
-		fprintf(fp,"<?xml version='1.0' encoding='utf-8' standalone='no'?>\n<TreeReport>\n");
-#endif
-		// Walk the threads
-		while(iter != mThreadList.end()) {
-			pThread	= *iter;
-			// Walk the nodes
-			Node * pParent = pThread->GetRootNode();
-			if(pParent != NULL) {
-				if(GetChildData(pParent, NULL, 0, TreeReportType, fp) == false) {
-					cout << "WriteTreeReportToFile ERROR"  << endl;
-					break;
+	do {
+		pHead = gpThreads;
+		pThread->SetNextThread(pHead);
+	} while(!__sync_bool_compare_and_swap(&gpThreads, pHead, pThread));
+}
+// A thread is stuck in the outermost open scope that has been open longer than
+// the limit.  The scopes inside it may come and go while it stays open, so
+// they're only reported as the path to where the thread is now.
+static void ReportStuckScopes(uint64_t nLimit)
+{
+	PerfShadowStack::Frame	frames[PERF_SHADOW_STACK_DEPTH];
+	uint64_t				nNow	= 0;
+
+	GetCurrentTimeStamp(&nNow);
+	ThreadRecord* pThread = __atomic_load_n(&gpThreads, __ATOMIC_ACQUIRE);
+	while(pThread != NULL) {
+		PerfShadowStack* pStack = pThread->GetShadowStack();
+		uint32_t nFrames	= 0;
+		uint32_t nDepth		= 0;
+		uint32_t nStuck		= 0;
+		if(pStack->Read(&frames[0], PERF_SHADOW_STACK_DEPTH, &nFrames, &nDepth) == true) {
+			for(uint32_t idx = 0; idx < nFrames && nStuck == 0; idx++) {
+				if(nNow > frames[idx].nEntryTime && nNow - frames[idx].nEntryTime > nLimit) {
+					nStuck = idx + 1;
 				}
 			}
-			iter++;
 		}
-#ifdef TREE_REPORT_XML
-		fprintf(fp,"</TreeReport>\n");
-#endif
-		fclose(fp);
+		if(nStuck > 0 && pStack->IsReported(nStuck, frames[nStuck - 1].nEntryTime) == false) {
+			PerfShadowStack::Frame*	pFrame	= &frames[nStuck - 1];
+			string					name;
+			string					path;
+
+			pStack->SetReported(nStuck, pFrame->nEntryTime);
+			__sync_fetch_and_add(&gnStuckScopes, 1);
+			PerfIDData* pPerfData = FindPerfDataByPerfID(pFrame->id);
+			name = (pPerfData != NULL) ? pPerfData->szName : "?";
+			for(uint32_t idx = 0; idx < nFrames; idx++) {
+				PerfIDData* pPathData = FindPerfDataByPerfID(frames[idx].id);
+				char szOpen[32];
+				snprintf(szOpen, sizeof(szOpen), " (%lu ms)", (unsigned long)((nNow - frames[idx].nEntryTime) / 1000));
+				path += (idx > 0) ? " > " : "";
+				path += (pPathData != NULL) ? pPathData->szName : "?";
+				path += szOpen;
+			}
+			cout << "STUCK: Thread " << (unsigned long)pStack->GetThreadID() << " (" << pStack->GetThreadName() << ")";
+			cout << " in " << name << " for " << (nNow - pFrame->nEntryTime) / 1000 << " ms";
+			cout << ", depth " << nDepth << ": " << path << endl;
+		}
+		pThread = pThread->GetNextThread();
 	}
-	return;
 }
-/*
-**---------------------------------------------------------------------
-** External Functions
-**---------------------------------------------------------------------
-*/
-/* Initialize the performance metrics system */
-bool PerfMetrics::PerfStart ( void )
+static void* WatchdogThread(void* pArg)
 {
+	uint64_t		nInterval	= gnWatchdog / 4;
+	struct timespec	wakeTime;
 
-	// Create an array for the threads
-	mThreadList.clear();
-	GetCurrentTimeStamp(&gStartTime);
-
-	// Setup mutex
-	if(bLockInit) {
-		pthread_mutexattr_t attr;
-		if (pthread_mutexattr_init(&attr) == 0) {
-			if (pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE) == 0)	{
-				int retVal = pthread_mutex_init(&lock, &attr);
-				if(retVal == 0)
-					bLockInit = true;
-			}
-			pthread_mutexattr_destroy(&attr);
+	// Often enough to catch a scope soon after it passes the limit
+	if(nInterval < 10) {
+		nInterval = 10;
+	}
+	else if(nInterval > 1000) {
+		nInterval = 1000;
+	}
+	pthread_mutex_lock(&gWatchdogMutex);
+	while(gbWatchdogRun == true) {
+		clock_gettime(CLOCK_REALTIME, &wakeTime);
+		wakeTime.tv_nsec	+= (nInterval % 1000) * 1000000;
+		wakeTime.tv_sec		+= nInterval / 1000 + wakeTime.tv_nsec / 1000000000;
+		wakeTime.tv_nsec	%= 1000000000;
+		pthread_cond_timedwait(&gWatchdogCond, &gWatchdogMutex, &wakeTime);
+		if(gbWatchdogRun == true) {
+			ReportStuckScopes(gnWatchdog * 1000);
+		}
+	}
+	pthread_mutex_unlock(&gWatchdogMutex);
+	return NULL;
+}
+static void StartWatchdog()
+{
+	if(gnWatchdog == 0 || gbWatchdogRun == true) {
+		return;
+	}
+	gbWatchdogRun = true;
+	if(pthread_create(&gWatchdogThread, NULL, WatchdogThread, NULL) != 0) {
+		gbWatchdogRun = false;
+	}
+}
+static void StopWatchdog()
+{
+	if(gbWatchdogRun == false) {
+		return;
+	}
+	pthread_mutex_lock(&gWatchdogMutex);
+	gbWatchdogRun = false;
+	pthread_cond_signal(&gWatchdogCond);
+	pthread_mutex_unlock(&gWatchdogMutex);
+	pthread_join(gWatchdogThread, NULL);
+}
+// Only the thread writes its counts, so plain adds published with atomic stores
+static void AddLiveCall(ThreadRecord* pThread, PerfID id, uint64_t nTime, uint64_t nSelf, bool bAborted)
+{
+	PerfLiveCounts* pCounts = pThread->GetLiveCounts();
+
+	// A thread that was running when the counts were turned on may not have them yet
+	if(id >= PERF_LIVE_MAX_IDS || pCounts == NULL) {
+		return;
+	}
+	pCounts += id;
+	__atomic_store_n(&pCounts->nCalls, pCounts->nCalls + 1, __ATOMIC_RELAXED);
+	__atomic_store_n(&pCounts->nTotalTime, pCounts->nTotalTime + nTime, __ATOMIC_RELAXED);
+	__atomic_store_n(&pCounts->nSelfTime, pCounts->nSelfTime + nSelf, __ATOMIC_RELAXED);
+	if(nTime > pCounts->nMaxTime) {
+		__atomic_store_n(&pCounts->nMaxTime, nTime, __ATOMIC_RELAXED);
+	}
+	if(bAborted == true) {
+		__atomic_store_n(&pCounts->nAbortedCalls, pCounts->nAbortedCalls + 1, __ATOMIC_RELAXED);
+	}
+	uint64_t* pnBucket = &pCounts->nLatency[PerfLiveStats::GetLatencyBucket(nTime)];
+	__atomic_store_n(pnBucket, *pnBucket + 1, __ATOMIC_RELAXED);
+}
+static void SumLiveCounts(PerfLiveCounts* pTotal, const PerfLiveCounts* pCounts)
+{
+	pTotal->nCalls			+= __atomic_load_n(&pCounts->nCalls, __ATOMIC_RELAXED);
+	pTotal->nTotalTime		+= __atomic_load_n(&pCounts->nTotalTime, __ATOMIC_RELAXED);
+	pTotal->nSelfTime		+= __atomic_load_n(&pCounts->nSelfTime, __ATOMIC_RELAXED);
+	pTotal->nAbortedCalls	+= __atomic_load_n(&pCounts->nAbortedCalls, __ATOMIC_RELAXED);
+	uint64_t nMax = __atomic_load_n(&pCounts->nMaxTime, __ATOMIC_RELAXED);
+	if(nMax > pTotal->nMaxTime) {
+		pTotal->nMaxTime = nMax;
+	}
+	for(uint32_t nBucket = 0; nBucket < PERF_LIVE_LATENCY_BUCKETS; nBucket++) {
+		pTotal->nLatency[nBucket] += __atomic_load_n(&pCounts->nLatency[nBucket], __ATOMIC_RELAXED);
+	}
+}
+//
+// Sum every thread's counts by ID and by category, in registry order.  Nothing
+// is locked, the registry is append-only and a thread's counts may be a call
+// behind.  The names stay valid until PERF_CLEANUP, which stops every reader
+// first.
+//
+static void GetLiveSnapshot(vector<PerfLiveRow>& ids, vector<PerfLiveRow>& categories)
+{
+	PerfLiveRow		row;
+	PerfIDList		idList	= gPerfIDList;		// Before the categories, so they have every ID's
+	PerfCatList		catList	= gPerfCatList;
+
+	ids.clear();
+	categories.clear();
+	for(PerfCatList::iterator catIter = catList.begin(); catIter != catList.end(); catIter++) {
+		memset(&row, 0, sizeof(row));
+		row.id			= (*catIter)->nID;
+		row.szName		= (*catIter)->szName;
+		row.szCategory	= (*catIter)->szName;
+		categories.push_back(row);
+	}
+	for(PerfIDList::iterator iter = idList.begin(); iter != idList.end(); iter++) {
+		PerfIDData* pPerfData = *iter;
+		memset(&row, 0, sizeof(row));
+		row.id			= pPerfData->id;
+		row.szName		= pPerfData->szName;
+		row.szCategory	= pPerfData->szCategory;
+		if(pPerfData->id < PERF_LIVE_MAX_IDS) {
+			for(ThreadRecord* pThread = __atomic_load_n(&gpThreads, __ATOMIC_ACQUIRE); pThread != NULL; pThread = pThread->GetNextThread()) {
+				PerfLiveCounts* pCounts = pThread->GetLiveCounts();
+				if(pCounts != NULL) {
+					SumLiveCounts(&row.counts, &pCounts[pPerfData->id]);
+				}
+			}
+		}
+		ids.push_back(row);
+		for(size_t nCat = 0; nCat < categories.size(); nCat++) {
+			if(categories[nCat].id == pPerfData->categoryID) {
+				SumLiveCounts(&categories[nCat].counts, &row.counts);
+				break;
+			}
+		}
+	}
+}
+//
+// Copy a snapshot into the segment.  IDs and categories keep the slot of
+// their place in the registry, which only grows.
+//
+static void PublishLiveStats(bool bStopped)
+{
+	vector<PerfLiveRow>	ids;
+	vector<PerfLiveRow>	categories;
+	uint64_t			nNow		= 0;
+	uint32_t			nDropped	= 0;
+
+	GetLiveSnapshot(ids, categories);
+	for(uint32_t nSlot = 0; nSlot < ids.size(); nSlot++) {
+		// Calls of a PerfID this large aren't counted, see AddLiveCall
+		if(nSlot >= PERF_LIVE_MAX_IDS || ids[nSlot].id >= PERF_LIVE_MAX_IDS) {
+			nDropped++;
+		}
+		if(nSlot < PERF_LIVE_MAX_IDS) {
+			gpLiveStats->SetID(nSlot, ids[nSlot].id, ids[nSlot].szName, ids[nSlot].szCategory, ids[nSlot].counts);
+		}
+	}
+	gpLiveStats->SetDroppedIDs(nDropped);
+	for(uint32_t nSlot = 0; nSlot < categories.size() && nSlot < PERF_LIVE_MAX_CATEGORIES; nSlot++) {
+		gpLiveStats->SetCategory(nSlot, categories[nSlot].id, categories[nSlot].szName, categories[nSlot].counts);
+	}
+	GetCurrentTimeStamp(&nNow);
+	gpLiveStats->SetUpdated(nNow, bStopped);
+}
+static void* LiveStatsThread(void* pArg)
+{
+	struct timespec	wakeTime;
+
+	pthread_mutex_lock(&gLiveStatsMutex);
+	while(gbLiveStatsRun == true) {
+		clock_gettime(CLOCK_REALTIME, &wakeTime);
+		wakeTime.tv_nsec	+= (gnLiveStats % 1000) * 1000000;
+		wakeTime.tv_sec		+= gnLiveStats / 1000 + wakeTime.tv_nsec / 1000000000;
+		wakeTime.tv_nsec	%= 1000000000;
+		pthread_cond_timedwait(&gLiveStatsCond, &gLiveStatsMutex, &wakeTime);
+		if(gbLiveStatsRun == true) {
+			PublishLiveStats(false);
+		}
+	}
+	pthread_mutex_unlock(&gLiveStatsMutex);
+	return NULL;
+}
+//
+// Threads that register from now on create their counts as they register,
+// the ones already running get them here, so PerfExit never allocates them.
+//
+static void EnableLiveCounts()
+{
+	__atomic_store_n(&gbLiveCounts, true, __ATOMIC_SEQ_CST);
+	for(ThreadRecord* pThread = __atomic_load_n(&gpThreads, __ATOMIC_SEQ_CST); pThread != NULL; pThread = pThread->GetNextThread()) {
+		pThread->CreateLiveCounts();
+	}
+}
+static void StartLiveStats()
+{
+	if(gnLiveStats == 0 || gbLiveStatsRun == true) {
+		return;
+	}
+	if(gpLiveStats == NULL) {
+		gpLiveStats = new PerfLiveStats();
+		if(gpLiveStats->Create(gnLiveStats, gStartTime) == false) {
+			cout << "ERROR: PerfMetrics could not create the live stats segment, errno " << errno << endl;
+			delete gpLiveStats;
+			gpLiveStats = NULL;
+			return;
+		}
+	}
+	EnableLiveCounts();
+	gbLiveStatsRun	= true;
+	if(pthread_create(&gLiveStatsThread, NULL, LiveStatsThread, NULL) != 0) {
+		gbLiveStatsRun = false;
+	}
+}
+// The final totals stay in the segment until PERF_CLEANUP
+static void StopLiveStats()
+{
+	if(gbLiveStatsRun == true) {
+		pthread_mutex_lock(&gLiveStatsMutex);
+		gbLiveStatsRun = false;
+		pthread_cond_signal(&gLiveStatsCond);
+		pthread_mutex_unlock(&gLiveStatsMutex);
+		pthread_join(gLiveStatsThread, NULL);
+	}
+	if(gpLiveStats != NULL) {
+		PublishLiveStats(true);
+	}
+}
+static void AppendMetric(string& body, const char* szFormat, ...)
+{
+	char	buff[1024];
+	va_list	va;
+
+	va_start(va, szFormat);
+	int nLen = vsnprintf(buff, sizeof(buff), szFormat, va);
+	va_end(va);
+	if(nLen > 0) {
+		body.append(buff, (size_t)nLen < sizeof(buff) ? nLen : sizeof(buff) - 1);
+	}
+}
+// Label values escape backslash, double quote and newline
+static string GetMetricLabel(const char* szValue)
+{
+	string label;
+
+	for(const char* p = szValue; p != NULL && *p != '\0'; p++) {
+		if(*p == '\\' || *p == '"') {
+			label += '\\';
+			label += *p;
+		}
+		else if(*p == '\n') {
+			label += "\\n";
+		}
+		else {
+			label += *p;
+		}
+	}
+	return label;
+}
+static void AppendMetricHeader(string& body, const char* szName, const char* szType, const char* szHelp)
+{
+	AppendMetric(body, "# HELP %s %s\n# TYPE %s %s\n", szName, szHelp, szName, szType);
+}
+//
+// The endpoint's body, in the Prometheus text format.  Built on the
+// endpoint's thread from a snapshot, a scrape takes no lock PERF_ENTRY or a
+// new ID could wait on.  Times are in seconds.
+//
+static bool FormatEndpointMetrics(string& body, void* pContext)
+{
+	vector<PerfLiveRow>	ids;
+	vector<PerfLiveRow>	categories;
+	vector<string>		labels;
+	uint64_t			nThreads	= 0;
+
+	GetLiveSnapshot(ids, categories);
+	for(size_t i = 0; i < ids.size(); i++) {
+		labels.push_back("name=\"" + GetMetricLabel(ids[i].szName) + "\",category=\"" + GetMetricLabel(ids[i].szCategory) + "\"");
+	}
+
+	AppendMetricHeader(body, "perfmetrics_calls_total", "counter", "Calls completed by ID.");
+	for(size_t i = 0; i < ids.size(); i++) {
+		AppendMetric(body, "perfmetrics_calls_total{%s} %llu\n", labels[i].c_str(), (unsigned long long)ids[i].counts.nCalls);
+	}
+	AppendMetricHeader(body, "perfmetrics_self_seconds_total", "counter", "Time spent in each ID less its children.");
+	for(size_t i = 0; i < ids.size(); i++) {
+		AppendMetric(body, "perfmetrics_self_seconds_total{%s} %.6f\n", labels[i].c_str(), ids[i].counts.nSelfTime / 1e6);
+	}
+	AppendMetricHeader(body, "perfmetrics_aborted_calls_total", "counter", "Calls closed by the exit of an outer ID.");
+	for(size_t i = 0; i < ids.size(); i++) {
+		AppendMetric(body, "perfmetrics_aborted_calls_total{%s} %llu\n", labels[i].c_str(), (unsigned long long)ids[i].counts.nAbortedCalls);
+	}
+	AppendMetricHeader(body, "perfmetrics_max_call_seconds", "gauge", "Longest call by ID since PERF_START.");
+	for(size_t i = 0; i < ids.size(); i++) {
+		AppendMetric(body, "perfmetrics_max_call_seconds{%s} %.6f\n", labels[i].c_str(), ids[i].counts.nMaxTime / 1e6);
+	}
+	AppendMetricHeader(body, "perfmetrics_call_duration_seconds", "histogram", "Call time by ID, children included.");
+	for(size_t i = 0; i < ids.size(); i++) {
+		uint64_t nCount = 0;
+		for(uint32_t nBucket = 0; nBucket < PERF_LIVE_LATENCY_BUCKETS - 1; nBucket++) {
+			nCount += ids[i].counts.nLatency[nBucket];
+			AppendMetric(body, "perfmetrics_call_duration_seconds_bucket{%s,le=\"%.9g\"} %llu\n", labels[i].c_str(),
+						 PerfLiveStats::GetBucketLimit(nBucket) / 1e6, (unsigned long long)nCount);
+		}
+		nCount += ids[i].counts.nLatency[PERF_LIVE_LATENCY_BUCKETS - 1];
+		AppendMetric(body, "perfmetrics_call_duration_seconds_bucket{%s,le=\"+Inf\"} %llu\n", labels[i].c_str(), (unsigned long long)nCount);
+		AppendMetric(body, "perfmetrics_call_duration_seconds_sum{%s} %.6f\n", labels[i].c_str(), ids[i].counts.nTotalTime / 1e6);
+		AppendMetric(body, "perfmetrics_call_duration_seconds_count{%s} %llu\n", labels[i].c_str(), (unsigned long long)nCount);
+	}
+
+	AppendMetricHeader(body, "perfmetrics_category_calls_total", "counter", "Calls completed by category.");
+	for(size_t i = 0; i < categories.size(); i++) {
+		AppendMetric(body, "perfmetrics_category_calls_total{category=\"%s\"} %llu\n", GetMetricLabel(categories[i].szName).c_str(),
+					 (unsigned long long)categories[i].counts.nCalls);
+	}
+	AppendMetricHeader(body, "perfmetrics_category_self_seconds_total", "counter", "Self time summed over the IDs of each category.");
+	for(size_t i = 0; i < categories.size(); i++) {
+		AppendMetric(body, "perfmetrics_category_self_seconds_total{category=\"%s\"} %.6f\n", GetMetricLabel(categories[i].szName).c_str(),
+					 categories[i].counts.nSelfTime / 1e6);
+	}
+	AppendMetricHeader(body, "perfmetrics_category_aborted_calls_total", "counter", "Aborted calls by category.");
+	for(size_t i = 0; i < categories.size(); i++) {
+		AppendMetric(body, "perfmetrics_category_aborted_calls_total{category=\"%s\"} %llu\n", GetMetricLabel(categories[i].szName).c_str(),
+					 (unsigned long long)categories[i].counts.nAbortedCalls);
+	}
+
+	for(ThreadRecord* pThread = __atomic_load_n(&gpThreads, __ATOMIC_ACQUIRE); pThread != NULL; pThread = pThread->GetNextThread()) {
+		nThreads++;
+	}
+	AppendMetricHeader(body, "perfmetrics_threads", "gauge", "Threads seen by the profiler.");
+	AppendMetric(body, "perfmetrics_threads %llu\n", (unsigned long long)nThreads);
+	AppendMetricHeader(body, "perfmetrics_profiler_memory_bytes", "gauge", "Memory held by the call trees.");
+	AppendMetric(body, "perfmetrics_profiler_memory_bytes %llu\n", (unsigned long long)gnProfilerMemory);
+	AppendMetricHeader(body, "perfmetrics_dropped_calls_total", "counter", "Calls not given a node because of a limit.");
+	AppendMetric(body, "perfmetrics_dropped_calls_total %llu\n", (unsigned long long)gnDroppedCalls);
+	AppendMetricHeader(body, "perfmetrics_stuck_scopes_total", "counter", "Scopes reported by the watchdog.");
+	AppendMetric(body, "perfmetrics_stuck_scopes_total %llu\n", (unsigned long long)gnStuckScopes);
+	return true;
+}
+static void StartMetricsEndpoint()
+{
+	if(gszMetricsEndpoint[0] == '\0' || gpMetricsEndpoint != NULL) {
+		return;
+	}
+	gpMetricsEndpoint = new PerfMetricsEndpoint();
+	if(gpMetricsEndpoint->Start(gszMetricsEndpoint, FormatEndpointMetrics, NULL) == false) {
+		cout << "ERROR: PerfMetrics could not listen on " << gszMetricsEndpoint << ", errno " << errno << endl;
+		delete gpMetricsEndpoint;
+		gpMetricsEndpoint = NULL;
+		return;
+	}
+	EnableLiveCounts();
+}
+static void StopMetricsEndpoint()
+{
+	if(gpMetricsEndpoint != NULL) {
+		gpMetricsEndpoint->Stop();
+		delete gpMetricsEndpoint;
+		gpMetricsEndpoint = NULL;
+	}
+}
+// Caller holds gRegistryMutex
+static PerfIDData* AddInternalID(const char* szName, const char* szCategory, PerfID id, PerfID catID)
+{
+	PerfIDData* pPerfData 	= NewRegistryData<PerfIDData>();
+	pPerfData->szName		= RegistryStrDup(szName);
+	pPerfData->szCategory 	= szCategory;
+	pPerfData->id 			= id;
+	pPerfData->categoryID	= catID;
+	gPerfIDList.push_back(pPerfData);
+	if(gpImage != NULL) {
+		gpImage->AddID(id, catID, pPerfData->szName, szCategory, true);
+	}
+	return pPerfData;
+}
+static PerfIDData* FindPerfDataByName(const char* szName, const char* szCategory)
+{
+	PerfIDList::iterator 	iter 	= gPerfIDList.begin();
+
+	while(iter != gPerfIDList.end()) {
+		PerfIDData* pPerfData = *iter;
+		if(strcmp(pPerfData->szCategory, szCategory) == 0) {
+			if(strcmp(pPerfData->szName, szName) == 0) {
+				return pPerfData;
+			}
+		}
+		iter++;
+	}
+	return NULL;
+}
+// Caller holds gRegistryMutex
+static PerfIDData* AddPerfData(const char* szName, PerfCategoryData* pPerfCatData, PerfID id)
+{
+	PerfIDData* pPerfData = NewRegistryData<PerfIDData>();
+	pPerfData->szName		= RegistryStrDup(szName);
+	pPerfData->categoryID	= pPerfCatData->nID;
+	pPerfData->szCategory 	= pPerfCatData->szName;
+	pPerfData->id 			= id;
+	pPerfData->budget.pnCategoryBudget = &pPerfCatData->nBudget;
+	if(gnSlowCalls != 0) {
+		pPerfData->pSlowCalls	= new PerfSlowCalls(gnSlowCalls);
+	}
+	gPerfIDList.push_back(pPerfData);
+	if(gpImage != NULL) {
+		gpImage->AddID(id, pPerfCatData->nID, pPerfData->szName, pPerfCatData->szName, false);
+	}
+	return pPerfData;
+}
+static PerfCategoryData* FindCategoryData(const char* szCategory)
+{
+	PerfCatList::iterator 	catIter = gPerfCatList.begin();
+
+	while(catIter != gPerfCatList.end()) {
+		if(strcmp((*catIter)->szName, szCategory) == 0) {
+			return *catIter;
+		}
+		catIter++;
+	}
+	return NULL;
+}
+static PerfCategoryData* FindCategoryDataByID(PerfID catID)
+{
+	PerfCatList::iterator 	catIter = gPerfCatList.begin();
+
+	while(catIter != gPerfCatList.end()) {
+		if((*catIter)->nID == catID) {
+			return *catIter;
+		}
+		catIter++;
+	}
+	return NULL;
+}
+static void StartImage()
+{
+	if(gszImageFile[0] == '\0' || gpImage != NULL) {
+		return;
+	}
+	gpImage = new PerfImage();
+	if(gpImage->Create(gszImageFile, gnImageNodes != 0 ? gnImageNodes : PERF_IMAGE_DEFAULT_NODES, gStartTime) == false) {
+		cout << "ERROR: PerfMetrics could not map " << gszImageFile << ", errno " << errno << endl;
+		delete gpImage;
+		gpImage = NULL;
+		return;
+	}
+	for(PerfIDList::iterator iter = gPerfIDList.begin(); iter != gPerfIDList.end(); iter++) {
+		bool bInternal = FindCategoryDataByID((*iter)->categoryID) == NULL;
+		gpImage->AddID((*iter)->id, (*iter)->categoryID, (*iter)->szName, (*iter)->szCategory, bInternal);
+	}
+}
+// Caller holds gRegistryMutex
+static PerfCategoryData* AddCategoryData(const char* szCategory, PerfID catID)
+{
+	PerfCategoryData* pPerfCatData = NewRegistryData<PerfCategoryData>();
+	pPerfCatData->szName 	= RegistryStrDup(szCategory);
+	pPerfCatData->nID 		= catID;
+	pPerfCatData->bRusage	= false;
+	gPerfCatList.push_back(pPerfCatData);
+	return pPerfCatData;
+}
+static PerfID NextUniqueID()
+{
+	pthread_mutex_lock(&lock);
+	PerfID id = ++nID;
+	pthread_mutex_unlock(&lock);
+	return id;
+}
+// The lookups don't lock, a name that isn't there is looked up again under
+// the lock before it's added
+static PerfCategoryData* FindOrAddCategoryData(const char* szCategory)
+{
+	PerfCategoryData* pPerfCatData = FindCategoryData(szCategory);
+
+	if(pPerfCatData == NULL) {
+		pthread_mutex_lock(&gRegistryMutex);
+		pPerfCatData = FindCategoryData(szCategory);
+		if(pPerfCatData == NULL) {
+			pPerfCatData = AddCategoryData(szCategory, NextUniqueID());
+		}
+		pthread_mutex_unlock(&gRegistryMutex);
+	}
+	return pPerfCatData;
+}
+static PerfIDData* FindOrAddPerfData(const char* szName, const char* szCategory)
+{
+	PerfIDData* pPerfData = FindPerfDataByName(szName, szCategory);
+
+	if(pPerfData == NULL) {
+		pthread_mutex_lock(&gRegistryMutex);
+		pPerfData = FindPerfDataByName(szName, szCategory);
+		if(pPerfData == NULL) {
+			// Is this a new category
+			PerfCategoryData* pPerfCatData = FindCategoryData(szCategory);
+			if(pPerfCatData == NULL) {
+				pPerfCatData = AddCategoryData(szCategory, NextUniqueID());
+			}
+			pPerfData = AddPerfData(szName, pPerfCatData, NextUniqueID());
+		}
+		pthread_mutex_unlock(&gRegistryMutex);
+	}
+	return pPerfData;
+}
+static PerformanceRec* GetOverflowRecord(ThreadRecord* pThread, PerformanceRec* pParent)
+{
+	NodeList::iterator 	iter		= pParent->GetSiblingIterator();
+	PerformanceRec*			pOverflow	= NULL;
+
+	while(pParent->IsSiblingEnd(iter) == false) {
+		if(((PerformanceRec*)*iter)->GetID() == gPERF_ID_OVERFLOW) {
+			return (PerformanceRec*)*iter;
+		}
+		iter++;
+	}
+	// Already paid for and reserved by the parent, see PERF_NODE_MEMORY
+	pThread->ReleaseArena(PERF_RECORD_MEMORY);
+	pOverflow = NewPerfRecord(gPERF_ID_OVERFLOW, gPERF_CATID_OVERFLOW, PerfRecord, pParent, pThread->GetThreadID(), pThread->GetArena());
+	pParent->AddSibling(pOverflow);
+	return pOverflow;
+}
+//
+// Add a child record, or when a tree limit has been reached charge the call
+// to the parent's [other] node instead.
+//
+static PerformanceRec* AddChildRecord(ThreadRecord* pThread, PerformanceRec* pParent, PerfID id)
+{
+	PerformanceRec* 	pChild			= NULL;
+	PerfID				catID			= FindPerfDataByPerfID(id)->categoryID;
+	PerfCategoryData*	pPerfCatData	= (gbRusage == true) ? FindCategoryDataByID(catID) : NULL;
+	bool				bRusage			= (pPerfCatData != NULL && pPerfCatData->bRusage == true);
+	uint64_t			nMemory			= PERF_NODE_MEMORY;
+
+	// The whole footprint is checked up front, so neither the blocks nor the
+	// [other] node ever go past the limit or out of the arena onto the heap
+	if(bRusage == true) {
+		nMemory += PerformanceRec::GetRusageMemory();
+	}
+	if(pThread->GetCounters() != NULL) {
+		nMemory += PerformanceRec::GetCountersMemory();
+	}
+	if((gnMaxThreadNodes != 0 && pThread->GetNodeCount() >= gnMaxThreadNodes) ||
+	   (gnMaxDepth != 0 && pParent->GetDepth() >= gnMaxDepth) ||
+	   ChargeNodeMemory(pThread, nMemory) == false) {
+		pThread->AddDroppedCall();
+		__sync_fetch_and_add(&gnDroppedCalls, 1);
+		return GetOverflowRecord(pThread, pParent);
+	}
+	pChild = NewPerfRecord(id, catID, PerfRecord, pParent, pThread->GetThreadID(), pThread->GetArena());
+	pParent->AddSibling(pChild);
+	pThread->AddNode();
+	pThread->ReserveArena(PERF_RECORD_MEMORY);
+	if(bRusage == true) {
+		pChild->EnableRusage(pThread->GetArena());
+	}
+	if(pThread->GetCounters() != NULL) {
+		pChild->EnableCounters(pThread->GetCounters(), pThread->GetArena());
+	}
+	return pChild;
+}
+//
+// Find the open record for this ID on the thread's call path.  Once calls
+// have been folded the path is no longer just the tree parents of the
+// current node, so it's taken from the thread's frames.
+//
+static PerformanceRec* FindActiveRecord(ThreadRecord* pThread, PerfID id)
+{
+	size_t nFrame = pThread->GetFrameDepth();
+
+	while(nFrame > 0) {
+		ThreadRecord::EntryFrame* pFrame = pThread->GetFrame(--nFrame);
+		if(pFrame->pRecord->GetID() == id) {
+			return pFrame->pRecord;
+		}
+	}
+	return NULL;
+}
+//
+// Close the thread's innermost call.  An aborted call is timed up to now, the
+// exit of the outer call that unwound it.
+//
+static void CloseFrame(ThreadRecord* pThread, bool bAborted)
+{
+	ThreadRecord::EntryFrame	frame	= *pThread->GetFrame(pThread->GetFrameDepth() - 1);
+	PerformanceRec*				pRecord	= frame.pRecord;
+	uint64_t					nTime	= 0;
+
+	{
+		// Not held for the budget callback, it may block
+		PerfTreeGuard guard(pThread);
+
+		pThread->PopFrame();
+		if(bAborted == true) {
+			pRecord->AddAbortedCall();
+			__sync_fetch_and_add(&gnAbortedCalls, 1);
+		}
+		if(frame.bFolded == true) {
+			// Exit of a folded call, go back to where it was made from
+			uint64_t nExitTime = 0;
+			GetCurrentTimeStamp(&nExitTime);
+			nTime = nExitTime - frame.nEntryTime;
+			pRecord->AddRecursiveExit(nTime);
+			((PerformanceRec*)frame.pReturn)->AddFoldedTime(nTime);
+		}
+		else {
+			pRecord->AddExit(frame.nEntryTime);
+			nTime = pRecord->GetLastCallTime();
+		}
+		if(pThread->GetFrameDepth() > 0) {
+			pThread->GetFrame(pThread->GetFrameDepth() - 1)->nChildTime += nTime;
+		}
+		if(gbLiveCounts == true) {
+			AddLiveCall(pThread, frame.id, nTime, nTime > frame.nChildTime ? nTime - frame.nChildTime : 0, bAborted);
+		}
+		if(frame.bFolded == true) {
+			pThread->SetCurrentNode(frame.pReturn);
+			return;
+		}
+		if(pRecord->GetSlowCalls() != NULL && pRecord->GetLastCallTime() > pRecord->GetSlowCalls()->GetThreshold()) {
+			AddSlowCall(pRecord);
+		}
+		pThread->SetCurrentNode(frame.pReturn);
+	}
+	// After the current node moves up, so scopes in the callback aren't children of this call
+	if(pRecord->GetBudget() != NULL) {
+		CheckBudget(pRecord);
+	}
+}
+
+static void SortIDByTotalCalls(IDReport* pReport, int nElements)
+{
+	int i, j;
+	IDReport temp;
+	int numLength = nElements;
+
+	for(i = 0; i< (numLength -1); i++)  {
+		for(j = (i+1); j < numLength; j++) {
+			if (pReport[i].nSamples < pReport[j].nSamples) {
+				temp 		= pReport[i];          // swap
+				pReport[i] 	= pReport[j];
+				pReport[j] 	= temp;
+			}
+		}
+	}
+
+	return;
+}
+
+// In the working directory, or a dump's directory, see DumpReports
+static FILE* OpenReportFile(const char* szFile)
+{
+	std::string path = gReportDir + szFile;
+	return fopen(path.c_str(), "w");
+}
+void WriteCategoryReportToFile(CategoryReport* pReport, int nElements)
+{
+	FILE * fp = OpenReportFile(szCatReportFile);
+	if(fp != NULL) {
+		int idx = 0;
+
+		fprintf(fp, "Name");
+		fprintf(fp, "%s", ELEMENT_DELIMITER);
+		fprintf(fp, "Samples");
+		fprintf(fp, "%s", ELEMENT_DELIMITER);
+		fprintf(fp, "Total");
+		fprintf(fp, "%s", ELEMENT_DELIMITER);
+		fprintf(fp, "Self");
+		fprintf(fp, "%s", ELEMENT_DELIMITER);
+		fprintf(fp, "Min");
+		fprintf(fp, "%s", ELEMENT_DELIMITER);
+		fprintf(fp, "Max");
+		fprintf(fp, "%s", ELEMENT_DELIMITER);
+		fprintf(fp, "Avg");
+		if(gbRusage == true) {
+			WriteRusageHeader(fp);
+		}
+		if(geCounterMode != PerfCountersNone) {
+			WriteCounterHeader(fp);
+		}
+		if(gbIO == true) {
+			WriteIOHeader(fp);
+		}
+		if(gbWork == true) {
+			WriteWorkHeader(fp);
+		}
+		#ifdef DISPLAY_CPU_TOTALS
+		fprintf(fp, "%s", ELEMENT_DELIMITER);
+		fprintf(fp, "CPU Total");
+		fprintf(fp, "%s", ELEMENT_DELIMITER);
+		fprintf(fp, "Self");
+		fprintf(fp, "%s", ELEMENT_DELIMITER);
+		fprintf(fp, "Min");
+		fprintf(fp, "%s", ELEMENT_DELIMITER);
+		fprintf(fp, "Max");
+		fprintf(fp, "%s", ELEMENT_DELIMITER);
+		fprintf(fp, "Avg");
+		fprintf(fp, "%s", ELEMENT_DELIMITER);
+		#endif
+		fprintf(fp, "\n");
+		for(idx = 0; idx < nElements; idx++) {
+			if(pReport[idx].nSamples > 0) {
+				fprintf(fp, "%s", pReport[idx].szName);
+				fprintf(fp, "%s", ELEMENT_DELIMITER);
+				fprintf(fp, "%u", pReport[idx].nSamples);
+				fprintf(fp, "%s", ELEMENT_DELIMITER);
+				fprintf(fp, "%lf", pReport[idx].nTotalTime / 1000.0);
+				fprintf(fp, "%s", ELEMENT_DELIMITER);
+				fprintf(fp, "%lf", pReport[idx].nSelfTime / 1000.0);
+				fprintf(fp, "%s", ELEMENT_DELIMITER);
+				fprintf(fp, "%lf", pReport[idx].nMinTime / 1000.0);
+				fprintf(fp, "%s", ELEMENT_DELIMITER);
+				fprintf(fp, "%lf", pReport[idx].nMaxTime / 1000.0);
+				fprintf(fp, "%s", ELEMENT_DELIMITER);
+				fprintf(fp, "%lf", pReport[idx].nAvgTime / 1000.0);
+				if(gbRusage == true) {
+					WriteRusageColumns(fp, &pReport[idx].rusage);
+				}
+				if(geCounterMode != PerfCountersNone) {
+					WriteCounterColumns(fp, pReport[idx].nCounterValues, pReport[idx].nSamples);
+				}
+				if(gbIO == true) {
+					WriteIOColumns(fp, &pReport[idx].io);
+				}
+				if(gbWork == true) {
+					WriteWorkColumns(fp, pReport[idx].nTotalTime, pReport[idx].nWorkUnits);
+				}
+#ifdef DISPLAY_CPU_TOTALS
+				fprintf(fp, "%s", ELEMENT_DELIMITER);
+				fprintf(fp, "%lf", pReport[idx].nTotalCPUTime * 1000.0);
+				fprintf(fp, "%s", ELEMENT_DELIMITER);
+				fprintf(fp, "%lf", pReport[idx].nSelfCPUTime * 1000.0);
+				fprintf(fp, "%s", ELEMENT_DELIMITER);
+				fprintf(fp, "%lf", pReport[idx].nMinCPUTime * 1000.0);
+				fprintf(fp, "%s", ELEMENT_DELIMITER);
+				fprintf(fp, "%lf", pReport[idx].nMaxCPUTime * 1000.0);
+				fprintf(fp, "%s", ELEMENT_DELIMITER);
+				fprintf(fp, "%lf", pReport[idx].nAvgCPUTime * 1000.0);
+#endif
+				fprintf(fp, "\n");
+			}
+		}
+		fclose(fp);
+	}
+	return;
+}
+void WriteIDReportToFile(IDReport* pReport, int nElements)
+{
+	FILE * fp = OpenReportFile(szIDReportFile);
+//	printf("AVE -- WriteIDReportToFile nElements = %d fp = %p\n", nElements, fp);
+	if(fp != NULL) {
+		int idx = 0;
+
+		fprintf(fp, "Name");
+		fprintf(fp, "%s", ELEMENT_DELIMITER);
+		fprintf(fp, "Samples");
+		fprintf(fp, "%s", ELEMENT_DELIMITER);
+		fprintf(fp, "Total");
+		fprintf(fp, "%s", ELEMENT_DELIMITER);
+		fprintf(fp, "Self");
+		fprintf(fp, "%s", ELEMENT_DELIMITER);
+		fprintf(fp, "Min");
+		fprintf(fp, "%s", ELEMENT_DELIMITER);
+		fprintf(fp, "Max");
+		fprintf(fp, "%s", ELEMENT_DELIMITER);
+		fprintf(fp, "Avg");
+		fprintf(fp, "%s", ELEMENT_DELIMITER);
+		fprintf(fp, "Category");
+#ifdef PERFORMANCE_MEMORY
+		fprintf(fp, "%s", ELEMENT_DELIMITER);
+		fprintf(fp, "Allocs");
+		fprintf(fp, "%s", ELEMENT_DELIMITER);
+		fprintf(fp, "Alloc Bytes");
+		fprintf(fp, "%s", ELEMENT_DELIMITER);
+		fprintf(fp, "Frees");
+		fprintf(fp, "%s", ELEMENT_DELIMITER);
+		fprintf(fp, "Live Bytes");
+#endif
+		if(gbRusage == true) {
+			WriteRusageHeader(fp);
+		}
+		if(geCounterMode != PerfCountersNone) {
+			WriteCounterHeader(fp);
+		}
+		if(gbIO == true) {
+			WriteIOHeader(fp);
+		}
+		if(gbWork == true) {
+			WriteWorkHeader(fp);
+		}
+		if(gbBudgets == true) {
+			WriteBudgetHeader(fp);
+		}
+		if(gnAbortedCalls > 0) {
+			fprintf(fp, "%sAborted", ELEMENT_DELIMITER);
+		}
+#ifdef DISPLAY_CPU_TOTALS
+		fprintf(fp, "%s", ELEMENT_DELIMITER);
+		fprintf(fp, "CPU Total");
+		fprintf(fp, "%s", ELEMENT_DELIMITER);
+		fprintf(fp, "Self");
+		fprintf(fp, "%s", ELEMENT_DELIMITER);
+		fprintf(fp, "Min");
+		fprintf(fp, "%s", ELEMENT_DELIMITER);
+		fprintf(fp, "Max");
+		fprintf(fp, "%s", ELEMENT_DELIMITER);
+		fprintf(fp, "Avg");
+		fprintf(fp, "%s", ELEMENT_DELIMITER);
+#endif
+		fprintf(fp, "\n");
+		for(idx = 0; idx < nElements; idx++) {
+//			printf("AVE -- WriteIDReportToFile name = %s samples = %d\n", pReport[idx].szName, pReport[idx].nSamples);
+			if(pReport[idx].nSamples > 0) {
+				fprintf(fp, "%s", pReport[idx].szName);
+				fprintf(fp, "%s", ELEMENT_DELIMITER);
+				fprintf(fp, "%u", pReport[idx].nSamples);
+				fprintf(fp, "%s", ELEMENT_DELIMITER);
+				fprintf(fp, "%lf", pReport[idx].nTotalTime / 1000.0);
+				fprintf(fp, "%s", ELEMENT_DELIMITER);
+				fprintf(fp, "%lf", pReport[idx].nSelfTime / 1000.0);
+				fprintf(fp, "%s", ELEMENT_DELIMITER);
+				fprintf(fp, "%lf", pReport[idx].nMinTime / 1000.0);
+				fprintf(fp, "%s", ELEMENT_DELIMITER);
+				fprintf(fp, "%lf", pReport[idx].nMaxTime / 1000.0);
+				fprintf(fp, "%s", ELEMENT_DELIMITER);
+				fprintf(fp, "%lf", pReport[idx].nAvgTime / 1000.0);
+				fprintf(fp, "%s", ELEMENT_DELIMITER);
+				fprintf(fp, "%s", pReport[idx].szCategory);
+#ifdef PERFORMANCE_MEMORY
+				fprintf(fp, "%s", ELEMENT_DELIMITER);
+				fprintf(fp, "%lu", (unsigned long)pReport[idx].nAllocCount);
+				fprintf(fp, "%s", ELEMENT_DELIMITER);
+				fprintf(fp, "%lu", (unsigned long)pReport[idx].nAllocBytes);
+				fprintf(fp, "%s", ELEMENT_DELIMITER);
+				fprintf(fp, "%lu", (unsigned long)pReport[idx].nFreeCount);
+				fprintf(fp, "%s", ELEMENT_DELIMITER);
+				fprintf(fp, "%lu", (unsigned long)pReport[idx].nLiveBytes);
+#endif
+				if(gbRusage == true) {
+					WriteRusageColumns(fp, &pReport[idx].rusage);
+				}
+				if(geCounterMode != PerfCountersNone) {
+					WriteCounterColumns(fp, pReport[idx].nCounterValues, pReport[idx].nSamples);
+				}
+				if(gbIO == true) {
+					WriteIOColumns(fp, &pReport[idx].io);
+				}
+				if(gbWork == true) {
+					WriteWorkColumns(fp, pReport[idx].nTotalTime, pReport[idx].nWorkUnits);
+				}
+				if(gbBudgets == true) {
+					WriteBudgetColumns(fp, pReport[idx].nBudget, pReport[idx].nBreaches);
+				}
+				if(gnAbortedCalls > 0) {
+					fprintf(fp, "%s%lu", ELEMENT_DELIMITER, (unsigned long)pReport[idx].nAbortedCalls);
+				}
+#ifdef DISPLAY_CPU_TOTALS
+				fprintf(fp, "%s", ELEMENT_DELIMITER);
+				fprintf(fp, "%lf", pReport[idx].nTotalCPUTime * 1000.0);
+				fprintf(fp, "%s", ELEMENT_DELIMITER);
+				fprintf(fp, "%lf", pReport[idx].nSelfCPUTime * 1000.0);
+				fprintf(fp, "%s", ELEMENT_DELIMITER);
+				fprintf(fp, "%lf", pReport[idx].nMinCPUTime * 1000.0);
+				fprintf(fp, "%s", ELEMENT_DELIMITER);
+				fprintf(fp, "%lf", pReport[idx].nMaxCPUTime * 1000.0);
+				fprintf(fp, "%s", ELEMENT_DELIMITER);
+				fprintf(fp, "%lf", pReport[idx].nAvgCPUTime * 1000.0);
+#endif
+				fprintf(fp, "\n");
+			}
+		}
+		fclose(fp);
+	}
+	return;
+}
+static void SortLocksByWait(PerfLockData* pLocks, int nElements)
+{
+	PerfLockData temp;
+
+	for(int i = 0; i < (nElements - 1); i++) {
+		for(int j = (i + 1); j < nElements; j++) {
+			if(pLocks[i].nWaitTime < pLocks[j].nWaitTime) {
+				temp 		= pLocks[i];
+				pLocks[i] 	= pLocks[j];
+				pLocks[j] 	= temp;
+			}
+		}
+	}
+	return;
+}
+// Indexes of the IDs that took a lock, most waiting first
+static int SortIDByLockWait(IDReport* pReport, int nElements, int* pOrder)
+{
+	int nOrder = 0;
+
+	for(int idx = 0; idx < nElements; idx++) {
+		if(pReport[idx].nLockAcquires > 0) {
+			int pos = nOrder++;
+			while(pos > 0 && pReport[pOrder[pos - 1]].nLockWaitTime < pReport[idx].nLockWaitTime) {
+				pOrder[pos] = pOrder[pos - 1];
+				pos--;
+			}
+			pOrder[pos] = idx;
+		}
+	}
+	return nOrder;
+}
+void WriteContentionReportToFile(PerfLockData* pLocks, int nLocks, IDReport* pReport, int nElements)
+{
+	FILE * fp = OpenReportFile(szContentionReportFile);
+	if(fp != NULL) {
+		int	order[nElements + 1];
+		int	nOrder	= SortIDByLockWait(pReport, nElements, &order[0]);
+
+		fprintf(fp, "Lock%sAcquires%sContended%sContended %%%sWait Total%sWait Max%sWait Avg%sHold Total%sHold Max\n",
+					ELEMENT_DELIMITER, ELEMENT_DELIMITER, ELEMENT_DELIMITER, ELEMENT_DELIMITER,
+					ELEMENT_DELIMITER, ELEMENT_DELIMITER, ELEMENT_DELIMITER, ELEMENT_DELIMITER);
+		for(int idx = 0; idx < nLocks; idx++) {
+			fprintf(fp, "%s", pLocks[idx].szName);
+			fprintf(fp, "%s%lu", ELEMENT_DELIMITER, (unsigned long)pLocks[idx].nAcquires);
+			fprintf(fp, "%s%lu", ELEMENT_DELIMITER, (unsigned long)pLocks[idx].nContended);
+			fprintf(fp, "%s%0.2f", ELEMENT_DELIMITER, (pLocks[idx].nContended * 100.0) / pLocks[idx].nAcquires);
+			fprintf(fp, "%s%lf", ELEMENT_DELIMITER, pLocks[idx].nWaitTime / 1000.0);
+			fprintf(fp, "%s%lf", ELEMENT_DELIMITER, pLocks[idx].nMaxWait / 1000.0);
+			fprintf(fp, "%s%lf", ELEMENT_DELIMITER, pLocks[idx].nContended > 0 ? (pLocks[idx].nWaitTime / pLocks[idx].nContended) / 1000.0 : 0.0);
+			fprintf(fp, "%s%lf", ELEMENT_DELIMITER, pLocks[idx].nHoldTime / 1000.0);
+			fprintf(fp, "%s%lf", ELEMENT_DELIMITER, pLocks[idx].nMaxHold / 1000.0);
+			fprintf(fp, "\n");
+		}
+		// Who was doing the waiting, it comes from the trees so there's none
+		// next to a binary report
+		if(pReport != NULL) {
+			fprintf(fp, "\nName%sCategory%sAcquires%sContended%sWait Total%sHold Total\n",
+						ELEMENT_DELIMITER, ELEMENT_DELIMITER, ELEMENT_DELIMITER, ELEMENT_DELIMITER, ELEMENT_DELIMITER);
+		}
+		for(int idx = 0; idx < nOrder; idx++) {
+			IDReport* pID = &pReport[order[idx]];
+			fprintf(fp, "%s%s%s", pID->szName, ELEMENT_DELIMITER, pID->szCategory);
+			fprintf(fp, "%s%lu", ELEMENT_DELIMITER, (unsigned long)pID->nLockAcquires);
+			fprintf(fp, "%s%lu", ELEMENT_DELIMITER, (unsigned long)pID->nLockContended);
+			fprintf(fp, "%s%lf", ELEMENT_DELIMITER, pID->nLockWaitTime / 1000.0);
+			fprintf(fp, "%s%lf", ELEMENT_DELIMITER, pID->nLockHoldTime / 1000.0);
+			fprintf(fp, "\n");
+		}
+		fclose(fp);
+	}
+	return;
+}
+static void PrintContentionReport(PerfLockData* pLocks, int nLocks)
+{
+	cout << "\n\nContention Report " << endl;
+	cout << "Lock\t\t\t\tAcquires\tContended\tContended %\tWait Total\tWait Max\tHold Total\tHold Max" << endl;
+	cout << "----------------------------------------------------------------------------------------------";
+	cout << "----------------------------------------------------------" << endl;
+	for(int idx = 0; idx < nLocks; idx++) {
+		cout << pLocks[idx].szName;
+		if(strlen(pLocks[idx].szName) < 8) {
+			cout << "\t\t\t\t";
+		}
+		else if(strlen(pLocks[idx].szName) < 16) {
+			cout << "\t\t\t";
+		}
+		else if(strlen(pLocks[idx].szName) < 24) {
+			cout << "\t\t";
+		}
+		else {
+			cout << "\t";
+		}
+		cout << pLocks[idx].nAcquires << "\t\t" << pLocks[idx].nContended << "\t\t";
+		cout << (pLocks[idx].nContended * 100.0) / pLocks[idx].nAcquires << "\t\t";
+		cout << pLocks[idx].nWaitTime / 1000.0 << "\t\t" << pLocks[idx].nMaxWait / 1000.0 << "\t\t";
+		cout << pLocks[idx].nHoldTime / 1000.0 << "\t\t" << pLocks[idx].nMaxHold / 1000.0 << endl;
+	}
+	return;
+}
+// Sum each thread's values, a gauge's value is the last one set on any thread
+static void GetMetricTotals(PerfMetricValue* pTotals, uint32_t nMetrics)
+{
+	memset(pTotals, 0, sizeof(PerfMetricValue) * nMetrics);
+	for(list<ThreadRecord*>::iterator iter = mThreadList.begin(); iter != mThreadList.end(); ++iter) {
+		PerfMetricValue* pMetrics = (*iter)->GetMetrics(false);
+		if(pMetrics == NULL) {
+			continue;
+		}
+		for(uint32_t idx = 0; idx < nMetrics; idx++) {
+			PerfMetricValue*	pTotal	= &pTotals[idx];
+			PerfMetricValue		value;
+
+			// The owning thread may still be updating it
+			value.nUpdates	= __atomic_load_n(&pMetrics[idx].nUpdates, __ATOMIC_RELAXED);
+			value.nValue	= __atomic_load_n(&pMetrics[idx].nValue, __ATOMIC_RELAXED);
+			value.nMin		= __atomic_load_n(&pMetrics[idx].nMin, __ATOMIC_RELAXED);
+			value.nMax		= __atomic_load_n(&pMetrics[idx].nMax, __ATOMIC_RELAXED);
+			value.nSequence	= __atomic_load_n(&pMetrics[idx].nSequence, __ATOMIC_RELAXED);
+			if(value.nUpdates == 0) {
+				continue;
+			}
+			if(gMetricDefs[idx].bGauge == false) {
+				pTotal->nValue += value.nValue;
+			}
+			else {
+				if(pTotal->nUpdates == 0 || value.nMin < pTotal->nMin) {
+					pTotal->nMin = value.nMin;
+				}
+				if(pTotal->nUpdates == 0 || value.nMax > pTotal->nMax) {
+					pTotal->nMax = value.nMax;
+				}
+				if(value.nSequence > pTotal->nSequence) {
+					pTotal->nValue		= value.nValue;
+					pTotal->nSequence	= value.nSequence;
+				}
+			}
+			pTotal->nMetric		= idx;
+			pTotal->nUpdates	+= value.nUpdates;
+		}
+	}
+	return;
+}
+void WriteMetricsReportToFile(PerfMetricValue* pTotals, uint32_t nMetrics)
+{
+	FILE * fp = OpenReportFile(szMetricsReportFile);
+	if(fp != NULL) {
+		fprintf(fp, "Metric%sType%sUpdates%sValue%sMin%sMax\n",
+					ELEMENT_DELIMITER, ELEMENT_DELIMITER, ELEMENT_DELIMITER, ELEMENT_DELIMITER, ELEMENT_DELIMITER);
+		for(uint32_t idx = 0; idx < nMetrics; idx++) {
+			fprintf(fp, "%s", gMetricDefs[idx].szName);
+			fprintf(fp, "%s%s", ELEMENT_DELIMITER, gMetricDefs[idx].bGauge ? "Gauge" : "Counter");
+			fprintf(fp, "%s%u", ELEMENT_DELIMITER, pTotals[idx].nUpdates);
+			fprintf(fp, "%s%ld", ELEMENT_DELIMITER, (long)pTotals[idx].nValue);
+			if(gMetricDefs[idx].bGauge == true) {
+				fprintf(fp, "%s%ld%s%ld", ELEMENT_DELIMITER, (long)pTotals[idx].nMin, ELEMENT_DELIMITER, (long)pTotals[idx].nMax);
+			}
+			else {
+				fprintf(fp, "%s%s", ELEMENT_DELIMITER, ELEMENT_DELIMITER);
+			}
+			fprintf(fp, "\n");
+		}
+		fclose(fp);
+	}
+	return;
+}
+static void PrintMetricsReport(PerfMetricValue* pTotals, uint32_t nMetrics)
+{
+	cout << "\n\nMetrics Report " << endl;
+	cout << "Metric\t\t\t\tType\t\tUpdates\t\tValue\t\tMin\t\tMax" << endl;
+	cout << "----------------------------------------------------------------------------------------------" << endl;
+	for(uint32_t idx = 0; idx < nMetrics; idx++) {
+		cout << gMetricDefs[idx].szName;
+		if(strlen(gMetricDefs[idx].szName) < 8) {
+			cout << "\t\t\t\t";
+		}
+		else if(strlen(gMetricDefs[idx].szName) < 16) {
+			cout << "\t\t\t";
+		}
+		else if(strlen(gMetricDefs[idx].szName) < 24) {
+			cout << "\t\t";
+		}
+		else {
+			cout << "\t";
+		}
+		cout << (gMetricDefs[idx].bGauge ? "Gauge" : "Counter") << "\t\t";
+		cout << pTotals[idx].nUpdates << "\t\t" << pTotals[idx].nValue;
+		if(gMetricDefs[idx].bGauge == true) {
+			cout << "\t\t" << pTotals[idx].nMin << "\t\t" << pTotals[idx].nMax;
+		}
+		cout << endl;
+	}
+	return;
+}
+static bool HasBenchResults()
+{
+	pthread_mutex_lock(&gBenchMutex);
+	bool bResults = !gBenchResults.empty();
+	pthread_mutex_unlock(&gBenchMutex);
+	return bResults;
+}
+// Times per iteration in ns, so runs of the same benchmark can be compared
+void WriteBenchReportToFile()
+{
+	FILE * fp = OpenReportFile(szBenchReportFile);
+	if(fp != NULL) {
+		fprintf(fp, "Name%sCategory%sSamples%sIterations%sMedian%sMAD%sCI Low%sCI High%sMean%sStdDev%sMin%sMax%sLow Outliers%sHigh Outliers\n",
+					ELEMENT_DELIMITER, ELEMENT_DELIMITER, ELEMENT_DELIMITER, ELEMENT_DELIMITER, ELEMENT_DELIMITER,
+					ELEMENT_DELIMITER, ELEMENT_DELIMITER, ELEMENT_DELIMITER, ELEMENT_DELIMITER, ELEMENT_DELIMITER,
+					ELEMENT_DELIMITER, ELEMENT_DELIMITER, ELEMENT_DELIMITER);
+		pthread_mutex_lock(&gBenchMutex);
+		for(size_t idx = 0; idx < gBenchResults.size(); idx++) {
+			PerfBenchResult* pResult = &gBenchResults[idx].result;
+
+			fprintf(fp, "%s%s%s", gBenchResults[idx].name.c_str(), ELEMENT_DELIMITER, gBenchResults[idx].category.c_str());
+			fprintf(fp, "%s%u%s%lu", ELEMENT_DELIMITER, pResult->nSamples, ELEMENT_DELIMITER, (unsigned long)pResult->nIterations);
+			fprintf(fp, "%s%lf%s%lf", ELEMENT_DELIMITER, pResult->nMedian, ELEMENT_DELIMITER, pResult->nMAD);
+			fprintf(fp, "%s%lf%s%lf", ELEMENT_DELIMITER, pResult->nCILow, ELEMENT_DELIMITER, pResult->nCIHigh);
+			fprintf(fp, "%s%lf%s%lf", ELEMENT_DELIMITER, pResult->nMean, ELEMENT_DELIMITER, pResult->nStdDev);
+			fprintf(fp, "%s%lf%s%lf", ELEMENT_DELIMITER, pResult->nMin, ELEMENT_DELIMITER, pResult->nMax);
+			fprintf(fp, "%s%u%s%u\n", ELEMENT_DELIMITER, pResult->nLowOutliers, ELEMENT_DELIMITER, pResult->nHighOutliers);
+		}
+		pthread_mutex_unlock(&gBenchMutex);
+		fclose(fp);
+	}
+	return;
+}
+static void PrintBenchReport()
+{
+	cout << "\n\nBenchmark Report (ns per iteration)" << endl;
+	cout << "Name\t\t\t\tSamples\t\tIterations\tMedian\t\tMAD\t\t95% CI\t\t\tOutliers" << endl;
+	cout << "----------------------------------------------------------------------------------------------------------------" << endl;
+	pthread_mutex_lock(&gBenchMutex);
+	for(size_t idx = 0; idx < gBenchResults.size(); idx++) {
+		PerfBenchResult* pResult = &gBenchResults[idx].result;
+
+		cout << gBenchResults[idx].name;
+		if(gBenchResults[idx].name.size() < 8) {
+			cout << "\t\t\t\t";
+		}
+		else if(gBenchResults[idx].name.size() < 16) {
+			cout << "\t\t\t";
+		}
+		else if(gBenchResults[idx].name.size() < 24) {
+			cout << "\t\t";
+		}
+		else {
+			cout << "\t";
+		}
+		cout << pResult->nSamples << "\t\t" << pResult->nIterations << "\t\t";
+		cout << pResult->nMedian << "\t\t" << pResult->nMAD << "\t\t";
+		cout << pResult->nCILow << " - " << pResult->nCIHigh << "\t";
+		cout << pResult->nLowOutliers << " low, " << pResult->nHighOutliers << " high" << endl;
+	}
+	pthread_mutex_unlock(&gBenchMutex);
+	return;
+}
+// Each ID's slowest calls, slowest first, with where they were called from
+void WriteOutlierReportToFile()
+{
+	FILE * fp = OpenReportFile(szOutlierReportFile);
+	if(fp != NULL) {
+		vector<PerfSlowCalls::SlowCall> calls;
+
+		fprintf(fp, "Name%sCategory%sRank%sDuration%sStart%sThreadID%sPath\n",
+					ELEMENT_DELIMITER, ELEMENT_DELIMITER, ELEMENT_DELIMITER, ELEMENT_DELIMITER,
+					ELEMENT_DELIMITER, ELEMENT_DELIMITER);
+		for(PerfIDList::iterator iter = gpReportIDs->begin(); iter != gpReportIDs->end(); ++iter) {
+			if((*iter)->pSlowCalls == NULL) {
+				continue;
+			}
+			(*iter)->pSlowCalls->GetCalls(calls);
+			for(size_t idx = 0; idx < calls.size(); idx++) {
+				fprintf(fp, "%s%s%s", (*iter)->szName, ELEMENT_DELIMITER, (*iter)->szCategory);
+				fprintf(fp, "%s%lu", ELEMENT_DELIMITER, (unsigned long)idx + 1);
+				fprintf(fp, "%s%lf", ELEMENT_DELIMITER, calls[idx].nDuration / 1000.0);
+				// ms from PERF_START
+				fprintf(fp, "%s%lf", ELEMENT_DELIMITER, (calls[idx].nStartTime - gStartTime) / 1000.0);
+				fprintf(fp, "%s%lX%s", ELEMENT_DELIMITER, (unsigned long)calls[idx].threadID, ELEMENT_DELIMITER);
+				if(calls[idx].bTruncated == true) {
+					fprintf(fp, "...");
+				}
+				for(uint32_t nFrame = 0; nFrame < calls[idx].nDepth; nFrame++) {
+					PerfIDData* pPerfData = FindPerfDataByPerfID(calls[idx].path[nFrame]);
+					fprintf(fp, "%s%s", (nFrame > 0 || calls[idx].bTruncated) ? " > " : "",
+								pPerfData != NULL ? pPerfData->szName : "?");
+				}
+				fprintf(fp, "\n");
+			}
+		}
+		fclose(fp);
+	}
+	return;
+}
+void WriteTreeReportToFile()
+{
+	ThreadRecord* 					pThread		= NULL;
+	list<ThreadRecord*>::iterator 	iter 		= gpReportThreads->begin();
+
+	FILE * fp = OpenReportFile(szTreeReportFile);
+	if(fp != NULL) {
+		// Document Header
+#ifdef TREE_REPORT_XML
+		fprintf(fp,"<?xml version='1.0' encoding='utf-8' standalone='no'?>\n<TreeReport>\n");
+#endif
+		// Walk the threads
+		while(iter != gpReportThreads->end()) {
+			pThread	= *iter;
+			// Walk the nodes
+			Node * pParent = pThread->GetRootNode();
+			if(pParent != NULL) {
+				if(GetChildData(pParent, NULL, 0, TreeReportType, fp) == false) {
+					cout << "WriteTreeReportToFile ERROR"  << endl;
+					break;
+				}
+			}
+			iter++;
+		}
+#ifdef TREE_REPORT_XML
+		fprintf(fp,"</TreeReport>\n");
+#endif
+		fclose(fp);
+	}
+	return;
+}
+static uint32_t CountBinaryNodes(Node* pNode)
+{
+	uint32_t			nNodes	= 1;
+	NodeList::iterator	iter	= pNode->GetSiblingIterator();
+
+	while(pNode->IsSiblingEnd(iter) == false) {
+		if((*iter)->GetNodeType() == PerfRecord) {
+			nNodes += CountBinaryNodes(*iter);
+		}
+		iter++;
+	}
+	return nNodes;
+}
+static void PutBinaryNode(PerfBinaryReport& binary, Node* pNode, map<PerfID, uint32_t>& ids, uint32_t nColumns, uint32_t nDepth, uint32_t* pnLastDepth, uint32_t* pnLastID)
+{
+	PerformanceRec*		pPerfRec	= (PerformanceRec*)pNode;
+	PerfRecordReport	report;
+
+	pPerfRec->GetReport(&report);
+	map<PerfID, uint32_t>::iterator idIter = ids.find(pPerfRec->GetID());
+	uint32_t nID = (idIter != ids.end()) ? idIter->second : ids.size();
+
+	binary.PutSigned((int64_t)nDepth - *pnLastDepth);
+	binary.PutSigned((int64_t)nID - *pnLastID);
+	binary.PutVarint(report.nTotalCalls);
+	binary.PutVarint(report.nTotalTime);
+	binary.PutVarint(report.nTotalSelf);
+	binary.PutVarint(report.nMinTime);
+	binary.PutVarint(report.nMaxTime >= report.nMinTime ? report.nMaxTime - report.nMinTime : 0);
+	binary.PutVarint(report.nAbortedCalls);
+	binary.PutVarint(report.nRecursiveCalls);
+	binary.PutVarint(report.nMaxRecursion);
+	if((nColumns & PERF_BINARY_WORK) != 0) {
+		binary.PutVarint(report.nWorkUnits);
+	}
+	if((nColumns & PERF_BINARY_IO) != 0) {
+		binary.PutVarint(report.nIOOps);
+		binary.PutVarint(report.nIOBytes);
+		binary.PutVarint(report.nIOTime);
+		for(uint32_t nBucket = 0; nBucket < PERF_IO_LATENCY_BUCKETS; nBucket++) {
+			binary.PutVarint(report.nIOLatency[nBucket]);
+		}
+	}
+	if((nColumns & PERF_BINARY_RUSAGE) != 0) {
+		binary.PutVarint(report.bRusage ? 1 : 0);
+		if(report.bRusage == true) {
+			binary.PutVarint(report.rusage.nVolCtxSwitches);
+			binary.PutVarint(report.rusage.nInvolCtxSwitches);
+			binary.PutVarint(report.rusage.nMinorFaults);
+			binary.PutVarint(report.rusage.nMajorFaults);
+			binary.PutVarint(report.rusage.nBlockIn);
+			binary.PutVarint(report.rusage.nBlockOut);
+		}
+	}
+	if((nColumns & PERF_BINARY_ALLOCS) != 0) {
+		binary.PutVarint(report.nAllocCount);
+		binary.PutVarint(report.nAllocBytes);
+		binary.PutVarint(report.nFreeCount);
+		binary.PutVarint(report.nLiveBytes);
+	}
+	if((nColumns & PERF_BINARY_LOCKS) != 0) {
+		binary.PutVarint(report.nLockAcquires);
+		binary.PutVarint(report.nLockContended);
+		binary.PutVarint(report.nLockWaitTime);
+		binary.PutVarint(report.nLockHoldTime);
+	}
+	*pnLastDepth	= nDepth;
+	*pnLastID		= nID;
+
+	NodeList::iterator iter = pNode->GetSiblingIterator();
+	while(pNode->IsSiblingEnd(iter) == false) {
+		if((*iter)->GetNodeType() == PerfRecord) {
+			PutBinaryNode(binary, *iter, ids, nColumns, nDepth + 1, pnLastDepth, pnLastID);
+		}
+		iter++;
+	}
+}
+// Everything the category, ID and tree reports need, see PerfBinaryReport.h
+static bool WriteBinaryReportToFile()
+{
+	PerfBinaryReport			binary;
+	map<std::string, uint32_t>	strings;
+	vector<const char*>			stringList;
+	map<PerfID, uint32_t>		ids;
+	uint32_t					nColumns	= 0;
+
+	// The same optional columns the text reports would have
+	nColumns |= (gbWork == true) ? PERF_BINARY_WORK : 0;
+	nColumns |= (gbIO == true) ? PERF_BINARY_IO : 0;
+	nColumns |= (gbRusage == true) ? PERF_BINARY_RUSAGE : 0;
+#ifdef PERFORMANCE_MEMORY
+	nColumns |= PERF_BINARY_ALLOCS;
+#endif
+	nColumns |= (gbBudgets == true) ? PERF_BINARY_BUDGETS : 0;
+	nColumns |= (__atomic_load_n(&gnLockCount, __ATOMIC_ACQUIRE) > 0) ? PERF_BINARY_LOCKS : 0;
+	for(PerfCatList::iterator catIter = gpReportCategories->begin(); catIter != gpReportCategories->end(); catIter++) {
+		if(strings.insert(make_pair(std::string((*catIter)->szName), (uint32_t)stringList.size())).second) {
+			stringList.push_back((*catIter)->szName);
+		}
+	}
+	for(PerfIDList::iterator iter = gpReportIDs->begin(); iter != gpReportIDs->end(); iter++) {
+		if(strings.insert(make_pair(std::string((*iter)->szName), (uint32_t)stringList.size())).second) {
+			stringList.push_back((*iter)->szName);
+		}
+		if(strings.insert(make_pair(std::string((*iter)->szCategory), (uint32_t)stringList.size())).second) {
+			stringList.push_back((*iter)->szCategory);
+		}
+	}
+	binary.PutVarint(nColumns);
+	binary.PutVarint(stringList.size());
+	for(uint32_t idx = 0; idx < stringList.size(); idx++) {
+		binary.PutString(stringList[idx]);
+	}
+	binary.PutVarint(gpReportCategories->size());
+	for(PerfCatList::iterator catIter = gpReportCategories->begin(); catIter != gpReportCategories->end(); catIter++) {
+		binary.PutVarint((*catIter)->nID);
+		binary.PutVarint(strings[(*catIter)->szName]);
+	}
+	binary.PutVarint(gpReportIDs->size());
+	for(PerfIDList::iterator iter = gpReportIDs->begin(); iter != gpReportIDs->end(); iter++) {
+		uint32_t nIndex = ids.size();
+		ids[(*iter)->id] = nIndex;
+		binary.PutVarint((*iter)->id);
+		binary.PutVarint((*iter)->categoryID);
+		binary.PutVarint(strings[(*iter)->szName]);
+		binary.PutVarint(strings[(*iter)->szCategory]);
+		if((nColumns & PERF_BINARY_BUDGETS) != 0) {
+			binary.PutVarint(GetBudget(&(*iter)->budget));
+			binary.PutVarint((*iter)->budget.nBreaches);
+		}
+	}
+	uint32_t nThreads = 0;
+	for(list<ThreadRecord*>::iterator iter = gpReportThreads->begin(); iter != gpReportThreads->end(); iter++) {
+		if((*iter)->GetRootNode() != NULL) {
+			nThreads++;
+		}
+	}
+	binary.PutVarint(nThreads);
+	for(list<ThreadRecord*>::iterator iter = gpReportThreads->begin(); iter != gpReportThreads->end(); iter++) {
+		Node*		pRoot		= (*iter)->GetRootNode();
+		uint32_t	nLastDepth	= 0;
+		uint32_t	nLastID		= 0;
+
+		if(pRoot == NULL) {
+			continue;
+		}
+		binary.PutVarint((uint64_t)(*iter)->GetThreadID());
+		binary.PutVarint(CountBinaryNodes(pRoot));
+		PutBinaryNode(binary, pRoot, ids, nColumns, 0, &nLastDepth, &nLastID);
+	}
+
+	FILE * fp = OpenReportFile(szBinaryReportFile);
+	if(fp == NULL) {
+		return false;
+	}
+	bool bWritten = binary.Write(fp, gStartTime, gEndTime);
+	fclose(fp);
+	return bWritten;
+}
+// Index the ID names so tree walks don't search gPerfIDList per node
+static void GetNameTable(vector<const char*>& names)
+{
+	names.assign(nID + 1, (const char*)NULL);
+	for(PerfIDList::iterator iter = gpReportIDs->begin(); iter != gpReportIDs->end(); ++iter) {
+		if((*iter)->id < names.size()) {
+			names[(*iter)->id] = (*iter)->szName;
+		}
+	}
+}
+#ifdef FOLDED_REPORT
+//
+// Collapsed stack ("a;b;c <self_ns>") output for flamegraph tools.
+// The path is kept in a single buffer that grows on the way down and is
+// truncated on the way back up, so each node costs O(name length).
+//
+static void AppendFoldedFrame(std::string& path, const char* szName)
+{
+	if(path.empty() == false) {
+		path.append(1, ';');
+	}
+	// The folded format reserves ';' as the frame separator and is line based
+	for(const char* p = szName; *p != '\0'; p++) {
+		if(*p == ';') {
+			path.append(1, ':');
+		}
+		else if(*p == '\n' || *p == '\r') {
+			path.append(1, ' ');
+		}
+		else {
+			path.append(1, *p);
+		}
+	}
+}
+static void FoldNodeData(Node* pNode, std::string& path, size_t nRootLen, vector<const char*>& names,
+							FILE* fp, map<std::string, uint64_t>& merged)
+{
+	NodeList::iterator iter = pNode->GetSiblingIterator();
+
+	while(pNode->IsSiblingEnd(iter) == false) {
+		Node* pChild = *iter;
+		if(pChild->GetNodeType() == PerfRecord) {
+			PerformanceRec* 	pPerfRec 	= (PerformanceRec*)pChild;
+			PerfRecordReport 	report;
+			size_t				nLen		= path.size();
+			PerfID				id			= pPerfRec->GetID();
+
+			AppendFoldedFrame(path, (id < names.size() && names[id] != NULL) ? names[id] : "[unknown]");
+			if(pPerfRec->GetReport(&report) == true && report.nTotalSelf > 0) {
+				uint64_t nSelfNs = report.nTotalSelf * 1000;
+				fprintf(fp, "%s %llu\n", path.c_str(), (unsigned long long)nSelfNs);
+				// Merged view drops the per thread root frame
+				merged[path.substr(nRootLen)] += nSelfNs;
+			}
+			FoldNodeData(pChild, path, nRootLen, names, fp, merged);
+			path.resize(nLen);
+		}
+		iter++;
+	}
+}
+void WriteFoldedReportToFile()
+{
+	ThreadRecord* 					pThread		= NULL;
+	list<ThreadRecord*>::iterator 	iter 		= gpReportThreads->begin();
+	vector<const char*>				names;
+	map<std::string, uint64_t>		merged;
+	std::string						path;
+	char							szRoot[64];
+
+	GetNameTable(names);
+	FILE * fp = OpenReportFile(szFoldedReportFile);
+	if(fp == NULL) {
+		return;
+	}
+	path.reserve(4096);
+	// Walk the threads
+	while(iter != gpReportThreads->end()) {
+		pThread	= *iter;
+		Node * pRoot = pThread->GetRootNode();
+		if(pRoot != NULL) {
+			snprintf(szRoot, sizeof(szRoot), "ThreadStart %lX", (unsigned long)pThread->GetThreadID());
+			path.clear();
+			AppendFoldedFrame(path, szRoot);
+			// Keep the ';' so merged paths start at the first real frame
+			FoldNodeData(pRoot, path, path.size() + 1, names, fp, merged);
+		}
+		iter++;
+	}
+	fclose(fp);
+
+	fp = OpenReportFile(szFoldedMergedFile);
+	if(fp != NULL) {
+		for(map<std::string, uint64_t>::iterator mIter = merged.begin(); mIter != merged.end(); ++mIter) {
+			fprintf(fp, "%s %llu\n", mIter->first.c_str(), (unsigned long long)mIter->second);
+		}
+		fclose(fp);
+	}
+	return;
+}
+#endif //FOLDED_REPORT
+#ifdef MERGED_TREE_REPORT
+//
+// Cross thread view.  Threads are grouped by name with the trailing number
+// removed (io-worker-1, io-worker-2 -> io-worker-*) and each group's trees
+// are merged by PerfID path.  Groups are merged in parallel, then folded
+// into one global tree.
+//
+typedef struct MergeGroup_s
+{
+	std::string				name;
+	vector<ThreadRecord*>	threads;
+	MergedRec*				pRoot;
+} MergeGroup;
+
+typedef struct MergeWork_s
+{
+	vector<MergeGroup*>*	pGroups;
+	volatile uint32_t		nNext;
+} MergeWork;
+
+static std::string GetThreadGroupName(const char* szThreadName)
+{
+	std::string name(szThreadName);
+	size_t		nLen = name.size();
+
+	while(nLen > 0 && isdigit((unsigned char)name[nLen - 1])) {
+		nLen--;
+	}
+	if(name.empty() || nLen == 0) {
+		return std::string("unnamed");
+	}
+	if(nLen < name.size()) {
+		name.resize(nLen);
+		name.append("*");
+	}
+	return name;
+}
+static void MergeChildData(MergedRec* pDest, Node* pNode)
+{
+	NodeList::iterator iter = pNode->GetSiblingIterator();
+
+	while(pNode->IsSiblingEnd(iter) == false) {
+		Node* pChild = *iter;
+		if(pChild->GetNodeType() == PerfRecord) {
+			PerformanceRec* pPerfRec 	= (PerformanceRec*)pChild;
+			MergedRec*		pMerged		= pDest->GetChild(pPerfRec->GetID(), pPerfRec->GetCatID());
+			pMerged->Merge(pPerfRec);
+			MergeChildData(pMerged, pChild);
+		}
+		else if(pChild->GetNodeType() == MergedRecord) {
+			MergedRec*		pSource		= (MergedRec*)pChild;
+			MergedRec*		pMerged		= pDest->GetChild(pSource->GetID(), pSource->GetCatID());
+			pMerged->Merge(pSource);
+			MergeChildData(pMerged, pChild);
+		}
+		iter++;
+	}
+}
+static void* MergeGroupThread(void* pArg)
+{
+	MergeWork* 	pWork 	= (MergeWork*)pArg;
+	uint32_t	idx		= __sync_fetch_and_add(&pWork->nNext, 1);
+
+	while(idx < pWork->pGroups->size()) {
+		MergeGroup* pGroup = (*pWork->pGroups)[idx];
+		for(size_t nThread = 0; nThread < pGroup->threads.size(); nThread++) {
+			Node* 		pRoot 	= pGroup->threads[nThread]->GetRootNode();
+			uint64_t	nTotal	= 0;
+			NodeList::iterator iter = pRoot->GetSiblingIterator();
+
+			// The thread root never exits, its time is the sum of the top level scopes
+			while(pRoot->IsSiblingEnd(iter) == false) {
+				nTotal += ((PerformanceRec*)*iter)->GetTotalTime();
+				iter++;
+			}
+			pGroup->pRoot->AddThreadTotal(nTotal);
+			MergeChildData(pGroup->pRoot, pRoot);
+		}
+		idx = __sync_fetch_and_add(&pWork->nNext, 1);
+	}
+	return NULL;
+}
+static bool OrderMergedByTotal(Node* first, Node* second)
+{
+	return ((MergedRec*)first)->GetTotalTime() > ((MergedRec*)second)->GetTotalTime();
+}
+static void WriteMergedNodeAsXML(MergedRec* pNode, uint32_t nDepth, vector<const char*>& names, FILE* fp)
+{
+	NodeList::iterator 	iter;
+	PerfRecordReport		report;
+	PerfID					id			= pNode->GetID();
+	std::string				funcName((id < names.size() && names[id] != NULL) ? names[id] : "[unknown]");
+
+	EscapeToXML(funcName);
+	pNode->GetReport(&report);
+	fprintf(fp, "%*s<Entry Name='%s'", nDepth * 3, "", funcName.c_str());
+	fprintf(fp, " Calls='%d'", report.nTotalCalls);
+	fprintf(fp, " Total='%0.3f' Self='%0.3f' Max='%0.3f' Min='%0.3f' Avg='%0.3f'",
+					report.nTotalTime / 1000.0,
+					report.nTotalSelf / 1000.0,
+					report.nMaxTime / 1000.0,
+					report.nMinTime / 1000.0,
+					report.nTotalCalls > 0 ? (report.nTotalTime / report.nTotalCalls) / 1000.0 : 0.0);
+	fprintf(fp, " Threads='%u' P50='%0.3f' P90='%0.3f' P99='%0.3f'",
+					pNode->GetThreadCount(),
+					pNode->GetThreadPercentile(50) / 1000.0,
+					pNode->GetThreadPercentile(90) / 1000.0,
+					pNode->GetThreadPercentile(99) / 1000.0);
+
+	iter = pNode->GetSiblingIterator();
+	if(pNode->IsSiblingEnd(iter)) {
+		fprintf(fp, " />\n");
+		return;
+	}
+	fprintf(fp, " >\n");
+	pNode->GetSiblingList()->sort(OrderMergedByTotal);
+	for(iter = pNode->GetSiblingIterator(); pNode->IsSiblingEnd(iter) == false; iter++) {
+		WriteMergedNodeAsXML((MergedRec*)*iter, nDepth + 1, names, fp);
+	}
+	fprintf(fp, "%*s</Entry>\n", nDepth * 3, "");
+}
+static void WriteMergedGroupAsXML(const char* szElement, const char* szName, MergedRec* pRoot, vector<const char*>& names, FILE* fp)
+{
+	std::string groupName(szName);
+
+	EscapeToXML(groupName);
+	fprintf(fp, "<%s Name='%s' Threads='%u' Total='%0.3f' P50='%0.3f' P90='%0.3f' P99='%0.3f' >\n",
+					szElement, groupName.c_str(),
+					pRoot->GetThreadCount(),
+					pRoot->GetTotalTime() / 1000.0,
+					pRoot->GetThreadPercentile(50) / 1000.0,
+					pRoot->GetThreadPercentile(90) / 1000.0,
+					pRoot->GetThreadPercentile(99) / 1000.0);
+	pRoot->GetSiblingList()->sort(OrderMergedByTotal);
+	for(NodeList::iterator iter = pRoot->GetSiblingIterator(); pRoot->IsSiblingEnd(iter) == false; iter++) {
+		WriteMergedNodeAsXML((MergedRec*)*iter, 1, names, fp);
+	}
+	fprintf(fp, "</%s>\n", szElement);
+}
+void WriteMergedTreeReportToFile()
+{
+	vector<MergeGroup*>				groups;
+	map<std::string, MergeGroup*>	groupMap;
+	vector<const char*>				names;
+	MergeWork						work;
+	long							nWorkers	= sysconf(_SC_NPROCESSORS_ONLN);
+
+	// Group the threads by name
+	for(list<ThreadRecord*>::iterator iter = gpReportThreads->begin(); iter != gpReportThreads->end(); ++iter) {
+		if((*iter)->GetRootNode() == NULL) {
+			continue;
+		}
+		std::string name = GetThreadGroupName((*iter)->GetThreadName());
+		map<std::string, MergeGroup*>::iterator groupIter = groupMap.find(name);
+		MergeGroup* pGroup = NULL;
+		if(groupIter == groupMap.end()) {
+			pGroup			= new MergeGroup();
+			pGroup->name	= name;
+			pGroup->pRoot	= new MergedRec(gPERF_ID_THREAD_START, gPERF_CATID_THREAD_START);
+			groupMap[name]	= pGroup;
+			groups.push_back(pGroup);
+		}
+		else {
+			pGroup = groupIter->second;
+		}
+		pGroup->threads.push_back(*iter);
+	}
+
+	// Merge the groups in parallel, the thread trees are only read
+	work.pGroups	= &groups;
+	work.nNext		= 0;
+	if(nWorkers < 1) {
+		nWorkers = 1;
+	}
+	if((size_t)nWorkers > groups.size()) {
+		nWorkers = groups.size();
+	}
+	vector<pthread_t> workers;
+	for(long idx = 1; idx < nWorkers; idx++) {
+		pthread_t worker;
+		if(pthread_create(&worker, NULL, MergeGroupThread, &work) == 0) {
+			workers.push_back(worker);
+		}
+	}
+	MergeGroupThread(&work);
+	for(size_t idx = 0; idx < workers.size(); idx++) {
+		pthread_join(workers[idx], NULL);
+	}
+
+	// Global view across every group
+	MergedRec* pGlobal = new MergedRec(gPERF_ID_THREAD_START, gPERF_CATID_THREAD_START);
+	for(size_t idx = 0; idx < groups.size(); idx++) {
+		pGlobal->Merge(groups[idx]->pRoot);
+		MergeChildData(pGlobal, groups[idx]->pRoot);
+	}
+
+	FILE * fp = OpenReportFile(szMergedTreeReportFile);
+	if(fp != NULL) {
+		GetNameTable(names);
+		fprintf(fp,"<?xml version='1.0' encoding='utf-8' standalone='no'?>\n<MergedTreeReport>\n");
+		for(size_t idx = 0; idx < groups.size(); idx++) {
+			WriteMergedGroupAsXML("Group", groups[idx]->name.c_str(), groups[idx]->pRoot, names, fp);
+		}
+		WriteMergedGroupAsXML("Global", "*", pGlobal, names, fp);
+		fprintf(fp,"</MergedTreeReport>\n");
+		fclose(fp);
+	}
+
+	delete pGlobal;
+	for(size_t idx = 0; idx < groups.size(); idx++) {
+		delete groups[idx]->pRoot;
+		delete groups[idx];
+	}
+	return;
+}
+#endif //MERGED_TREE_REPORT
+// Names and IDs, one entry per registered category and ID
+static void InitCategoryReport(CategoryReport* pReport)
+{
+	uint32_t idx = 0;
+
+	for(PerfCatList::iterator iter = gpReportCategories->begin(); iter != gpReportCategories->end(); ++iter) {
+		pReport[idx].szName	= (*iter)->szName;
+		pReport[idx].catID	= (*iter)->nID;
+		idx++;
+	}
+}
+static void InitIDReport(IDReport* pReport)
+{
+	for(uint32_t idx = 0; idx < gpReportIDs->size(); idx++) {
+		pReport[idx].szName		= FindPerfDataByIdx(idx)->szName;
+		pReport[idx].szCategory	= FindPerfDataByIdx(idx)->szCategory;
+		pReport[idx].nBudget	= GetBudget(&FindPerfDataByIdx(idx)->budget);
+		pReport[idx].nBreaches	= FindPerfDataByIdx(idx)->budget.nBreaches;
+	}
+}
+//
+// Lock every tree, then copy them, so the copies are all from the same
+// moment.  Threads that enter or exit a call wait for the copy, but not
+// for the reports.  The registry is copied while the trees are locked, so
+// it has every ID in the copies.
+//
+static void GetTreeSnapshot(list<ThreadRecord*>& threads, PerfIDList& ids, PerfCatList& categories)
+{
+	ThreadRecord* pFirst = __atomic_load_n(&gpThreads, __ATOMIC_ACQUIRE);
+
+	for(ThreadRecord* pThread = pFirst; pThread != NULL; pThread = pThread->GetNextThread()) {
+		pThread->LockTree();
+	}
+	ids			= gPerfIDList;
+	categories	= gPerfCatList;
+	for(ThreadRecord* pThread = pFirst; pThread != NULL; pThread = pThread->GetNextThread()) {
+		// gpThreads is newest first
+		threads.push_front(pThread->CopyTree());
+	}
+	for(ThreadRecord* pThread = pFirst; pThread != NULL; pThread = pThread->GetNextThread()) {
+		pThread->UnlockTree();
+	}
+}
+//
+// The text reports that don't need the trees, written next to PerfReport.bin.
+// The contention report only has its table of locks.
+//
+static void WriteBinaryCompanionReports()
+{
+	uint32_t nLocks = __atomic_load_n(&gnLockCount, __ATOMIC_ACQUIRE);
+	if(nLocks > 0) {
+		PerfLockData	locks[nLocks];
+
+		memcpy(&locks[0], &gLockData[0], sizeof(PerfLockData) * nLocks);
+		SortLocksByWait(&locks[0], nLocks);
+		WriteContentionReportToFile(&locks[0], nLocks, NULL, 0);
+	}
+	if(gnSlowCalls != 0) {
+		WriteOutlierReportToFile();
+	}
+}
+//
+// The report files that come from the trees, written from a snapshot into
+// ./perfmetrics.<pid>.<yyyymmdd-hhmmss.mmm>/
+//
+static void DumpReports()
+{
+	list<ThreadRecord*>	threads;
+	PerfIDList			ids;
+	PerfCatList			categories;
+	struct timeval		now;
+	struct tm			tmNow;
+	char				szDir[128];
+
+	gettimeofday(&now, NULL);
+	localtime_r(&now.tv_sec, &tmNow);
+	snprintf(szDir, sizeof(szDir), "./perfmetrics.%d.%04d%02d%02d-%02d%02d%02d.%03d/", (int)getpid(),
+			 tmNow.tm_year + 1900, tmNow.tm_mon + 1, tmNow.tm_mday, tmNow.tm_hour, tmNow.tm_min, tmNow.tm_sec, (int)(now.tv_usec / 1000));
+	if(mkdir(szDir, 0755) != 0) {
+		cout << "ERROR: PerfMetrics could not create " << szDir << ", errno " << errno << endl;
+		return;
+	}
+
+	pthread_mutex_lock(&gReportMutex);
+	// The application is still running and may add IDs, the reports only
+	// see the ones in the snapshot and nothing it may wait on is held
+	GetTreeSnapshot(threads, ids, categories);
+	uint32_t			nCategories	= categories.size();
+	uint32_t			nIDs		= ids.size();
+	CategoryReport		catReport[nCategories];
+	IDReport			idReport[nIDs];
+
+	memset(&catReport[0], 0, sizeof(CategoryReport) * nCategories);
+	memset(&idReport[0], 0, sizeof(IDReport) * nIDs);
+	gpReportThreads		= &threads;
+	gpReportIDs			= &ids;
+	gpReportCategories	= &categories;
+	gReportDir			= szDir;
+	if(gbBinaryReport == true) {
+		WriteBinaryReportToFile();
+		WriteBinaryCompanionReports();
+	}
+	else {
+		InitCategoryReport(&catReport[0]);
+		GenerateReport((void*)&catReport[0], nCategories, CategoryReportType);
+		WriteCategoryReportToFile(&catReport[0], nCategories);
+		InitIDReport(&idReport[0]);
+		GenerateReport((void*)&idReport[0], nIDs, IDReportType);
+		SortIDByTotalCalls(&idReport[0], nIDs);
+		WriteIDReportToFile(&idReport[0], nIDs);
+		uint32_t nLocks = __atomic_load_n(&gnLockCount, __ATOMIC_ACQUIRE);
+		if(nLocks > 0) {
+			PerfLockData	locks[nLocks];
+
+			memcpy(&locks[0], &gLockData[0], sizeof(PerfLockData) * nLocks);
+			SortLocksByWait(&locks[0], nLocks);
+			WriteContentionReportToFile(&locks[0], nLocks, &idReport[0], nIDs);
+		}
+		WriteTreeReportToFile();
+#ifdef FOLDED_REPORT
+		WriteFoldedReportToFile();
+#endif
+#ifdef MERGED_TREE_REPORT
+		WriteMergedTreeReportToFile();
+#endif
+		if(gnSlowCalls != 0) {
+			WriteOutlierReportToFile();
+		}
+	}
+	if(HasBenchResults()) {
+		WriteBenchReportToFile();
+	}
+	gpReportThreads		= &mThreadList;
+	gpReportIDs			= &gPerfIDList;
+	gpReportCategories	= &gPerfCatList;
+	gReportDir.clear();
+	pthread_mutex_unlock(&gReportMutex);
+
+	while(!threads.empty()) {
+		delete threads.front();
+		threads.pop_front();
+	}
+	cout << "PerfMetrics reports written to " << szDir << endl;
+}
+// Only async signal safe calls here
+static void ReportSignalHandler(int nSignal)
+{
+	int nErrno = errno;
+
+	gbReportRequested = 1;
+	sem_post(&gReportSem);
+	errno = nErrno;
+}
+static void* ReportThread(void* pArg)
+{
+	while(true) {
+		while(sem_wait(&gReportSem) != 0 && errno == EINTR) {
+		}
+		if(gbReportThreadRun == false) {
+			break;
+		}
+		if(gbReportRequested != 0) {
+			gbReportRequested = 0;
+			DumpReports();
+		}
+	}
+	return NULL;
+}
+static void StartReportThread()
+{
+	struct sigaction action;
+
+	if(gnReportSignal == 0 || gbReportThreadRun == true) {
+		return;
+	}
+	sem_init(&gReportSem, 0, 0);
+	gbTreeLocks			= true;
+	gbReportThreadRun	= true;
+	if(pthread_create(&gReportThread, NULL, ReportThread, NULL) != 0) {
+		gbReportThreadRun = false;
+		sem_destroy(&gReportSem);
+		return;
+	}
+	memset(&action, 0, sizeof(action));
+	action.sa_handler	= ReportSignalHandler;
+	action.sa_flags		= SA_RESTART;
+	sigemptyset(&action.sa_mask);
+	sigaction(gnReportSignal, &action, &gOldReportAction);
+}
+static void StopReportThread()
+{
+	if(gbReportThreadRun == false) {
+		return;
+	}
+	sigaction(gnReportSignal, &gOldReportAction, NULL);
+	gbReportThreadRun = false;
+	sem_post(&gReportSem);
+	pthread_join(gReportThread, NULL);
+	sem_destroy(&gReportSem);
+}
+/*
+**---------------------------------------------------------------------
+** External Functions
+**---------------------------------------------------------------------
+*/
+/* Initialize the performance metrics system */
+bool PerfMetrics::PerfStart ( void )
+{
+
+	// Create an array for the threads
+	mThreadList.clear();
+	__sync_fetch_and_add(&gnThreadGeneration, 1);
+	GetCurrentTimeStamp(&gStartTime);
+
+	if(gnRegistryArena != 0 && gRegistryArena.GetSize() == 0) {
+		gRegistryArena.Init(gnRegistryArena);
+	}
+	StartBudgetThread();
+	StartWatchdog();
+	StartLiveStats();
+	StartMetricsEndpoint();
+	StartReportThread();
+	StartImage();
+#ifdef PERFORMANCE_MEMORY
+	// Registered after the static data is built, so it runs before it's destroyed
+	if(mbAtExitSet == false) {
+		atexit(StopAllocTracking);
+		mbAtExitSet = true;
+	}
+	mbTrackAllocs = true;
+#endif
+
+	// Setup mutex
+	if(bLockInit) {
+		pthread_mutexattr_t attr;
+		if (pthread_mutexattr_init(&attr) == 0) {
+			if (pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE) == 0)	{
+				int retVal = pthread_mutex_init(&lock, &attr);
+				if(retVal == 0)
+					bLockInit = true;
+			}
+			pthread_mutexattr_destroy(&attr);
 		}
 	}
 	
@@ -922,6 +3727,14 @@ bool PerfMetrics::PerfStart ( void )
 bool PerfMetrics::PerfStop ( void )
 {
 	GetCurrentTimeStamp(&gEndTime);
+	StopBudgetThread();
+	StopWatchdog();
+	StopLiveStats();
+	StopMetricsEndpoint();
+	StopReportThread();
+	if(gpImage != NULL) {
+		gpImage->SetEnded(gEndTime);
+	}
 
 	pthread_mutex_destroy(&lock);
 	bLockInit = false;
@@ -938,22 +3751,80 @@ bool PerfMetrics::PerfCleanup ( void )
 		// If we have't already stopped then stop now.
 		PerfStop();
 	}
+#ifdef PERFORMANCE_MEMORY
+	// Nodes are about to go, stop charging allocations to them
+	mbTrackAllocs = false;
+#endif
+	__sync_fetch_and_add(&gnThreadGeneration, 1);
 	while(!mThreadList.empty()) {
 		pThread		= mThreadList.front();
 		mThreadList.pop_front();
 		delete pThread;
 	}
-	while(!gPerfIDList.empty()) {
-		pPerfData	= gPerfIDList.front();
-		gPerfIDList.pop_front();
-		if(pPerfData->szName)
-			delete[] pPerfData->szName;
-		delete pPerfData;
+	PerfIDList::iterator idIter = gPerfIDList.begin();
+	while(idIter != gPerfIDList.end()) {
+		pPerfData	= *idIter++;
+		RegistryStrFree(pPerfData->szName);
+		if(pPerfData->pSlowCalls != NULL) {
+			delete pPerfData->pSlowCalls;
+		}
+		DeleteRegistryData(pPerfData);
+	}
+	gPerfIDList.clear();
+	PerfCatList::iterator catIter = gPerfCatList.begin();
+	while(catIter != gPerfCatList.end()) {
+		PerfCategoryData* pPerfCatData = *catIter++;
+		RegistryStrFree(pPerfCatData->szName);
+		DeleteRegistryData(pPerfCatData);
 	}
+	gPerfCatList.clear();
+	gRegistryArena.Free();
 
 	// Reset the static variables.
 	gStartTime	= 0;
 	gEndTime	= 0;
+	gnProfilerMemory			= 0;
+	gnDroppedCalls				= 0;
+	gnDroppedIO					= 0;
+	gnDroppedThreads			= 0;
+	gnDroppedMetrics			= 0;
+	gnAbortedCalls				= 0;
+	gbRusage					= false;
+	geCounterMode				= PerfCountersNone;
+	gnLockCount					= 0;
+	gbIO						= false;
+	gbWork						= false;
+	gnMetricCount				= 0;
+	gnGaugeSequence				= 0;
+	gbBudgets					= false;
+	gpThreads					= NULL;
+	if(gpLiveStats != NULL) {
+		delete gpLiveStats;
+		gpLiveStats				= NULL;
+	}
+	gbLiveCounts				= false;
+	gbTreeLocks					= false;
+	gnStuckScopes				= 0;
+	if(gpImage != NULL) {
+		delete gpImage;
+		gpImage					= NULL;
+	}
+	pthread_mutex_lock(&gBenchMutex);
+	gBenchResults.clear();
+	pthread_mutex_unlock(&gBenchMutex);
+	if(gpBudgetQueue != NULL) {
+		delete gpBudgetQueue;
+		gpBudgetQueue			= NULL;
+	}
+	gPERF_ID_THREAD_START		= INVALID_PERF_ID;
+	gPERF_CATID_THREAD_START	= INVALID_PERF_ID;
+	gPERF_ID_OVERFLOW			= INVALID_PERF_ID;
+	gPERF_CATID_OVERFLOW		= INVALID_PERF_ID;
+#ifdef PERFORMANCE_MEMORY    
+	mAllocTable.Clear();
+	mAllocCurrent				= 0;
+	mAllocMax					= 0;
+#endif
 
 	return true;
 }
@@ -962,12 +3833,39 @@ bool PerfMetrics::PerfReport ( void )
 {
 	uint32_t 			idx			= 0;
 	uint64_t			nTotalTime	= gEndTime - gStartTime;
-	CategoryReport		catReport[gPerfCatList.size()];
-	IDReport			idReport[gPerfIDList.size()];
+	// PERF_SET_BUDGET may still add IDs, the report has the ones there are now
+	PerfIDList			ids			= gPerfIDList;
+	PerfCatList			categories	= gPerfCatList;
+	uint32_t			nIDs		= ids.size();
+	uint32_t			nCategories	= categories.size();
+	CategoryReport		catReport[nCategories];
+	IDReport			idReport[nIDs];
 	
+	pthread_mutex_lock(&gReportMutex);
+	gpReportIDs			= &ids;
+	gpReportCategories	= &categories;
+	if(gbBinaryReport == true) {
+		// One sequential write, perfmetrics-report makes the text reports from it
+		bool bWritten = WriteBinaryReportToFile();
+		uint32_t nMetrics = __atomic_load_n(&gnMetricCount, __ATOMIC_ACQUIRE);
+		if(nMetrics > 0) {
+			PerfMetricValue	totals[nMetrics];
+
+			GetMetricTotals(&totals[0], nMetrics);
+			WriteMetricsReportToFile(&totals[0], nMetrics);
+		}
+		WriteBinaryCompanionReports();
+		if(HasBenchResults()) {
+			WriteBenchReportToFile();
+		}
+		gpReportIDs			= &gPerfIDList;
+		gpReportCategories	= &gPerfCatList;
+		pthread_mutex_unlock(&gReportMutex);
+		return bWritten;
+	}
     LogData("Generating Performance Report total time = %llu (%llu - %llu)\n", nTotalTime, gEndTime, gStartTime);
-	memset(&catReport[0], 0, sizeof(CategoryReport) * gPerfCatList.size());
-	memset(&idReport[0], 0, sizeof(IDReport) * gPerfIDList.size());
+	memset(&catReport[0], 0, sizeof(CategoryReport) * nCategories);
+	memset(&idReport[0], 0, sizeof(IDReport) * nIDs);
 	
     cout << endl;
 
@@ -977,26 +3875,39 @@ bool PerfMetrics::PerfReport ( void )
 	#endif
 	// Total Time
 	cout << setiosflags(ios::fixed) << setprecision(3) << "Total Time = " << nTotalTime / 1000.0 << " (msec)" << endl;
+	if(gnMaxThreadNodes != 0 || gnMaxDepth != 0 || gnMaxMemory != 0 || gnThreadArena != 0) {
+		cout << "Tree memory = " << gnProfilerMemory << " (bytes)" << endl;
+		cout << "Dropped calls = " << gnDroppedCalls << " (charged to [other])" << endl;
+		cout << "Dropped I/O ops = " << gnDroppedIO << " (no room for an I/O block)" << endl;
+		cout << "Dropped metric updates = " << gnDroppedMetrics << " (no room for the thread's metrics)" << endl;
+		cout << "Threads not profiled = " << gnDroppedThreads << " (no room for the thread's tree)" << endl;
+	}
 
 
 	// Total Category
-	LogData("Setting up category report - num of categories = %d\n", gPerfCatList.size());
-	for(std::list<PerfCategoryData*>::iterator iter = gPerfCatList.begin(); iter != gPerfCatList.end(); ++iter) {
-		catReport[idx].szName	= (*iter)->szName;
-		catReport[idx].catID	= (*iter)->nID;
-//		cout << " Setting up Category " << catReport[idx].szName;
-//		cout << " ID = " << catReport[idx].catID << endl;
-		idx++;
-	}
-	GenerateReport((void*)&catReport[0], gPerfCatList.size(), CategoryReportType);
+	LogData("Setting up category report - num of categories = %d\n", nCategories);
+	InitCategoryReport(&catReport[0]);
+	GenerateReport((void*)&catReport[0], nCategories, CategoryReportType);
 
 #ifdef WRITE_REPORT_TO_FILE
-	WriteCategoryReportToFile(&catReport[0], gPerfCatList.size());
+	WriteCategoryReportToFile(&catReport[0], nCategories);
 #endif
 
 #ifdef WRITE_REPORT_TO_SCREEN
 	cout << "\n\nCategory Report " << endl;
 	cout << "Name\t\tSamples\t\tTotal\t\tSelf\t\tMin\t\tMax\t\tAvg";
+	if(gbRusage == true) {
+		cout << "\t\tVolCS\t\tInvolCS\t\tMinFlt\t\tMajFlt\t\tBlkIn\t\tBlkOut";
+	}
+	if(geCounterMode != PerfCountersNone) {
+		PrintCounterHeader();
+	}
+	if(gbIO == true) {
+		cout << "\t\tIO Ops\t\tIO Bytes\t\tIO Time\t\tMB/s\t\tIO Latency (us)";
+	}
+	if(gbWork == true) {
+		cout << "\t\tWork Units\t\tns/Unit\t\tUnits/s";
+	}
 #ifdef DISPLAY_CPU_TOTALS
 	cout << "\t\tCPU Total\t\tSelf\t\tMin\t\tMax\t\tAvg";
 #endif
@@ -1006,7 +3917,7 @@ bool PerfMetrics::PerfReport ( void )
 	cout << "---------------------------------------------------------------------------------------------";
 #endif
 	cout << endl;
-	for(idx = 0; idx < gPerfCatList.size(); idx++) {
+	for(idx = 0; idx < nCategories; idx++) {
 		if(catReport[idx].nSamples > 0) {
 			cout << catReport[idx].szName;
 			if(strlen(catReport[idx].szName) > 8) {
@@ -1026,6 +3937,18 @@ bool PerfMetrics::PerfReport ( void )
 			cout << catReport[idx].nMaxTime / 1000.0;
 			catReport[idx].nMaxTime >= MAX_REPORT_NUMBER_TAB ? cout << "\t" :  cout << "\t\t";
 			cout << catReport[idx].nAvgTime / 1000.0;
+			if(gbRusage == true) {
+				PrintRusageColumns(&catReport[idx].rusage);
+			}
+			if(geCounterMode != PerfCountersNone) {
+				PrintCounterColumns(catReport[idx].nCounterValues, catReport[idx].nSamples);
+			}
+			if(gbIO == true) {
+				PrintIOColumns(&catReport[idx].io);
+			}
+			if(gbWork == true) {
+				PrintWorkColumns(catReport[idx].nTotalTime, catReport[idx].nWorkUnits);
+			}
 #ifdef DISPLAY_CPU_TOTALS
 			cout << "\t\t";
 			cout << catReport[idx].nTotalCPUTime * 1000.0;
@@ -1046,24 +3969,40 @@ bool PerfMetrics::PerfReport ( void )
 #endif // WRITE_REPORT_TO_SCREEN
 
 	// Total ID
-	LogData("Setting up ID report num of IDs = %d\n", gPerfIDList.size() - 1);  // Don't count Thread PerfID
-	for(idx = 0; idx < gPerfIDList.size(); idx++) {
-		idReport[idx].szName		= FindPerfDataByIdx(idx)->szName;
-		idReport[idx].szCategory	= FindPerfDataByIdx(idx)->szCategory;
-//		cout << "Setting up ID report Name = " << idReport[idx].szName;
-//		cout << " Category = " << idReport[idx].szCategory << endl;
-	}
-	GenerateReport((void*)&idReport[0], gPerfIDList.size(), IDReportType);
+	LogData("Setting up ID report num of IDs = %d\n", nIDs - 1);  // Don't count Thread PerfID
+	InitIDReport(&idReport[0]);
+	GenerateReport((void*)&idReport[0], nIDs, IDReportType);
 	// Sort the data
-	SortIDByTotalCalls(&idReport[0], gPerfIDList.size());
+	SortIDByTotalCalls(&idReport[0], nIDs);
 
 #ifdef WRITE_REPORT_TO_FILE
-	WriteIDReportToFile(&idReport[0], gPerfIDList.size());
+	WriteIDReportToFile(&idReport[0], nIDs);
 #endif
 
 #ifdef WRITE_REPORT_TO_SCREEN
 	cout << "\n\nID Report " << endl;
 	cout << "Name\t\t\t\t\t\tSamples\t\tTotal\t\tSelf\t\tMin\t\tMax\t\tAvg\t\tCategory";
+#ifdef PERFORMANCE_MEMORY
+	cout << "\t\tAllocs\t\tBytes\t\tFrees\t\tLive";
+#endif
+	if(gbRusage == true) {
+		cout << "\t\tVolCS\t\tInvolCS\t\tMinFlt\t\tMajFlt\t\tBlkIn\t\tBlkOut";
+	}
+	if(geCounterMode != PerfCountersNone) {
+		PrintCounterHeader();
+	}
+	if(gbIO == true) {
+		cout << "\t\tIO Ops\t\tIO Bytes\t\tIO Time\t\tMB/s\t\tIO Latency (us)";
+	}
+	if(gbWork == true) {
+		cout << "\t\tWork Units\t\tns/Unit\t\tUnits/s";
+	}
+	if(gbBudgets == true) {
+		cout << "\t\tBudget\t\tBreaches";
+	}
+	if(gnAbortedCalls > 0) {
+		cout << "\t\tAborted";
+	}
 #ifdef DISPLAY_CPU_TOTALS
 	cout << "\t\tCPU Total\t\tSelf\t\tMin\t\tMax\t\tAvg";
 #endif
@@ -1074,7 +4013,7 @@ bool PerfMetrics::PerfReport ( void )
 	cout << "---------------------------------------------------------------------------------------------";
 #endif
 	cout << endl;
-	for(idx = 0; idx < gPerfIDList.size(); idx++) {
+	for(idx = 0; idx < nIDs; idx++) {
 		if(idReport[idx].nSamples > 0) {
 			cout << idReport[idx].szName;
 			if(strlen(idReport[idx].szName) < 8) {
@@ -1108,6 +4047,34 @@ bool PerfMetrics::PerfReport ( void )
 			cout << idReport[idx].nAvgTime / 1000.0;
 			idReport[idx].nAvgTime >= MAX_REPORT_NUMBER_TAB ? cout << "\t" :  cout << "\t\t";
 			cout << idReport[idx].szCategory;
+#ifdef PERFORMANCE_MEMORY
+			cout << "\t\t";
+			cout << idReport[idx].nAllocCount;
+			idReport[idx].nAllocCount >= MAX_REPORT_NUMBER_TAB ? cout << "\t" :  cout << "\t\t";
+			cout << idReport[idx].nAllocBytes;
+			idReport[idx].nAllocBytes >= MAX_REPORT_NUMBER_TAB ? cout << "\t" :  cout << "\t\t";
+			cout << idReport[idx].nFreeCount;
+			idReport[idx].nFreeCount >= MAX_REPORT_NUMBER_TAB ? cout << "\t" :  cout << "\t\t";
+			cout << idReport[idx].nLiveBytes;
+#endif
+			if(gbRusage == true) {
+				PrintRusageColumns(&idReport[idx].rusage);
+			}
+			if(geCounterMode != PerfCountersNone) {
+				PrintCounterColumns(idReport[idx].nCounterValues, idReport[idx].nSamples);
+			}
+			if(gbIO == true) {
+				PrintIOColumns(&idReport[idx].io);
+			}
+			if(gbWork == true) {
+				PrintWorkColumns(idReport[idx].nTotalTime, idReport[idx].nWorkUnits);
+			}
+			if(gbBudgets == true) {
+				cout << "\t\t" << idReport[idx].nBudget << "\t\t" << idReport[idx].nBreaches;
+			}
+			if(gnAbortedCalls > 0) {
+				cout << "\t\t" << idReport[idx].nAbortedCalls;
+			}
 
 #ifdef DISPLAY_CPU_TOTALS
 			cout << "\t\t";
@@ -1124,8 +4091,51 @@ bool PerfMetrics::PerfReport ( void )
 			cout << endl;
 		}
 	}		
+	if(gpBudgetQueue != NULL && gpBudgetQueue->GetDropped() > 0) {
+		cout << endl << "Budget breach events dropped, the callback fell behind: " << gpBudgetQueue->GetDropped() << endl;
+	}
+	if(gnStuckScopes > 0) {
+		cout << endl << "Scopes reported stuck by the watchdog: " << gnStuckScopes << endl;
+	}
 #endif // WRITE_REPORT_TO_SCREEN
 
+	// Lock contention, only when something used PERF_MUTEX_LOCK or PERF_LOCK_GUARD
+	uint32_t nLocks = __atomic_load_n(&gnLockCount, __ATOMIC_ACQUIRE);
+	if(nLocks > 0) {
+		PerfLockData	locks[nLocks];
+
+		memcpy(&locks[0], &gLockData[0], sizeof(PerfLockData) * nLocks);
+		SortLocksByWait(&locks[0], nLocks);
+#ifdef WRITE_REPORT_TO_FILE
+		WriteContentionReportToFile(&locks[0], nLocks, &idReport[0], nIDs);
+#endif
+#ifdef WRITE_REPORT_TO_SCREEN
+		PrintContentionReport(&locks[0], nLocks);
+#endif
+	}
+	// Counters and gauges, only when something used PERF_COUNTER_ADD or PERF_GAUGE_SET
+	uint32_t nMetrics = __atomic_load_n(&gnMetricCount, __ATOMIC_ACQUIRE);
+	if(nMetrics > 0) {
+		PerfMetricValue	totals[nMetrics];
+
+		GetMetricTotals(&totals[0], nMetrics);
+#ifdef WRITE_REPORT_TO_FILE
+		WriteMetricsReportToFile(&totals[0], nMetrics);
+#endif
+#ifdef WRITE_REPORT_TO_SCREEN
+		PrintMetricsReport(&totals[0], nMetrics);
+#endif
+	}
+	// Only when something ran PERF_BENCH
+	if(HasBenchResults()) {
+#ifdef WRITE_REPORT_TO_FILE
+		WriteBenchReportToFile();
+#endif
+#ifdef WRITE_REPORT_TO_SCREEN
+		PrintBenchReport();
+#endif
+	}
+
 #ifdef WRITE_REPORT_TO_SCREEN
 	cout << "\n\nNode Tree Report " << endl;
 	GenerateReport((void*)NULL, 0, TreeReportType);
@@ -1135,7 +4145,19 @@ bool PerfMetrics::PerfReport ( void )
 
 #ifdef WRITE_REPORT_TO_FILE
 	WriteTreeReportToFile();
+#ifdef FOLDED_REPORT
+	WriteFoldedReportToFile();
+#endif
+#ifdef MERGED_TREE_REPORT
+	WriteMergedTreeReportToFile();
+#endif
+	if(gnSlowCalls != 0) {
+		WriteOutlierReportToFile();
+	}
 #endif
+	gpReportIDs			= &gPerfIDList;
+	gpReportCategories	= &gPerfCatList;
+	pthread_mutex_unlock(&gReportMutex);
 
 	return true;
 }
@@ -1145,57 +4167,109 @@ bool PerfMetrics::PerfEntry ( PerfID id )
 	PerformanceRec* pCurrentRecord	= NULL;
 	ThreadRecord*	pActiveThread	= NULL;
 	pthread_t 		currentThread 	= pthread_self();
+	uint64_t		nEntryTime		= 0;
+	ThreadRecord::EntryFrame	frame;
 	
 	// We have stopped don't collect any more data
 	if(gEndTime != 0) {
 		return false;
 	}
 
-	list<ThreadRecord*>::reverse_iterator iter 	= mThreadList.rbegin();
-	
-	// Start at the end as this is likely to match first
-	while(iter != mThreadList.rend()) {
-		if((*iter)->GetThreadID() == currentThread) {
-			break;
+	pActiveThread = FindThreadRecord();
+	if(pActiveThread == NULL) {
+		// A thread that didn't fit in PerfOptionMaxMemory isn't profiled
+		if(tlsRefusedGeneration == gnThreadGeneration) {
+			return false;
+		}
+		if(ReserveProfilerMemory(sizeof(ThreadRecord) + PERF_NODE_MEMORY) == false) {
+			tlsRefusedGeneration = gnThreadGeneration;
+			__sync_fetch_and_add(&gnDroppedThreads, 1);
+			return false;
 		}
-		iter++;
-	}
-	if(iter == mThreadList.rend()) {
 		// Add new thread
 //		cout << "New Thread ID " << currentThread << endl;
 		pActiveThread = new ThreadRecord();
+		if(gnThreadArena != 0) {
+			// Everything this thread's tree needs is allocated now
+			pActiveThread->CreateArena(gnThreadArena);
+		}
+		if(gbPerfCounters == true && pActiveThread->OpenCounters(geCounterMode) == true) {
+			// Every thread opens the same counters as the first one
+			geCounterMode = pActiveThread->GetCounters()->GetMode();
+		}
+		pthread_mutex_lock(&gThreadListMutex);
 		mThreadList.push_back(pActiveThread);
-		if(gPERF_ID_THREAD_START == INVALID_PERF_ID ) {
-			// First thread
-			PerfIDData* pPerfData 	= new PerfIDData();
-			pPerfData->szName		= strdup("ThreadStart");
-			pPerfData->szCategory 	= strdup("THREAD");
-			pPerfData->id 			= GetUniqueID();
-			pPerfData->categoryID	= GetUniqueID();
-			gPerfIDList.push_back(pPerfData);
-			// Save the thread ID.
-			gPERF_ID_THREAD_START 		= pPerfData->id;
-			gPERF_CATID_THREAD_START 	= pPerfData->categoryID;
+		pthread_mutex_unlock(&gThreadListMutex);
+		tlsThread			= pActiveThread;
+		tlsThreadGeneration	= gnThreadGeneration;
+		if(__atomic_load_n(&gPERF_ID_THREAD_START, __ATOMIC_ACQUIRE) == INVALID_PERF_ID) {
+			pthread_mutex_lock(&gRegistryMutex);
+			if(gPERF_ID_THREAD_START == INVALID_PERF_ID) {
+				// First thread
+				PerfIDData* pThreadData 	= AddInternalID("ThreadStart", "THREAD", GetUniqueID(), GetUniqueID());
+				// Calls dropped by the tree limits
+				PerfIDData* pPerfData		= AddInternalID("[other]", "OVERFLOW", GetUniqueID(), GetUniqueID());
+				gPERF_ID_OVERFLOW			= pPerfData->id;
+				gPERF_CATID_OVERFLOW		= pPerfData->categoryID;
+				// Save the thread ID, last so the other threads see both.
+				gPERF_CATID_THREAD_START 	= pThreadData->categoryID;
+				__atomic_store_n(&gPERF_ID_THREAD_START, pThreadData->id, __ATOMIC_RELEASE);
+			}
+			pthread_mutex_unlock(&gRegistryMutex);
 		}
 		// Add a root node for the tread start.
 		// The root node only has one entry and exit
-		pCurrentRecord = NewPerfRecord(gPERF_ID_THREAD_START, gPERF_CATID_THREAD_START, PerfRecord, NULL, currentThread);
+		pCurrentRecord = NewPerfRecord(gPERF_ID_THREAD_START, gPERF_CATID_THREAD_START, PerfRecord, NULL, currentThread, pActiveThread->GetArena());
+		pActiveThread->ReserveArena(PERF_RECORD_MEMORY);
 		pActiveThread->SetRootNode((Node*)pCurrentRecord);
 		pActiveThread->SetCurrentNode((Node*)pCurrentRecord);	
-		pCurrentRecord->AddEntry();
+		GetCurrentTimeStamp(&nEntryTime);
+		pCurrentRecord->AddEntry(nEntryTime);
+		// Other threads only see it with its root node
+		AddThread(pActiveThread);
+		// After it's on the list, EnableLiveCounts either sees the thread or
+		// has already set the flag
+		if(__atomic_load_n(&gbLiveCounts, __ATOMIC_SEQ_CST) == true) {
+			pActiveThread->CreateLiveCounts();
+		}
 //		cout << "Adding root node " << (void*)pCurrentRecord << " ID = " << (unsigned long)pCurrentRecord->GetID() << endl;
 	}
-	else {
-		pActiveThread = *iter;
-	}
+	PerfTreeGuard guard(pActiveThread);
 
 	// Get the current node
 	Node* pNode = pActiveThread->GetCurrentNode();
 //	cout << "Using threadID " << pActiveThread->GetThreadID() << " Looking for ID " << id << endl;
 //	cout << "Current Node = " << pNode << endl;
 
+	frame.pReturn		= pNode;
+	frame.nChildTime	= 0;
+	frame.id			= id;
+	frame.bFolded		= true;
+	if(((PerformanceRec*)pNode)->GetID() == gPERF_ID_OVERFLOW) {
+		// Everything called from an [other] node stays in it, and is a dropped call too
+		GetCurrentTimeStamp(&frame.nEntryTime);
+		frame.pRecord	= (PerformanceRec*)pNode;
+		pActiveThread->PushFrame(frame);
+		frame.pRecord->AddRecursiveEntry();
+		pActiveThread->AddDroppedCall();
+		__sync_fetch_and_add(&gnDroppedCalls, 1);
+		return true;
+	}
+	if(gbFoldRecursion == true) {
+		// Is this ID already on the call path?
+		PerformanceRec* pActive = FindActiveRecord(pActiveThread, id);
+		if(pActive != NULL) {
+			GetCurrentTimeStamp(&frame.nEntryTime);
+			frame.pRecord	= pActive;
+			pActiveThread->PushFrame(frame);
+			pActive->AddRecursiveEntry();
+			pActiveThread->SetCurrentNode(pActive);
+			return true;
+		}
+	}
+
 	if(pNode->GetNodeType() == PerfRecord) {
-		list<Node*>::iterator 	childIter	= pNode->GetSiblingIterator();
+		NodeList::iterator 	childIter	= pNode->GetSiblingIterator();
 		PerformanceRec* 		pChild 		= NULL;
 
 		// Found the current record, now does it have this ID as a child already?
@@ -1204,9 +4278,7 @@ bool PerfMetrics::PerfEntry ( PerfID id )
 		if(pNode->IsSiblingEnd(childIter) == true) {
 			// There are no current child nodes
 			// Add a new node
-			PerfID catID = FindPerfDataByPerfID(id)->categoryID;
-			pChild = NewPerfRecord(id, catID, PerfRecord, pCurrentRecord, currentThread);
-			pCurrentRecord->AddSibling(pChild);
+			pChild = AddChildRecord(pActiveThread, pCurrentRecord, id);
 //			cout << "No children, adding first child node " << pChild << " ID = " << pChild->GetID() << endl;
 //			cout << "Parent =  " << pCurrentRecord << " Parent ID = " << pCurrentRecord->GetID() << endl;
 		}
@@ -1233,9 +4305,7 @@ bool PerfMetrics::PerfEntry ( PerfID id )
 				}
 				if(pNode->IsSiblingEnd(childIter) == true) {
 					// End of list
-					PerfID catID = FindPerfDataByPerfID(id)->categoryID;
-					pChild = NewPerfRecord(id, catID, PerfRecord, pCurrentRecord, currentThread);
-					pCurrentRecord->AddSibling(pChild);
+					pChild = AddChildRecord(pActiveThread, pCurrentRecord, id);
 //					cout << "Could not find child ID adding new one " << endl;
 //					cout << "\tNew child " << pChild << " ID = " << pChild->GetID() << endl;
 //					cout << "\tParent =  " << pCurrentRecord << " Parent ID = " << pCurrentRecord->GetID() << endl;
@@ -1243,8 +4313,12 @@ bool PerfMetrics::PerfEntry ( PerfID id )
 			}
 		}
 		if(pChild != NULL) {
+			GetCurrentTimeStamp(&frame.nEntryTime);
+			frame.pRecord	= pChild;
+			frame.bFolded	= false;
 			pActiveThread->SetCurrentNode((Node*)pChild);
-			pChild->AddEntry();
+			pActiveThread->PushFrame(frame);
+			pChild->AddEntry(frame.nEntryTime);
 //			cout << "Setting current node to " << pChild << " ID = " << pChild->GetID() << endl;
 		}
 		else {
@@ -1255,191 +4329,562 @@ bool PerfMetrics::PerfEntry ( PerfID id )
 		// Error
 		return false;
 	}
-	
+	
+	return true;
+}
+/* Record an exit point */
+bool PerfMetrics::PerfExit ( PerfID id )
+{
+	PerformanceRec* pCurrentRecord	= NULL;
+	ThreadRecord*	pActiveThread	= NULL;
+	
+	// We have stopped don't collect any more data
+	if(gEndTime != 0) {
+		return false;
+	}
+
+	pActiveThread = FindThreadRecord();
+	if(pActiveThread == NULL) {
+		if(tlsRefusedGeneration == gnThreadGeneration) {
+			return false;
+		}
+		//Error.  How can we be exiting when we don't have the thread on record.
+		cout << "ERROR: PerfMetrics::PerfExit could not find Thread" << endl;
+		return false;
+	}
+
+	// The innermost open call of this ID, normally the last one entered
+	size_t nFrame = pActiveThread->GetFrameDepth();
+	while(nFrame > 0 && pActiveThread->GetFrame(nFrame - 1)->id != id) {
+		nFrame--;
+	}
+	if(nFrame == 0) {
+		// Error
+		pCurrentRecord = (PerformanceRec*)pActiveThread->GetCurrentNode();
+		cout << "ERROR: PerfMetrics::PerfExit could not find ID (" << (unsigned int)id << ") current record id = " << (unsigned int)pCurrentRecord->GetID() << endl;
+		return false;
+	}
+	// Calls entered since then missed their exits, an exception went through them
+	while(pActiveThread->GetFrameDepth() > nFrame) {
+		CloseFrame(pActiveThread, true);
+	}
+	CloseFrame(pActiveThread, false);
+	return true;
+}
+
+bool PerfMetrics::PerfEntry(const char * szName,  const char * szCategory)
+{
+	// We have stopped don't collect any more data
+	if(gEndTime != 0) {
+		return false;
+	}
+
+	// Does this name/cat pair exist already?
+	PerfIDData* pPerfData = FindOrAddPerfData(szName, szCategory);
+	// Record the entry point
+	return PerfEntry(pPerfData->id);
+}
+bool PerfMetrics::PerfExit(const char * szName, const char * szCategory)
+{
+	// We have stopped don't collect any more data
+	if(gEndTime != 0) {
+		return false;
+	}
+
+	// Does this name/cat pair exist already?
+	PerfIDData* pPerfData = FindPerfDataByName(szName, szCategory);
+	// If not, this is an error
+	if(pPerfData == NULL) {
+		cout << endl << "ERROR: PerfExit with no matching PerfEntry!!!";
+		cout << " Name = " << szName << " Category = " << szCategory << endl << endl;
+		return false;
+	}
+
+	// Record the exit point
+	return PerfExit(pPerfData->id);
+}
+//
+// An allocation that stands for nCount of them and nBytes in all, so the
+// sampled allocation hooks can give estimates rather than just what they saw.
+// The free takes back the same weight.
+//
+bool PerfAllocSampled(void* addr, size_t size, uint64_t nBytes, uint32_t nCount)
+{
+#ifdef PERFORMANCE_MEMORY    
+    AllocRecord oldRec;
+    uint64_t    nCurrent;
+    uint64_t    nMax;
+
+    PerformanceRec* pOwner = NULL;
+    
+    if(addr == NULL || mbTrackAllocs == false) {
+        return false;
+    }
+    // Charge the allocation to the thread's current node
+    ThreadRecord* pThread = FindThreadRecord();
+    if(pThread != NULL && pThread->GetCurrentNode() != NULL && pThread->GetCurrentNode()->GetNodeType() == PerfRecord) {
+        pOwner = (PerformanceRec*)pThread->GetCurrentNode();
+        pOwner->AddAlloc(size, nBytes, nCount);
+    }
+    // An address we never saw freed, drop the old size so it isn't counted twice
+    if(mAllocTable.Insert(AllocRecord(addr, nBytes, pOwner, nCount), oldRec)) {
+        __sync_fetch_and_sub(&mAllocCurrent, oldRec.GetSize());
+        if(oldRec.GetOwner() != NULL) {
+            ((PerformanceRec*)oldRec.GetOwner())->AddFree(oldRec.GetSize(), oldRec.GetCount());
+        }
+    }
+    nCurrent = __sync_add_and_fetch(&mAllocCurrent, nBytes);
+    nMax = __atomic_load_n(&mAllocMax, __ATOMIC_RELAXED);
+    while(nCurrent > nMax && !__sync_bool_compare_and_swap(&mAllocMax, nMax, nCurrent)) {
+        nMax = __atomic_load_n(&mAllocMax, __ATOMIC_RELAXED);
+    }
+#endif
+    return true;
+}
+bool PerfMetrics::PerfAlloc(void* addr, int size)
+{
+    if(size < 0) {
+        return false;
+    }
+    return PerfAllocSampled(addr, size, size, 1);
+}
+
+bool PerfMetrics::PerfFree(void* addr)
+{
+#ifdef PERFORMANCE_MEMORY    
+	AllocRecord rec;
+
+	if (mbTrackAllocs == false) {
+		return false;
+	}
+	if (mAllocTable.Remove(addr, rec)) {
+		__sync_fetch_and_sub(&mAllocCurrent, rec.GetSize());
+		// Freed memory goes back to the node that allocated it, whichever thread frees it
+		if(rec.GetOwner() != NULL) {
+			((PerformanceRec*)rec.GetOwner())->AddFree(rec.GetSize(), rec.GetCount());
+		}
+		return true;
+	}
+	//cout << "WARNING!  FREEING NON-ALLOCATED MEMORY AT " << addr << endl;
+#endif
+	return false;
+}
+//
+// Capture getrusage(RUSAGE_THREAD) deltas for every call in this category.
+// Costs two syscalls per call so it's only for categories that need it.
+// Nodes created before this is called aren't changed.
+//
+bool PerfMetrics::PerfCategoryRusage(const char * szCategory)
+{
+	PerfCategoryData* pPerfCatData = FindOrAddCategoryData(szCategory);
+
+	pPerfCatData->bRusage	= true;
+	gbRusage				= true;
 	return true;
 }
-/* Record an exit point */
-bool PerfMetrics::PerfExit ( PerfID id )
+//
+// Count units of work (items, bytes, rows) against the innermost open scope
+// so batch calls of different sizes can be compared per unit.
+//
+bool PerfMetrics::PerfAddWork(uint64_t nUnits)
 {
-	PerformanceRec* pCurrentRecord	= NULL;
-	ThreadRecord*	pActiveThread	= NULL;
-	pthread_t 		currentThread 	= pthread_self();
-	
-	// We have stopped don't collect any more data
-	if(gEndTime != 0) {
+	if(gStartTime == 0 || gEndTime != 0) {
+		return false;
+	}
+	ThreadRecord* pThread = FindThreadRecord();
+	if(pThread == NULL || pThread->GetCurrentNode() == NULL || pThread->GetCurrentNode()->GetNodeType() != PerfRecord) {
 		return false;
 	}
+	((PerformanceRec*)pThread->GetCurrentNode())->AddWork(nUnits);
+	if(gbWork == false) {
+		gbWork = true;
+	}
+	return true;
+}
+//
+// Named counters and gauges, kept per thread and against the current node so
+// the reports can show them next to the timings.
+//
+bool PerfMetrics::PerfCounterAdd(const char * szName, int64_t nDelta)
+{
+	return AddMetric(szName, nDelta, false);
+}
+bool PerfMetrics::PerfGaugeSet(const char * szName, int64_t nValue)
+{
+	return AddMetric(szName, nValue, true);
+}
+//
+// Latency budgets in usec.  A call that takes longer counts as a breach of
+// its ID, an ID without a budget of its own uses its category's.  0 clears.
+//
+bool PerfMetrics::PerfSetBudget(const char * szName, const char * szCategory, uint64_t nBudget)
+{
+	PerfIDData* pPerfData = FindOrAddPerfData(szName, szCategory);
 
-	list<ThreadRecord*>::reverse_iterator iter 	= mThreadList.rbegin();
-	
-	// Start at the end as this is likely to match first
-	while(iter != mThreadList.rend()) {
-		if((*iter)->GetThreadID() == currentThread) {
-			break;
-		}
-		iter++;
+	__atomic_store_n(&pPerfData->budget.nBudget, nBudget, __ATOMIC_RELAXED);
+	gbBudgets = true;
+	return true;
+}
+bool PerfMetrics::PerfSetCategoryBudget(const char * szCategory, uint64_t nBudget)
+{
+	PerfCategoryData* pPerfCatData = FindOrAddCategoryData(szCategory);
+
+	__atomic_store_n(&pPerfCatData->nBudget, nBudget, __ATOMIC_RELAXED);
+	gbBudgets = true;
+	return true;
+}
+//
+// Called with every breach.  Synchronous callbacks run on the thread that
+// breached, inside its PerfExit.  Asynchronous ones run on a library thread
+// fed by a bounded queue, events are dropped if it can't keep up.
+// Set it before PerfStart, or while no instrumented code is running.
+//
+bool PerfMetrics::PerfSetBudgetCallback(PerfBudgetCallback pfnCallback, void* pContext, bool bAsync)
+{
+	StopBudgetThread();
+	gpfnBudgetCallback	= pfnCallback;
+	gpBudgetContext		= pContext;
+	gbBudgetAsync		= bAsync;
+	if(gStartTime != 0 && gEndTime == 0) {
+		StartBudgetThread();
 	}
-	if(iter != mThreadList.rend()) {
-		pActiveThread = *iter;
+	return true;
+}
+//
+// Serve the live counts to scrapers, see PerfMetricsEndpoint.  A path
+// is a Unix domain socket, a port is TCP on 127.0.0.1 only.  NULL or ""
+// turns it off.  Calls are counted from when the endpoint starts.
+//
+bool PerfMetrics::PerfSetMetricsEndpoint(const char* szAddress)
+{
+	if(szAddress != NULL && strlen(szAddress) >= sizeof(gszMetricsEndpoint)) {
+		return false;
 	}
-	else {
-		//Error.  How can we be exiting when we don't have the thread on record.
-		cout << "ERROR: PerfMetrics::PerfExit could not find Thread" << endl;
+	StopMetricsEndpoint();
+	snprintf(gszMetricsEndpoint, sizeof(gszMetricsEndpoint), "%s", szAddress != NULL ? szAddress : "");
+	if(gStartTime != 0 && gEndTime == 0) {
+		StartMetricsEndpoint();
+		return gpMetricsEndpoint != NULL || gszMetricsEndpoint[0] == '\0';
+	}
+	return true;
+}
+//
+// Mirror the profile into szFile as it's built, see PerfImage.h for the
+// layout.  Whatever was recorded up to a crash stays in the file and
+// perfmetrics-report turns it into the usual reports.  nMaxNodes 0 is
+// PERF_IMAGE_DEFAULT_NODES.  Set it before PERF_START.
+//
+bool PerfMetrics::PerfSetImageFile(const char* szFile, unsigned long nMaxNodes)
+{
+	if(gStartTime != 0 || nMaxNodes > UINT32_MAX ||
+	   (szFile != NULL && strlen(szFile) >= sizeof(gszImageFile))) {
 		return false;
 	}
+	snprintf(gszImageFile, sizeof(gszImageFile), "%s", szFile != NULL ? szFile : "");
+	gnImageNodes = nMaxNodes;
+	return true;
+}
+//
+// Lock a mutex and record how long we waited for it.  The uncontended case
+// is a single trylock, the clock is only read when we have to block.
+//
+int PerfMetrics::PerfMutexLock(pthread_mutex_t* pMutex, const char * szName)
+{
+	uint64_t	nWaitStart	= 0;
+	bool		bContended	= false;
+	int			retVal		= pthread_mutex_trylock(pMutex);
 
-	// Get the current node
-	Node* pNode = pActiveThread->GetCurrentNode();
-	if(pNode->GetNodeType() == PerfRecord) {
-		pCurrentRecord = (PerformanceRec*)pNode;
-		if(pCurrentRecord->GetID() != id) {
-			// Error
-			cout << "ERROR: PerfMetrics::PerfExit could not find ID (" << (unsigned int)id << ") current record id = " << (unsigned int)pCurrentRecord->GetID() << endl;
-			return false;
-		}
-		pCurrentRecord->AddExit();
-		if(pActiveThread->GetRootNode() != pNode) {
-//			cout << "Exiting, setting current node to " << pNode->GetParent() << endl;
-			pActiveThread->SetCurrentNode(pNode->GetParent());
-		}
+	if(retVal == EBUSY) {
+		bContended	= true;
+		nWaitStart	= PerfLockWaitStart();
+		retVal		= pthread_mutex_lock(pMutex);
 	}
-	else {
-		cout << "pActiveThread->GetCurrentNode()->GetNodeType() returned " << (int)pNode->GetNodeType() << endl;
+	if(retVal == 0) {
+		PerfLockAcquired(pMutex, szName, nWaitStart, bContended);
 	}
-	return true;
+	return retVal;
+}
+int PerfMetrics::PerfMutexUnlock(pthread_mutex_t* pMutex, const char * szName)
+{
+	PerfLockReleased(pMutex);
+	return pthread_mutex_unlock(pMutex);
 }
+uint64_t PerfMetrics::PerfLockWaitStart()
+{
+	uint64_t nTimeStamp = 0;
 
-bool PerfMetrics::PerfEntry(const char * szName,  const char * szCategory)
+	GetCurrentTimeStamp(&nTimeStamp);
+	return nTimeStamp;
+}
+bool PerfMetrics::PerfLockAcquired(void* pLock, const char * szName, uint64_t nWaitStart, bool bContended)
 {
-	PerfID								id		= INVALID_PERF_ID;
-	PerfID								catID	= INVALID_PERF_ID;
-	list<PerfIDData*>::iterator 		iter 	= gPerfIDList.begin();
-	list<PerfCategoryData*>::iterator 	catIter = gPerfCatList.begin();
+	uint64_t		nAcquireTime	= 0;
+	uint64_t		nWaitTime		= 0;
+	PerfLockData*	pLockData		= NULL;
+	PerformanceRec*	pNode			= NULL;
 
-	// We have stopped don't collect any more data
-	if(gEndTime != 0) {
+	if(gStartTime == 0 || gEndTime != 0) {
 		return false;
 	}
-
-	// Is this a new category
-	while(catIter != gPerfCatList.end()) {
-		PerfCategoryData* pPerfCatData = *catIter;
-		if(strcmp(pPerfCatData->szName, szCategory) == 0) {
-			catID = pPerfCatData->nID;
-//			cout << "Found entry for " << szCategory << endl;
-			break;
+	GetCurrentTimeStamp(&nAcquireTime);
+	if(bContended == true && nAcquireTime > nWaitStart) {
+		nWaitTime = nAcquireTime - nWaitStart;
+	}
+	pLockData = GetLockData(szName);
+	if(pLockData != NULL) {
+		__sync_fetch_and_add(&pLockData->nAcquires, 1);
+		if(bContended == true) {
+			__sync_fetch_and_add(&pLockData->nContended, 1);
+			__sync_fetch_and_add(&pLockData->nWaitTime, nWaitTime);
+			AtomicMax(&pLockData->nMaxWait, nWaitTime);
 		}
-		catIter++;
 	}
-	if(catIter == gPerfCatList.end()) {
-		PerfCategoryData* pPerfCatData = new PerfCategoryData();
-		pPerfCatData->szName 	= strdup(szCategory);
-		pPerfCatData->nID 		= GetUniqueID();
-		gPerfCatList.push_back(pPerfCatData);
-		catID = pPerfCatData->nID;
-
+	// Charge the wait to the thread's current node
+	ThreadRecord* pThread = FindThreadRecord();
+	if(pThread != NULL && pThread->GetCurrentNode() != NULL && pThread->GetCurrentNode()->GetNodeType() == PerfRecord) {
+		pNode = (PerformanceRec*)pThread->GetCurrentNode();
+		pNode->AddLockWait(nWaitTime, bContended);
 	}
+	// Deeper nesting than this isn't timed for hold
+	if(tlsHeldLockCount < PERF_MAX_HELD_LOCKS) {
+		PerfHeldLock* pHeld	= &tlsHeldLocks[tlsHeldLockCount++];
+		pHeld->pLock		= pLock;
+		pHeld->pLockData	= pLockData;
+		pHeld->pNode		= pNode;
+		pHeld->nAcquireTime	= nAcquireTime;
+		pHeld->nRunStart	= gStartTime;
+	}
+	return true;
+}
+bool PerfMetrics::PerfLockReleased(void* pLock)
+{
+	uint64_t	nReleaseTime	= 0;
+	uint64_t	nHoldTime		= 0;
+	int			idx				= (int)tlsHeldLockCount - 1;
 
+	// Normally the last lock taken, but they don't have to be released in order
+	while(idx >= 0 && tlsHeldLocks[idx].pLock != pLock) {
+		idx--;
+	}
+	if(idx < 0) {
+		return false;
+	}
+	PerfHeldLock held = tlsHeldLocks[idx];
+	for(; idx < (int)tlsHeldLockCount - 1; idx++) {
+		tlsHeldLocks[idx] = tlsHeldLocks[idx + 1];
+	}
+	tlsHeldLockCount--;
 
-	// Does this name/cat pair exist already?
-	while(iter != gPerfIDList.end()) {
-		PerfIDData* pPerfData = *iter;
-		if(strcmp(pPerfData->szCategory, szCategory) == 0) {
-			if(strcmp(pPerfData->szName, szName) == 0) {
-				id = pPerfData->id;
-//				cout << "Found entry id for " << szName << ", " << szCategory << endl;
-				break;
-			}
-		}
-		iter++;
+	if(held.nRunStart != gStartTime || gEndTime != 0) {
+		return false;
 	}
-	// If not create a new entry
-	if(iter == gPerfIDList.end()) {
-		PerfIDData* pPerfData = new PerfIDData();
-		pPerfData->szName		= strdup(szName);
-		pPerfData->categoryID	= catID;
-		pPerfData->szCategory 	= szCategory;
-		pPerfData->id 			= GetUniqueID();
-		gPerfIDList.push_back(pPerfData);
-		id = pPerfData->id;
-//		cout << "Created new entry id " << (unsigned long)pPerfData->id<< " for " << szName << ", " << szCategory << " Cat ID " << (int)pPerfData->categoryID << endl;
-//		cout << "ID list is " << gPerfIDList.size() << " elements long" << endl;
+	GetCurrentTimeStamp(&nReleaseTime);
+	if(nReleaseTime > held.nAcquireTime) {
+		nHoldTime = nReleaseTime - held.nAcquireTime;
 	}
-	// Record the entry point
-	return PerfEntry(id);
+	if(held.pLockData != NULL) {
+		__sync_fetch_and_add(&held.pLockData->nHoldTime, nHoldTime);
+		AtomicMax(&held.pLockData->nMaxHold, nHoldTime);
+	}
+	// Hold time goes to the node that took the lock
+	if(held.pNode != NULL) {
+		held.pNode->AddLockHold(nHoldTime);
+	}
+	return true;
 }
-bool PerfMetrics::PerfExit(const char * szName, const char * szCategory)
+ssize_t PerfMetrics::PerfRead(int fd, void* pBuf, size_t nCount)
 {
-	PerfID							id		= INVALID_PERF_ID;
-	list<PerfIDData*>::iterator 	iter 	= gPerfIDList.begin();
+	PerfIOFunction	io("read", szIOCategory, 0);
+	ssize_t			nRet = read(fd, pBuf, nCount);
 
-	// We have stopped don't collect any more data
-	if(gEndTime != 0) {
+	io.SetBytes(nRet);
+	return nRet;
+}
+ssize_t PerfMetrics::PerfWrite(int fd, const void* pBuf, size_t nCount)
+{
+	PerfIOFunction	io("write", szIOCategory, 0);
+	ssize_t			nRet = write(fd, pBuf, nCount);
+
+	io.SetBytes(nRet);
+	return nRet;
+}
+ssize_t PerfMetrics::PerfPread(int fd, void* pBuf, size_t nCount, off_t nOffset)
+{
+	PerfIOFunction	io("pread", szIOCategory, 0);
+	ssize_t			nRet = pread(fd, pBuf, nCount, nOffset);
+
+	io.SetBytes(nRet);
+	return nRet;
+}
+ssize_t PerfMetrics::PerfPwrite(int fd, const void* pBuf, size_t nCount, off_t nOffset)
+{
+	PerfIOFunction	io("pwrite", szIOCategory, 0);
+	ssize_t			nRet = pwrite(fd, pBuf, nCount, nOffset);
+
+	io.SetBytes(nRet);
+	return nRet;
+}
+int PerfMetrics::PerfFsync(int fd)
+{
+	PerfIOFunction	io("fsync", szIOCategory, 0);
+
+	return fsync(fd);
+}
+ssize_t PerfMetrics::PerfSend(int fd, const void* pBuf, size_t nCount, int nFlags)
+{
+	PerfIOFunction	io("send", szIOCategory, 0);
+	ssize_t			nRet = send(fd, pBuf, nCount, nFlags);
+
+	io.SetBytes(nRet);
+	return nRet;
+}
+ssize_t PerfMetrics::PerfRecv(int fd, void* pBuf, size_t nCount, int nFlags)
+{
+	PerfIOFunction	io("recv", szIOCategory, 0);
+	ssize_t			nRet = recv(fd, pBuf, nCount, nFlags);
+
+	io.SetBytes(nRet);
+	return nRet;
+}
+uint64_t PerfMetrics::PerfIOStart()
+{
+	uint64_t nTimeStamp = 0;
+
+	GetCurrentTimeStamp(&nTimeStamp);
+	return nTimeStamp;
+}
+//
+// Charge one I/O of nBytes to the current node, a failed call counts as an
+// op with no bytes.
+//
+bool PerfMetrics::PerfIOEnd(uint64_t nStart, int64_t nBytes)
+{
+	uint64_t	nEnd		= 0;
+	uint64_t	nLatency	= 0;
+
+	if(gStartTime == 0 || gEndTime != 0) {
+		return false;
+	}
+	GetCurrentTimeStamp(&nEnd);
+	if(nEnd > nStart) {
+		nLatency = nEnd - nStart;
+	}
+	ThreadRecord* pThread = FindThreadRecord();
+	if(pThread == NULL || pThread->GetCurrentNode() == NULL || pThread->GetCurrentNode()->GetNodeType() != PerfRecord) {
 		return false;
 	}
+	{
+		PerfTreeGuard	guard(pThread);
+		PerformanceRec*	pRecord	= (PerformanceRec*)pThread->GetCurrentNode();
+		uint64_t		nMemory	= PerformanceRec::GetIOMemory();
 
-	// Does this name/cat pair exist already?
-	while(iter != gPerfIDList.end()) {
-		// Does it have the same category
-		PerfIDData* pPerfData = *iter;
-		if(strcmp(pPerfData->szCategory, szCategory) == 0) {
-			if(strcmp(pPerfData->szName, szName) == 0) {
-//				cout << "Found exit id for " << szName << ", " << (int)eCategory << endl;
-				id = pPerfData->id;
-				break;
+		// With no room for the node's I/O block the op goes to the parent's
+		// [other] node, as the node itself would have if it were new
+		if(pRecord->HasIO() == false && ChargeNodeMemory(pThread, nMemory) == false) {
+			PerformanceRec* pParent = (PerformanceRec*)pRecord->GetParent();
+			pRecord = (pParent != NULL) ? GetOverflowRecord(pThread, pParent) : NULL;
+			if(pRecord != NULL && pRecord->HasIO() == false && ChargeNodeMemory(pThread, nMemory) == false) {
+				pRecord = NULL;
 			}
 		}
-		iter++;
+		if(pRecord == NULL) {
+			__sync_fetch_and_add(&gnDroppedIO, 1);
+		}
+		else {
+			pRecord->AddIO(nBytes > 0 ? nBytes : 0, nLatency, pThread->GetArena());
+		}
 	}
-	// If not, this is an error
-	if(iter == gPerfIDList.end()) {
-		cout << endl << "ERROR: PerfExit with no matching PerfEntry!!!";
-		cout << " Name = " << szName << " Category = " << szCategory << endl << endl;
-		return false;
+	if(gbIO == false) {
+		gbIO = true;
 	}
-
-	// Record the exit point
-	return PerfExit(id);
+	return true;
 }
-bool PerfMetrics::PerfAlloc(void* addr, int size)
+//
+// A micro-benchmark.  Each timed batch is a call of szName with the batch's
+// iterations as work units, so it shows in the other reports like any other
+// ID.  The statistics are kept for BenchReport.txt.
+//
+bool PerfMetrics::PerfBench(const char * szName, const char * szCategory, PerfBenchFunction pfnBench, void* pContext, PerfBenchResult* pResult)
 {
-#ifdef PERFORMANCE_MEMORY    
-    AllocRecord* pRec = new AllocRecord(addr, size);
-    mAllocMap.insert(AllocPair(pRec));
-    mAllocCurrent += size;
-    if (mAllocCurrent > mAllocMax) {
-        mAllocMax = mAllocCurrent;
-    }
-#endif
-    return true;
-}
+	PerfBenchRecord	record;
 
-bool PerfMetrics::PerfFree(void* addr)
+	if(gStartTime == 0 || gEndTime != 0 || szName == NULL || szCategory == NULL) {
+		return false;
+	}
+	PerfBenchRunner runner(szName, szCategory, pfnBench, pContext);
+	if(runner.Run(gnBenchWarmup * 1000000ULL, gnBenchTime * 1000000ULL) == false) {
+		return false;
+	}
+	runner.GetResult(&record.result);
+	if(pResult != NULL) {
+		*pResult = record.result;
+	}
+	record.name		= szName;
+	record.category	= szCategory;
+	pthread_mutex_lock(&gBenchMutex);
+	gBenchResults.push_back(record);
+	pthread_mutex_unlock(&gBenchMutex);
+	return true;
+}
+bool PerfMetrics::PerfSetOption(PerfOption eOption, unsigned long nValue)
 {
-#ifdef PERFORMANCE_MEMORY    
-	if(mAllocMap.size() > 0) {
-		AllocRecord* pRec = mAllocMap.at((unsigned int)addr);
-		if (pRec) {
-			mAllocMap.erase((unsigned int)addr);
-			mAllocCurrent -= pRec->GetSize();
-			delete pRec;
-			return true;
-		} else {
-			//cout << "WARNING!  FREEING NON-ALLOCATED MEMORY AT " << (unsigned int)addr << endl;
+	switch(eOption) {
+		case PerfOptionFoldRecursion:
+			gbFoldRecursion = (nValue != 0);
+			break;
+		case PerfOptionMaxThreadNodes:
+			gnMaxThreadNodes = nValue;
+			break;
+		case PerfOptionMaxDepth:
+			gnMaxDepth = nValue;
+			break;
+		case PerfOptionMaxMemory:
+			gnMaxMemory = nValue;
+			break;
+		case PerfOptionThreadArena:
+			gnThreadArena = nValue;
+			break;
+		case PerfOptionRegistryArena:
+			gnRegistryArena = nValue;
+			break;
+		case PerfOptionAllocSampleRate:
+			gnAllocSampleRate = nValue;
+			break;
+		case PerfOptionPerfCounters:
+			gbPerfCounters = (nValue != 0);
+			break;
+		case PerfOptionSlowCalls:
+			gnSlowCalls = nValue;
+			break;
+		case PerfOptionWatchdog:
+			gnWatchdog = nValue;
+			break;
+		case PerfOptionLiveStats:
+			gnLiveStats = nValue;
+			break;
+		case PerfOptionReportSignal:
+			if(nValue >= (unsigned long)NSIG) {
+				return false;
+			}
+			gnReportSignal = (int)nValue;
+			break;
+		case PerfOptionBinaryReport:
+			gbBinaryReport = (nValue != 0);
+			break;
+		case PerfOptionBenchWarmup:
+			gnBenchWarmup = nValue;
+			break;
+		case PerfOptionBenchTime:
+			gnBenchTime = nValue != 0 ? nValue : 1000;
+			break;
+		default:
 			return false;
-		}
-	} else {
-		//cout << "WARNING!  FREEING MEMORY when allocation map is empty ptr = " << (unsigned int)addr << endl;
 	}
-#endif
-	return false;
+	return true;
 }
 PerfID PerfMetrics::GetUniqueID()
 {
-	pthread_mutex_lock(&lock);
-	nID++;
-	pthread_mutex_unlock(&lock);
-	return nID;
+	return NextUniqueID();
 }
 
 
@@ -1457,6 +4902,14 @@ PerfFunction::PerfFunction(const char * szName,  const char * szCategory)
 {
 	PerfMetrics::PerfEntry(szName, szCategory);
 }
+PerfFunction::PerfFunction(const char * szName,  const char * szCategory, uint64_t nUnits)
+: m_id(INVALID_PERF_ID)
+, m_szName(szName)
+, m_szCategory(szCategory)
+{
+	PerfMetrics::PerfEntry(szName, szCategory);
+	PerfMetrics::PerfAddWork(nUnits);
+}
 PerfFunction::~PerfFunction()
 {
 	if(m_id != INVALID_PERF_ID)
@@ -1464,6 +4917,23 @@ PerfFunction::~PerfFunction()
 	else
 		PerfMetrics::PerfExit(m_szName, m_szCategory);
 }
+PerfIOFunction::PerfIOFunction(const char * szName,  const char * szCategory, int64_t nBytes)
+: m_szName(szName)
+, m_szCategory(szCategory)
+, m_nBytes(nBytes)
+{
+	PerfMetrics::PerfEntry(szName, szCategory);
+	m_nStart = PerfMetrics::PerfIOStart();
+}
+PerfIOFunction::~PerfIOFunction()
+{
+	// The caller may still want errno from the I/O
+	int nErrno = errno;
+
+	PerfMetrics::PerfIOEnd(m_nStart, m_nBytes);
+	PerfMetrics::PerfExit(m_szName, m_szCategory);
+	errno = nErrno;
+}
 
 // C entty points
 BEGIN_EXTERN_C
@@ -1500,6 +4970,86 @@ void PerfFunction(const char * szName, const char * szCategory)
 {
     return;
 }
+bool PerfSetOption(PerfOption eOption, unsigned long nValue)
+{
+    return PerfMetrics::PerfSetOption(eOption, nValue);
+}
+bool PerfCategoryRusage(const char * szCategory)
+{
+    return PerfMetrics::PerfCategoryRusage(szCategory);
+}
+bool PerfAddWork(uint64_t nUnits)
+{
+    return PerfMetrics::PerfAddWork(nUnits);
+}
+bool PerfCounterAdd(const char * szName, int64_t nDelta)
+{
+    return PerfMetrics::PerfCounterAdd(szName, nDelta);
+}
+bool PerfGaugeSet(const char * szName, int64_t nValue)
+{
+    return PerfMetrics::PerfGaugeSet(szName, nValue);
+}
+bool PerfSetBudget(const char * szName, const char * szCategory, uint64_t nBudget)
+{
+    return PerfMetrics::PerfSetBudget(szName, szCategory, nBudget);
+}
+bool PerfSetCategoryBudget(const char * szCategory, uint64_t nBudget)
+{
+    return PerfMetrics::PerfSetCategoryBudget(szCategory, nBudget);
+}
+bool PerfSetBudgetCallback(PerfBudgetCallback pfnCallback, void* pContext, int bAsync)
+{
+    return PerfMetrics::PerfSetBudgetCallback(pfnCallback, pContext, bAsync != 0);
+}
+bool PerfSetMetricsEndpoint(const char * szAddress)
+{
+    return PerfMetrics::PerfSetMetricsEndpoint(szAddress);
+}
+bool PerfSetImageFile(const char * szFile, unsigned long nMaxNodes)
+{
+    return PerfMetrics::PerfSetImageFile(szFile, nMaxNodes);
+}
+int PerfMutexLock(pthread_mutex_t* pMutex, const char * szName)
+{
+    return PerfMetrics::PerfMutexLock(pMutex, szName);
+}
+int PerfMutexUnlock(pthread_mutex_t* pMutex, const char * szName)
+{
+    return PerfMetrics::PerfMutexUnlock(pMutex, szName);
+}
+ssize_t PerfRead(int fd, void* pBuf, size_t nCount)
+{
+    return PerfMetrics::PerfRead(fd, pBuf, nCount);
+}
+ssize_t PerfWrite(int fd, const void* pBuf, size_t nCount)
+{
+    return PerfMetrics::PerfWrite(fd, pBuf, nCount);
+}
+ssize_t PerfPread(int fd, void* pBuf, size_t nCount, off_t nOffset)
+{
+    return PerfMetrics::PerfPread(fd, pBuf, nCount, nOffset);
+}
+ssize_t PerfPwrite(int fd, const void* pBuf, size_t nCount, off_t nOffset)
+{
+    return PerfMetrics::PerfPwrite(fd, pBuf, nCount, nOffset);
+}
+int PerfFsync(int fd)
+{
+    return PerfMetrics::PerfFsync(fd);
+}
+ssize_t PerfSend(int fd, const void* pBuf, size_t nCount, int nFlags)
+{
+    return PerfMetrics::PerfSend(fd, pBuf, nCount, nFlags);
+}
+ssize_t PerfRecv(int fd, void* pBuf, size_t nCount, int nFlags)
+{
+    return PerfMetrics::PerfRecv(fd, pBuf, nCount, nFlags);
+}
+bool PerfBench(const char * szName, const char * szCategory, PerfBenchFunction pfnBench, void* pContext, PerfBenchResult* pResult)
+{
+    return PerfMetrics::PerfBench(szName, szCategory, pfnBench, pContext, pResult);
+}
 END_EXTERN_C
 
 
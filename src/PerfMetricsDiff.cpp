@@ -0,0 +1,506 @@
+/*****************************************************************************
+MIT License
+
+Copyright (c) 2016 Douglas Adler
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*****************************************************************************/
+
+//
+// perfmetrics-diff, what changed between two profiles.  Each side is an
+// IDReport.txt, a PerfReport.bin, a PERF_SET_IMAGE_FILE image or a
+// directory holding one of them, like a report dump.  IDs and calling
+// paths are matched by name.  Paths and the per thread percentiles
+// need a tree, so an IDReport.txt only gives the ID rows.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "PerfProfile.h"
+
+using namespace std;
+
+#define ELEMENT_DELIMITER		";"
+
+typedef enum DiffMetric_e
+{
+	DiffCalls,
+	DiffTotal,
+	DiffSelf,
+	DiffAvg,
+	DiffMax,
+	DiffP50,					// Of the per thread totals, as in MergedTreeReport.xml
+	DiffP90,
+	DiffP99,
+	DiffMetricLast
+} DiffMetric;
+
+static const char* gszMetrics[DiffMetricLast] = { "calls", "total", "self", "avg", "max", "p50", "p90", "p99" };
+static const char* gszColumns[DiffMetricLast] = { "Calls", "Total", "Self", "Avg", "Max", "P50", "P90", "P99" };
+
+// Times in usec, calls as a count
+typedef struct DiffValues_s
+{
+	double				nValue[DiffMetricLast];
+	map<uint64_t, uint64_t>	threads;		// Total time by thread, for the percentiles
+} DiffValues;
+
+typedef struct DiffSide_s
+{
+	map<string, DiffValues>	ids;
+	map<string, DiffValues>	paths;
+	bool				bTree;				// Has paths and percentiles
+} DiffSide;
+
+typedef struct DiffRow_s
+{
+	string		name;
+	bool		bPath;
+	bool		bBase;
+	bool		bNew;
+	double		nBase[DiffMetricLast];
+	double		nNew[DiffMetricLast];
+	double		nImpact;					// New less base of the ranking metric
+} DiffRow;
+
+static void Usage(const char* szProgram)
+{
+	fprintf(stderr, "Usage: %s [-m metric] [-r pct] [-a value] [-l lines] [-i | -p] [-c] <base> <new>\n", szProgram);
+	fprintf(stderr, "  -m  rank and check by calls, total, self, avg, max, p50, p90 or p99, default self\n");
+	fprintf(stderr, "  -r  fail when the metric grew by at least pct percent\n");
+	fprintf(stderr, "  -a  fail when the metric grew by at least value, ms or calls\n");
+	fprintf(stderr, "  -l  rows to show, default 30, 0 shows all\n");
+	fprintf(stderr, "  -i  IDs only, -p paths only\n");
+	fprintf(stderr, "  -c  all rows and columns as ; separated text\n");
+	fprintf(stderr, "base and new are an IDReport.txt, a PerfReport.bin, a profile image or a directory with one.\n");
+	fprintf(stderr, "With -r and -a both set a row has to pass both.  Exits 1 when a row does, 2 on an error.\n");
+}
+
+static DiffValues NewValues()
+{
+	DiffValues values;
+
+	for(uint32_t idx = 0; idx < DiffMetricLast; idx++) {
+		values.nValue[idx] = 0;
+	}
+	return values;
+}
+
+static void SumNode(DiffValues& values, PerfProfileNode& node)
+{
+	values.nValue[DiffCalls]	+= node.nCalls;
+	values.nValue[DiffTotal]	+= node.nTotalTime;
+	values.nValue[DiffSelf]		+= node.nSelfTime;
+	if(node.nMaxTime > values.nValue[DiffMax]) {
+		values.nValue[DiffMax] = node.nMaxTime;
+	}
+	values.threads[node.nThreadID] += node.nTotalTime;
+}
+
+// Nearest rank, the same as MergedRec::GetThreadPercentile
+static double GetPercentile(vector<uint64_t>& totals, uint32_t nPercent)
+{
+	if(totals.empty()) {
+		return 0;
+	}
+	size_t nRank = (totals.size() * nPercent + 99) / 100;
+	if(nRank == 0) {
+		nRank = 1;
+	}
+	return totals[nRank - 1];
+}
+
+static void FinishValues(map<string, DiffValues>& rows)
+{
+	for(map<string, DiffValues>::iterator iter = rows.begin(); iter != rows.end(); iter++) {
+		DiffValues&			values	= iter->second;
+		vector<uint64_t>	totals;
+
+		if(values.nValue[DiffCalls] > 0) {
+			values.nValue[DiffAvg] = values.nValue[DiffTotal] / values.nValue[DiffCalls];
+		}
+		for(map<uint64_t, uint64_t>::iterator thread = values.threads.begin(); thread != values.threads.end(); thread++) {
+			totals.push_back(thread->second);
+		}
+		sort(totals.begin(), totals.end());
+		values.nValue[DiffP50]	= GetPercentile(totals, 50);
+		values.nValue[DiffP90]	= GetPercentile(totals, 90);
+		values.nValue[DiffP99]	= GetPercentile(totals, 99);
+	}
+}
+
+// Paths are the names from below the thread's root joined by |, so threads
+// doing the same work match
+static void LoadProfile(PerfProfile& profile, DiffSide& side)
+{
+	vector<PerfProfileNode>&	nodes	= profile.GetNodes();
+	vector<string>				paths(nodes.size());
+
+	for(uint32_t idx = 0; idx < nodes.size(); idx++) {
+		PerfProfileNode&	node	= nodes[idx];
+		string				name	= profile.GetName(node.id);
+
+		if(node.nParent != 0) {
+			string& parent = paths[node.nParent - 1];
+			paths[idx] = parent.empty() ? name : parent + "|" + name;
+		}
+		if(node.nCalls == 0) {
+			continue;
+		}
+		if(side.ids.find(name) == side.ids.end()) {
+			side.ids[name] = NewValues();
+		}
+		SumNode(side.ids[name], node);
+		if(node.nParent != 0) {
+			if(side.paths.find(paths[idx]) == side.paths.end()) {
+				side.paths[paths[idx]] = NewValues();
+			}
+			SumNode(side.paths[paths[idx]], node);
+		}
+	}
+	FinishValues(side.ids);
+	FinishValues(side.paths);
+	side.bTree = true;
+}
+
+static void SplitLine(char* szLine, vector<string>& columns)
+{
+	columns.clear();
+	szLine[strcspn(szLine, "\r\n")] = '\0';
+	char* szColumn = szLine;
+	while(szColumn != NULL) {
+		char* szNext = strstr(szColumn, ELEMENT_DELIMITER);
+		if(szNext != NULL) {
+			*szNext++ = '\0';
+		}
+		columns.push_back(szColumn);
+		szColumn = szNext;
+	}
+}
+
+static int FindColumn(vector<string>& header, const char* szName)
+{
+	for(uint32_t idx = 0; idx < header.size(); idx++) {
+		if(header[idx] == szName) {
+			return idx;
+		}
+	}
+	return -1;
+}
+
+// Times in the report are in ms
+static bool LoadIDReport(const char* szFile, DiffSide& side)
+{
+	char			szLine[4096];
+	vector<string>	header;
+	vector<string>	columns;
+	FILE*			fp		= fopen(szFile, "r");
+
+	if(fp == NULL) {
+		return false;
+	}
+	if(fgets(szLine, sizeof(szLine), fp) == NULL) {
+		fclose(fp);
+		return false;
+	}
+	SplitLine(szLine, header);
+	int nName	= FindColumn(header, "Name");
+	int nCalls	= FindColumn(header, "Samples");
+	int nTotal	= FindColumn(header, "Total");
+	int nSelf	= FindColumn(header, "Self");
+	int nMax	= FindColumn(header, "Max");
+	int nAvg	= FindColumn(header, "Avg");
+	if(nName != 0 || nCalls < 0 || nTotal < 0 || nSelf < 0 || nMax < 0 || nAvg < 0) {
+		fclose(fp);
+		return false;
+	}
+	while(fgets(szLine, sizeof(szLine), fp) != NULL) {
+		SplitLine(szLine, columns);
+		if(columns.size() < header.size()) {
+			continue;
+		}
+		DiffValues values = NewValues();
+		values.nValue[DiffCalls]	= strtod(columns[nCalls].c_str(), NULL);
+		values.nValue[DiffTotal]	= strtod(columns[nTotal].c_str(), NULL) * 1000.0;
+		values.nValue[DiffSelf]		= strtod(columns[nSelf].c_str(), NULL) * 1000.0;
+		values.nValue[DiffMax]		= strtod(columns[nMax].c_str(), NULL) * 1000.0;
+		values.nValue[DiffAvg]		= strtod(columns[nAvg].c_str(), NULL) * 1000.0;
+		side.ids[columns[nName]] = values;
+	}
+	fclose(fp);
+	side.bTree = false;
+	return true;
+}
+
+static bool IsFile(const string& path)
+{
+	struct stat info;
+
+	return stat(path.c_str(), &info) == 0 && S_ISREG(info.st_mode);
+}
+
+static bool LoadSide(const char* szPath, DiffSide& side)
+{
+	struct stat	info;
+	string		path(szPath);
+	PerfProfile	profile;
+
+	if(stat(szPath, &info) == 0 && S_ISDIR(info.st_mode)) {
+		path = IsFile(path + "/PerfReport.bin") ? path + "/PerfReport.bin" : path + "/IDReport.txt";
+	}
+	if(profile.Load(path.c_str()) == true) {
+		LoadProfile(profile, side);
+		return true;
+	}
+	return LoadIDReport(path.c_str(), side);
+}
+
+static double GetRelative(double nBase, double nNew)
+{
+	if(nBase == 0) {
+		return nNew == 0 ? 0 : INFINITY;
+	}
+	return (nNew - nBase) * 100.0 / nBase;
+}
+
+static bool SortByImpact(const DiffRow& a, const DiffRow& b)
+{
+	if(fabs(a.nImpact) != fabs(b.nImpact)) {
+		return fabs(a.nImpact) > fabs(b.nImpact);
+	}
+	return a.name < b.name;
+}
+
+static void AddRows(map<string, DiffValues>& base, map<string, DiffValues>& next, bool bPath, DiffMetric eMetric, vector<DiffRow>& rows)
+{
+	map<string, bool> names;
+
+	for(map<string, DiffValues>::iterator iter = base.begin(); iter != base.end(); iter++) {
+		names[iter->first] = true;
+	}
+	for(map<string, DiffValues>::iterator iter = next.begin(); iter != next.end(); iter++) {
+		names[iter->first] = true;
+	}
+	for(map<string, bool>::iterator iter = names.begin(); iter != names.end(); iter++) {
+		map<string, DiffValues>::iterator baseIter = base.find(iter->first);
+		map<string, DiffValues>::iterator nextIter = next.find(iter->first);
+		DiffRow row;
+
+		row.name	= iter->first;
+		row.bPath	= bPath;
+		row.bBase	= baseIter != base.end();
+		row.bNew	= nextIter != next.end();
+		for(uint32_t idx = 0; idx < DiffMetricLast; idx++) {
+			row.nBase[idx]	= row.bBase ? baseIter->second.nValue[idx] : 0;
+			row.nNew[idx]	= row.bNew ? nextIter->second.nValue[idx] : 0;
+		}
+		row.nImpact = row.nNew[eMetric] - row.nBase[eMetric];
+		rows.push_back(row);
+	}
+}
+
+// Calls are a count, everything else is shown in ms
+static double GetDisplay(DiffMetric eMetric, double nValue)
+{
+	return eMetric == DiffCalls ? nValue : nValue / 1000.0;
+}
+
+static const char* GetStatus(DiffRow& row)
+{
+	if(row.bBase == false) {
+		return "new";
+	}
+	if(row.bNew == false) {
+		return "gone";
+	}
+	return "";
+}
+
+static void FormatChange(char* szBuffer, size_t nSize, DiffMetric eMetric, DiffRow& row)
+{
+	double	nRelative	= GetRelative(row.nBase[eMetric], row.nNew[eMetric]);
+	int		nPrecision	= eMetric == DiffCalls ? 0 : 3;
+
+	if(isinf(nRelative)) {
+		snprintf(szBuffer, nSize, "%+.*f (new)", nPrecision, GetDisplay(eMetric, row.nNew[eMetric] - row.nBase[eMetric]));
+	}
+	else {
+		snprintf(szBuffer, nSize, "%+.*f (%+.1f%%)", nPrecision, GetDisplay(eMetric, row.nNew[eMetric] - row.nBase[eMetric]), nRelative);
+	}
+}
+
+static void PrintRows(vector<DiffRow>& rows, bool bTree, DiffMetric eMetric, uint32_t nLines)
+{
+	DiffMetric	shown[]		= { DiffCalls, DiffTotal, DiffSelf, DiffP50, DiffP90, DiffP99 };
+	uint32_t	nShown		= bTree ? 6 : 3;
+	char		szChange[64];
+
+	printf("%-5s %-40s %12s %12s", "Kind", "Name", "Base", "New");
+	for(uint32_t idx = 0; idx < nShown; idx++) {
+		printf(" %22s", gszColumns[shown[idx]]);
+	}
+	printf("   (Base and New are %s, changes %s)\n", gszMetrics[eMetric], eMetric == DiffCalls ? "in calls" : "in ms");
+	for(uint32_t nRow = 0; nRow < rows.size() && (nLines == 0 || nRow < nLines); nRow++) {
+		DiffRow& row = rows[nRow];
+		printf("%-5s %-40.40s %12.3f %12.3f", row.bPath ? "path" : "id", row.name.c_str(),
+				GetDisplay(eMetric, row.nBase[eMetric]), GetDisplay(eMetric, row.nNew[eMetric]));
+		for(uint32_t idx = 0; idx < nShown; idx++) {
+			FormatChange(szChange, sizeof(szChange), shown[idx], row);
+			printf(" %22s", szChange);
+		}
+		printf(" %s\n", GetStatus(row));
+	}
+}
+
+static void PrintCSV(vector<DiffRow>& rows, bool bTree)
+{
+	uint32_t nMetrics = bTree ? DiffMetricLast : DiffP50;
+
+	printf("Kind%sName%sStatus", ELEMENT_DELIMITER, ELEMENT_DELIMITER);
+	for(uint32_t idx = 0; idx < nMetrics; idx++) {
+		printf("%sBase %s%sNew %s%sDelta %s%sDelta %s %%", ELEMENT_DELIMITER, gszColumns[idx], ELEMENT_DELIMITER, gszColumns[idx],
+				ELEMENT_DELIMITER, gszColumns[idx], ELEMENT_DELIMITER, gszColumns[idx]);
+	}
+	printf("\n");
+	for(uint32_t nRow = 0; nRow < rows.size(); nRow++) {
+		DiffRow& row = rows[nRow];
+		printf("%s%s%s%s%s", row.bPath ? "path" : "id", ELEMENT_DELIMITER, row.name.c_str(), ELEMENT_DELIMITER, GetStatus(row));
+		for(uint32_t idx = 0; idx < nMetrics; idx++) {
+			DiffMetric	eMetric		= (DiffMetric)idx;
+			double		nRelative	= GetRelative(row.nBase[idx], row.nNew[idx]);
+			printf("%s%lf%s%lf%s%lf%s", ELEMENT_DELIMITER, GetDisplay(eMetric, row.nBase[idx]), ELEMENT_DELIMITER, GetDisplay(eMetric, row.nNew[idx]),
+					ELEMENT_DELIMITER, GetDisplay(eMetric, row.nNew[idx] - row.nBase[idx]), ELEMENT_DELIMITER);
+			if(isinf(nRelative) == false) {
+				printf("%lf", nRelative);
+			}
+		}
+		printf("\n");
+	}
+}
+
+int main(int argc, char** argv)
+{
+	DiffSide		base;
+	DiffSide		next;
+	vector<DiffRow>	rows;
+	DiffMetric		eMetric		= DiffSelf;
+	double			nRelative	= -1;
+	double			nAbsolute	= -1;
+	uint32_t		nLines		= 30;
+	bool			bIDs		= true;
+	bool			bPaths		= true;
+	bool			bCSV		= false;
+	int				nOption;
+
+	while((nOption = getopt(argc, argv, "m:r:a:l:ipch")) != -1) {
+		switch(nOption) {
+			case 'm':
+				for(eMetric = DiffCalls; eMetric < DiffMetricLast; eMetric = (DiffMetric)(eMetric + 1)) {
+					if(strcmp(optarg, gszMetrics[eMetric]) == 0) {
+						break;
+					}
+				}
+				break;
+			case 'r':
+				nRelative = strtod(optarg, NULL);
+				break;
+			case 'a':
+				nAbsolute = strtod(optarg, NULL);
+				break;
+			case 'l':
+				nLines = strtoul(optarg, NULL, 10);
+				break;
+			case 'i':
+				bPaths = false;
+				break;
+			case 'p':
+				bIDs = false;
+				break;
+			case 'c':
+				bCSV = true;
+				break;
+			default:
+				Usage(argv[0]);
+				return 2;
+		}
+	}
+	if(optind != argc - 2 || eMetric == DiffMetricLast || (bIDs == false && bPaths == false)) {
+		Usage(argv[0]);
+		return 2;
+	}
+	for(int idx = 0; idx < 2; idx++) {
+		if(LoadSide(argv[optind + idx], idx == 0 ? base : next) == false) {
+			fprintf(stderr, "%s: can't read %s, it isn't an IDReport.txt, a PerfReport.bin or a profile image\n", argv[0], argv[optind + idx]);
+			return 2;
+		}
+	}
+	// Only compare what both sides have
+	bool bTree = base.bTree && next.bTree;
+	if(bTree == false && eMetric >= DiffP50) {
+		fprintf(stderr, "%s: %s needs a PerfReport.bin or a profile image on both sides\n", argv[0], gszMetrics[eMetric]);
+		return 2;
+	}
+	if(bIDs) {
+		AddRows(base.ids, next.ids, false, eMetric, rows);
+	}
+	if(bPaths && bTree) {
+		AddRows(base.paths, next.paths, true, eMetric, rows);
+	}
+	sort(rows.begin(), rows.end(), SortByImpact);
+
+	if(bCSV) {
+		PrintCSV(rows, bTree);
+	}
+	else {
+		PrintRows(rows, bTree, eMetric, nLines);
+	}
+
+	// A regression has to pass every threshold that was given
+	uint32_t nBreaches = 0;
+	if(nRelative >= 0 || nAbsolute >= 0) {
+		for(uint32_t idx = 0; idx < rows.size(); idx++) {
+			DiffRow& row = rows[idx];
+			if(row.nImpact <= 0) {
+				continue;
+			}
+			if(nAbsolute >= 0 && GetDisplay(eMetric, row.nImpact) < nAbsolute) {
+				continue;
+			}
+			if(nRelative >= 0 && GetRelative(row.nBase[eMetric], row.nNew[eMetric]) < nRelative) {
+				continue;
+			}
+			if(nBreaches++ == 0) {
+				fprintf(stderr, "\nRegressions in %s:\n", gszMetrics[eMetric]);
+			}
+			fprintf(stderr, "  %s %s %.3f -> %.3f\n", row.bPath ? "path" : "id", row.name.c_str(),
+					GetDisplay(eMetric, row.nBase[eMetric]), GetDisplay(eMetric, row.nNew[eMetric]));
+		}
+	}
+	return nBreaches > 0 ? 1 : 0;
+}
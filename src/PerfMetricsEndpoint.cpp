@@ -0,0 +1,305 @@
+/*****************************************************************************
+MIT License
+
+Copyright (c) 2016 Douglas Adler
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "PerfMetricsEndpoint.h"
+
+#define ENDPOINT_REQUEST_SIZE	4096
+#define ENDPOINT_TIMEOUT_MS		1000	// A slow client is dropped after this
+#define ENDPOINT_CONTENT_TYPE	"text/plain; version=0.0.4; charset=utf-8"
+
+PerfMetricsEndpoint::PerfMetricsEndpoint()
+{
+	mpfnFormat		= NULL;
+	mpContext		= NULL;
+	mnListen		= -1;
+	mnWakePipe[0]	= -1;
+	mnWakePipe[1]	= -1;
+	mbUnix			= false;
+	mbRunning		= false;
+}
+
+PerfMetricsEndpoint::~PerfMetricsEndpoint()
+{
+	Stop();
+}
+
+bool PerfMetricsEndpoint::Start(const char* szAddress, PerfMetricsFormat pfnFormat, void* pContext)
+{
+	if(mbRunning == true || szAddress == NULL || pfnFormat == NULL) {
+		return false;
+	}
+	if(Listen(szAddress) == false) {
+		return false;
+	}
+	if(pipe(mnWakePipe) != 0) {
+		Stop();
+		return false;
+	}
+	mpfnFormat	= pfnFormat;
+	mpContext	= pContext;
+	mbRunning	= true;
+	if(pthread_create(&mThread, NULL, ServeThread, this) != 0) {
+		mbRunning = false;
+		Stop();
+		return false;
+	}
+	return true;
+}
+// Waits for a scrape in progress to finish
+bool PerfMetricsEndpoint::Stop()
+{
+	if(mbRunning == true) {
+		char c = 0;
+		while(write(mnWakePipe[1], &c, 1) < 0 && errno == EINTR) {
+		}
+		pthread_join(mThread, NULL);
+		mbRunning = false;
+	}
+	if(mnListen >= 0) {
+		close(mnListen);
+		mnListen = -1;
+		if(mbUnix == true) {
+			unlink(mAddress.c_str());
+		}
+	}
+	for(int i = 0; i < 2; i++) {
+		if(mnWakePipe[i] >= 0) {
+			close(mnWakePipe[i]);
+			mnWakePipe[i] = -1;
+		}
+	}
+	return true;
+}
+bool PerfMetricsEndpoint::IsRunning()
+{
+	return mbRunning;
+}
+const char* PerfMetricsEndpoint::GetAddress()
+{
+	return mAddress.c_str();
+}
+// TCP only ever binds the loopback address, nothing is served off the host
+bool PerfMetricsEndpoint::Listen(const char* szAddress)
+{
+	mAddress	= szAddress;
+	mbUnix		= (szAddress[0] == '/');
+	if(mbUnix == true) {
+		struct sockaddr_un	addr;
+		struct stat			info;
+
+		if(strlen(szAddress) >= sizeof(addr.sun_path)) {
+			return false;
+		}
+		memset(&addr, 0, sizeof(addr));
+		addr.sun_family = AF_UNIX;
+		strcpy(addr.sun_path, szAddress);
+		mnListen = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+		if(mnListen < 0) {
+			return false;
+		}
+		// A socket left behind by an earlier run refuses connections.  Anything
+		// else at the path, a socket someone is listening on included, is left
+		// alone and the endpoint doesn't start.
+		if(lstat(szAddress, &info) == 0) {
+			int nError = EEXIST;
+
+			if(S_ISSOCK(info.st_mode) == true) {
+				int nProbe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+
+				if(nProbe >= 0) {
+					nError = (connect(nProbe, (struct sockaddr*)&addr, sizeof(addr)) != 0) ? errno : EADDRINUSE;
+					close(nProbe);
+				}
+				else {
+					nError = errno;
+				}
+			}
+			if(nError != ECONNREFUSED) {
+				close(mnListen);
+				mnListen	= -1;
+				errno		= nError;
+				return false;
+			}
+			unlink(szAddress);
+		}
+		if(bind(mnListen, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+			close(mnListen);
+			mnListen = -1;
+			return false;
+		}
+	}
+	else {
+		struct sockaddr_in	addr;
+		const char*			szPort	= strrchr(szAddress, ':');
+		char*				szEnd	= NULL;
+		int					nOn		= 1;
+
+		if(szPort != NULL) {
+			if(strncmp(szAddress, "127.0.0.1:", szPort - szAddress + 1) != 0 && strncmp(szAddress, "localhost:", szPort - szAddress + 1) != 0) {
+				return false;
+			}
+			szPort++;
+		}
+		else {
+			szPort = szAddress;
+		}
+		unsigned long nPort = strtoul(szPort, &szEnd, 10);
+		if(szEnd == szPort || *szEnd != '\0' || nPort == 0 || nPort > 65535) {
+			return false;
+		}
+		memset(&addr, 0, sizeof(addr));
+		addr.sin_family			= AF_INET;
+		addr.sin_port			= htons((uint16_t)nPort);
+		addr.sin_addr.s_addr	= htonl(INADDR_LOOPBACK);
+		mnListen = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+		if(mnListen < 0) {
+			return false;
+		}
+		setsockopt(mnListen, SOL_SOCKET, SO_REUSEADDR, &nOn, sizeof(nOn));
+		if(bind(mnListen, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+			close(mnListen);
+			mnListen = -1;
+			return false;
+		}
+	}
+	if(listen(mnListen, 8) != 0) {
+		close(mnListen);
+		mnListen = -1;
+		if(mbUnix == true) {
+			unlink(szAddress);
+		}
+		return false;
+	}
+	return true;
+}
+void* PerfMetricsEndpoint::ServeThread(void* pArg)
+{
+	PerfMetricsEndpoint*	pThis		= (PerfMetricsEndpoint*)pArg;
+	struct pollfd			fds[2];
+
+	fds[0].fd		= pThis->mnListen;
+	fds[0].events	= POLLIN;
+	fds[1].fd		= pThis->mnWakePipe[0];
+	fds[1].events	= POLLIN;
+	while(true) {
+		fds[0].revents = 0;
+		fds[1].revents = 0;
+		if(poll(fds, 2, -1) < 0) {
+			if(errno == EINTR) {
+				continue;
+			}
+			break;
+		}
+		if(fds[1].revents != 0) {
+			break;
+		}
+		if((fds[0].revents & POLLIN) != 0) {
+			int nClient = accept4(pThis->mnListen, NULL, NULL, SOCK_CLOEXEC);
+			if(nClient >= 0) {
+				pThis->Serve(nClient);
+				close(nClient);
+			}
+		}
+	}
+	return NULL;
+}
+// Just enough HTTP/1.1 for a scraper, every response closes the connection
+void PerfMetricsEndpoint::Serve(int nClient)
+{
+	char			request[ENDPOINT_REQUEST_SIZE];
+	size_t			nRead		= 0;
+	struct timeval	timeout;
+	std::string		body;
+	const char*		szStatus	= "200 OK";
+
+	timeout.tv_sec	= ENDPOINT_TIMEOUT_MS / 1000;
+	timeout.tv_usec	= (ENDPOINT_TIMEOUT_MS % 1000) * 1000;
+	setsockopt(nClient, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+	setsockopt(nClient, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+	while(nRead < sizeof(request) - 1) {
+		ssize_t n = recv(nClient, request + nRead, sizeof(request) - 1 - nRead, 0);
+		if(n < 0 && errno == EINTR) {
+			continue;
+		}
+		if(n <= 0) {
+			return;
+		}
+		nRead += n;
+		request[nRead] = '\0';
+		if(strstr(request, "\r\n\r\n") != NULL || strstr(request, "\n\n") != NULL) {
+			break;
+		}
+	}
+	request[nRead] = '\0';
+
+	char* szPath = strchr(request, ' ');
+	if(strncmp(request, "GET ", 4) != 0 || szPath == NULL) {
+		szStatus = "405 Method Not Allowed";
+	}
+	else {
+		szPath++;
+		size_t nPath = strcspn(szPath, " ?\r\n");
+		if((nPath == 1 && szPath[0] == '/') || (nPath == 8 && strncmp(szPath, "/metrics", 8) == 0)) {
+			if(mpfnFormat(body, mpContext) == false) {
+				szStatus = "503 Service Unavailable";
+				body.clear();
+			}
+		}
+		else {
+			szStatus = "404 Not Found";
+		}
+	}
+
+	char header[256];
+	int nHeader = snprintf(header, sizeof(header), "HTTP/1.1 %s\r\nContent-Type: " ENDPOINT_CONTENT_TYPE "\r\nContent-Length: %zu\r\nConnection: close\r\n\r\n",
+						   szStatus, body.size());
+	std::string response(header, nHeader);
+	response += body;
+
+	size_t nSent = 0;
+	while(nSent < response.size()) {
+		ssize_t n = send(nClient, response.data() + nSent, response.size() - nSent, MSG_NOSIGNAL);
+		if(n < 0 && errno == EINTR) {
+			continue;
+		}
+		if(n <= 0) {
+			return;
+		}
+		nSent += n;
+	}
+}
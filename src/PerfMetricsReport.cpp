@@ -0,0 +1,484 @@
+/*****************************************************************************
+MIT License
+
+Copyright (c) 2016 Douglas Adler
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*****************************************************************************/
+
+//
+// perfmetrics-report, the category, ID and tree reports from a profile
+// image written with PERF_SET_IMAGE_FILE, or from the PerfReport.bin
+// written with PerfOptionBinaryReport.  The image is read as the process
+// left it, so this works after a crash too.  Calls still open when the
+// process died aren't counted, only completed exits are.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "PerfBinaryReport.h"
+#include "PerfProfile.h"
+
+using namespace std;
+
+#define ELEMENT_DELIMITER		";"
+
+typedef struct ReportRow_s
+{
+	string		name;
+	string		category;
+	uint32_t	nSamples;
+	uint64_t	nTotalTime;
+	uint64_t	nSelfTime;
+	uint32_t	nMinTime;
+	uint32_t	nMaxTime;
+	uint32_t	nAbortedCalls;
+	uint64_t	nWorkUnits;
+	uint64_t	nIOOps;
+	uint64_t	nIOBytes;
+	uint64_t	nIOTime;
+	uint64_t	nIOLatency[PERF_IO_LATENCY_BUCKETS];
+	PerfRusage	rusage;
+	uint64_t	nAllocCount;
+	uint64_t	nAllocBytes;
+	uint64_t	nFreeCount;
+	uint64_t	nLiveBytes;
+	uint64_t	nBudget;
+	uint64_t	nBreaches;
+} ReportRow;
+
+static void Usage(const char* szProgram)
+{
+	fprintf(stderr, "Usage: %s [-o dir] <image | PerfReport.bin>\n", szProgram);
+	fprintf(stderr, "  -o  write the reports to dir, default the working directory\n");
+	fprintf(stderr, "Writes CategoryReport.txt, IDReport.txt and TreeReport.xml from a PERF_SET_IMAGE_FILE\n");
+	fprintf(stderr, "profile or a PerfOptionBinaryReport PerfReport.bin.\n");
+}
+
+static void SumRow(ReportRow& row, PerfProfileNode& node)
+{
+	row.nSamples		+= node.nCalls;
+	row.nTotalTime		+= node.nTotalTime;
+	row.nSelfTime		+= node.nSelfTime;
+	if(node.nMaxTime > row.nMaxTime) {
+		row.nMaxTime = node.nMaxTime;
+	}
+	if(node.nMinTime < row.nMinTime || row.nMinTime == 0) {
+		row.nMinTime = node.nMinTime;
+	}
+	row.nAbortedCalls	+= node.nAbortedCalls;
+	row.nWorkUnits		+= node.nWorkUnits;
+	row.nIOOps			+= node.nIOOps;
+	row.nIOBytes		+= node.nIOBytes;
+	row.nIOTime			+= node.nIOTime;
+	for(uint32_t nBucket = 0; nBucket < PERF_IO_LATENCY_BUCKETS; nBucket++) {
+		row.nIOLatency[nBucket] += node.nIOLatency[nBucket];
+	}
+	if(node.bRusage == true) {
+		row.rusage.nVolCtxSwitches		+= node.rusage.nVolCtxSwitches;
+		row.rusage.nInvolCtxSwitches	+= node.rusage.nInvolCtxSwitches;
+		row.rusage.nMinorFaults			+= node.rusage.nMinorFaults;
+		row.rusage.nMajorFaults			+= node.rusage.nMajorFaults;
+		row.rusage.nBlockIn				+= node.rusage.nBlockIn;
+		row.rusage.nBlockOut			+= node.rusage.nBlockOut;
+	}
+	row.nAllocCount		+= node.nAllocCount;
+	row.nAllocBytes		+= node.nAllocBytes;
+	row.nFreeCount		+= node.nFreeCount;
+	row.nLiveBytes		+= node.nLiveBytes;
+}
+
+static ReportRow NewRow(const string& name, const string& category)
+{
+	ReportRow row = ReportRow();
+
+	row.name			= name;
+	row.category		= category;
+	row.nSamples		= 0;
+	row.nTotalTime		= 0;
+	row.nSelfTime		= 0;
+	row.nMinTime		= 0;
+	row.nMaxTime		= 0;
+	row.nAbortedCalls	= 0;
+	return row;
+}
+
+// The same order as SortIDByTotalCalls, so ties come out as they do there
+static void SortBySamples(vector<ReportRow>& rows)
+{
+	for(uint32_t i = 0; i + 1 < rows.size(); i++) {
+		for(uint32_t j = i + 1; j < rows.size(); j++) {
+			if(rows[i].nSamples < rows[j].nSamples) {
+				swap(rows[i], rows[j]);
+			}
+		}
+	}
+}
+
+static FILE* OpenReportFile(const string& dir, const char* szFile)
+{
+	string path = dir.empty() ? szFile : dir + "/" + szFile;
+	FILE* fp = fopen(path.c_str(), "w");
+	if(fp == NULL) {
+		fprintf(stderr, "Can't write %s\n", path.c_str());
+	}
+	return fp;
+}
+
+static void WriteRowColumns(FILE* fp, ReportRow& row)
+{
+	fprintf(fp, "%s%s%u", row.name.c_str(), ELEMENT_DELIMITER, row.nSamples);
+	fprintf(fp, "%s%lf", ELEMENT_DELIMITER, row.nTotalTime / 1000.0);
+	fprintf(fp, "%s%lf", ELEMENT_DELIMITER, row.nSelfTime / 1000.0);
+	fprintf(fp, "%s%lf", ELEMENT_DELIMITER, row.nMinTime / 1000.0);
+	fprintf(fp, "%s%lf", ELEMENT_DELIMITER, row.nMaxTime / 1000.0);
+	fprintf(fp, "%s%lf", ELEMENT_DELIMITER, (row.nTotalTime / row.nSamples) / 1000.0);
+}
+
+// Latency histogram as limit:count pairs in usec, as the library writes it
+static string FormatIOLatency(const uint64_t* pLatency)
+{
+	string	latency;
+	char	buffer[64];
+
+	for(uint32_t nBucket = 0; nBucket < PERF_IO_LATENCY_BUCKETS; nBucket++) {
+		if(pLatency[nBucket] == 0) {
+			continue;
+		}
+		if(nBucket < PERF_IO_LATENCY_BUCKETS - 1) {
+			snprintf(buffer, sizeof(buffer), "%s%lu:%lu", latency.empty() ? "" : " ",
+						1UL << nBucket, (unsigned long)pLatency[nBucket]);
+		}
+		else {
+			snprintf(buffer, sizeof(buffer), "%s%lu+:%lu", latency.empty() ? "" : " ",
+						1UL << (nBucket - 1), (unsigned long)pLatency[nBucket]);
+		}
+		latency.append(buffer);
+	}
+	return latency;
+}
+
+static double GetIOThroughput(uint64_t nBytes, uint64_t nTime)
+{
+	return nTime > 0 ? (double)nBytes / nTime : 0.0;
+}
+
+static double GetNsPerUnit(uint64_t nTime, uint64_t nUnits)
+{
+	return nUnits > 0 ? (nTime * 1000.0) / nUnits : 0.0;
+}
+
+static double GetUnitsPerSec(uint64_t nTime, uint64_t nUnits)
+{
+	return nTime > 0 ? (nUnits * 1000000.0) / nTime : 0.0;
+}
+
+// The optional columns in the library's order, the ones the file has
+static void WriteColumnHeader(FILE* fp, uint32_t nColumns, bool bIDReport)
+{
+	if(bIDReport == true && (nColumns & PERF_BINARY_ALLOCS) != 0) {
+		fprintf(fp, ";Allocs;Alloc Bytes;Frees;Live Bytes");
+	}
+	if((nColumns & PERF_BINARY_RUSAGE) != 0) {
+		fprintf(fp, ";Vol CS;Invol CS;Minor Faults;Major Faults;Block In;Block Out");
+	}
+	if((nColumns & PERF_BINARY_IO) != 0) {
+		fprintf(fp, ";IO Ops;IO Bytes;IO Time;MB/s;IO Latency (us)");
+	}
+	if((nColumns & PERF_BINARY_WORK) != 0) {
+		fprintf(fp, ";Work Units;ns/Unit;Units/s");
+	}
+	if(bIDReport == true && (nColumns & PERF_BINARY_BUDGETS) != 0) {
+		fprintf(fp, ";Budget;Breaches");
+	}
+}
+
+static void WriteOptionalColumns(FILE* fp, ReportRow& row, uint32_t nColumns, bool bIDReport)
+{
+	if(bIDReport == true && (nColumns & PERF_BINARY_ALLOCS) != 0) {
+		fprintf(fp, "%s%lu", ELEMENT_DELIMITER, (unsigned long)row.nAllocCount);
+		fprintf(fp, "%s%lu", ELEMENT_DELIMITER, (unsigned long)row.nAllocBytes);
+		fprintf(fp, "%s%lu", ELEMENT_DELIMITER, (unsigned long)row.nFreeCount);
+		fprintf(fp, "%s%lu", ELEMENT_DELIMITER, (unsigned long)row.nLiveBytes);
+	}
+	if((nColumns & PERF_BINARY_RUSAGE) != 0) {
+		fprintf(fp, "%s%lu", ELEMENT_DELIMITER, (unsigned long)row.rusage.nVolCtxSwitches);
+		fprintf(fp, "%s%lu", ELEMENT_DELIMITER, (unsigned long)row.rusage.nInvolCtxSwitches);
+		fprintf(fp, "%s%lu", ELEMENT_DELIMITER, (unsigned long)row.rusage.nMinorFaults);
+		fprintf(fp, "%s%lu", ELEMENT_DELIMITER, (unsigned long)row.rusage.nMajorFaults);
+		fprintf(fp, "%s%lu", ELEMENT_DELIMITER, (unsigned long)row.rusage.nBlockIn);
+		fprintf(fp, "%s%lu", ELEMENT_DELIMITER, (unsigned long)row.rusage.nBlockOut);
+	}
+	if((nColumns & PERF_BINARY_IO) != 0) {
+		fprintf(fp, "%s%lu", ELEMENT_DELIMITER, (unsigned long)row.nIOOps);
+		fprintf(fp, "%s%lu", ELEMENT_DELIMITER, (unsigned long)row.nIOBytes);
+		fprintf(fp, "%s%lf", ELEMENT_DELIMITER, row.nIOTime / 1000.0);
+		fprintf(fp, "%s%lf", ELEMENT_DELIMITER, GetIOThroughput(row.nIOBytes, row.nIOTime));
+		fprintf(fp, "%s%s", ELEMENT_DELIMITER, FormatIOLatency(row.nIOLatency).c_str());
+	}
+	if((nColumns & PERF_BINARY_WORK) != 0) {
+		fprintf(fp, "%s%lu", ELEMENT_DELIMITER, (unsigned long)row.nWorkUnits);
+		fprintf(fp, "%s%lf", ELEMENT_DELIMITER, GetNsPerUnit(row.nTotalTime, row.nWorkUnits));
+		fprintf(fp, "%s%lf", ELEMENT_DELIMITER, GetUnitsPerSec(row.nTotalTime, row.nWorkUnits));
+	}
+	if(bIDReport == true && (nColumns & PERF_BINARY_BUDGETS) != 0) {
+		fprintf(fp, "%s%lu", ELEMENT_DELIMITER, (unsigned long)row.nBudget);
+		fprintf(fp, "%s%lu", ELEMENT_DELIMITER, (unsigned long)row.nBreaches);
+	}
+}
+
+// A category is only counted at its outermost node on each path
+static bool WriteCategoryReport(PerfProfile& profile, const string& dir)
+{
+	vector<ReportRow>	rows;
+	map<PerfID, uint32_t>	index;
+
+	for(uint32_t idx = 0; idx < profile.GetCategories().size(); idx++) {
+		index[profile.GetCategories()[idx].catID] = rows.size();
+		rows.push_back(NewRow(profile.GetCategories()[idx].name, ""));
+	}
+	for(uint32_t idx = 0; idx < profile.GetNodes().size(); idx++) {
+		PerfProfileNode& node = profile.GetNodes()[idx];
+		map<PerfID, uint32_t>::iterator iter = index.find(node.catID);
+		if(node.nCalls == 0 || iter == index.end()) {
+			continue;
+		}
+		bool bNested = false;
+		for(uint32_t nParent = node.nParent; nParent != 0 && bNested == false; nParent = profile.GetNodes()[nParent - 1].nParent) {
+			bNested = profile.GetNodes()[nParent - 1].catID == node.catID;
+		}
+		if(bNested == false) {
+			SumRow(rows[iter->second], node);
+		}
+	}
+	FILE* fp = OpenReportFile(dir, "CategoryReport.txt");
+	if(fp == NULL) {
+		return false;
+	}
+	fprintf(fp, "Name;Samples;Total;Self;Min;Max;Avg");
+	WriteColumnHeader(fp, profile.GetColumns(), false);
+	fprintf(fp, "\n");
+	for(uint32_t idx = 0; idx < rows.size(); idx++) {
+		if(rows[idx].nSamples > 0) {
+			WriteRowColumns(fp, rows[idx]);
+			WriteOptionalColumns(fp, rows[idx], profile.GetColumns(), false);
+			fprintf(fp, "\n");
+		}
+	}
+	fclose(fp);
+	return true;
+}
+
+static bool WriteIDReport(PerfProfile& profile, const string& dir)
+{
+	vector<ReportRow>	rows;
+	map<PerfID, uint32_t>	index;
+	bool				bAborted	= false;
+
+	for(uint32_t idx = 0; idx < profile.GetIDs().size(); idx++) {
+		index[profile.GetIDs()[idx].id] = rows.size();
+		rows.push_back(NewRow(profile.GetIDs()[idx].name, profile.GetIDs()[idx].category));
+		rows.back().nBudget		= profile.GetIDs()[idx].nBudget;
+		rows.back().nBreaches	= profile.GetIDs()[idx].nBreaches;
+	}
+	for(uint32_t idx = 0; idx < profile.GetNodes().size(); idx++) {
+		PerfProfileNode& node = profile.GetNodes()[idx];
+		if(node.nCalls == 0) {
+			continue;
+		}
+		if(index.find(node.id) == index.end()) {
+			index[node.id] = rows.size();
+			rows.push_back(NewRow(profile.GetName(node.id), ""));
+		}
+		SumRow(rows[index[node.id]], node);
+		bAborted |= node.nAbortedCalls > 0;
+	}
+	SortBySamples(rows);
+	FILE* fp = OpenReportFile(dir, "IDReport.txt");
+	if(fp == NULL) {
+		return false;
+	}
+	fprintf(fp, "Name;Samples;Total;Self;Min;Max;Avg;Category");
+	WriteColumnHeader(fp, profile.GetColumns(), true);
+	fprintf(fp, "%s\n", bAborted ? ";Aborted" : "");
+	for(uint32_t idx = 0; idx < rows.size(); idx++) {
+		if(rows[idx].nSamples > 0) {
+			WriteRowColumns(fp, rows[idx]);
+			fprintf(fp, "%s%s", ELEMENT_DELIMITER, rows[idx].category.c_str());
+			WriteOptionalColumns(fp, rows[idx], profile.GetColumns(), true);
+			if(bAborted) {
+				fprintf(fp, "%s%u", ELEMENT_DELIMITER, rows[idx].nAbortedCalls);
+			}
+			fprintf(fp, "\n");
+		}
+	}
+	fclose(fp);
+	return true;
+}
+
+static void EscapeToXML(string& data)
+{
+	string buffer;
+
+	buffer.reserve(data.size() + 50);
+	for(size_t pos = 0; pos != data.size(); ++pos) {
+		switch(data[pos]) {
+			case '&':  buffer.append("&amp;");		break;
+			case '\"': buffer.append("&quot;");		break;
+			case '\'': buffer.append("&apos;");		break;
+			case '<':  buffer.append("&lt;");		break;
+			case '>':  buffer.append("&gt;");		break;
+			default:   buffer.append(1, data[pos]);	break;
+		}
+	}
+	data.swap(buffer);
+}
+
+class OrderByTotal
+{
+public:
+	OrderByTotal(vector<PerfProfileNode>& nodes) : mNodes(nodes) {}
+	bool operator()(uint32_t a, uint32_t b) const
+	{
+		return mNodes[a].nTotalTime > mNodes[b].nTotalTime;
+	}
+private:
+	vector<PerfProfileNode>&	mNodes;
+};
+
+// Indented by depth, a node that was never exited is left out but its children aren't
+static void WriteTreeNode(PerfProfile& profile, uint32_t nNode, uint32_t nDepth, FILE* fp)
+{
+	PerfProfileNode&	node	= profile.GetNodes()[nNode];
+	bool		bEntry	= node.nCalls > 0;
+
+	stable_sort(node.children.begin(), node.children.end(), OrderByTotal(profile.GetNodes()));
+	if(bEntry) {
+		string name = profile.GetName(node.id);
+		EscapeToXML(name);
+		fprintf(fp, "%*s<Entry Name='%s'", nDepth * 3, "", name.c_str());
+		fprintf(fp, " Calls='%d'", (int)node.nCalls);
+		fprintf(fp, " Total='%0.3f' Self='%0.3f' Max='%0.3f' Min='%0.3f' Avg='%0.3f'",
+					node.nTotalTime / 1000.0, node.nSelfTime / 1000.0,
+					node.nMaxTime / 1000.0, node.nMinTime / 1000.0,
+					(node.nTotalTime / node.nCalls) / 1000.0);
+		if(node.nRecursiveCalls > 0) {
+			fprintf(fp, " Recursive='%u' MaxRecursion='%u'", node.nRecursiveCalls, node.nMaxRecursion);
+		}
+		if(node.nAbortedCalls > 0) {
+			fprintf(fp, " Aborted='%u'", node.nAbortedCalls);
+		}
+		if(node.nAllocCount > 0) {
+			fprintf(fp, " Allocs='%lu' AllocBytes='%lu' Frees='%lu' LiveBytes='%lu'",
+						(unsigned long)node.nAllocCount, (unsigned long)node.nAllocBytes,
+						(unsigned long)node.nFreeCount, (unsigned long)node.nLiveBytes);
+		}
+		if(node.bRusage == true) {
+			fprintf(fp, " VolCS='%lu' InvolCS='%lu' MinorFaults='%lu' MajorFaults='%lu' BlockIn='%lu' BlockOut='%lu'",
+						(unsigned long)node.rusage.nVolCtxSwitches, (unsigned long)node.rusage.nInvolCtxSwitches,
+						(unsigned long)node.rusage.nMinorFaults, (unsigned long)node.rusage.nMajorFaults,
+						(unsigned long)node.rusage.nBlockIn, (unsigned long)node.rusage.nBlockOut);
+		}
+		if(node.nLockAcquires > 0) {
+			fprintf(fp, " LockAcquires='%lu' LockContended='%lu' LockWait='%0.3f' LockHold='%0.3f'",
+						(unsigned long)node.nLockAcquires, (unsigned long)node.nLockContended,
+						node.nLockWaitTime / 1000.0, node.nLockHoldTime / 1000.0);
+		}
+		if(node.nIOOps > 0) {
+			fprintf(fp, " IOOps='%lu' IOBytes='%lu' IOTime='%0.3f' IOMBps='%0.3f' IOLatency='%s'",
+						(unsigned long)node.nIOOps, (unsigned long)node.nIOBytes, node.nIOTime / 1000.0,
+						GetIOThroughput(node.nIOBytes, node.nIOTime), FormatIOLatency(node.nIOLatency).c_str());
+		}
+		if(node.nWorkUnits > 0) {
+			fprintf(fp, " Work='%lu' NsPerUnit='%0.3f' UnitsPerSec='%0.3f'", (unsigned long)node.nWorkUnits,
+						GetNsPerUnit(node.nTotalTime, node.nWorkUnits), GetUnitsPerSec(node.nTotalTime, node.nWorkUnits));
+		}
+		if(node.children.empty()) {
+			fprintf(fp, " />\n");
+			return;
+		}
+		fprintf(fp, " >\n");
+	}
+	for(uint32_t idx = 0; idx < node.children.size(); idx++) {
+		WriteTreeNode(profile, node.children[idx], nDepth + 1, fp);
+	}
+	if(bEntry) {
+		fprintf(fp, "%*s</Entry>\n", nDepth * 3, "");
+	}
+}
+
+static bool WriteTreeReport(PerfProfile& profile, const string& dir)
+{
+	FILE* fp = OpenReportFile(dir, "TreeReport.xml");
+	if(fp == NULL) {
+		return false;
+	}
+	fprintf(fp, "<?xml version='1.0' encoding='utf-8' standalone='no'?>\n<TreeReport>\n");
+	for(uint32_t idx = 0; idx < profile.GetNodes().size(); idx++) {
+		if(profile.GetNodes()[idx].nParent == 0) {
+			fprintf(fp, "<Thread ID='%lX' >\n", (unsigned long)profile.GetNodes()[idx].nThreadID);
+			WriteTreeNode(profile, idx, 0, fp);
+			fprintf(fp, "</Thread>\n");
+		}
+	}
+	fprintf(fp, "</TreeReport>\n");
+	fclose(fp);
+	return true;
+}
+
+int main(int argc, char** argv)
+{
+	PerfProfile	profile;
+	string			dir;
+	int				nOption;
+
+	while((nOption = getopt(argc, argv, "o:h")) != -1) {
+		switch(nOption) {
+			case 'o':
+				dir = optarg;
+				break;
+			default:
+				Usage(argv[0]);
+				return 1;
+		}
+	}
+	if(optind != argc - 1) {
+		Usage(argv[0]);
+		return 1;
+	}
+	if(profile.Load(argv[optind]) == false) {
+		fprintf(stderr, "%s: %s isn't a profile image or PerfReport.bin, or is damaged or from another version\n", argv[0], argv[optind]);
+		return 1;
+	}
+	if(profile.GetDroppedNodes() > 0) {
+		fprintf(stderr, "%s: %lu nodes didn't fit in the image or weren't complete, raise nMaxNodes\n", argv[0], (unsigned long)profile.GetDroppedNodes());
+	}
+	if(WriteCategoryReport(profile, dir) == false || WriteIDReport(profile, dir) == false || WriteTreeReport(profile, dir) == false) {
+		return 1;
+	}
+	return 0;
+}
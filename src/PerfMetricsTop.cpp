@@ -0,0 +1,197 @@
+/*****************************************************************************
+MIT License
+
+Copyright (c) 2016 Douglas Adler
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*****************************************************************************/
+
+//
+// perfmetrics-top, a live view of a process run with PerfOptionLiveStats.
+// Attaches to the process's live stats segment read only, so the process
+// never knows it's being watched.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/time.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "PerfLiveStats.h"
+
+using namespace std;
+
+typedef struct TopRow_s
+{
+	PerfLiveRecord	record;
+	uint64_t		nCalls;				// Since the last refresh
+	uint64_t		nSelfTime;
+} TopRow;
+
+static bool SortBySelf(const TopRow& a, const TopRow& b)
+{
+	if(a.nSelfTime != b.nSelfTime) {
+		return a.nSelfTime > b.nSelfTime;
+	}
+	return a.record.nSelfTime > b.record.nSelfTime;
+}
+
+static double GetSeconds()
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec + now.tv_nsec / 1000000000.0;
+}
+
+static void Usage(const char* szProgram)
+{
+	fprintf(stderr, "Usage: %s [-d ms] [-n count] [-l lines] [-c] [-b] <pid | /segment>\n", szProgram);
+	fprintf(stderr, "  -d  refresh every ms, default 1000\n");
+	fprintf(stderr, "  -n  exit after count refreshes, default forever\n");
+	fprintf(stderr, "  -l  rows to show, default 25\n");
+	fprintf(stderr, "  -c  show categories instead of IDs\n");
+	fprintf(stderr, "  -b  batch mode, don't clear the screen\n");
+	fprintf(stderr, "Rows are sorted by self time since the last refresh, then by total self time.\n");
+}
+
+// Deltas are against the last refresh, by slot
+static bool ReadRows(PerfLiveStats& stats, bool bCategories, vector<PerfLiveRecord>& last, vector<TopRow>& rows)
+{
+	PerfLiveHeader*	pHeader	= stats.GetHeader();
+	uint32_t		nSlots	= bCategories ? __atomic_load_n(&pHeader->nCategories, __ATOMIC_ACQUIRE) : __atomic_load_n(&pHeader->nIDs, __ATOMIC_ACQUIRE);
+	TopRow			row;
+
+	rows.clear();
+	if(last.size() < nSlots) {
+		PerfLiveRecord empty;
+		memset(&empty, 0, sizeof(empty));
+		last.resize(nSlots, empty);
+	}
+	for(uint32_t nSlot = 0; nSlot < nSlots; nSlot++) {
+		bool bRead = bCategories ? stats.ReadCategory(nSlot, &row.record) : stats.ReadID(nSlot, &row.record);
+		if(bRead == false || row.record.nCalls == 0) {
+			continue;
+		}
+		if(last[nSlot].nID != row.record.nID) {
+			memset(&last[nSlot], 0, sizeof(PerfLiveRecord));
+		}
+		row.nCalls		= row.record.nCalls - last[nSlot].nCalls;
+		row.nSelfTime	= row.record.nSelfTime - last[nSlot].nSelfTime;
+		last[nSlot]		= row.record;
+		rows.push_back(row);
+	}
+	sort(rows.begin(), rows.end(), SortBySelf);
+	return true;
+}
+
+static void PrintRows(PerfLiveHeader* pHeader, vector<TopRow>& rows, double nSeconds, uint32_t nLines, bool bCategories, bool bBatch)
+{
+	struct timeval	now;
+
+	gettimeofday(&now, NULL);
+	if(bBatch == false) {
+		printf("\033[H\033[2J");
+	}
+	uint64_t nNow = (uint64_t)now.tv_sec * 1000000 + now.tv_usec;
+	printf("pid %d  up %.1f s  updated %.1f s ago  every %u ms%s\n", pHeader->nPid,
+			(nNow - pHeader->nStartTime) / 1000000.0,
+			nNow > pHeader->nUpdateTime ? (nNow - pHeader->nUpdateTime) / 1000000.0 : 0.0,
+			pHeader->nInterval, pHeader->bStopped ? "  stopped" : "");
+	if(pHeader->nDroppedIDs > 0) {
+		printf("warning: %u IDs aren't counted, the segment only has room for %u\n", pHeader->nDroppedIDs, pHeader->nMaxIDs);
+	}
+	printf("\n%-32s %-16s %10s %12s %12s %12s %10s %10s %8s\n", bCategories ? "Category" : "Name", bCategories ? "" : "Category",
+			"Calls/s", "Self ms/s", "Calls", "Self ms", "Avg us", "Max us", "Aborted");
+	for(uint32_t idx = 0; idx < rows.size() && idx < nLines; idx++) {
+		PerfLiveRecord* pRecord = &rows[idx].record;
+		printf("%-32.32s %-16.16s %10.1f %12.3f %12lu %12.3f %10.1f %10lu %8lu\n",
+				pRecord->szName, bCategories ? "" : pRecord->szCategory,
+				nSeconds > 0 ? rows[idx].nCalls / nSeconds : 0.0,
+				nSeconds > 0 ? rows[idx].nSelfTime / 1000.0 / nSeconds : 0.0,
+				(unsigned long)pRecord->nCalls,
+				pRecord->nSelfTime / 1000.0,
+				(double)pRecord->nTotalTime / pRecord->nCalls,
+				(unsigned long)pRecord->nMaxTime,
+				(unsigned long)pRecord->nAbortedCalls);
+	}
+	fflush(stdout);
+}
+
+int main(int argc, char** argv)
+{
+	PerfLiveStats			stats;
+	vector<PerfLiveRecord>	last;
+	vector<TopRow>			rows;
+	uint32_t				nDelay		= 1000;
+	long					nCount		= -1;
+	uint32_t				nLines		= 25;
+	bool					bCategories	= false;
+	bool					bBatch		= false;
+	int						nOption;
+
+	while((nOption = getopt(argc, argv, "d:n:l:cbh")) != -1) {
+		switch(nOption) {
+			case 'd':
+				nDelay = strtoul(optarg, NULL, 10);
+				break;
+			case 'n':
+				nCount = strtol(optarg, NULL, 10);
+				break;
+			case 'l':
+				nLines = strtoul(optarg, NULL, 10);
+				break;
+			case 'c':
+				bCategories = true;
+				break;
+			case 'b':
+				bBatch = true;
+				break;
+			default:
+				Usage(argv[0]);
+				return 1;
+		}
+	}
+	if(optind != argc - 1 || nDelay == 0) {
+		Usage(argv[0]);
+		return 1;
+	}
+	if(stats.Attach(argv[optind]) == false) {
+		fprintf(stderr, "%s: can't attach to %s, is it running with PerfOptionLiveStats and the same version?\n", argv[0], argv[optind]);
+		return 1;
+	}
+	// The first pass only sets the baseline for the rates
+	double nLast = GetSeconds();
+	ReadRows(stats, bCategories, last, rows);
+	PrintRows(stats.GetHeader(), rows, 0, nLines, bCategories, bBatch);
+	while(nCount < 0 || --nCount > 0) {
+		usleep(nDelay * 1000);
+		double nNow = GetSeconds();
+		ReadRows(stats, bCategories, last, rows);
+		PrintRows(stats.GetHeader(), rows, nNow - nLast, nLines, bCategories, bBatch);
+		nLast = nNow;
+	}
+	stats.Detach();
+	return 0;
+}
@@ -0,0 +1,162 @@
+/*****************************************************************************
+MIT License
+
+Copyright (c) 2016 Douglas Adler
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*****************************************************************************/
+
+//
+// make check.  Once the tree has its nodes, PERF_FUNC calls must not
+// allocate.  Then new contexts are entered until the thread arena is full,
+// and the calls that go to [other] must not fall back to the heap either.
+// Last the metrics endpoint is started, and neither the running thread nor a
+// new one may allocate the live counts when a call exits.
+//
+// malloc and friends are defined here and call the glibc __libc_ versions,
+// so every allocation made in the process is counted, operator new included.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "PerfMetrics.h"
+
+#define TEST_WARMUP_CALLS		1000
+#define TEST_STEADY_CALLS		100000
+#define TEST_NEW_CONTEXTS		2000
+#define TEST_THREAD_ARENA		(64 * 1024)
+
+extern "C" void*	__libc_malloc(size_t nSize);
+extern "C" void*	__libc_calloc(size_t nCount, size_t nSize);
+extern "C" void*	__libc_realloc(void* p, size_t nSize);
+extern "C" void		__libc_free(void* p);
+
+static volatile bool			gbCounting	= false;
+static volatile unsigned long	gnAllocs	= 0;
+
+extern "C" void* malloc(size_t nSize)
+{
+	if(gbCounting == true) {
+		__sync_fetch_and_add(&gnAllocs, 1);
+	}
+	return __libc_malloc(nSize);
+}
+extern "C" void* calloc(size_t nCount, size_t nSize)
+{
+	if(gbCounting == true) {
+		__sync_fetch_and_add(&gnAllocs, 1);
+	}
+	return __libc_calloc(nCount, nSize);
+}
+extern "C" void* realloc(void* p, size_t nSize)
+{
+	if(gbCounting == true) {
+		__sync_fetch_and_add(&gnAllocs, 1);
+	}
+	return __libc_realloc(p, nSize);
+}
+extern "C" void free(void* p)
+{
+	__libc_free(p);
+}
+
+static void Leaf()
+{
+	PERF_FUNC("Leaf", "Test");
+}
+static void Outer()
+{
+	PERF_FUNC("Outer", "Test");
+	Leaf();
+	Leaf();
+}
+// Registers, then counts the calls it makes once it has
+static void* Worker(void* pArg)
+{
+	PERF_ENTRY("Worker", "Test");
+	gbCounting = true;
+	for(int idx = 0; idx < TEST_WARMUP_CALLS; idx++) {
+		Leaf();
+	}
+	gbCounting = false;
+	PERF_EXIT("Worker", "Test");
+	return NULL;
+}
+
+int main(int argc, char** argv)
+{
+	static char		szNames[TEST_NEW_CONTEXTS][32];
+	char			szEndpoint[64];
+	pthread_t		worker;
+	unsigned long	nSteadyAllocs	= 0;
+	unsigned long	nFillAllocs		= 0;
+	unsigned long	nLiveAllocs		= 0;
+
+	PERF_SET_OPTION(PerfOptionThreadArena, TEST_THREAD_ARENA);
+	PERF_SET_OPTION(PerfOptionRegistryArena, 1 << 20);
+	PERF_CATEGORY_RUSAGE("Rusage");
+	PERF_START();
+	for(int idx = 0; idx < TEST_WARMUP_CALLS; idx++) {
+		Outer();
+	}
+	for(int idx = 0; idx < TEST_NEW_CONTEXTS; idx++) {
+		snprintf(szNames[idx], sizeof(szNames[idx]), "Context%d", idx);
+	}
+
+	gbCounting = true;
+	for(int idx = 0; idx < TEST_STEADY_CALLS; idx++) {
+		Outer();
+	}
+	nSteadyAllocs = gnAllocs;
+	// Far more nodes than the arena holds, with getrusage blocks
+	for(int idx = 0; idx < TEST_NEW_CONTEXTS; idx++) {
+		PERF_ENTRY(szNames[idx], "Rusage");
+		Leaf();
+		PERF_EXIT(szNames[idx], "Rusage");
+	}
+	nFillAllocs = gnAllocs - nSteadyAllocs;
+	gbCounting = false;
+
+	// Live counts for this thread, which is already running, and a new one
+	snprintf(szEndpoint, sizeof(szEndpoint), "/tmp/perfmetrics-noalloc-test.%d.sock", (int)getpid());
+	if(PERF_SET_METRICS_ENDPOINT(szEndpoint) == true) {
+		gnAllocs	= 0;
+		gbCounting	= true;
+		for(int idx = 0; idx < TEST_WARMUP_CALLS; idx++) {
+			Outer();
+		}
+		gbCounting	= false;
+		pthread_create(&worker, NULL, Worker, NULL);
+		pthread_join(worker, NULL);
+		nLiveAllocs = gnAllocs;
+	}
+	else {
+		printf("The metrics endpoint didn't start, live counts not tested\n");
+	}
+
+	PERF_STOP();
+	PERF_CLEANUP();
+	printf("Allocations in %d warmed up calls: %lu\n", TEST_STEADY_CALLS, nSteadyAllocs);
+	printf("Allocations filling a %d byte arena: %lu\n", TEST_THREAD_ARENA, nFillAllocs);
+	printf("Allocations in calls with live counts: %lu\n", nLiveAllocs);
+	return (nSteadyAllocs == 0 && nFillAllocs == 0 && nLiveAllocs == 0) ? 0 : 1;
+}
@@ -0,0 +1,381 @@
+/*****************************************************************************
+MIT License
+
+Copyright (c) 2016 Douglas Adler
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*****************************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <map>
+
+#include "PerfProfile.h"
+#include "PerfImage.h"
+#include "PerfBinaryReport.h"
+
+using namespace std;
+
+PerfProfile::PerfProfile()
+{
+	mnDroppedNodes	= 0;
+	mnColumns		= 0;
+}
+
+PerfProfile::~PerfProfile()
+{
+}
+
+bool PerfProfile::Load(const char* szFile)
+{
+	mCategories.clear();
+	mIDs.clear();
+	mNodes.clear();
+	mnDroppedNodes	= 0;
+	mnColumns		= 0;
+	if(GetMagic(szFile) == PERF_BINARY_MAGIC) {
+		return LoadBinary(szFile);
+	}
+	return LoadImage(szFile);
+}
+vector<PerfProfileCategory>& PerfProfile::GetCategories()
+{
+	return mCategories;
+}
+vector<PerfProfileID>& PerfProfile::GetIDs()
+{
+	return mIDs;
+}
+vector<PerfProfileNode>& PerfProfile::GetNodes()
+{
+	return mNodes;
+}
+uint64_t PerfProfile::GetDroppedNodes()
+{
+	return mnDroppedNodes;
+}
+uint32_t PerfProfile::GetColumns()
+{
+	return mnColumns;
+}
+PerfProfileID* PerfProfile::FindID(PerfID id)
+{
+	for(uint32_t idx = 0; idx < mIDs.size(); idx++) {
+		if(mIDs[idx].id == id) {
+			return &mIDs[idx];
+		}
+	}
+	return NULL;
+}
+string PerfProfile::GetName(PerfID id)
+{
+	PerfProfileID* pID = FindID(id);
+	if(pID != NULL) {
+		return pID->name;
+	}
+	char buffer[32];
+	snprintf(buffer, sizeof(buffer), "ID %u", (unsigned int)id);
+	return buffer;
+}
+// Both formats start with one
+uint64_t PerfProfile::GetMagic(const char* szFile)
+{
+	uint64_t	nMagic	= 0;
+	FILE*		fp		= fopen(szFile, "r");
+
+	if(fp != NULL) {
+		if(fread(&nMagic, sizeof(nMagic), 1, fp) != 1) {
+			nMagic = 0;
+		}
+		fclose(fp);
+	}
+	return nMagic;
+}
+void PerfProfile::LinkNodes()
+{
+	for(uint32_t idx = 0; idx < mNodes.size(); idx++) {
+		PerfProfileNode& node = mNodes[idx];
+		if(node.nParent != 0) {
+			mNodes[node.nParent - 1].children.push_back(idx);
+		}
+	}
+}
+// Incomplete slots are skipped along with everything under them
+bool PerfProfile::LoadImage(const char* szFile)
+{
+	PerfImage			image;
+	map<uint32_t, uint32_t>	slots;			// Image slot to node index
+	map<PerfID, bool>	categories;
+	vector<int64_t>		self;			// Less the child totals once they're all in
+
+	if(image.Open(szFile) == false) {
+		return false;
+	}
+	PerfImageHeader* pHeader = image.GetHeader();
+	uint32_t nIDs	= min((uint32_t)pHeader->nIDs, pHeader->nMaxIDs);
+	uint32_t nNodes	= min((uint32_t)pHeader->nNodes, pHeader->nMaxNodes);
+
+	mnDroppedNodes = pHeader->nDroppedNodes;
+	for(uint32_t nSlot = 0; nSlot < nIDs; nSlot++) {
+		PerfImageID* pImageID = image.GetID(nSlot);
+		if(pImageID == NULL) {
+			continue;
+		}
+		PerfProfileID id = PerfProfileID();
+		id.id			= pImageID->nID;
+		id.catID		= pImageID->nCategoryID;
+		id.bInternal	= (pImageID->nFlags & PERF_IMAGE_INTERNAL) != 0;
+		id.name.assign(pImageID->szName, strnlen(pImageID->szName, PERF_IMAGE_NAME_SIZE));
+		id.category.assign(pImageID->szCategory, strnlen(pImageID->szCategory, PERF_IMAGE_NAME_SIZE));
+		mIDs.push_back(id);
+		// The image doesn't keep the category list, they come in as their first ID does
+		if(id.bInternal == false && categories.find(id.catID) == categories.end()) {
+			PerfProfileCategory category;
+			category.catID	= id.catID;
+			category.name	= id.category;
+			mCategories.push_back(category);
+			categories[id.catID] = true;
+		}
+	}
+	for(uint32_t nSlot = 0; nSlot < nNodes; nSlot++) {
+		PerfImageNode* pImageNode = image.GetNode(nSlot);
+		if(pImageNode == NULL) {
+			mnDroppedNodes++;
+			continue;
+		}
+		PerfProfileNode node = PerfProfileNode();
+		node.nParent = 0;
+		if(pImageNode->nParent != 0) {
+			map<uint32_t, uint32_t>::iterator iter = slots.find(pImageNode->nParent - 1);
+			if(pImageNode->nParent - 1 >= nSlot || iter == slots.end()) {
+				mnDroppedNodes++;
+				continue;
+			}
+			node.nParent = iter->second + 1;
+		}
+		node.id					= pImageNode->nID;
+		node.catID				= pImageNode->nCategoryID;
+		node.nThreadID			= pImageNode->nThreadID;
+		node.nCalls				= pImageNode->nCalls;
+		node.nTotalTime			= pImageNode->nTotalTime;
+		node.nSelfTime			= 0;
+		node.nMinTime			= pImageNode->nMinTime;
+		node.nMaxTime			= pImageNode->nMaxTime;
+		node.nAbortedCalls		= pImageNode->nAbortedCalls;
+		node.nRecursiveCalls	= pImageNode->nRecursiveCalls;
+		node.nMaxRecursion		= pImageNode->nMaxRecursion;
+		slots[nSlot] = mNodes.size();
+		mNodes.push_back(node);
+		// The same as PerformanceRec::GetReport
+		self.push_back((int64_t)(pImageNode->nTotalTime + pImageNode->nRecursiveTime) - (int64_t)pImageNode->nFoldedOutTime);
+	}
+	image.Close();
+	for(uint32_t idx = 0; idx < mNodes.size(); idx++) {
+		if(mNodes[idx].nParent != 0) {
+			self[mNodes[idx].nParent - 1] -= mNodes[idx].nTotalTime;
+		}
+	}
+	for(uint32_t idx = 0; idx < mNodes.size(); idx++) {
+		mNodes[idx].nSelfTime = self[idx] > 0 ? self[idx] : 0;
+	}
+	LinkNodes();
+	return true;
+}
+static bool GetStringIndex(PerfBinaryReport& binary, vector<string>& strings, string* pValue)
+{
+	uint64_t nIndex = 0;
+
+	if(binary.GetVarint(&nIndex) == false || nIndex >= strings.size()) {
+		return false;
+	}
+	*pValue = strings[nIndex];
+	return true;
+}
+// The optional node fields, in the order PerfBinaryReport.h lists them
+bool PerfProfile::LoadBinaryColumns(PerfBinaryReport& binary, PerfProfileNode* pNode)
+{
+	uint64_t nValue = 0;
+
+	if((mnColumns & PERF_BINARY_WORK) != 0 && binary.GetVarint(&pNode->nWorkUnits) == false) {
+		return false;
+	}
+	if((mnColumns & PERF_BINARY_IO) != 0) {
+		if(binary.GetVarint(&pNode->nIOOps) == false || binary.GetVarint(&pNode->nIOBytes) == false ||
+		   binary.GetVarint(&pNode->nIOTime) == false) {
+			return false;
+		}
+		for(uint32_t nBucket = 0; nBucket < PERF_IO_LATENCY_BUCKETS; nBucket++) {
+			if(binary.GetVarint(&pNode->nIOLatency[nBucket]) == false) {
+				return false;
+			}
+		}
+	}
+	if((mnColumns & PERF_BINARY_RUSAGE) != 0) {
+		if(binary.GetVarint(&nValue) == false) {
+			return false;
+		}
+		pNode->bRusage = (nValue != 0);
+		if(pNode->bRusage == true &&
+		   (binary.GetVarint(&pNode->rusage.nVolCtxSwitches) == false || binary.GetVarint(&pNode->rusage.nInvolCtxSwitches) == false ||
+			binary.GetVarint(&pNode->rusage.nMinorFaults) == false || binary.GetVarint(&pNode->rusage.nMajorFaults) == false ||
+			binary.GetVarint(&pNode->rusage.nBlockIn) == false || binary.GetVarint(&pNode->rusage.nBlockOut) == false)) {
+			return false;
+		}
+	}
+	if((mnColumns & PERF_BINARY_ALLOCS) != 0 &&
+	   (binary.GetVarint(&pNode->nAllocCount) == false || binary.GetVarint(&pNode->nAllocBytes) == false ||
+		binary.GetVarint(&pNode->nFreeCount) == false || binary.GetVarint(&pNode->nLiveBytes) == false)) {
+		return false;
+	}
+	if((mnColumns & PERF_BINARY_LOCKS) != 0 &&
+	   (binary.GetVarint(&pNode->nLockAcquires) == false || binary.GetVarint(&pNode->nLockContended) == false ||
+		binary.GetVarint(&pNode->nLockWaitTime) == false || binary.GetVarint(&pNode->nLockHoldTime) == false)) {
+		return false;
+	}
+	return true;
+}
+bool PerfProfile::LoadBinaryNode(PerfBinaryReport& binary, uint64_t nThreadID, vector<uint32_t>& path, int64_t* pnDepth, int64_t* pnID)
+{
+	int64_t		nDepthDelta	= 0;
+	int64_t		nIDDelta	= 0;
+	uint64_t	values[8];
+	PerfProfileNode	node	= PerfProfileNode();
+
+	if(binary.GetSigned(&nDepthDelta) == false || binary.GetSigned(&nIDDelta) == false) {
+		return false;
+	}
+	for(uint32_t idx = 0; idx < 8; idx++) {
+		if(binary.GetVarint(&values[idx]) == false) {
+			return false;
+		}
+	}
+	if(LoadBinaryColumns(binary, &node) == false) {
+		return false;
+	}
+	*pnDepth	+= nDepthDelta;
+	*pnID		+= nIDDelta;
+	// Each thread starts at its root and never goes more than one below the node before
+	if(*pnDepth < 0 || *pnDepth > (int64_t)path.size() || (path.empty() && *pnDepth != 0) || (path.empty() == false && *pnDepth == 0) || *pnID < 0) {
+		return false;
+	}
+	path.resize(*pnDepth);
+	node.nParent			= path.empty() ? 0 : path.back() + 1;
+	if((uint64_t)*pnID < mIDs.size()) {
+		node.id				= mIDs[*pnID].id;
+		node.catID			= mIDs[*pnID].catID;
+	}
+	else {
+		node.id				= INVALID_PERF_ID;
+		node.catID			= INVALID_PERF_ID;
+	}
+	node.nThreadID			= nThreadID;
+	node.nCalls				= values[0];
+	node.nTotalTime			= values[1];
+	node.nSelfTime			= values[2];
+	node.nMinTime			= values[3];
+	node.nMaxTime			= values[3] + values[4];
+	node.nAbortedCalls		= values[5];
+	node.nRecursiveCalls	= values[6];
+	node.nMaxRecursion		= values[7];
+	path.push_back(mNodes.size());
+	mNodes.push_back(node);
+	return true;
+}
+// The checksum is checked before any of the file is used
+bool PerfProfile::LoadBinary(const char* szFile)
+{
+	PerfBinaryReport	binary;
+	vector<string>		strings;
+	map<PerfID, bool>	categories;
+	uint64_t			nCount		= 0;
+	uint64_t			nValue		= 0;
+
+	if(binary.Open(szFile) == false) {
+		return false;
+	}
+	if(binary.GetVarint(&nValue) == false) {
+		return false;
+	}
+	mnColumns = (uint32_t)nValue;
+	if(binary.GetVarint(&nCount) == false) {
+		return false;
+	}
+	for(uint64_t idx = 0; idx < nCount; idx++) {
+		string value;
+		if(binary.GetString(&value) == false) {
+			return false;
+		}
+		strings.push_back(value);
+	}
+	if(binary.GetVarint(&nCount) == false) {
+		return false;
+	}
+	for(uint64_t idx = 0; idx < nCount; idx++) {
+		PerfProfileCategory category;
+		if(binary.GetVarint(&nValue) == false || GetStringIndex(binary, strings, &category.name) == false) {
+			return false;
+		}
+		category.catID = nValue;
+		mCategories.push_back(category);
+		categories[category.catID] = true;
+	}
+	if(binary.GetVarint(&nCount) == false) {
+		return false;
+	}
+	for(uint64_t idx = 0; idx < nCount; idx++) {
+		PerfProfileID	id		= PerfProfileID();
+		uint64_t	nCatID = 0;
+		if(binary.GetVarint(&nValue) == false || binary.GetVarint(&nCatID) == false ||
+		   GetStringIndex(binary, strings, &id.name) == false || GetStringIndex(binary, strings, &id.category) == false) {
+			return false;
+		}
+		if((mnColumns & PERF_BINARY_BUDGETS) != 0 &&
+		   (binary.GetVarint(&id.nBudget) == false || binary.GetVarint(&id.nBreaches) == false)) {
+			return false;
+		}
+		id.id			= nValue;
+		id.catID		= nCatID;
+		id.bInternal	= categories.find(id.catID) == categories.end();
+		mIDs.push_back(id);
+	}
+	if(binary.GetVarint(&nCount) == false) {
+		return false;
+	}
+	for(uint64_t nThread = 0; nThread < nCount; nThread++) {
+		uint64_t			nThreadID	= 0;
+		uint64_t			nNodes		= 0;
+		vector<uint32_t>	path;
+		int64_t				nDepth		= 0;
+		int64_t				nID			= 0;
+
+		if(binary.GetVarint(&nThreadID) == false || binary.GetVarint(&nNodes) == false) {
+			return false;
+		}
+		for(uint64_t idx = 0; idx < nNodes; idx++) {
+			if(LoadBinaryNode(binary, nThreadID, path, &nDepth, &nID) == false) {
+				return false;
+			}
+		}
+	}
+	binary.Close();
+	LinkNodes();
+	return true;
+}
@@ -0,0 +1,123 @@
+/*****************************************************************************
+MIT License
+
+Copyright (c) 2016 Douglas Adler
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*****************************************************************************/
+
+#include <string.h>
+
+#include "PerfShadowStack.h"
+
+// A reader gives up after this many changes under it
+#define SHADOW_READ_RETRIES		16
+
+PerfShadowStack::PerfShadowStack(pthread_t threadID, const char* szThreadName)
+{
+	mnSequence			= 0;
+	mnDepth				= 0;
+	mThreadID			= threadID;
+	strncpy(mszThreadName, szThreadName, sizeof(mszThreadName) - 1);
+	mszThreadName[sizeof(mszThreadName) - 1] = '\0';
+	mnReportedDepth		= 0;
+	mnReportedEntryTime	= 0;
+}
+
+PerfShadowStack::~PerfShadowStack()
+{
+}
+
+bool PerfShadowStack::Push(PerfID id, uint64_t nEntryTime)
+{
+	uint32_t nDepth = mnDepth;
+
+	if(nDepth < PERF_SHADOW_STACK_DEPTH) {
+		__atomic_store_n(&mnSequence, mnSequence + 1, __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_RELEASE);
+		__atomic_store_n(&mFrames[nDepth].id, id, __ATOMIC_RELAXED);
+		__atomic_store_n(&mFrames[nDepth].nEntryTime, nEntryTime, __ATOMIC_RELAXED);
+		__atomic_store_n(&mnDepth, nDepth + 1, __ATOMIC_RELAXED);
+		__atomic_store_n(&mnSequence, mnSequence + 1, __ATOMIC_RELEASE);
+	}
+	else {
+		// Nothing a reader copies changes
+		__atomic_store_n(&mnDepth, nDepth + 1, __ATOMIC_RELAXED);
+	}
+	return true;
+}
+bool PerfShadowStack::Pop()
+{
+	if(mnDepth == 0) {
+		return false;
+	}
+	__atomic_store_n(&mnDepth, mnDepth - 1, __ATOMIC_RELEASE);
+	return true;
+}
+uint32_t PerfShadowStack::GetDepth()
+{
+	return mnDepth;
+}
+bool PerfShadowStack::Read(Frame* pFrames, uint32_t nMax, uint32_t* pnFrames, uint32_t* pnDepth)
+{
+	for(uint32_t nTry = 0; nTry < SHADOW_READ_RETRIES; nTry++) {
+		uint64_t nSequence = __atomic_load_n(&mnSequence, __ATOMIC_ACQUIRE);
+		if((nSequence & 1) != 0) {
+			continue;
+		}
+		uint32_t nDepth		= __atomic_load_n(&mnDepth, __ATOMIC_RELAXED);
+		uint32_t nFrames	= nDepth;
+		if(nFrames > PERF_SHADOW_STACK_DEPTH) {
+			nFrames = PERF_SHADOW_STACK_DEPTH;
+		}
+		if(nFrames > nMax) {
+			nFrames = nMax;
+		}
+		for(uint32_t idx = 0; idx < nFrames; idx++) {
+			pFrames[idx].id			= __atomic_load_n(&mFrames[idx].id, __ATOMIC_RELAXED);
+			pFrames[idx].nEntryTime	= __atomic_load_n(&mFrames[idx].nEntryTime, __ATOMIC_RELAXED);
+		}
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		// A pop doesn't change the sequence, but it can't change the frames under it either
+		if(__atomic_load_n(&mnSequence, __ATOMIC_RELAXED) == nSequence) {
+			*pnFrames	= nFrames;
+			*pnDepth	= nDepth;
+			return true;
+		}
+	}
+	return false;
+}
+pthread_t PerfShadowStack::GetThreadID()
+{
+	return mThreadID;
+}
+const char* PerfShadowStack::GetThreadName()
+{
+	return mszThreadName;
+}
+bool PerfShadowStack::IsReported(uint32_t nDepth, uint64_t nEntryTime)
+{
+	return mnReportedDepth == nDepth && mnReportedEntryTime == nEntryTime;
+}
+bool PerfShadowStack::SetReported(uint32_t nDepth, uint64_t nEntryTime)
+{
+	mnReportedDepth		= nDepth;
+	mnReportedEntryTime	= nEntryTime;
+	return true;
+}
@@ -0,0 +1,126 @@
+/*****************************************************************************
+MIT License
+
+Copyright (c) 2016 Douglas Adler
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*****************************************************************************/
+
+#include <string.h>
+
+#include <algorithm>
+
+#include "PerfSlowCalls.h"
+
+PerfSlowCalls::PerfSlowCalls(uint32_t nSize)
+{
+	mnLock		= 0;
+	mnThreshold	= 0;
+	mnSize		= nSize;
+	mnCount		= 0;
+	mpCalls		= new SlowCall[nSize];
+}
+
+PerfSlowCalls::~PerfSlowCalls()
+{
+	delete [] mpCalls;
+}
+
+void PerfSlowCalls::Lock(volatile int* pLock)
+{
+	while(__sync_lock_test_and_set(pLock, 1)) {
+		while(__atomic_load_n(pLock, __ATOMIC_RELAXED)) {
+		}
+	}
+}
+void PerfSlowCalls::Unlock(volatile int* pLock)
+{
+	__sync_lock_release(pLock);
+}
+
+uint64_t PerfSlowCalls::GetThreshold()
+{
+	return __atomic_load_n(&mnThreshold, __ATOMIC_RELAXED);
+}
+bool PerfSlowCalls::Add(const SlowCall& call)
+{
+	bool bAdded = false;
+
+	Lock(&mnLock);
+	if(mnCount < mnSize) {
+		mpCalls[mnCount] = call;
+		SiftUp(mnCount);
+		mnCount++;
+		bAdded = true;
+	}
+	else if(call.nDuration > mpCalls[0].nDuration) {
+		// Replace the fastest one kept
+		mpCalls[0] = call;
+		SiftDown(0);
+		bAdded = true;
+	}
+	// Until the heap is full anything gets in
+	if(mnCount == mnSize) {
+		__atomic_store_n(&mnThreshold, mpCalls[0].nDuration, __ATOMIC_RELAXED);
+	}
+	Unlock(&mnLock);
+	return bAdded;
+}
+void PerfSlowCalls::SiftUp(uint32_t nPos)
+{
+	while(nPos > 0) {
+		uint32_t nParent = (nPos - 1) / 2;
+		if(mpCalls[nParent].nDuration <= mpCalls[nPos].nDuration) {
+			break;
+		}
+		std::swap(mpCalls[nParent], mpCalls[nPos]);
+		nPos = nParent;
+	}
+}
+void PerfSlowCalls::SiftDown(uint32_t nPos)
+{
+	while(true) {
+		uint32_t nSmallest	= nPos;
+		uint32_t nLeft		= (2 * nPos) + 1;
+		uint32_t nRight		= nLeft + 1;
+
+		if(nLeft < mnCount && mpCalls[nLeft].nDuration < mpCalls[nSmallest].nDuration) {
+			nSmallest = nLeft;
+		}
+		if(nRight < mnCount && mpCalls[nRight].nDuration < mpCalls[nSmallest].nDuration) {
+			nSmallest = nRight;
+		}
+		if(nSmallest == nPos) {
+			break;
+		}
+		std::swap(mpCalls[nSmallest], mpCalls[nPos]);
+		nPos = nSmallest;
+	}
+}
+static bool OrderBySlowest(const PerfSlowCalls::SlowCall& first, const PerfSlowCalls::SlowCall& second)
+{
+	return first.nDuration > second.nDuration;
+}
+void PerfSlowCalls::GetCalls(std::vector<SlowCall>& calls)
+{
+	Lock(&mnLock);
+	calls.assign(mpCalls, mpCalls + mnCount);
+	Unlock(&mnLock);
+	std::sort(calls.begin(), calls.end(), OrderBySlowest);
+}
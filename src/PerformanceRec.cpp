@@ -26,6 +26,7 @@ SOFTWARE.
 #include <time.h>
 #include <sys/time.h>
 #include <sys/times.h>		// for times() to get cpu ticks
+#include <sys/resource.h>
 #include <stdlib.h>
 #include <unistd.h>
 //#include <sys/sysconf.h>
@@ -37,14 +38,16 @@ SOFTWARE.
 #define USEC_PER_SEC	1000000
 #define MAX_UINT32       0xFFFFFFFFul
 
-PerformanceRec::PerformanceRec()
+PerformanceRec::PerformanceRec(PerfArena* pArena)
+: Node(pArena)
 {
 	mMaxTime			= 0;
 	mMinTime			= MAX_UINT32;
 	mStartTime			= 0;
 	mTotalTime			= 0;
 	mTotalCalls			= 0;
-	mCurrentEntryTime	= 0;
+	mAbortedCalls		= 0;
+	mLastEntryTime		= 0;
 	mLastExitTime		= 0;
 	mEntryCPUTime		= 0;
 	mStartCPUTime		= 0;
@@ -52,16 +55,81 @@ PerformanceRec::PerformanceRec()
 	mTotalCPUTime		= 0;
 	mMinCPUTime			= 10000;
 	mMaxCPUTime			= 0.0;
+	mRecursionDepth		= 0;
+	mMaxRecursion		= 0;
+	mRecursiveCalls		= 0;
+	mRecursiveTime		= 0;
+	mFoldedOutTime		= 0;
+	mpRusage			= NULL;
+	mpCounters			= NULL;
+	mLockAcquires		= 0;
+	mLockContended		= 0;
+	mLockWaitTime		= 0;
+	mLockHoldTime		= 0;
+	mpIO				= NULL;
+	mWorkUnits			= 0;
+	mpMetrics			= NULL;
+	mpSlowCalls			= NULL;
+	mpBudget			= NULL;
+	mpImage				= NULL;
+#ifdef PERFORMANCE_MEMORY
+	mAllocCount			= 0;
+	mAllocBytes			= 0;
+	mFreeCount			= 0;
+	mFreeBytes			= 0;
+	memset(mAllocSizes, 0, sizeof(mAllocSizes));
+#endif
 	
 	mID 				= INVALID_PERF_ID;
 	mCatID				= INVALID_PERF_ID;
 	mThreadID			= (pthread_t)-1;
+	mDepth				= 0;
 	
 	mbFirstEntry		= true;
 }
 
 PerformanceRec::~PerformanceRec()
 {
+	PerfArena::Release(mpRusage);
+	PerfArena::Release(mpCounters);
+	PerfArena::Release(mpIO);
+	PerfArena::Release(mpMetrics);
+}
+
+// Records come from the thread's arena when it has one, see PerfOptionThreadArena
+void* PerformanceRec::operator new(size_t nSize, PerfArena* pArena)
+{
+	return PerfArena::Allocate(nSize, pArena);
+}
+void PerformanceRec::operator delete(void* p, PerfArena* pArena)
+{
+	PerfArena::Release(p);
+}
+void PerformanceRec::operator delete(void* p)
+{
+	PerfArena::Release(p);
+}
+
+// Copy of this node's data from the heap, without its parent or children
+PerformanceRec* PerformanceRec::Clone()
+{
+	PerformanceRec* pCopy = new((PerfArena*)NULL) PerformanceRec(*this);
+
+	pCopy->mpRusage		= (RusageData*)CopyData(mpRusage, sizeof(RusageData));
+	pCopy->mpCounters	= (CounterData*)CopyData(mpCounters, sizeof(CounterData));
+	pCopy->mpIO			= (IOData*)CopyData(mpIO, sizeof(IOData));
+	pCopy->mpMetrics	= (PerfMetricValue*)CopyData(mpMetrics, sizeof(PerfMetricValue) * PERF_MAX_NODE_METRICS);
+	pCopy->mpImage		= NULL;
+	return pCopy;
+}
+void* PerformanceRec::CopyData(const void* pData, size_t nSize)
+{
+	if(pData == NULL) {
+		return NULL;
+	}
+	void* pCopy = PerfArena::Allocate(nSize, NULL);
+	memcpy(pCopy, pData, nSize);
+	return pCopy;
 }
 
 bool PerformanceRec::GetCurrentTimeStamp(uint64_t* pnTimeStamp)
@@ -75,11 +143,27 @@ bool PerformanceRec::GetCurrentTimeStamp(uint64_t* pnTimeStamp)
 	
 	return true;
 }
+bool PerformanceRec::GetThreadRusage(PerfRusage* pUsage)
+{
+	struct rusage	usage;
+
+	if(getrusage(RUSAGE_THREAD, &usage) != 0) {
+		memset(pUsage, 0, sizeof(PerfRusage));
+		return false;
+	}
+	pUsage->nVolCtxSwitches		= usage.ru_nvcsw;
+	pUsage->nInvolCtxSwitches	= usage.ru_nivcsw;
+	pUsage->nMinorFaults		= usage.ru_minflt;
+	pUsage->nMajorFaults		= usage.ru_majflt;
+	pUsage->nBlockIn			= usage.ru_inblock;
+	pUsage->nBlockOut			= usage.ru_oublock;
+	return true;
+}
 uint64_t PerformanceRec::GetChildTotalTime()
 {
 	Node* 					pChild 			= NULL;
 	uint64_t				nTotalChild		= 0;
-	list<Node*>::iterator 	iter			= GetSiblingIterator();
+	NodeList::iterator 	iter			= GetSiblingIterator();
 	
 	while(IsSiblingEnd(iter) == false) {
 		pChild = *iter;
@@ -98,7 +182,7 @@ clock_t	PerformanceRec::GetChildTotalTimeCPU()
 {
 	Node* 					pChild 			= NULL;
 	clock_t					nTotalChildCPU	= 0;
-	list<Node*>::iterator 	iter			= GetSiblingIterator();
+	NodeList::iterator 	iter			= GetSiblingIterator();
 
 	while(IsSiblingEnd(iter) == false) {
 		pChild = *iter;
@@ -141,19 +225,34 @@ pthread_t PerformanceRec::GetThreadID()
 {
 	return mThreadID;
 }
-
-bool PerformanceRec::AddEntry()
+bool PerformanceRec::SetDepth(uint32_t nDepth)
 {
-	GetCurrentTimeStamp(&mCurrentEntryTime);
+	mDepth = nDepth;
+	return true;
+}
+uint32_t PerformanceRec::GetDepth()
+{
+	return mDepth;
+}
 
+// The entry time is kept by the caller's frame, see ThreadRecord::EntryFrame
+bool PerformanceRec::AddEntry(uint64_t nEntryTime)
+{
 	struct tms cpu_data;
 	times(&cpu_data);
 
 	mEntryCPUTime	= 	cpu_data.tms_utime + cpu_data.tms_cutime; 		// User Time
 	mEntryCPUTime	+= 	cpu_data.tms_stime + cpu_data.tms_cstime; 		// System Time
+
+	if(mpRusage != NULL) {
+		GetThreadRusage(&mpRusage->entry);
+	}
+	if(mpCounters != NULL) {
+		mpCounters->pCounters->Read(mpCounters->entry);
+	}
 	
 	if(mbFirstEntry == true) {
-		mStartTime 		= mCurrentEntryTime;
+		mStartTime 		= nEntryTime;
 		mStartCPUTime	= mEntryCPUTime;
 		mThreadID		= pthread_self();
 		
@@ -162,12 +261,13 @@ bool PerformanceRec::AddEntry()
 	
 	return true;
 }
-bool PerformanceRec::AddExit()
+bool PerformanceRec::AddExit(uint64_t nEntryTime)
 {
 	uint64_t	delta		= 0;
 	clock_t		deltaCPU	= 0;
 	
 	GetCurrentTimeStamp(&mLastExitTime);
+	mLastEntryTime = nEntryTime;
 
 	struct tms cpu_data;
 	times(&cpu_data);
@@ -175,8 +275,26 @@ bool PerformanceRec::AddExit()
 	mExitCPUTime	= 	cpu_data.tms_utime + cpu_data.tms_cutime; 		// User Time
 	mExitCPUTime	+= 	cpu_data.tms_stime + cpu_data.tms_cstime; 		// System Time
 
+	if(mpCounters != NULL) {
+		uint64_t	values[PERF_MAX_COUNTERS];
+		mpCounters->pCounters->Read(values);
+		for(uint32_t idx = 0; idx < mpCounters->pCounters->GetCount(); idx++) {
+			mpCounters->total[idx] += values[idx] - mpCounters->entry[idx];
+		}
+	}
+	if(mpRusage != NULL) {
+		PerfRusage	usage;
+		GetThreadRusage(&usage);
+		mpRusage->total.nVolCtxSwitches		+= usage.nVolCtxSwitches - mpRusage->entry.nVolCtxSwitches;
+		mpRusage->total.nInvolCtxSwitches	+= usage.nInvolCtxSwitches - mpRusage->entry.nInvolCtxSwitches;
+		mpRusage->total.nMinorFaults		+= usage.nMinorFaults - mpRusage->entry.nMinorFaults;
+		mpRusage->total.nMajorFaults		+= usage.nMajorFaults - mpRusage->entry.nMajorFaults;
+		mpRusage->total.nBlockIn			+= usage.nBlockIn - mpRusage->entry.nBlockIn;
+		mpRusage->total.nBlockOut			+= usage.nBlockOut - mpRusage->entry.nBlockOut;
+	}
+
 	// Find the elapsed time
-	delta 		= mLastExitTime - mCurrentEntryTime;
+	delta 		= mLastExitTime - mLastEntryTime;
 	deltaCPU	= mExitCPUTime - mEntryCPUTime;
 
 	// Record the data
@@ -195,8 +313,246 @@ bool PerformanceRec::AddExit()
 	if(mMaxCPUTime < deltaCPU) {
 		mMaxCPUTime = deltaCPU;
 	}
+	if(mpImage != NULL) {
+		UpdateImage();
+	}
+	return true;
+}
+// Counted as well as the exit, the time up to the outer exit still counts
+bool PerformanceRec::AddAbortedCall()
+{
+	mAbortedCalls++;
+	return true;
+}
+//
+// A recursive call folded into this node.  Only the outermost call is timed,
+// so the inclusive time isn't counted twice.
+//
+bool PerformanceRec::AddRecursiveEntry()
+{
+	mRecursionDepth++;
+	mRecursiveCalls++;
+	if(mRecursionDepth > mMaxRecursion) {
+		mMaxRecursion = mRecursionDepth;
+	}
+	return true;
+}
+bool PerformanceRec::AddRecursiveExit(uint64_t nTime)
+{
+	mRecursionDepth--;
+	mRecursiveTime += nTime;
+	if(mpImage != NULL) {
+		UpdateImage();
+	}
+	return true;
+}
+// The caller of a folded call gives that time back when computing self
+bool PerformanceRec::AddFoldedTime(uint64_t nTime)
+{
+	mFoldedOutTime += nTime;
+	if(mpImage != NULL) {
+		UpdateImage();
+	}
+	return true;
+}
+uint32_t PerformanceRec::GetRecursionDepth()
+{
+	return mRecursionDepth;
+}
+// Capture getrusage deltas for this node, a syscall on every entry and exit
+bool PerformanceRec::EnableRusage(PerfArena* pArena)
+{
+	if(mpRusage == NULL) {
+		mpRusage = (RusageData*)PerfArena::Allocate(sizeof(RusageData), pArena);
+		memset(mpRusage, 0, sizeof(RusageData));
+	}
+	return true;
+}
+size_t PerformanceRec::GetRusageMemory()
+{
+	return PerfArena::AllocationSize(sizeof(RusageData));
+}
+size_t PerformanceRec::GetCountersMemory()
+{
+	return PerfArena::AllocationSize(sizeof(CounterData));
+}
+size_t PerformanceRec::GetIOMemory()
+{
+	return PerfArena::AllocationSize(sizeof(IOData));
+}
+// The I/O block is added by the first AddIO, it has to be charged before then
+bool PerformanceRec::HasIO()
+{
+	return mpIO != NULL;
+}
+size_t PerformanceRec::GetMetricsMemory()
+{
+	return PerfArena::AllocationSize(sizeof(PerfMetricValue) * PERF_MAX_NODE_METRICS);
+}
+// Added by the first AddMetric, charged the same way as the I/O block
+bool PerformanceRec::HasMetrics()
+{
+	return mpMetrics != NULL;
+}
+bool PerformanceRec::AddLockWait(uint64_t nWaitTime, bool bContended)
+{
+	mLockAcquires++;
+	if(bContended == true) {
+		mLockContended++;
+	}
+	mLockWaitTime += nWaitTime;
+	return true;
+}
+bool PerformanceRec::AddLockHold(uint64_t nHoldTime)
+{
+	mLockHoldTime += nHoldTime;
+	return true;
+}
+bool PerformanceRec::AddIO(uint64_t nBytes, uint64_t nLatency, PerfArena* pArena)
+{
+	if(mpIO == NULL) {
+		mpIO = (IOData*)PerfArena::Allocate(sizeof(IOData), pArena);
+		memset(mpIO, 0, sizeof(IOData));
+	}
+	mpIO->nOps++;
+	mpIO->nBytes	+= nBytes;
+	mpIO->nTime		+= nLatency;
+	mpIO->nLatency[GetLatencyBucket(nLatency)]++;
+	return true;
+}
+bool PerformanceRec::AddWork(uint64_t nUnits)
+{
+	mWorkUnits += nUnits;
+	return true;
+}
+bool PerformanceRec::SetSlowCalls(PerfSlowCalls* pSlowCalls)
+{
+	mpSlowCalls = pSlowCalls;
+	return true;
+}
+PerfSlowCalls* PerformanceRec::GetSlowCalls()
+{
+	return mpSlowCalls;
+}
+bool PerformanceRec::SetBudget(PerfBudget* pBudget)
+{
+	mpBudget = pBudget;
+	return true;
+}
+PerfBudget* PerformanceRec::GetBudget()
+{
+	return mpBudget;
+}
+bool PerformanceRec::SetImageNode(PerfImageNode* pImage)
+{
+	mpImage = pImage;
+	return true;
+}
+PerfImageNode* PerformanceRec::GetImageNode()
+{
+	return mpImage;
+}
+// Plain stores, a reader after a crash may find the last exit half written
+bool PerformanceRec::UpdateImage()
+{
+	mpImage->nCalls				= mTotalCalls;
+	mpImage->nTotalTime			= mTotalTime;
+	mpImage->nRecursiveTime		= mRecursiveTime;
+	mpImage->nFoldedOutTime		= mFoldedOutTime;
+	mpImage->nMinTime			= mMinTime;
+	mpImage->nMaxTime			= mMaxTime;
+	mpImage->nAbortedCalls		= mAbortedCalls;
+	mpImage->nRecursiveCalls	= mRecursiveCalls;
+	mpImage->nMaxRecursion		= mMaxRecursion;
+	return true;
+}
+uint64_t PerformanceRec::GetLastEntryTime()
+{
+	return mLastEntryTime;
+}
+// Duration of the call that last exited
+uint64_t PerformanceRec::GetLastCallTime()
+{
+	return mLastExitTime - mLastEntryTime;
+}
+bool PerformanceRec::AddMetric(uint32_t nMetric, int64_t nValue, bool bGauge, uint64_t nSequence, PerfArena* pArena)
+{
+	if(mpMetrics == NULL) {
+		mpMetrics = (PerfMetricValue*)PerfArena::Allocate(sizeof(PerfMetricValue) * PERF_MAX_NODE_METRICS, pArena);
+		memset(mpMetrics, 0, sizeof(PerfMetricValue) * PERF_MAX_NODE_METRICS);
+	}
+	for(uint32_t idx = 0; idx < PERF_MAX_NODE_METRICS; idx++) {
+		if(mpMetrics[idx].nUpdates == 0) {
+			mpMetrics[idx].nMetric = nMetric;
+		}
+		if(mpMetrics[idx].nMetric == nMetric) {
+			UpdateMetric(&mpMetrics[idx], nValue, bGauge, nSequence);
+			return true;
+		}
+	}
+	return false;
+}
+// Only the owning thread writes, but the per thread values are read by the
+// report without a lock, so each field is stored whole
+void PerformanceRec::UpdateMetric(PerfMetricValue* pMetric, int64_t nValue, bool bGauge, uint64_t nSequence)
+{
+	if(bGauge == false) {
+		__atomic_store_n(&pMetric->nValue, pMetric->nValue + nValue, __ATOMIC_RELAXED);
+	}
+	else {
+		if(pMetric->nUpdates == 0 || nValue < pMetric->nMin) {
+			__atomic_store_n(&pMetric->nMin, nValue, __ATOMIC_RELAXED);
+		}
+		if(pMetric->nUpdates == 0 || nValue > pMetric->nMax) {
+			__atomic_store_n(&pMetric->nMax, nValue, __ATOMIC_RELAXED);
+		}
+		__atomic_store_n(&pMetric->nValue, nValue, __ATOMIC_RELAXED);
+		__atomic_store_n(&pMetric->nSequence, nSequence, __ATOMIC_RELAXED);
+	}
+	__atomic_store_n(&pMetric->nUpdates, pMetric->nUpdates + 1, __ATOMIC_RELAXED);
+}
+uint32_t PerformanceRec::GetLatencyBucket(uint64_t nLatency)
+{
+	uint32_t nBucket = 0;
+
+	while(nBucket < PERF_IO_LATENCY_BUCKETS - 1 && nLatency > ((uint64_t)1 << nBucket)) {
+		nBucket++;
+	}
+	return nBucket;
+}
+bool PerformanceRec::EnableCounters(PerfCounters* pCounters, PerfArena* pArena)
+{
+	if(mpCounters == NULL) {
+		mpCounters = (CounterData*)PerfArena::Allocate(sizeof(CounterData), pArena);
+		memset(mpCounters, 0, sizeof(CounterData));
+		mpCounters->pCounters = pCounters;
+	}
 	return true;
 }
+#ifdef PERFORMANCE_MEMORY
+bool PerformanceRec::AddAlloc(uint64_t nSize, uint64_t nBytes, uint32_t nCount)
+{
+	__sync_fetch_and_add(&mAllocCount, nCount);
+	__sync_fetch_and_add(&mAllocBytes, nBytes);
+	__sync_fetch_and_add(&mAllocSizes[GetSizeClass(nSize)], nCount);
+	return true;
+}
+bool PerformanceRec::AddFree(uint64_t nBytes, uint32_t nCount)
+{
+	__sync_fetch_and_add(&mFreeCount, nCount);
+	__sync_fetch_and_add(&mFreeBytes, nBytes);
+	return true;
+}
+uint32_t PerformanceRec::GetSizeClass(uint64_t nSize)
+{
+	uint32_t nClass = 0;
+
+	while(nClass < PERF_ALLOC_SIZE_CLASSES - 1 && nSize > ((uint64_t)PERF_ALLOC_MIN_CLASS_SIZE << nClass)) {
+		nClass++;
+	}
+	return nClass;
+}
+#endif
 bool PerformanceRec::GetReport(PerfRecordReport* report)
 {
 	if(mTotalCalls == 0) {
@@ -209,7 +565,10 @@ bool PerformanceRec::GetReport(PerfRecordReport* report)
 		report->nEndTime			= mLastExitTime;
 		report->nTotalCalls			= mTotalCalls;
 		report->nTotalTime			= mTotalTime;
-		report->nTotalSelf 			= mTotalTime - GetChildTotalTime();
+		// Folded calls run under other children of this node, add them back here
+		// and take them away from the node they were called from.
+		int64_t nSelf				= (int64_t)(mTotalTime + mRecursiveTime) - (int64_t)(GetChildTotalTime() + mFoldedOutTime);
+		report->nTotalSelf 			= nSelf > 0 ? nSelf : 0;
 		report->nMinTime			= mMinTime;
 		report->nMaxTime			= mMaxTime;
 		report->nStartCPUTime		= ((double)(mStartCPUTime)) / sysconf(_SC_CLK_TCK); 	// Convert to seconds
@@ -218,6 +577,56 @@ bool PerformanceRec::GetReport(PerfRecordReport* report)
 		report->nTotalCPUTimeSelf	= ((double)(mTotalCPUTime - GetChildTotalTimeCPU())) / sysconf(_SC_CLK_TCK); 	// Convert to seconds
 		report->nMinCPUTime			= ((double)(mMinCPUTime)) / sysconf(_SC_CLK_TCK); 	// Convert to seconds
 		report->nMaxCPUTime			= ((double)(mMaxCPUTime)) / sysconf(_SC_CLK_TCK); 	// Convert to seconds
+		report->nRecursiveCalls		= mRecursiveCalls;
+		report->nMaxRecursion		= mMaxRecursion;
+		report->nAbortedCalls		= mAbortedCalls;
+#ifdef PERFORMANCE_MEMORY
+		report->nAllocCount			= mAllocCount;
+		report->nAllocBytes			= mAllocBytes;
+		report->nFreeCount			= mFreeCount;
+		report->nLiveBytes			= mAllocBytes - mFreeBytes;
+		memcpy(report->nAllocSizes, mAllocSizes, sizeof(report->nAllocSizes));
+#else
+		report->nAllocCount			= 0;
+		report->nAllocBytes			= 0;
+		report->nFreeCount			= 0;
+		report->nLiveBytes			= 0;
+		memset(report->nAllocSizes, 0, sizeof(report->nAllocSizes));
+#endif
+		report->bRusage				= (mpRusage != NULL);
+		if(mpRusage != NULL) {
+			report->rusage			= mpRusage->total;
+		}
+		else {
+			memset(&report->rusage, 0, sizeof(report->rusage));
+		}
+		memset(report->nCounterValues, 0, sizeof(report->nCounterValues));
+		report->nCounters			= 0;
+		if(mpCounters != NULL) {
+			report->nCounters		= mpCounters->pCounters->GetCount();
+			memcpy(report->nCounterValues, mpCounters->total, sizeof(uint64_t) * report->nCounters);
+		}
+		report->nLockAcquires		= mLockAcquires;
+		report->nLockContended		= mLockContended;
+		report->nLockWaitTime		= mLockWaitTime;
+		report->nLockHoldTime		= mLockHoldTime;
+		if(mpIO != NULL) {
+			report->nIOOps			= mpIO->nOps;
+			report->nIOBytes		= mpIO->nBytes;
+			report->nIOTime			= mpIO->nTime;
+			memcpy(report->nIOLatency, mpIO->nLatency, sizeof(report->nIOLatency));
+		}
+		else {
+			report->nIOOps			= 0;
+			report->nIOBytes		= 0;
+			report->nIOTime			= 0;
+			memset(report->nIOLatency, 0, sizeof(report->nIOLatency));
+		}
+		report->nWorkUnits			= mWorkUnits;
+		report->nMetrics			= 0;
+		for(uint32_t idx = 0; mpMetrics != NULL && idx < PERF_MAX_NODE_METRICS && mpMetrics[idx].nUpdates > 0; idx++) {
+			report->metrics[report->nMetrics++] = mpMetrics[idx];
+		}
 	}
 	return true;
 }
@@ -22,13 +22,33 @@ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
 SOFTWARE.
 *****************************************************************************/
 
+#include <string.h>
+
 #include "ThreadRecord.h"
+#include "PerformanceRec.h"
+
+// Calls nest this deep before the stack has to grow
+#define FRAME_STACK_RESERVE		256
 
 ThreadRecord::ThreadRecord()
 {
+	mpArena			= NULL;
+	mArenaReserved	= 0;
+	mpCounters		= NULL;
 	mTree 			= NULL;
 	mCurrentNode	= NULL;
+	mNodeCount		= 0;
+	mDroppedCalls = 0;
+	mpMetrics		= NULL;
 	mThreadID		= (pthread_t)pthread_self();
+	if(pthread_getname_np(mThreadID, mszThreadName, sizeof(mszThreadName)) != 0) {
+		mszThreadName[0] = '\0';
+	}
+	mFrames.reserve(FRAME_STACK_RESERVE);
+	mpShadowStack	= new PerfShadowStack(mThreadID, mszThreadName);
+	mpNextThread	= NULL;
+	mpLiveCounts	= NULL;
+	pthread_mutex_init(&mTreeMutex, NULL);
 }
 
 ThreadRecord::~ThreadRecord()
@@ -37,6 +57,69 @@ ThreadRecord::~ThreadRecord()
 		delete mTree;
 		mCurrentNode = NULL;
 	}
+	PerfArena::Release(mpMetrics);
+	// The nodes are gone, the arena can go
+	if(mpArena != NULL) {
+		delete mpArena;
+	}
+	if(mpCounters != NULL) {
+		delete mpCounters;
+	}
+	delete mpShadowStack;
+	if(mpLiveCounts != NULL) {
+		delete [] mpLiveCounts;
+	}
+	pthread_mutex_destroy(&mTreeMutex);
+}
+
+// Preallocate the storage for this thread's tree
+bool ThreadRecord::CreateArena(size_t nSize)
+{
+	PerfArena* pArena = new PerfArena();
+	if(pArena->Init(nSize) == false) {
+		delete pArena;
+		return false;
+	}
+	mpArena = pArena;
+	return true;
+}
+PerfArena* ThreadRecord::GetArena()
+{
+	return mpArena;
+}
+bool ThreadRecord::ReserveArena(size_t nSize)
+{
+	mArenaReserved += nSize;
+	return true;
+}
+bool ThreadRecord::ReleaseArena(size_t nSize)
+{
+	mArenaReserved -= (nSize < mArenaReserved) ? nSize : mArenaReserved;
+	return true;
+}
+// Room for new nodes once the reserved room is set aside, unlimited without an arena
+size_t ThreadRecord::GetArenaAvailable()
+{
+	if(mpArena == NULL) {
+		return SIZE_MAX;
+	}
+	size_t nAvailable = mpArena->GetAvailable();
+	return (nAvailable > mArenaReserved) ? nAvailable - mArenaReserved : 0;
+}
+// perf_event counters for this thread, must be called on the thread itself
+bool ThreadRecord::OpenCounters(PerfCounterMode eMode)
+{
+	PerfCounters* pCounters = new PerfCounters();
+	if(pCounters->Open(eMode) == false) {
+		delete pCounters;
+		return false;
+	}
+	mpCounters = pCounters;
+	return true;
+}
+PerfCounters* ThreadRecord::GetCounters()
+{
+	return mpCounters;
 }
 
 bool ThreadRecord::SetRootNode(Node* pRoot)
@@ -61,3 +144,133 @@ pthread_t ThreadRecord::GetThreadID()
 {
 	return mThreadID;
 }
+const char* ThreadRecord::GetThreadName()
+{
+	return mszThreadName;
+}
+// The shadow stack follows, so other threads can see the open calls
+bool ThreadRecord::PushFrame(const EntryFrame& frame)
+{
+	mFrames.push_back(frame);
+	mpShadowStack->Push(frame.id, frame.nEntryTime);
+	return true;
+}
+bool ThreadRecord::PopFrame()
+{
+	if(mFrames.empty()) {
+		return false;
+	}
+	mFrames.pop_back();
+	mpShadowStack->Pop();
+	return true;
+}
+ThreadRecord::EntryFrame* ThreadRecord::GetFrame(size_t nFrame)
+{
+	return &mFrames[nFrame];
+}
+size_t ThreadRecord::GetFrameDepth()
+{
+	return mFrames.size();
+}
+bool ThreadRecord::AddNode()
+{
+	mNodeCount++;
+	return true;
+}
+uint32_t ThreadRecord::GetNodeCount()
+{
+	return mNodeCount;
+}
+// A call was charged to an [other] node because of a limit.  Every call
+// of a dropped context lands here, there is no node to find next time.
+bool ThreadRecord::AddDroppedCall()
+{
+	mDroppedCalls++;
+	return true;
+}
+uint64_t ThreadRecord::GetDroppedCalls()
+{
+	return mDroppedCalls;
+}
+// Only this thread updates them, they're summed across threads for the report.
+// The block comes from the thread's arena, the caller charges it first.
+PerfMetricValue* ThreadRecord::GetMetrics(bool bCreate)
+{
+	PerfMetricValue* pMetrics = __atomic_load_n(&mpMetrics, __ATOMIC_ACQUIRE);
+
+	if(pMetrics == NULL && bCreate == true) {
+		pMetrics = (PerfMetricValue*)PerfArena::Allocate(sizeof(PerfMetricValue) * PERF_MAX_METRICS, mpArena);
+		memset(pMetrics, 0, sizeof(PerfMetricValue) * PERF_MAX_METRICS);
+		__atomic_store_n(&mpMetrics, pMetrics, __ATOMIC_RELEASE);
+	}
+	return pMetrics;
+}
+size_t ThreadRecord::GetMetricsMemory()
+{
+	return PerfArena::AllocationSize(sizeof(PerfMetricValue) * PERF_MAX_METRICS);
+}
+PerfShadowStack* ThreadRecord::GetShadowStack()
+{
+	return mpShadowStack;
+}
+ThreadRecord* ThreadRecord::GetNextThread()
+{
+	return mpNextThread;
+}
+bool ThreadRecord::SetNextThread(ThreadRecord* pNext)
+{
+	mpNextThread = pNext;
+	return true;
+}
+// The thread itself when it registers, or the thread that turns the counts on
+// for threads already running, so the first one in wins
+bool ThreadRecord::CreateLiveCounts()
+{
+	if(__atomic_load_n(&mpLiveCounts, __ATOMIC_ACQUIRE) != NULL) {
+		return true;
+	}
+	PerfLiveCounts* pCounts = new PerfLiveCounts[PERF_LIVE_MAX_IDS];
+	memset(pCounts, 0, sizeof(PerfLiveCounts) * PERF_LIVE_MAX_IDS);
+	if(__sync_bool_compare_and_swap(&mpLiveCounts, (PerfLiveCounts*)NULL, pCounts) == false) {
+		delete [] pCounts;
+	}
+	return true;
+}
+PerfLiveCounts* ThreadRecord::GetLiveCounts()
+{
+	return __atomic_load_n(&mpLiveCounts, __ATOMIC_ACQUIRE);
+}
+bool ThreadRecord::LockTree()
+{
+	return pthread_mutex_lock(&mTreeMutex) == 0;
+}
+bool ThreadRecord::UnlockTree()
+{
+	return pthread_mutex_unlock(&mTreeMutex) == 0;
+}
+static Node* CopyNode(PerformanceRec* pRecord, Node* pParent)
+{
+	PerformanceRec* pCopy = pRecord->Clone();
+
+	pCopy->SetParent(pParent);
+	for(NodeList::iterator iter = pRecord->GetSiblingIterator(); pRecord->IsSiblingEnd(iter) == false; iter++) {
+		if((*iter)->GetNodeType() == PerfRecord) {
+			pCopy->AddSibling(CopyNode((PerformanceRec*)*iter, pCopy));
+		}
+	}
+	return pCopy;
+}
+// The copy keeps this thread's ID and name, its calls in progress are left out
+ThreadRecord* ThreadRecord::CopyTree()
+{
+	ThreadRecord* pCopy = new ThreadRecord();
+
+	pCopy->mThreadID = mThreadID;
+	memcpy(pCopy->mszThreadName, mszThreadName, sizeof(mszThreadName));
+	if(mTree != NULL) {
+		pCopy->mTree = CopyNode((PerformanceRec*)mTree, NULL);
+	}
+	pCopy->mNodeCount		= mNodeCount;
+	pCopy->mDroppedCalls	= mDroppedCalls;
+	return pCopy;
+}